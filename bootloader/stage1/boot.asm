@@ -48,13 +48,17 @@ start:
     mov si, msg_boot
     call print
 
+    ; Probe INT 13h extensions and drive geometry
+    call disk_init
+
     ; Load root directory to 0x0800:0000
-    mov ax, 19              ; Root starts at sector 19 (1 + 2*9)
+    mov eax, 19             ; Root starts at sector 19 (1 + 2*9)
     mov bx, 0x0800
     mov es, bx
     xor bx, bx
     mov cx, 14              ; 14 sectors for root directory
-    call read_sectors
+    call disk_read
+    jc boot_error
 
     ; Find STAGE2.BIN in root directory
     mov ax, 0x0800
@@ -74,54 +78,32 @@ find_loop:
     add di, 32              ; Next entry
     loop find_loop
 
-    ; Not found
+boot_error:
+    ; Not found or unreadable
     mov si, msg_error
     call print
     jmp halt
 
 found_stage2:
-    ; Get first cluster
-    mov ax, [es:di + 26]    ; First cluster at offset 26
-
     ; Load Stage 2 to 0x1000:0000
     ; Simplified: assume Stage 2 is in cluster 2 (sector 33)
-    mov ax, 33              ; Data area starts at sector 33
+    mov eax, 33             ; Data area starts at sector 33
     mov bx, 0x1000
     mov es, bx
     xor bx, bx
     mov cx, 16              ; Load 16 sectors for Stage 2
-    call read_sectors
+    call disk_read
+    jc boot_error
 
     ; Jump to Stage 2
     mov dl, [drive_number]
     jmp 0x1000:0x0000
 
-; Function: read_sectors
-; AX = start sector, CX = count, ES:BX = destination
-read_sectors:
-    mov [dap_sector], ax
-    mov [dap_count], cx
-    mov [dap_offset], bx
-    mov [dap_segment], es
-
-    ; Try LBA first
-    mov ah, 0x42
-    mov dl, [drive_number]
-    mov si, dap
-    int 0x13
-    jnc .done
-
-    ; Fallback to CHS
-    mov ah, 0x02
-    mov al, cl              ; Sector count
-    mov ch, 0               ; Cylinder
-    mov cl, 2               ; Sector (1-based)
-    mov dh, 0               ; Head
-    mov dl, [drive_number]
-    int 0x13
-
-.done:
-    ret
+; Shared disk read routine
+%define DISK_DRIVE drive_number
+%define DISK_SPT sectors_per_track
+%define DISK_HEADS heads
+%include "common/disk.inc"
 
 ; Function: print
 ; SI = string pointer
@@ -146,20 +128,6 @@ stage2_name     db 'STAGE2  BIN'
 msg_boot        db 'nekkoOS STA1', 13, 10, 0
 msg_error       db 'Error!', 13, 10, 0
 
-; DAP structure
-dap:
-    db 0x10                 ; Size
-    db 0                    ; Reserved
-dap_count:
-    dw 0                    ; Sector count
-dap_offset:
-    dw 0                    ; Offset
-dap_segment:
-    dw 0                    ; Segment
-dap_sector:
-    dd 0                    ; Start sector
-    dd 0                    ; High part
-
 ; Pad to 510 bytes and add boot signature
 times 510-($-$$) db 0
 dw 0xAA55
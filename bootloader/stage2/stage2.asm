@@ -7,9 +7,23 @@
 
 ; Constants
 KERNEL_LOAD_ADDR    equ 0x100000    ; Load kernel at 1MB
-KERNEL_START_LBA    equ 17          ; Kernel starts after stage2
-KERNEL_SECTOR_COUNT equ 64          ; Kernel size in sectors
+KERNEL_START_LBA    equ 49          ; KERNEL.BIN follows the 16 sectors of STAGE2.BIN
 MEMORY_MAP_ADDR     equ 0x8000      ; Memory map storage
+LOAD_BUFFER_SEG     equ 0x2000      ; Temporary load buffer (0x20000)
+
+; Kernel size in sectors, passed in by the Makefile from the size of
+; kernel.bin. The kernel is read to 0x20000 and must end below the stack.
+%ifndef KERNEL_SECTOR_COUNT
+%error "KERNEL_SECTOR_COUNT not defined (nasm -DKERNEL_SECTOR_COUNT=...)"
+%elif KERNEL_SECTOR_COUNT > (0x90000 - 0x20000) / 512
+%error "kernel.bin does not fit the stage 2 load buffer"
+%endif
+
+; Boot snapshot area (kernel/include/hibernate.h)
+SNAPSHOT_START_LBA  equ 1440        ; Header sector, the image follows
+SNAPSHOT_MAGIC      equ 0x50414E53  ; "SNAP"
+SNAPSHOT_VERSION    equ 1
+SNAPSHOT_BATCH      equ 128         ; Sectors per read, one 64KB buffer
 
 ; GDT constants
 GDT_CODE_SEG        equ 0x08        ; Code segment selector
@@ -36,8 +50,14 @@ start_stage2:
     ; Enable A20 line
     call enable_a20
 
-    ; Load kernel into memory
+    ; Pick extended or CHS reads for the boot drive
+    call disk_init
+
+    ; Resume from a boot snapshot if there is one, else load the kernel
+    call load_snapshot
+    jnc .snapshot_loaded
     call load_kernel
+.snapshot_loaded:
 
     ; Setup GDT
     call setup_gdt
@@ -246,24 +266,13 @@ load_kernel:
     ; Setup for loading to 1MB (requires switching to unreal mode)
     ; For simplicity, we'll load to conventional memory first, then move
 
-    ; Load kernel sectors
-    mov ax, 0x2000          ; Temporary load segment
-    mov es, ax
-    mov bx, 0               ; Offset
-
-    ; Setup DAP for kernel loading
-    mov word [dap_size], 0x10
-    mov word [dap_sectors], KERNEL_SECTOR_COUNT
-    mov word [dap_offset], 0
-    mov word [dap_segment], 0x2000
-    mov dword [dap_lba_low], KERNEL_START_LBA
-    mov dword [dap_lba_high], 0
-
-    ; Read kernel sectors
-    mov ah, 0x42
-    mov dl, [boot_drive]
-    mov si, dap
-    int 0x13
+    ; Read kernel sectors in as few BIOS calls as the firmware allows
+    mov eax, KERNEL_START_LBA
+    mov cx, KERNEL_SECTOR_COUNT
+    mov bx, LOAD_BUFFER_SEG ; Temporary load segment
+    mov es, bx
+    xor bx, bx              ; Offset
+    call disk_read
     jc .kernel_error
 
     mov si, msg_kernel_loaded
@@ -275,6 +284,94 @@ load_kernel:
     call print_string
     jmp halt
 
+; Function: load_snapshot
+; Loads a boot snapshot written by the kernel (hibernate=1) above 1MB.
+; Each batch of sectors goes through the temporary buffer and is moved up
+; with INT 15h AH=87h; the runs are decompressed in protected mode.
+; Output: CF clear if a snapshot was loaded
+load_snapshot:
+    mov eax, SNAPSHOT_START_LBA
+    mov cx, 1
+    mov bx, LOAD_BUFFER_SEG
+    mov es, bx
+    xor bx, bx
+    call disk_read
+    jc .none
+
+    cmp dword [es:0], SNAPSHOT_MAGIC
+    jne .none
+    cmp dword [es:4], SNAPSHOT_VERSION
+    jne .none
+
+    mov si, msg_snapshot
+    call print_string
+
+    mov eax, [es:8]
+    mov [snapshot_addr], eax
+    mov [snapshot_dest], eax
+    mov eax, [es:12]
+    mov [snapshot_bytes], eax
+    mov eax, [es:16]
+    mov [snapshot_left], eax
+    mov eax, [es:20]
+    mov [snapshot_entry], eax
+    mov dword [snapshot_lba], SNAPSHOT_START_LBA + 1
+
+.batch:
+    mov ecx, [snapshot_left]
+    test ecx, ecx
+    jz .loaded
+    cmp ecx, SNAPSHOT_BATCH
+    jbe .sized
+    mov ecx, SNAPSHOT_BATCH
+.sized:
+    sub [snapshot_left], ecx
+    push cx
+    mov eax, [snapshot_lba]
+    mov bx, LOAD_BUFFER_SEG
+    mov es, bx
+    xor bx, bx
+    call disk_read
+    pop cx
+    jc .error
+    mov [snapshot_lba], eax
+
+    ; Move the batch to its place in the image
+    mov eax, [snapshot_dest]
+    mov [move_dest_low], ax
+    shr eax, 16
+    mov [move_dest_mid], al
+    mov [move_dest_high], ah
+    shl cx, 8               ; Sectors to words
+    push cx
+    mov ax, ds
+    mov es, ax
+    mov si, move_gdt
+    mov ah, 0x87
+    int 0x15
+    pop cx
+    jc .error
+    movzx ecx, cx
+    shl ecx, 1
+    add [snapshot_dest], ecx
+    jmp .batch
+
+.loaded:
+    mov byte [snapshot_ready], 1
+    clc
+    ret
+
+.error:
+    mov si, msg_snapshot_error
+    call print_string
+.none:
+    stc
+    ret
+
+; Shared disk read routine
+%define DISK_DRIVE boot_drive
+%include "common/disk.inc"
+
 ; Function: setup_gdt
 ; Sets up the Global Descriptor Table
 setup_gdt:
@@ -314,6 +411,9 @@ protected_mode_start:
     ; Setup stack
     mov esp, 0x90000
 
+    cmp byte [snapshot_ready], 0
+    jne resume_snapshot
+
     ; Move kernel from temporary location to 1MB
     mov esi, 0x20000        ; Source (temporary location)
     mov edi, KERNEL_LOAD_ADDR ; Destination (1MB)
@@ -323,6 +423,82 @@ protected_mode_start:
     ; Jump to kernel
     jmp KERNEL_LOAD_ADDR
 
+; Decompress every run of the snapshot image into place and enter the
+; kernel's resume trampoline (hibernate_resume)
+resume_snapshot:
+    mov esi, [snapshot_addr]
+    mov eax, esi
+    add eax, [snapshot_bytes]
+    mov [snapshot_end], eax
+
+.chunk:
+    cmp esi, [snapshot_end]
+    jae .enter
+    mov edi, [esi]          ; Physical address of the run
+    mov ecx, [esi + 8]      ; Compressed length
+    add esi, 12
+    call lz4_decompress
+    jmp .chunk
+
+.enter:
+    jmp [snapshot_entry]
+
+; Function: lz4_decompress (32-bit)
+; Decodes one LZ4 block; the input is trusted (written by the kernel)
+; Input:  ESI = source, ECX = source length, EDI = destination
+; Output: ESI and EDI advanced past the input and the output
+; Modifies: EAX, ECX, EDX
+lz4_decompress:
+    push ebx
+    push ebp
+    lea ebp, [esi + ecx]    ; End of input
+
+.sequence:
+    cmp esi, ebp
+    jae .done
+    movzx ebx, byte [esi]   ; Token
+    inc esi
+
+    mov ecx, ebx
+    shr ecx, 4              ; Literal length
+    cmp ecx, 15
+    jne .literals
+    call .length
+.literals:
+    rep movsb
+    cmp esi, ebp            ; The last sequence has no match
+    jae .done
+
+    movzx edx, word [esi]   ; Match offset
+    add esi, 2
+    mov ecx, ebx
+    and ecx, 15             ; Match length - 4
+    cmp ecx, 15
+    jne .match
+    call .length
+.match:
+    add ecx, 4
+    push esi
+    mov esi, edi
+    sub esi, edx
+    rep movsb               ; Byte copies, so overlapping matches repeat
+    pop esi
+    jmp .sequence
+
+.done:
+    pop ebp
+    pop ebx
+    ret
+
+; Add the length bytes following a nibble of 15 to ECX
+.length:
+    movzx eax, byte [esi]
+    inc esi
+    add ecx, eax
+    cmp al, 255
+    je .length
+    ret
+
 ; Should never reach here
 protected_halt:
     hlt
@@ -342,15 +518,32 @@ halt:
 boot_drive:         db 0
 memory_map_entries: dw 0
 
-; Disk Address Packet
-dap:
-dap_size:       dw 0x10
-dap_reserved:   dw 0
-dap_sectors:    dw 0
-dap_offset:     dw 0
-dap_segment:    dw 0
-dap_lba_low:    dd 0
-dap_lba_high:   dd 0
+; Boot snapshot being loaded
+snapshot_ready:     db 0
+snapshot_addr:      dd 0            ; Where the kernel wants the image
+snapshot_bytes:     dd 0
+snapshot_entry:     dd 0
+snapshot_lba:       dd 0
+snapshot_left:      dd 0            ; Sectors still to read
+snapshot_dest:      dd 0
+snapshot_end:       dd 0
+
+; INT 15h AH=87h descriptor table: source is the temporary buffer
+move_gdt:
+    dd 0, 0, 0, 0           ; Dummy and GDT descriptors, filled by the BIOS
+    dw 0xFFFF               ; Source limit
+    dw 0x0000               ; Source base low
+    db LOAD_BUFFER_SEG >> 12 ; Source base middle
+    db 0x93                 ; Access: present, data, writable
+    db 0x00
+    db 0x00                 ; Source base high
+    dw 0xFFFF               ; Destination limit
+move_dest_low:      dw 0
+move_dest_mid:      db 0
+    db 0x93
+    db 0x00
+move_dest_high:     db 0
+    dd 0, 0, 0, 0           ; BIOS code and stack descriptors
 
 ; GDT (Global Descriptor Table)
 gdt_start:
@@ -393,6 +586,8 @@ msg_kernel_error:   db 'Kernel load error!', 0x0D, 0x0A, 0
 msg_gdt:            db 'Setting up GDT...', 0x0D, 0x0A, 0
 msg_protected:      db 'Entering protected mode...', 0x0D, 0x0A, 0
 msg_halted:         db 'Stage 2 halted.', 0x0D, 0x0A, 0
+msg_snapshot:       db 'Resuming boot snapshot...', 0x0D, 0x0A, 0
+msg_snapshot_error: db 'Snapshot load error, booting kernel.', 0x0D, 0x0A, 0
 
 ; Pad to sector boundary
 times 8192-($-$$) db 0      ; Pad Stage 2 to 16 sectors (8KB)
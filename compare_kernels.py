@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+"""
+nekkoOS Kernel Build Comparison
+Builds the kernel in several configurations (plain i686, a newer -march,
+LTO, PGO, the profile-guided text layout and combinations of them), boots
+each one in QEMU with the in-kernel benchmarks selected and prints the
+"bench:" results side by side. PGO and layout variants get their profile
+from an extra boot of an instrumented or profiling kernel first.
+"""
+
+import argparse
+import os
+import queue
+import re
+import shutil
+import subprocess
+import sys
+import threading
+
+BUILD_DIR = 'build'
+KERNEL_DIR = 'kernel'
+KERNEL_ELF = os.path.join(BUILD_DIR, 'kernel.elf')
+VARIANT_DIR = os.path.join(BUILD_DIR, 'variants')
+
+BENCH_LINE = re.compile(r'bench: (\S+) (\S+) (\d+) (\S+)')
+BENCH_DONE = 'Benchmarks complete.'
+
+# name: (make variables, profile to collect first: None, 'pgo' or 'layout')
+VARIANTS = {
+    'i686':       ({}, None),
+    'march':      ({'MARCH': None}, None),
+    'lto':        ({'LTO': '1'}, None),
+    'pgo':        ({'PGO': 'use'}, 'pgo'),
+    'layout':     ({'LAYOUT': '1'}, 'layout'),
+    'lto-pgo':    ({'LTO': '1', 'PGO': 'use'}, 'pgo'),
+    'march-lto-pgo': ({'MARCH': None, 'LTO': '1', 'PGO': 'use'}, 'pgo'),
+}
+
+
+class Runner:
+    def __init__(self, args):
+        self.args = args
+
+    def make(self, variables, target=None):
+        command = [self.args.make, '-C', KERNEL_DIR, f'BUILD_DIR=../{BUILD_DIR}']
+        command += [f'{k}={v}' for k, v in variables.items()]
+        if target:
+            command.append(target)
+        if subprocess.run(command).returncode != 0:
+            raise RuntimeError(f"build failed: {' '.join(command)}")
+
+    def script(self, *args):
+        if subprocess.run([sys.executable] + list(args)).returncode != 0:
+            raise RuntimeError(f"{args[0]} failed")
+
+    def build(self, variables):
+        self.make({}, 'clean')
+        self.make(variables)
+
+    def boot(self, elf, cmdline, until, log):
+        """Boot elf in QEMU, collect the console until the line `until` appears"""
+        command = [self.args.qemu, '-m', '32M', '-display', 'none', '-serial', 'stdio',
+                   '-no-reboot', '-kernel', elf, '-append', f'serial=1 {cmdline}']
+        command += self.args.qemu_flags.split()
+        process = subprocess.Popen(command, stdout=subprocess.PIPE, stdin=subprocess.DEVNULL,
+                                   text=True, errors='replace')
+        lines = queue.Queue()
+
+        def reader():
+            for line in process.stdout:
+                lines.put(line)
+            lines.put(None)
+
+        threading.Thread(target=reader, daemon=True).start()
+
+        output = []
+        try:
+            while True:
+                line = lines.get(timeout=self.args.timeout)
+                if line is None:
+                    break
+                output.append(line)
+                if line.strip() == until:
+                    break
+        except queue.Empty:
+            print(f"  timed out after {self.args.timeout}s without '{until}'")
+        finally:
+            process.kill()
+            process.wait()
+
+        with open(log, 'w') as f:
+            f.writelines(output)
+        return output
+
+    def collect_pgo(self, name, variables):
+        gen = dict(variables, PGO='gen')
+        print(f"[{name}] building and booting the PGO=gen kernel")
+        self.make({}, 'profile-clean')
+        self.build(gen)
+        log = os.path.join(VARIANT_DIR, f'{name}-gcov.log')
+        self.boot(KERNEL_ELF, f'bench={self.args.bench}', 'gcov: end', log)
+        self.script('kernel_gcov.py', log)
+
+    def collect_layout(self, name, variables):
+        base = {k: v for k, v in variables.items() if k != 'LAYOUT'}
+        print(f"[{name}] building and booting a profiling kernel")
+        self.build(base)
+        log = os.path.join(VARIANT_DIR, f'{name}-profile.log')
+        self.boot(KERNEL_ELF, f'profile=1 bench={self.args.bench}', 'profile: end', log)
+        self.script('kernel_layout.py', KERNEL_ELF, log, os.path.join(BUILD_DIR, 'text_order.ld'))
+
+    def run_variant(self, name):
+        variables, profile = VARIANTS[name]
+        variables = {k: (v if v is not None else self.args.march) for k, v in variables.items()}
+
+        if profile == 'pgo':
+            self.collect_pgo(name, {k: v for k, v in variables.items() if k != 'PGO'})
+        elif profile == 'layout':
+            self.collect_layout(name, variables)
+
+        print(f"[{name}] building with {' '.join(f'{k}={v}' for k, v in variables.items()) or 'defaults'}")
+        self.build(variables)
+        elf = os.path.join(VARIANT_DIR, f'{name}.elf')
+        shutil.copyfile(KERNEL_ELF, elf)
+
+        runs = []
+        for run in range(self.args.runs):
+            print(f"[{name}] benchmark run {run + 1}/{self.args.runs}")
+            log = os.path.join(VARIANT_DIR, f'{name}-{run + 1}.log')
+            output = self.boot(elf, f'bench={self.args.bench}', BENCH_DONE, log)
+            runs.append({(m.group(1), m.group(2), m.group(4)): int(m.group(3))
+                         for m in map(BENCH_LINE.search, output) if m})
+        return runs
+
+
+def median(values):
+    values = sorted(values)
+    return values[len(values) // 2] if values else None
+
+
+def print_table(names, results):
+    keys = []
+    for name in names:
+        for run in results[name]:
+            keys += [k for k in run if k not in keys]
+
+    rows = [['benchmark', 'unit'] + names]
+    for key in keys:
+        row = [f'{key[0]} {key[1]}', key[2]]
+        base = median([r[key] for r in results[names[0]] if key in r])
+        for name in names:
+            value = median([r[key] for r in results[name] if key in r])
+            if value is None:
+                row.append('-')
+            elif name == names[0] or not base:
+                row.append(str(value))
+            else:
+                row.append(f'{value} ({(value - base) * 100 / base:+.1f}%)')
+        rows.append(row)
+
+    widths = [max(len(row[i]) for row in rows) for i in range(len(rows[0]))]
+    for row in rows:
+        print('  '.join(cell.ljust(width) for cell, width in zip(row, widths)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare the kernel benchmarks across build variants")
+    parser.add_argument('variants', nargs='*', default=list(VARIANTS),
+                        help=f"variants to compare, first is the baseline (default: {' '.join(VARIANTS)})")
+    parser.add_argument('--march', default='haswell', help="MARCH of the march variants (default haswell)")
+    parser.add_argument('--bench', default='all', help="bench= selection (default all)")
+    parser.add_argument('--runs', type=int, default=3, help="boots per variant, the median is shown (default 3)")
+    parser.add_argument('--make', default='make', help="make executable")
+    parser.add_argument('--qemu', default='qemu-system-i386', help="QEMU executable")
+    parser.add_argument('--qemu-flags', default='-cpu max', help="extra QEMU flags (default -cpu max)")
+    parser.add_argument('--timeout', type=int, default=300, help="seconds to wait for each boot")
+    args = parser.parse_args()
+
+    unknown = [v for v in args.variants if v not in VARIANTS]
+    if unknown:
+        print(f"Error: unknown variant {', '.join(unknown)}")
+        return 1
+
+    os.makedirs(VARIANT_DIR, exist_ok=True)
+    runner = Runner(args)
+    results = {}
+    try:
+        for name in args.variants:
+            results[name] = runner.run_variant(name)
+    except RuntimeError as e:
+        print(f"Error: {e}")
+        return 1
+
+    print()
+    print_table(args.variants, results)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -9,6 +9,14 @@ import struct
 import sys
 from datetime import datetime
 
+# Boot snapshot area written by the kernel (kernel/include/hibernate.h)
+SNAPSHOT_START_LBA = 1440
+SNAPSHOT_SECTORS = 1440
+
+# Stage 1 and stage 2 read these files as raw sectors, not through the FAT
+# (STAGE2.BIN is padded to 16 sectors, KERNEL_START_LBA in stage2.asm)
+FIXED_FILE_LBA = {'STAGE2.BIN': 33, 'KERNEL.BIN': 49}
+
 class FAT12Builder:
     def __init__(self, image_size=1474560):  # 1.44MB floppy size
         self.image_size = image_size
@@ -43,6 +51,16 @@ class FAT12Builder:
         # Next available cluster
         self.next_cluster = 2
         
+        # Keep the boot snapshot area out of the filesystem
+        self.reserve_sectors(SNAPSHOT_START_LBA, SNAPSHOT_SECTORS)
+        
+    def reserve_sectors(self, start, count):
+        """Mark the clusters covering a sector range as bad"""
+        first = max(start - self.data_start, 0) // self.sectors_per_cluster + 2
+        last = (start + count - self.data_start - 1) // self.sectors_per_cluster + 2
+        for cluster in range(first, min(last + 1, len(self.fat))):
+            self.fat[cluster] = 0xFF7
+    
     def create_boot_sector(self, boot_code):
         """Create FAT12 boot sector with bootloader code"""
         # Start with boot code
@@ -95,8 +113,16 @@ class FAT12Builder:
         if clusters_needed == 0:
             clusters_needed = 1
             
+        # Files are stored contiguously and must end before reserved clusters
+        if any(self.fat[self.next_cluster:self.next_cluster + clusters_needed]):
+            raise ValueError(f"No room for {filename} before the snapshot area")
+            
         # Allocate clusters
         first_cluster = self.next_cluster
+        if filename in FIXED_FILE_LBA:
+            lba = self.data_start + (first_cluster - 2) * self.sectors_per_cluster
+            if lba != FIXED_FILE_LBA[filename]:
+                raise ValueError(f"{filename} starts at sector {lba}, the boot loader reads it from {FIXED_FILE_LBA[filename]}")
         current_cluster = first_cluster
         
         for i in range(clusters_needed):
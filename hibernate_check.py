@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""
+nekkoOS Boot Snapshot Check
+Takes a boot snapshot and resumes it, end to end in QEMU: boots
+kernel.elf with hibernate=1 and the floppy image attached, as make
+hibernate does, then boots the floppy image, as make run-floppy does, and
+checks that stage 2 resumed the snapshot and the kernel reached the ready
+point again without running its initcalls. The snapshot is written into
+the image, so the check uses a copy of it.
+"""
+
+import argparse
+import os
+import queue
+import shutil
+import subprocess
+import sys
+import threading
+
+BUILD_DIR = 'build'
+READY_LINE = 'System ready. Entering idle loop...'
+SAVED_LINE = 'Boot snapshot saved'
+FAILED_LINE = 'Boot snapshot failed'
+RESUMED_LINE = 'Resumed from boot snapshot'
+COLD_BOOT_LINE = 'Initializing kernel subsystems...'
+
+
+def boot(args, boot_flags, log):
+    """Boot QEMU, collect the serial console until the ready line appears"""
+    command = [args.qemu, '-m', args.memory, '-display', 'none', '-serial', 'stdio', '-no-reboot']
+    command += args.qemu_flags.split() + boot_flags
+    process = subprocess.Popen(command, stdout=subprocess.PIPE, stdin=subprocess.DEVNULL,
+                               text=True, errors='replace')
+    lines = queue.Queue()
+
+    def reader():
+        for line in process.stdout:
+            lines.put(line)
+        lines.put(None)
+
+    threading.Thread(target=reader, daemon=True).start()
+
+    output = []
+    try:
+        while True:
+            line = lines.get(timeout=args.timeout)
+            if line is None:
+                break
+            output.append(line.rstrip())
+            if output[-1] == READY_LINE:
+                break
+    except queue.Empty:
+        print(f"  timed out after {args.timeout}s without '{READY_LINE}'")
+    finally:
+        process.kill()
+        process.wait()
+
+    with open(log, 'w') as f:
+        f.writelines(line + '\n' for line in output)
+    return output
+
+
+def has_line(output, prefix):
+    return any(line.startswith(prefix) for line in output)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Take a boot snapshot in QEMU and resume it from the floppy image")
+    parser.add_argument('--image', default=os.path.join(BUILD_DIR, 'nekkoOS.img'), help="floppy image")
+    parser.add_argument('--kernel', default=os.path.join(BUILD_DIR, 'kernel.elf'), help="multiboot kernel")
+    parser.add_argument('--cmdline', default='', help="extra kernel command line")
+    parser.add_argument('--qemu', default='qemu-system-i386', help="QEMU executable")
+    parser.add_argument('--memory', default='32M', help="guest memory, the same for both boots (default 32M)")
+    parser.add_argument('--qemu-flags', default='', help="extra QEMU flags")
+    parser.add_argument('--timeout', type=int, default=120, help="seconds to wait for each boot")
+    args = parser.parse_args()
+
+    image = os.path.join(os.path.dirname(args.image), 'hibernate-check.img')
+    shutil.copyfile(args.image, image)
+    drive = ['-drive', f'file={image},format=raw,if=floppy']
+
+    print("Booting kernel.elf with hibernate=1...")
+    output = boot(args, drive + ['-kernel', args.kernel, '-append', f'serial=1 hibernate=1 {args.cmdline}'],
+                  os.path.join(BUILD_DIR, 'hibernate-save.log'))
+    if not has_line(output, SAVED_LINE):
+        failed = [line for line in output if line.startswith(FAILED_LINE)]
+        print(f"Error: no snapshot saved{': ' + failed[0] if failed else ''}")
+        return 1
+    print(f"  {next(line for line in output if line.startswith(SAVED_LINE))}")
+
+    print("Booting the floppy image...")
+    output = boot(args, drive + ['-boot', 'a'], os.path.join(BUILD_DIR, 'hibernate-resume.log'))
+    if not has_line(output, RESUMED_LINE):
+        print("Error: stage 2 did not resume the snapshot")
+        return 1
+    if has_line(output, COLD_BOOT_LINE):
+        print("Error: the resumed kernel ran its initcalls again")
+        return 1
+    if output[-1] != READY_LINE:
+        print("Error: the resumed kernel did not reach the ready point")
+        return 1
+
+    for line in output:
+        if line.startswith(RESUMED_LINE) or line.startswith('bench: hibernate'):
+            print(f"  {line}")
+    print("Boot snapshot resumed.")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,95 @@
+/*
+ * ACPI table lookup for nekkoOS
+ * Finds the RSDP in the first kilobyte of the EBDA or in the BIOS area
+ * below 1MB, then the tables through the XSDT (ACPI 2.0, entries below
+ * 4GB only) or the RSDT. Physical memory is identity mapped, so tables
+ * are used in place. Nothing is parsed here beyond the headers.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "acpi.h"
+
+#define EBDA_SEGMENT_PTR    0x40E
+#define BIOS_AREA_START     0xE0000
+#define BIOS_AREA_END       0x100000
+#define RSDP_V1_LENGTH      20
+
+static const struct acpi_rsdp* rsdp;
+static bool rsdp_searched;
+
+static bool acpi_checksum_ok(const void* data, uint32_t length) {
+    const uint8_t* bytes = data;
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < length; i++)
+        sum += bytes[i];
+    return sum == 0;
+}
+
+static const struct acpi_rsdp* rsdp_scan(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr + sizeof(struct acpi_rsdp) <= end; addr += 16) {
+        const struct acpi_rsdp* candidate = (const struct acpi_rsdp*)addr;
+
+        if (memcmp(candidate->signature, "RSD PTR ", 8) == 0 &&
+            acpi_checksum_ok(candidate, RSDP_V1_LENGTH))
+            return candidate;
+    }
+    return NULL;
+}
+
+static const struct acpi_rsdp* rsdp_find(void) {
+    if (!rsdp_searched) {
+        /* BIOS data area word holding the EBDA segment */
+        volatile const uint16_t* ebda_segment = (volatile const uint16_t*)EBDA_SEGMENT_PTR;
+        __asm__ ("" : "+r"(ebda_segment));
+        uint32_t ebda = (uint32_t)*ebda_segment << 4;
+
+        rsdp_searched = true;
+        if (ebda >= 0x80000 && ebda < BIOS_AREA_START)
+            rsdp = rsdp_scan(ebda, ebda + 1024);
+        if (!rsdp)
+            rsdp = rsdp_scan(BIOS_AREA_START, BIOS_AREA_END);
+    }
+    return rsdp;
+}
+
+static const struct acpi_table_header* acpi_table_at(uint64_t addr) {
+    if (addr == 0 || addr >= 0x100000000ULL)
+        return NULL;
+
+    const struct acpi_table_header* table = (const struct acpi_table_header*)(uint32_t)addr;
+    if (table->length < sizeof(*table) || !acpi_checksum_ok(table, table->length))
+        return NULL;
+    return table;
+}
+
+const struct acpi_table_header* acpi_find_table(const char* signature) {
+    const struct acpi_rsdp* root = rsdp_find();
+    const struct acpi_table_header* sdt = NULL;
+    uint32_t entry_size = 4;
+
+    if (!root)
+        return NULL;
+
+    if (root->revision >= 2 && acpi_checksum_ok(root, root->length))
+        sdt = acpi_table_at(root->xsdt_address);
+    if (sdt)
+        entry_size = 8;
+    else
+        sdt = acpi_table_at(root->rsdt_address);
+    if (!sdt)
+        return NULL;
+
+    const uint8_t* entries = (const uint8_t*)(sdt + 1);
+    uint32_t count = (sdt->length - sizeof(*sdt)) / entry_size;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t addr = 0;
+
+        memcpy(&addr, entries + i * entry_size, entry_size);
+        const struct acpi_table_header* table = acpi_table_at(addr);
+        if (table && memcmp(table->signature, signature, 4) == 0)
+            return table;
+    }
+    return NULL;
+}
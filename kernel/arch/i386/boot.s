@@ -5,11 +5,15 @@
 .set ALIGN,    1<<0             # align loaded modules on page boundaries
 .set MEMINFO,  1<<1             # provide memory map
 .set FLAGS,    ALIGN | MEMINFO  # this is the Multiboot 'flag' field
-.set MAGIC,    0x2BADB002       # 'magic number' lets bootloader find the header
+.set MAGIC,    0x1BADB002       # 'magic number' lets bootloader find the header
 .set CHECKSUM, -(MAGIC + FLAGS) # checksum of above, to prove we are multiboot
 
-# Multiboot header
-.section .multiboot
+# Multiboot header, linked first in .text so that loaders find it in the
+# first 8KB of kernel.elf. Stage 2 jumps to the start of kernel.bin, so the
+# section begins with a jump to the entry point.
+.section .multiboot, "ax"
+.align 4
+    jmp _start
 .align 4
 .long MAGIC
 .long FLAGS
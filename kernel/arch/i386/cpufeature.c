@@ -0,0 +1,47 @@
+/*
+ * CPU feature detection for nekkoOS
+ * Reads the CPUID bits the kernel chooses code paths by into one word,
+ * so callers test a bit instead of running CPUID (which also serializes
+ * the pipeline) on every decision.
+ */
+
+#include "types.h"
+#include "cpufeature.h"
+#include "init.h"
+#include "kernel.h"
+
+#define CPUID_LEAF_EXTENDED_FEATURES 7
+#define CPUID_7_EBX_ERMS    BIT(9)
+#define CPUID_7_EDX_FSRM    BIT(4)
+
+uint32_t boot_cpu_features;
+
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    *eax = leaf;
+    *ecx = 0;
+    __asm__ volatile ("cpuid" : "+a"(*eax), "=b"(*ebx), "+c"(*ecx), "=d"(*edx));
+}
+
+int __init init_cpu_features(void) {
+    uint32_t max_leaf, ebx, ecx, edx;
+
+    cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+    if (max_leaf >= CPUID_LEAF_EXTENDED_FEATURES) {
+        uint32_t eax;
+
+        cpuid(CPUID_LEAF_EXTENDED_FEATURES, &eax, &ebx, &ecx, &edx);
+        if (ebx & CPUID_7_EBX_ERMS)
+            boot_cpu_features |= X86_FEATURE_ERMS;
+        if (edx & CPUID_7_EDX_FSRM)
+            boot_cpu_features |= X86_FEATURE_FSRM;
+    }
+
+    kprintf("CPU features:");
+    if (boot_cpu_has(X86_FEATURE_ERMS))
+        kprintf(" erms");
+    if (boot_cpu_has(X86_FEATURE_FSRM))
+        kprintf(" fsrm");
+    kprintf("\n");
+    return 0;
+}
+core_initcall(init_cpu_features);
@@ -0,0 +1,61 @@
+/*
+ * ISA DMA controller (8237A) support for nekkoOS
+ * Only the 8-bit master controller (channels 0-3) is used
+ */
+
+#include "types.h"
+#include "io.h"
+#include "dma.h"
+#include "errno.h"
+
+/* Master controller registers */
+#define DMA_MASK_REG        0x0A
+#define DMA_MODE_REG        0x0B
+#define DMA_FLIPFLOP_REG    0x0C
+
+/* Per-channel address, count and page registers */
+static const uint8_t dma_addr_port[4]  = { 0x00, 0x02, 0x04, 0x06 };
+static const uint8_t dma_count_port[4] = { 0x01, 0x03, 0x05, 0x07 };
+static const uint8_t dma_page_port[4]  = { 0x87, 0x83, 0x81, 0x82 };
+
+/* Mask (disable) a DMA channel */
+void dma_mask(uint8_t channel) {
+    outb(DMA_MASK_REG, 0x04 | (channel & 3));
+}
+
+/* Program a channel for a single transfer and unmask it */
+int dma_setup(uint8_t channel, uintptr_t addr, uint32_t length, uint8_t mode) {
+    if (channel > 3 || length == 0 || length > DMA_BOUNDARY)
+        return -EINVAL;
+
+    /* Buffer must be ISA addressable and stay inside one 64KB page */
+    if (addr + length > DMA_LIMIT ||
+        (addr & ~(DMA_BOUNDARY - 1)) != ((addr + length - 1) & ~(DMA_BOUNDARY - 1)))
+        return -EINVAL;
+
+    uint32_t count = length - 1;
+
+    dma_mask(channel);
+    outb(DMA_FLIPFLOP_REG, 0xFF);
+    outb(DMA_MODE_REG, mode | channel);
+
+    outb(dma_addr_port[channel], addr & 0xFF);
+    outb(dma_addr_port[channel], (addr >> 8) & 0xFF);
+    outb(dma_page_port[channel], (addr >> 16) & 0xFF);
+
+    outb(DMA_FLIPFLOP_REG, 0xFF);
+    outb(dma_count_port[channel], count & 0xFF);
+    outb(dma_count_port[channel], (count >> 8) & 0xFF);
+
+    /* Unmask channel */
+    outb(DMA_MASK_REG, channel);
+    return 0;
+}
+
+/* Bytes left untransferred on a channel */
+uint32_t dma_residue(uint8_t channel) {
+    outb(DMA_FLIPFLOP_REG, 0xFF);
+    uint32_t count = inb(dma_count_port[channel & 3]);
+    count |= (uint32_t)inb(dma_count_port[channel & 3]) << 8;
+    return (count + 1) & 0xFFFF;
+}
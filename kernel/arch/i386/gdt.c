@@ -0,0 +1,57 @@
+/*
+ * Global Descriptor Table for nekkoOS
+ * Flat 4GB kernel and user code/data segments. The boot loader's GDT is
+ * not guaranteed to survive, so the kernel installs its own before any
+ * interrupt gate refers to GDT_KERNEL_CODE.
+ */
+
+#include "types.h"
+#include "gdt.h"
+#include "init.h"
+#include "kernel.h"
+
+static struct gdt_entry gdt[GDT_ENTRIES];
+static struct gdt_ptr gdt_pointer;
+
+static void gdt_set_entry(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    gdt[index].limit_low = limit & 0xFFFF;
+    gdt[index].base_low = base & 0xFFFF;
+    gdt[index].base_middle = (base >> 16) & 0xFF;
+    gdt[index].access = access;
+    gdt[index].granularity = flags | ((limit >> 16) & 0x0F);
+    gdt[index].base_high = (base >> 24) & 0xFF;
+}
+
+/* Load the table and reload every segment register */
+static void gdt_load(void) {
+    __asm__ volatile (
+        "lgdt %0\n\t"
+        "ljmp %1, $1f\n"
+        "1:\n\t"
+        "mov %2, %%ds\n\t"
+        "mov %2, %%es\n\t"
+        "mov %2, %%fs\n\t"
+        "mov %2, %%gs\n\t"
+        "mov %2, %%ss\n\t"
+        : : "m"(gdt_pointer), "i"(GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA) : "memory");
+}
+
+/* GDT initialization */
+int __init init_gdt(void) {
+    kprintf("Initializing Global Descriptor Table...\n");
+
+    uint8_t flags = GDT_GRANULARITY_4K | GDT_SIZE_32;
+    gdt_set_entry(0, 0, 0, 0, 0);
+    gdt_set_entry(1, 0, 0xFFFFF, GDT_PRESENT | GDT_SEGMENT | GDT_EXECUTABLE | GDT_READ_WRITE, flags);
+    gdt_set_entry(2, 0, 0xFFFFF, GDT_PRESENT | GDT_SEGMENT | GDT_READ_WRITE, flags);
+    gdt_set_entry(3, 0, 0xFFFFF, GDT_PRESENT | GDT_RING3 | GDT_SEGMENT | GDT_EXECUTABLE | GDT_READ_WRITE, flags);
+    gdt_set_entry(4, 0, 0xFFFFF, GDT_PRESENT | GDT_RING3 | GDT_SEGMENT | GDT_READ_WRITE, flags);
+
+    gdt_pointer.limit = sizeof(gdt) - 1;
+    gdt_pointer.base = (uint32_t)gdt;
+    gdt_load();
+
+    kprintf("GDT initialized.\n");
+    return 0;
+}
+core_initcall(init_gdt);
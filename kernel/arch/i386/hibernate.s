@@ -0,0 +1,60 @@
+# nekkoOS hibernation context save and resume trampoline
+# hibernate_save records the callee-saved registers, the stack, EFLAGS and
+# the descriptor table registers, like setjmp. Stage 2 jumps to
+# hibernate_resume once the snapshot is back in RAM, still on its own GDT
+# and with interrupts disabled; the trampoline reinstalls the kernel's
+# tables and returns from hibernate_save a second time, with 1.
+
+.section .text
+
+# int hibernate_save(struct hibernate_context* context)
+.global hibernate_save
+.type hibernate_save, @function
+hibernate_save:
+    mov 4(%esp), %eax       # context
+
+    mov %ebx, 0(%eax)
+    mov %esi, 4(%eax)
+    mov %edi, 8(%eax)
+    mov %ebp, 12(%eax)
+    lea 4(%esp), %edx       # Stack pointer after the return
+    mov %edx, 16(%eax)
+    mov (%esp), %edx        # Return address
+    mov %edx, 20(%eax)
+    pushf
+    pop %edx
+    mov %edx, 24(%eax)
+    sgdt 28(%eax)
+    sidt 34(%eax)
+
+    xor %eax, %eax
+    ret
+
+# Entered from stage 2 in protected mode with interrupts disabled
+.global hibernate_resume
+.type hibernate_resume, @function
+hibernate_resume:
+    mov $hibernate_context, %eax
+
+    # Kernel GDT first: stage 2's table is not part of the snapshot
+    lgdt 28(%eax)
+    ljmp $0x08, $1f         # GDT_KERNEL_CODE
+1:  mov $0x10, %edx         # GDT_KERNEL_DATA
+    mov %dx, %ds
+    mov %dx, %es
+    mov %dx, %fs
+    mov %dx, %gs
+    mov %dx, %ss
+    lidt 34(%eax)
+
+    mov 0(%eax), %ebx
+    mov 4(%eax), %esi
+    mov 8(%eax), %edi
+    mov 12(%eax), %ebp
+    mov 16(%eax), %esp
+    pushl 24(%eax)
+    popf
+
+    mov 20(%eax), %edx
+    mov $1, %eax
+    jmp *%edx
@@ -0,0 +1,107 @@
+/*
+ * Interrupt Descriptor Table for nekkoOS
+ * Installs the entry stubs from interrupt.s and routes every vector
+ * through interrupt_dispatch: CPU exceptions to their registered handler
+ * (or an exception table fixup, or a panic), hardware interrupts to the
+ * IRQ layer and int $0x80 to the system call table.
+ */
+
+#include "types.h"
+#include "gdt.h"
+#include "idt.h"
+#include "irq.h"
+#include "irqflags.h"
+#include "extable.h"
+#include "syscall.h"
+#include "init.h"
+#include "kernel.h"
+
+/* Entry stubs (interrupt.s) */
+extern void (*isr_stub_table[])(void);
+
+static struct idt_entry idt[IDT_ENTRIES];
+static struct idt_ptr idt_pointer;
+static exception_handler_t exception_handlers[IDT_EXCEPTIONS];
+
+static const char* const exception_names[IDT_EXCEPTIONS] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow",
+    "Bound range exceeded", "Invalid opcode", "Device not available",
+    "Double fault", "Coprocessor segment overrun", "Invalid TSS",
+    "Segment not present", "Stack fault", "General protection fault",
+    "Page fault", "Reserved", "x87 floating point error", "Alignment check",
+    "Machine check", "SIMD floating point error", "Virtualization",
+    "Control protection", "Reserved", "Reserved", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Hypervisor injection", "VMM communication",
+    "Security", "Reserved",
+};
+
+void idt_set_gate(uint8_t vector, void (*handler)(void), uint8_t type_attr) {
+    uint32_t offset = (uint32_t)handler;
+
+    idt[vector].offset_low = offset & 0xFFFF;
+    idt[vector].selector = GDT_KERNEL_CODE;
+    idt[vector].zero = 0;
+    idt[vector].type_attr = type_attr;
+    idt[vector].offset_high = offset >> 16;
+}
+
+void set_exception_handler(uint8_t vector, exception_handler_t handler) {
+    if (vector < IDT_EXCEPTIONS)
+        exception_handlers[vector] = handler;
+}
+
+static void exception_dispatch(struct interrupt_frame* frame) {
+    exception_handler_t handler = exception_handlers[frame->vector];
+    if (handler) {
+        handler(frame);
+        return;
+    }
+
+    /* A user access that faulted resumes at its fixup */
+    if (fixup_exception(frame))
+        return;
+
+    kprintf("\nException: ");
+    kprintf(exception_names[frame->vector]);
+    kprintf(" (error ");
+    kprintf_hex(frame->error_code);
+    kprintf(") at ");
+    kprintf_hex(frame->eip);
+    kprintf("\n");
+    panic("unhandled exception");
+}
+
+/* Common C entry point for all vectors (called from interrupt_common) */
+void interrupt_dispatch(struct interrupt_frame* frame) {
+    bool irqs_were_on = frame->eflags & EFLAGS_IF;
+
+    if (irqs_were_on)
+        trace_irqs_off((void*)frame->eip);
+
+    if (frame->vector < IDT_EXCEPTIONS)
+        exception_dispatch(frame);
+    else if (frame->vector < IRQ_BASE + IRQ_LINES)
+        irq_dispatch(frame);
+    else if (frame->vector == SYSCALL_VECTOR)
+        syscall_dispatch(frame);
+
+    if (irqs_were_on)
+        trace_irqs_on((void*)frame->eip);
+}
+
+/* IDT initialization */
+int __init init_idt(void) {
+    kprintf("Initializing Interrupt Descriptor Table...\n");
+
+    for (int vector = 0; vector < IRQ_BASE + IRQ_LINES; vector++)
+        idt_set_gate(vector, isr_stub_table[vector], IDT_PRESENT | IDT_INTERRUPT_GATE);
+
+    idt_pointer.limit = sizeof(idt) - 1;
+    idt_pointer.base = (uint32_t)idt;
+    __asm__ volatile ("lidt %0" : : "m"(idt_pointer));
+    sort_main_extable();
+
+    kprintf("IDT initialized.\n");
+    return 0;
+}
+initcall_depends(init_idt, 0, "init_gdt");
@@ -0,0 +1,178 @@
+/*
+ * Hardware interrupt layer for nekkoOS
+ * Remaps the two 8259A PICs above the exception vectors and runs the
+ * registered top half for each IRQ line. On the way out it processes
+ * pending softirqs and preempts the interrupted thread if a wakeup asked
+ * for it.
+ */
+
+#include "types.h"
+#include "io.h"
+#include "idt.h"
+#include "irq.h"
+#include "irqflags.h"
+#include "smp.h"
+#include "sched.h"
+#include "softirq.h"
+#include "timer.h"
+#include "profile.h"
+#include "init.h"
+#include "bench.h"
+#include "errno.h"
+#include "kernel.h"
+#include "export.h"
+
+struct irq_desc {
+    irq_handler_t handler;
+    void* data;
+    const char* name;
+    uint32_t count;
+    uint64_t max_cycles;        /* Longest top half */
+};
+
+static struct irq_desc irq_table[IRQ_LINES];
+
+void irq_mask(int irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    uint32_t flags = local_irq_save();
+    outb(port, inb(port) | (1 << (irq & 7)));
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL(irq_mask);
+
+void irq_unmask(int irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    uint32_t flags = local_irq_save();
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL(irq_unmask);
+
+static void pic_eoi(int irq) {
+    if (irq >= 8)
+        outb(PIC2_COMMAND, PIC_EOI);
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+/* IRQ 7 and 15 fire spuriously when a request goes away before it is acknowledged */
+static bool pic_spurious(int irq) {
+    if (irq != 7 && irq != 15)
+        return false;
+
+    uint16_t port = irq == 7 ? PIC1_COMMAND : PIC2_COMMAND;
+    outb(port, PIC_READ_ISR);
+    if (inb(port) & 0x80)
+        return false;
+
+    /* The master saw a real cascade interrupt from the slave */
+    if (irq == 15)
+        outb(PIC1_COMMAND, PIC_EOI);
+    return true;
+}
+
+int request_irq(int irq, irq_handler_t handler, void* data, const char* name) {
+    if (irq < 0 || irq >= IRQ_LINES || irq == PIC_CASCADE_IRQ || !handler)
+        return -EINVAL;
+    if (irq_table[irq].handler)
+        return -EBUSY;
+
+    uint32_t flags = local_irq_save();
+    irq_table[irq].handler = handler;
+    irq_table[irq].data = data;
+    irq_table[irq].name = name;
+    local_irq_restore(flags);
+
+    irq_unmask(irq);
+    return 0;
+}
+EXPORT_SYMBOL(request_irq);
+
+void irq_dispatch(struct interrupt_frame* frame) {
+    int irq = frame->vector - IRQ_BASE;
+    struct irq_desc* desc = &irq_table[irq];
+    struct cpu* cpu = this_cpu();
+
+    if (pic_spurious(irq))
+        return;
+
+    uint64_t start = rdtsc();
+    cpu->preempt_count += HARDIRQ_OFFSET;
+    desc->count++;
+    if (irq == IRQ_TIMER)
+        profile_tick(frame->eip);
+    if (desc->handler)
+        desc->handler(irq, desc->data);
+    pic_eoi(irq);
+    cpu->preempt_count -= HARDIRQ_OFFSET;
+
+    uint64_t length = rdtsc() - start;
+    if (length > desc->max_cycles)
+        desc->max_cycles = length;
+
+    /* Bottom halves run with interrupts enabled, then maybe switch threads */
+    if (!in_interrupt() && cpu->softirq_pending)
+        invoke_softirq();
+    if (cpu->need_resched && cpu->preempt_count == 0)
+        preempt_schedule_irq();
+}
+
+/* Remap IRQ 0-15 to vectors 32-47 and load the masks */
+static void pic_remap(uint8_t master_mask, uint8_t slave_mask) {
+    outb(PIC1_COMMAND, PIC_ICW1_INIT);
+    io_wait();
+    outb(PIC2_COMMAND, PIC_ICW1_INIT);
+    io_wait();
+    outb(PIC1_DATA, IRQ_BASE);
+    io_wait();
+    outb(PIC2_DATA, IRQ_BASE + 8);
+    io_wait();
+    outb(PIC1_DATA, 1 << PIC_CASCADE_IRQ);
+    io_wait();
+    outb(PIC2_DATA, PIC_CASCADE_IRQ);
+    io_wait();
+    outb(PIC1_DATA, PIC_ICW4_8086);
+    io_wait();
+    outb(PIC2_DATA, PIC_ICW4_8086);
+    io_wait();
+
+    outb(PIC1_DATA, master_mask);
+    outb(PIC2_DATA, slave_mask);
+}
+
+/* Interrupt initialization */
+int __init init_interrupts(void) {
+    kprintf("Initializing interrupt handlers...\n");
+
+    /* Everything masked until a driver requests its line */
+    pic_remap((uint8_t)~(1 << PIC_CASCADE_IRQ), 0xFF);
+
+    local_irq_enable();
+    kprintf("Interrupts initialized.\n");
+    return 0;
+}
+initcall_depends(init_interrupts, 0, "init_idt");
+
+/* PIC masks at snapshot time; the firmware reprograms both PICs on reboot */
+static uint8_t saved_masks[2];
+
+void irq_suspend(void) {
+    saved_masks[0] = inb(PIC1_DATA);
+    saved_masks[1] = inb(PIC2_DATA);
+}
+
+void irq_resume(void) {
+    pic_remap(saved_masks[0], saved_masks[1]);
+}
+
+/* Longest top half per IRQ line */
+static void irq_benchmark(void) {
+    uint32_t khz = timer_tsc_khz();
+
+    for (int irq = 0; irq < IRQ_LINES; irq++) {
+        struct irq_desc* desc = &irq_table[irq];
+        if (!desc->handler || !khz)
+            continue;
+        bench_report("irq", desc->name, (uint32_t)div_u64(desc->max_cycles * 1000, khz), "us");
+    }
+}
+KERNEL_BENCH("irq", irq_benchmark);
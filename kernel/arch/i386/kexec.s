@@ -0,0 +1,36 @@
+# nekkoOS kexec relocation trampoline
+# Copied to a control page outside the new kernel's load window and
+# entered with interrupts disabled and EAX = struct kexec_control*
+# (kexec.h). It copies every segment into place, zeroes the rest of each
+# one, and enters the new kernel the way a multiboot loader would. Only
+# relative jumps and no stack: the old kernel, its stack and its GDT may
+# be overwritten by the copy (the loaded segment registers stay usable).
+
+.section .text
+
+.global kexec_relocate
+.global kexec_relocate_end
+kexec_relocate:
+    mov %eax, %ebp
+    lea 12(%ebp), %ebx      # segments
+    mov 8(%ebp), %edx       # count
+    cld
+
+1:  test %edx, %edx
+    jz 2f
+    mov 0(%ebx), %esi       # src
+    mov 4(%ebx), %edi       # dest
+    mov 8(%ebx), %ecx       # size
+    rep movsb
+    mov 12(%ebx), %ecx      # memsz - size bytes of zeroes
+    sub 8(%ebx), %ecx
+    xor %eax, %eax
+    rep stosb
+    add $16, %ebx
+    dec %edx
+    jmp 1b
+
+2:  mov 4(%ebp), %ebx       # Multiboot information
+    mov $0x2BADB002, %eax   # MULTIBOOT_BOOTLOADER_MAGIC
+    jmp *0(%ebp)
+kexec_relocate_end:
@@ -0,0 +1,39 @@
+# nekkoOS thread context switch
+# Only the callee-saved registers need saving: everything else is
+# already preserved by the C caller of switch_context.
+
+# Runs on every thread switch: kept with the hot code (kernel.ld)
+.section .text.hot, "ax"
+
+# void switch_context(uint32_t* prev_esp, uint32_t next_esp)
+.global switch_context
+.type switch_context, @function
+switch_context:
+    mov 4(%esp), %eax       # prev_esp
+    mov 8(%esp), %edx       # next_esp
+
+    push %ebp
+    push %ebx
+    push %esi
+    push %edi
+
+    mov %esp, (%eax)
+    mov %edx, %esp
+
+    pop %edi
+    pop %esi
+    pop %ebx
+    pop %ebp
+    ret
+
+# First return of a new thread: thread_create leaves the entry function
+# in EBX and its argument in ESI
+.global thread_trampoline
+.type thread_trampoline, @function
+thread_trampoline:
+    push %esi
+    push %ebx
+    call thread_entry
+    # thread_entry does not return
+1:  hlt
+    jmp 1b
@@ -0,0 +1,194 @@
+/*
+ * Timekeeping for nekkoOS
+ * Calibrates the CPU timestamp counter against PIT channel 2 and runs
+ * the periodic tick on channel 0. The tick interrupt only advances
+ * jiffies and the scheduler; expired kernel timers run in TIMER_SOFTIRQ.
+ */
+
+#include "types.h"
+#include "io.h"
+#include "timer.h"
+#include "irq.h"
+#include "irqflags.h"
+#include "sched.h"
+#include "softirq.h"
+#include "init.h"
+#include "kernel.h"
+#include "export.h"
+
+/* Calibration window: 10 ms worth of PIT ticks */
+#define CALIBRATE_MS        10
+#define CALIBRATE_LATCH     (PIT_FREQUENCY / (1000 / CALIBRATE_MS))
+
+static uint32_t tsc_khz = 0;
+static uint64_t tsc_boot = 0;
+
+volatile uint32_t jiffies = 0;
+EXPORT_SYMBOL(jiffies);
+
+/* Pending kernel timers, sorted by expiry */
+static LIST_HEAD(timer_list_head);
+
+/* Measure TSC ticks across a fixed PIT channel 2 countdown */
+static uint32_t __init calibrate_tsc(void) {
+    uint8_t gate = inb(PIT_GATE_PORT);
+
+    /* Enable channel 2 gate, keep the speaker disconnected */
+    outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01);
+
+    /* Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count) */
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2, CALIBRATE_LATCH & 0xFF);
+    outb(PIT_CHANNEL2, CALIBRATE_LATCH >> 8);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20))
+        ;
+    uint64_t end = rdtsc();
+
+    outb(PIT_GATE_PORT, gate);
+    return (uint32_t)div_u64(end - start, CALIBRATE_MS);
+}
+
+static bool timer_expired(void) {
+    if (list_empty(&timer_list_head))
+        return false;
+    struct timer_list* first = list_first_entry(&timer_list_head, struct timer_list, entry);
+    return time_after_eq(jiffies, first->expires);
+}
+
+/* Tick top half */
+static void timer_interrupt(int irq, void* data) {
+    (void)irq;
+    (void)data;
+
+    jiffies++;
+    sched_tick();
+    if (timer_expired())
+        raise_softirq_irqoff(TIMER_SOFTIRQ);
+}
+
+/* TIMER_SOFTIRQ: run expired timers with interrupts enabled */
+static void run_timers(void) {
+    uint32_t flags = local_irq_save();
+
+    while (timer_expired()) {
+        struct timer_list* timer = list_first_entry(&timer_list_head, struct timer_list, entry);
+        list_del(&timer->entry);
+        local_irq_restore(flags);
+        timer->fn(timer);
+        flags = local_irq_save();
+    }
+    local_irq_restore(flags);
+}
+
+void timer_setup(struct timer_list* timer, void (*fn)(struct timer_list* timer)) {
+    list_init(&timer->entry);
+    timer->expires = 0;
+    timer->fn = fn;
+}
+EXPORT_SYMBOL(timer_setup);
+
+/* (Re)arm a timer for an absolute jiffies value */
+void mod_timer(struct timer_list* timer, uint32_t expires) {
+    uint32_t flags = local_irq_save();
+    struct list_head* pos;
+
+    if (!list_empty(&timer->entry))
+        list_del(&timer->entry);
+    timer->expires = expires;
+
+    list_for_each(pos, &timer_list_head) {
+        if (!time_after_eq(expires, list_entry(pos, struct timer_list, entry)->expires))
+            break;
+    }
+    list_add_tail(&timer->entry, pos);
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL(mod_timer);
+
+/* Returns true if the timer was still pending */
+bool del_timer(struct timer_list* timer) {
+    uint32_t flags = local_irq_save();
+    bool pending = !list_empty(&timer->entry);
+
+    if (pending)
+        list_del(&timer->entry);
+    local_irq_restore(flags);
+    return pending;
+}
+EXPORT_SYMBOL(del_timer);
+
+/* Program channel 0 for the periodic tick */
+static void pit_start_tick(void) {
+    /* Channel 0, lobyte/hibyte, mode 2 (rate generator) */
+    uint16_t divisor = PIT_FREQUENCY / HZ;
+    outb(PIT_COMMAND, 0x34);
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, divisor >> 8);
+}
+
+/* Timer initialization */
+int __init init_timer(void) {
+    kprintf("Initializing timer...\n");
+
+    tsc_khz = calibrate_tsc();
+    if (tsc_khz == 0)
+        tsc_khz = 1;
+    tsc_boot = rdtsc();
+
+    kprintf("TSC frequency: ");
+    kprintf_dec(tsc_khz / 1000);
+    kprintf(" MHz\n");
+
+    pit_start_tick();
+
+    open_softirq(TIMER_SOFTIRQ, run_timers);
+    request_irq(IRQ_TIMER, timer_interrupt, NULL, "timer");
+    kprintf("Timer initialized.\n");
+    return 0;
+}
+arch_initcall(init_timer);
+
+/* TSC at snapshot time; the counter starts over from 0 on reboot */
+static uint64_t tsc_suspend;
+
+void timer_suspend(void) {
+    tsc_suspend = rdtsc();
+}
+
+/* Carry on from the snapshot: the time spent powered off does not count */
+void timer_resume(void) {
+    tsc_boot = rdtsc() - (tsc_suspend - tsc_boot);
+    pit_start_tick();
+}
+
+uint32_t timer_tsc_khz(void) {
+    return tsc_khz;
+}
+
+/* Microseconds since timer initialization */
+uint64_t timer_now_us(void) {
+    if (tsc_khz == 0)
+        return 0;
+    return div_u64((rdtsc() - tsc_boot) * 1000, tsc_khz);
+}
+
+uint32_t timer_elapsed_us(uint64_t start_us) {
+    return (uint32_t)(timer_now_us() - start_us);
+}
+
+/* Busy-wait for the given number of microseconds */
+void timer_udelay(uint32_t us) {
+    /* Before calibration, each POST port write takes roughly 1 us */
+    if (tsc_khz == 0) {
+        while (us--)
+            io_wait();
+        return;
+    }
+
+    uint64_t start = timer_now_us();
+    while (timer_now_us() - start < us)
+        __asm__ volatile ("pause");
+}
+EXPORT_SYMBOL(timer_udelay);
@@ -0,0 +1,209 @@
+/*
+ * User memory access for nekkoOS
+ * Copies to and from user space check only that the range lies below
+ * USER_SPACE_END and then run at full speed. A fault on an unmapped user
+ * page is caught through the exception table: the fixup code computes how
+ * much was left and the copy returns it, so no page-table walk is needed
+ * up front.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "uaccess.h"
+#include "extable.h"
+#include "timer.h"
+#include "bench.h"
+#include "errno.h"
+#include "kernel.h"
+
+/* Byte-granular store that may be unaligned */
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_u32;
+
+/*
+ * Copy n bytes with string moves: align the destination with movsb, move
+ * whole words with movsl, finish with movsb. Returns the bytes not copied.
+ * A fault in the word loop retries the rest with movsb, so the count is
+ * exact to the byte.
+ */
+static size_t __copy_user(void* to, const void* from, size_t n) {
+    uint32_t d0, d1, d2;
+
+    __asm__ volatile (
+        "   cmpl $7, %0\n"
+        "   jbe 3f\n"
+        "   movl %1, %0\n"
+        "   negl %0\n"
+        "   andl $3, %0\n"
+        "   subl %0, %3\n"
+        "1: rep movsb\n"
+        "   movl %3, %0\n"
+        "   shrl $2, %0\n"
+        "   andl $3, %3\n"
+        "2: rep movsl\n"
+        "   movl %3, %0\n"
+        "3: rep movsb\n"
+        "4:\n"
+        ".pushsection .fixup, \"ax\"\n"
+        "5: addl %3, %0\n"
+        "   jmp 4b\n"
+        "6: leal (%3, %0, 4), %0\n"
+        "   jmp 3b\n"
+        ".popsection\n"
+        _ASM_EXTABLE(1b, 5b)
+        _ASM_EXTABLE(2b, 6b)
+        _ASM_EXTABLE(3b, 4b)
+        : "=&c"(n), "=&D"(d0), "=&S"(d1), "=r"(d2)
+        : "3"(n), "0"(n), "1"(to), "2"(from)
+        : "memory");
+    return n;
+}
+
+/* Single loads from user space: 0, or -EFAULT with the value zeroed */
+static inline int get_user_u8(uint8_t* value, const char* addr) {
+    int err = 0;
+    uint8_t v;
+
+    __asm__ volatile (
+        "1: movb %2, %b1\n"
+        "2:\n"
+        ".pushsection .fixup, \"ax\"\n"
+        "3: movl %3, %0\n"
+        "   xorb %b1, %b1\n"
+        "   jmp 2b\n"
+        ".popsection\n"
+        _ASM_EXTABLE(1b, 3b)
+        : "=r"(err), "=q"(v)
+        : "m"(*addr), "i"(-EFAULT), "0"(err));
+    *value = v;
+    return err;
+}
+
+static inline int get_user_u32(uint32_t* value, const uint32_t* addr) {
+    int err = 0;
+    uint32_t v;
+
+    __asm__ volatile (
+        "1: movl %2, %1\n"
+        "2:\n"
+        ".pushsection .fixup, \"ax\"\n"
+        "3: movl %3, %0\n"
+        "   xorl %1, %1\n"
+        "   jmp 2b\n"
+        ".popsection\n"
+        _ASM_EXTABLE(1b, 3b)
+        : "=r"(err), "=r"(v)
+        : "m"(*addr), "i"(-EFAULT), "0"(err));
+    *value = v;
+    return err;
+}
+
+size_t copy_to_user(void* to, const void* from, size_t n) {
+    if (!access_ok(to, n))
+        return n;
+    return __copy_user(to, from, n);
+}
+
+size_t copy_from_user(void* to, const void* from, size_t n) {
+    size_t left = n;
+
+    if (access_ok(from, n))
+        left = __copy_user(to, from, n);
+    if (left)
+        memset((char*)to + n - left, 0, left);
+    return left;
+}
+
+/*
+ * Copy a NUL-terminated string a word at a time. Loads are aligned on the
+ * source, so a word never reaches into the page after the terminator.
+ */
+ssize_t strncpy_from_user(char* dst, const char* src, size_t count) {
+    uint32_t addr = (uint32_t)src;
+    size_t res = 0;
+    uint8_t c;
+
+    if (count == 0)
+        return 0;
+    if (addr >= USER_SPACE_END)
+        return -EFAULT;
+
+    /* Stop at the end of user space even if count reaches beyond it */
+    size_t max = MIN(count, USER_SPACE_END - addr);
+
+    while (res < max && !IS_ALIGNED(addr + res, 4)) {
+        if (get_user_u8(&c, src + res))
+            return -EFAULT;
+        dst[res] = c;
+        if (!c)
+            return res;
+        res++;
+    }
+
+    while (max - res >= 4) {
+        uint32_t word;
+
+        if (get_user_u32(&word, (const uint32_t*)(src + res)))
+            return -EFAULT;
+        if (has_zero_byte(word)) {
+            /* Little endian: the first byte in memory is the low byte */
+            for (;; word >>= 8) {
+                dst[res] = (char)word;
+                if (!(word & 0xFF))
+                    return res;
+                res++;
+            }
+        }
+        *(unaligned_u32*)(dst + res) = word;
+        res += 4;
+    }
+
+    while (res < max) {
+        if (get_user_u8(&c, src + res))
+            return -EFAULT;
+        dst[res] = c;
+        if (!c)
+            return res;
+        res++;
+    }
+
+    /* Unterminated within count, or running into kernel space */
+    return max == count ? (ssize_t)count : -EFAULT;
+}
+
+/* Cost of fetching a typical 64-byte syscall argument */
+#define UACCESS_BENCH_ROUNDS    1000
+#define UACCESS_BENCH_BYTES     64
+
+static char uaccess_bench_src[UACCESS_BENCH_BYTES] ALIGN(4);
+static char uaccess_bench_dst[UACCESS_BENCH_BYTES] ALIGN(4);
+
+static uint32_t uaccess_bench_ns(uint64_t cycles, uint32_t khz) {
+    return (uint32_t)div_u64(div_u64(cycles, UACCESS_BENCH_ROUNDS) * 1000000, khz);
+}
+
+static void uaccess_benchmark(void) {
+    uint32_t khz = timer_tsc_khz();
+    uint64_t start;
+
+    if (!khz)
+        return;
+
+    memset(uaccess_bench_src, 'a', UACCESS_BENCH_BYTES - 1);
+    uaccess_bench_src[UACCESS_BENCH_BYTES - 1] = '\0';
+
+    start = rdtsc();
+    for (int i = 0; i < UACCESS_BENCH_ROUNDS; i++)
+        memcpy(uaccess_bench_dst, uaccess_bench_src, UACCESS_BENCH_BYTES);
+    bench_report("uaccess", "memcpy_64", uaccess_bench_ns(rdtsc() - start, khz), "ns");
+
+    start = rdtsc();
+    for (int i = 0; i < UACCESS_BENCH_ROUNDS; i++)
+        copy_from_user(uaccess_bench_dst, uaccess_bench_src, UACCESS_BENCH_BYTES);
+    bench_report("uaccess", "copy_from_user_64", uaccess_bench_ns(rdtsc() - start, khz), "ns");
+
+    start = rdtsc();
+    for (int i = 0; i < UACCESS_BENCH_ROUNDS; i++)
+        strncpy_from_user(uaccess_bench_dst, uaccess_bench_src, UACCESS_BENCH_BYTES);
+    bench_report("uaccess", "strncpy_from_user_64", uaccess_bench_ns(rdtsc() - start, khz), "ns");
+}
+KERNEL_BENCH("uaccess", uaccess_benchmark);
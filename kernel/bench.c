@@ -0,0 +1,78 @@
+/*
+ * In-kernel benchmark runner for nekkoOS
+ * Runs the benchmarks selected with bench= after initialization and
+ * prints results in a fixed "bench:" line format for scripts to parse.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "param.h"
+#include "timer.h"
+#include "bench.h"
+#include "kernel.h"
+
+/* Benchmark table bounds (kernel.ld) */
+extern const struct kernel_bench __bench_start[];
+extern const struct kernel_bench __bench_end[];
+
+/* Comma separated benchmark names, or "all" */
+static char bench_selection[64] = "";
+param_string("bench", bench_selection);
+
+static bool bench_selected(const char* name) {
+    const char* p = bench_selection;
+    size_t length = strlen(name);
+
+    while (*p) {
+        const char* end = strchr(p, ',');
+        size_t token = end ? (size_t)(end - p) : strlen(p);
+
+        if ((token == 3 && strncmp(p, "all", 3) == 0) ||
+            (token == length && strncmp(p, name, length) == 0))
+            return true;
+
+        if (!end)
+            break;
+        p = end + 1;
+    }
+    return false;
+}
+
+/* Print one result as "bench: <name> <metric> <value> <unit>" */
+void bench_report(const char* name, const char* metric, uint32_t value, const char* unit) {
+    kprintf("bench: ");
+    kprintf(name);
+    kprintf(" ");
+    kprintf(metric);
+    kprintf(" ");
+    kprintf_dec(value);
+    kprintf(" ");
+    kprintf(unit);
+    kprintf("\n");
+}
+
+/* Operations per second for count operations taking the given TSC cycles */
+uint32_t bench_rate(uint32_t count, uint64_t cycles) {
+    uint32_t khz = timer_tsc_khz();
+    if (!khz)
+        return 0;
+
+    uint64_t us = div_u64(cycles * 1000, khz);
+    if (us == 0)
+        us = 1;
+    if (us > 0xFFFFFFFF)
+        return 0;
+    return (uint32_t)div_u64((uint64_t)count * 1000000, (uint32_t)us);
+}
+
+void run_benchmarks(void) {
+    if (bench_selection[0] == '\0')
+        return;
+
+    kprintf("\nRunning benchmarks...\n");
+    for (const struct kernel_bench* bench = __bench_start; bench < __bench_end; bench++) {
+        if (bench_selected(bench->name))
+            bench->run();
+    }
+    kprintf("Benchmarks complete.\n");
+}
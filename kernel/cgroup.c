@@ -0,0 +1,596 @@
+/*
+ * Control groups for nekkoOS
+ * Groups form a tree under the root group. Threads inherit the group of
+ * the thread that created them, and each controller limits a group
+ * together with everything below it:
+ *
+ * - CPU: a group competes with its sibling groups by its shares, as one
+ *   fair entity (sched_fair.c), and may have a quota of CPU time per
+ *   period; once the quota is used up its threads wait for the next period.
+ * - Memory: every page allocated by a thread is charged to its group and
+ *   to the group's ancestors, up to a limit in pages. A charge over a
+ *   limit first reclaims the group's own clean pages through the
+ *   registered shrinkers (the nkfs page cache), and fails if that does
+ *   not free enough. The owning group of each page is kept in a byte per
+ *   page frame.
+ * - I/O: requests queued on a busy block device are served in proportion
+ *   to their groups' weights (blkio.c).
+ *
+ * The root group has no limits and is never charged: pages allocated by
+ * interrupt handlers and before init_cgroups belong to it.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "errno.h"
+#include "list.h"
+#include "irqflags.h"
+#include "smp.h"
+#include "cgroup.h"
+#include "sched.h"
+#include "sched_class.h"
+#include "pmm.h"
+#include "block.h"
+#include "timer.h"
+#include "bench.h"
+#include "init.h"
+#include "kernel.h"
+
+struct cgroup root_cgroup = {
+    .name = "root",
+    .id = CGROUP_ROOT_ID,
+    .in_use = true,
+    .cpu_shares = CPU_SHARES_DEFAULT,
+    .cpu_period_us = CPU_PERIOD_DEFAULT_US,
+    .io_weight = IO_WEIGHT_DEFAULT,
+};
+
+/* Slot CGROUP_ROOT_ID stands for the root group */
+static struct cgroup cgroups[CGROUP_MAX];
+
+static LIST_HEAD(mem_shrinkers);
+
+/* Owning group id per page frame, CGROUP_ROOT_ID if uncharged */
+static uint8_t* page_owner;
+static uint32_t page_owner_pfns;
+
+/* Tries a charge over the limit makes before it fails */
+#define MEM_RECLAIM_RETRIES 3
+
+struct cgroup* cgroup_from_id(uint32_t id) {
+    return id == CGROUP_ROOT_ID || id >= CGROUP_MAX ? &root_cgroup : &cgroups[id];
+}
+
+struct cgroup* current_cgroup(void) {
+    struct thread* thread = current_thread();
+
+    if (in_interrupt() || !thread || !thread->cgroup)
+        return &root_cgroup;
+    return thread->cgroup;
+}
+
+static bool cgroup_is_descendant(struct cgroup* cg, struct cgroup* ancestor) {
+    for (; cg; cg = cg->parent) {
+        if (cg == ancestor)
+            return true;
+    }
+    return false;
+}
+
+/* NULL if the parent is gone or all groups are taken */
+struct cgroup* cgroup_create(struct cgroup* parent, const char* name) {
+    if (!parent)
+        parent = &root_cgroup;
+
+    uint32_t flags = local_irq_save();
+    struct cgroup* cg = NULL;
+
+    if (parent->in_use) {
+        for (uint32_t id = 1; id < CGROUP_MAX; id++) {
+            if (!cgroups[id].in_use) {
+                cg = &cgroups[id];
+                break;
+            }
+        }
+    }
+    if (cg) {
+        uint32_t id = (uint32_t)(cg - cgroups);
+
+        memset(cg, 0, sizeof(*cg));
+        cg->name = name;
+        cg->parent = parent;
+        cg->id = id;
+        cg->depth = parent->depth + 1;
+        cg->in_use = true;
+        cg->cpu_shares = CPU_SHARES_DEFAULT;
+        cg->cpu_period_us = CPU_PERIOD_DEFAULT_US;
+        cg->io_weight = IO_WEIGHT_DEFAULT;
+        parent->nr_children++;
+        fair_group_init(cg);
+    }
+    local_irq_restore(flags);
+    return cg;
+}
+
+/*
+ * -EBUSY while threads or child groups are attached. Pages still charged
+ * to the group pass to its parent, which already counts them.
+ */
+int cgroup_destroy(struct cgroup* cg) {
+    if (cg == &root_cgroup)
+        return -EINVAL;
+
+    uint32_t flags = local_irq_save();
+    int err = cg->nr_threads || cg->nr_children ? -EBUSY : 0;
+
+    if (!err) {
+        del_timer(&cg->cpu_period_timer);
+        if (cg->mem_usage && page_owner) {
+            for (uint32_t pfn = 0; pfn < page_owner_pfns; pfn++) {
+                if (page_owner[pfn] == cg->id)
+                    page_owner[pfn] = (uint8_t)cg->parent->id;
+            }
+        }
+        cg->parent->nr_children--;
+        cg->in_use = false;
+    }
+    local_irq_restore(flags);
+    return err;
+}
+
+/* Pages the thread already has stay charged where they are */
+int cgroup_attach(struct cgroup* cg, struct thread* thread) {
+    if (!cg->in_use)
+        return -EINVAL;
+
+    uint32_t flags = local_irq_save();
+    if (thread->cgroup != cg) {
+        thread->cgroup->nr_threads--;
+        cg->nr_threads++;
+        sched_move_group(thread, cg);
+    }
+    local_irq_restore(flags);
+    return 0;
+}
+
+/* Scheduler hooks for thread creation and exit (sched.c) */
+void cgroup_fork(struct thread* thread, struct cgroup* cg) {
+    thread->cgroup = cg;
+    cg->nr_threads++;
+}
+
+void cgroup_exit(struct thread* thread) {
+    thread->cgroup->nr_threads--;
+}
+
+int cgroup_set_cpu_shares(struct cgroup* cg, uint32_t shares) {
+    if (cg == &root_cgroup || shares < CPU_SHARES_MIN || shares > CPU_SHARES_MAX)
+        return -EINVAL;
+
+    uint32_t flags = local_irq_save();
+    cg->cpu_shares = shares;
+    fair_group_set_shares(cg);
+    local_irq_restore(flags);
+    return 0;
+}
+
+/* A quota of 0 lifts the limit; the quota may exceed the period on several CPUs */
+int cgroup_set_cpu_quota(struct cgroup* cg, uint32_t quota_us, uint32_t period_us) {
+    if (cg == &root_cgroup || period_us < CPU_PERIOD_MIN_US || period_us > CPU_PERIOD_MAX_US)
+        return -EINVAL;
+    if (quota_us && (quota_us < 1000 || quota_us > period_us * NR_CPUS))
+        return -EINVAL;
+
+    uint32_t flags = local_irq_save();
+    cg->cpu_quota_us = quota_us;
+    cg->cpu_period_us = period_us;
+    fair_group_set_bandwidth(cg);
+    local_irq_restore(flags);
+    return 0;
+}
+
+int cgroup_set_io_weight(struct cgroup* cg, uint32_t weight) {
+    if (cg == &root_cgroup || weight < IO_WEIGHT_MIN || weight > IO_WEIGHT_MAX)
+        return -EINVAL;
+    cg->io_weight = weight;
+    return 0;
+}
+
+void register_mem_shrinker(struct mem_shrinker* shrinker) {
+    uint32_t flags = local_irq_save();
+    list_add_tail(&shrinker->entry, &mem_shrinkers);
+    local_irq_restore(flags);
+}
+
+void unregister_mem_shrinker(struct mem_shrinker* shrinker) {
+    uint32_t flags = local_irq_save();
+    list_del(&shrinker->entry);
+    local_irq_restore(flags);
+}
+
+/*
+ * Free up to nr_pages pages charged to cg or below it. Shrinkers run
+ * with interrupts disabled, so none is unregistered under us; the caller
+ * must not be inside the allocators itself.
+ */
+static uint32_t mem_cgroup_reclaim(struct cgroup* cg, uint32_t nr_pages) {
+    uint32_t flags = local_irq_save();
+    uint32_t freed = 0;
+    struct list_head* pos;
+
+    list_for_each(pos, &mem_shrinkers) {
+        struct mem_shrinker* shrinker = list_entry(pos, struct mem_shrinker, entry);
+
+        if (freed >= nr_pages)
+            break;
+        freed += shrinker->reclaim(shrinker, cg, nr_pages - freed);
+    }
+    cg->mem_reclaimed += freed;
+    local_irq_restore(flags);
+    return freed;
+}
+
+/* The lowest group on the way to the root that count more pages would put over its limit */
+static struct cgroup* mem_cgroup_over_limit(struct cgroup* cg, uint32_t count) {
+    for (; cg != &root_cgroup; cg = cg->parent) {
+        if (cg->mem_limit && cg->mem_usage + count > cg->mem_limit)
+            return cg;
+    }
+    return NULL;
+}
+
+int cgroup_set_mem_limit(struct cgroup* cg, uint32_t pages) {
+    if (cg == &root_cgroup)
+        return -EINVAL;
+
+    uint32_t flags = local_irq_save();
+    bool fits = !pages || cg->mem_usage <= pages;
+    local_irq_restore(flags);
+
+    if (!fits) {
+        mem_cgroup_reclaim(cg, cg->mem_usage - pages);
+        if (cg->mem_usage > pages)
+            return -EBUSY;
+    }
+    cg->mem_limit = pages;
+    return 0;
+}
+
+/*
+ * Charge count pages to the current thread's group before they are
+ * allocated. Charges with interrupts disabled (e.g. slab refills) cannot
+ * reclaim and fail at the limit. *memcg is NULL if nothing was charged.
+ */
+int mem_cgroup_charge(uint32_t count, struct cgroup** memcg) {
+    struct cgroup* cg = current_cgroup();
+
+    *memcg = NULL;
+    if (!page_owner || cg == &root_cgroup)
+        return 0;
+
+    bool can_reclaim = !irqs_disabled();
+    for (int retry = 0;; retry++) {
+        uint32_t flags = local_irq_save();
+        struct cgroup* over = mem_cgroup_over_limit(cg, count);
+
+        if (!over) {
+            for (struct cgroup* c = cg; c != &root_cgroup; c = c->parent) {
+                c->mem_usage += count;
+                c->mem_max_usage = MAX(c->mem_max_usage, c->mem_usage);
+            }
+            local_irq_restore(flags);
+            *memcg = cg;
+            return 0;
+        }
+
+        uint32_t excess = over->mem_usage + count - over->mem_limit;
+        local_irq_restore(flags);
+
+        if (!can_reclaim || retry == MEM_RECLAIM_RETRIES || !mem_cgroup_reclaim(over, excess)) {
+            over->mem_failcnt++;
+            return -ENOMEM;
+        }
+    }
+}
+
+/* Record the owner of pages allocated against a charge */
+void mem_cgroup_commit(struct cgroup* memcg, void* addr, uint32_t count) {
+    uint32_t pfn = (uint32_t)addr >> PAGE_SHIFT;
+
+    if (!memcg)
+        return;
+    for (uint32_t i = 0; i < count && pfn + i < page_owner_pfns; i++)
+        page_owner[pfn + i] = (uint8_t)memcg->id;
+}
+
+static void mem_cgroup_unaccount(struct cgroup* cg, uint32_t count) {
+    for (; cg != &root_cgroup; cg = cg->parent)
+        cg->mem_usage -= count;
+}
+
+/* Give back a charge whose allocation failed */
+void mem_cgroup_cancel(struct cgroup* memcg, uint32_t count) {
+    if (!memcg)
+        return;
+
+    uint32_t flags = local_irq_save();
+    mem_cgroup_unaccount(memcg, count);
+    local_irq_restore(flags);
+}
+
+/* Uncharge freed pages from whichever groups own them */
+void mem_cgroup_uncharge(void* addr, uint32_t count) {
+    uint32_t pfn = (uint32_t)addr >> PAGE_SHIFT;
+
+    if (!page_owner)
+        return;
+
+    uint32_t flags = local_irq_save();
+    for (uint32_t i = 0; i < count && pfn + i < page_owner_pfns; i++) {
+        if (page_owner[pfn + i] != CGROUP_ROOT_ID) {
+            mem_cgroup_unaccount(cgroup_from_id(page_owner[pfn + i]), 1);
+            page_owner[pfn + i] = CGROUP_ROOT_ID;
+        }
+    }
+    local_irq_restore(flags);
+}
+
+/* True if the page is charged to cg or a group below it */
+bool mem_cgroup_page_in(struct cgroup* cg, const void* addr) {
+    uint32_t pfn = (uint32_t)addr >> PAGE_SHIFT;
+
+    if (cg == &root_cgroup)
+        return true;
+    if (!page_owner || pfn >= page_owner_pfns || page_owner[pfn] == CGROUP_ROOT_ID)
+        return false;
+    return cgroup_is_descendant(cgroup_from_id(page_owner[pfn]), cg);
+}
+
+/* Pages allocated until now stay with the root group */
+int __init init_cgroups(void) {
+    uint32_t pfns = pmm_max_pfn();
+    uint32_t pages = ALIGN_UP(pfns, PAGE_SIZE) / PAGE_SIZE;
+    uint8_t* owner = page_alloc(pages);
+
+    if (!owner) {
+        kprintf("cgroup: no memory for page owners, memory limits disabled\n");
+        return -ENOMEM;
+    }
+    memset(owner, CGROUP_ROOT_ID, pages * PAGE_SIZE);
+    page_owner_pfns = pfns;
+    page_owner = owner;
+    return 0;
+}
+initcall_depends(init_cgroups, 0, "init_memory");
+
+/*
+ * Throughput of groups under contention. CPU: three groups of fair hogs,
+ * gold with twice the shares of silver and capped with a 20% quota,
+ * reported as each group's part of the CPU time they got together.
+ * Memory: the pages a group limited to CGROUP_BENCH_MEM_LIMIT pages gets
+ * before it is refused, next to an unlimited sibling. I/O: readers in two
+ * groups weighted 4:1 on a device that takes 2ms per request, reported as
+ * each group's part of the requests served.
+ */
+#define CGROUP_BENCH_HOGS       3
+#define CGROUP_BENCH_CPU_MS     1000
+#define CGROUP_BENCH_MEM_LIMIT  64
+#define CGROUP_BENCH_READERS    2
+#define CGROUP_BENCH_IO_MS      600
+#define CGROUP_BENCH_IO_US      2000
+#define CGROUP_BENCH_IO_SECTORS 8
+
+struct cgroup_bench_group {
+    const char* name;
+    uint32_t shares;
+    uint32_t quota_us;
+    uint32_t io_weight;
+    const char* metric;
+    struct cgroup* cg;
+    uint64_t runtime;
+};
+
+static struct cgroup_bench_group cgroup_bench_cpu[] = {
+    { "gold", 2048, 0, 0, "gold_cpu", NULL, 0 },
+    { "silver", 1024, 0, 0, "silver_cpu", NULL, 0 },
+    { "capped", 1024, 20000, 0, "capped_cpu", NULL, 0 },
+};
+
+static struct cgroup_bench_group cgroup_bench_io[] = {
+    { "io_high", 0, 0, 400, "io_high_share", NULL, 0 },
+    { "io_low", 0, 0, 100, "io_low_share", NULL, 0 },
+};
+
+static volatile bool cgroup_bench_stop;
+static volatile uint32_t cgroup_bench_running;
+
+static void cgroup_bench_hog(void* arg) {
+    struct cgroup_bench_group* group = arg;
+
+    while (!cgroup_bench_stop)
+        ;
+
+    uint32_t flags = local_irq_save();
+    group->runtime += current_thread()->se.sum_exec_runtime;
+    cgroup_bench_running--;
+    local_irq_restore(flags);
+}
+
+static int cgroup_bench_dev_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buffer) {
+    (void)dev;
+    (void)lba;
+    timer_udelay(CGROUP_BENCH_IO_US);
+    memset(buffer, 0, count * 512);
+    return 0;
+}
+
+static const struct block_ops cgroup_bench_dev_ops = {
+    .read = cgroup_bench_dev_read,
+};
+
+static struct block_device cgroup_bench_dev = {
+    .name = "cgbench",
+    .sector_size = 512,
+    .sector_count = 1024,
+    .ops = &cgroup_bench_dev_ops,
+};
+
+static void cgroup_bench_reader(void* arg) {
+    uint8_t* buffer = arg;
+    uint32_t lba = 0;
+
+    while (!cgroup_bench_stop) {
+        blk_read(&cgroup_bench_dev, lba, CGROUP_BENCH_IO_SECTORS, buffer);
+        lba = (lba + CGROUP_BENCH_IO_SECTORS) % cgroup_bench_dev.sector_count;
+    }
+
+    uint32_t flags = local_irq_save();
+    cgroup_bench_running--;
+    local_irq_restore(flags);
+}
+
+/* Start fn in group, once per count; false if a thread could not be made */
+static bool cgroup_bench_spawn(struct cgroup_bench_group* group, uint32_t count,
+                               thread_fn_t fn, void* arg, uint32_t policy) {
+    struct spawn_attr attr = {
+        .flags = SPAWN_SETPOLICY | SPAWN_SETCGROUP,
+        .policy = policy,
+        .priority = THREAD_PRIO_NORMAL,
+        .cgroup = group->cg,
+    };
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!thread_spawn(group->name, fn, arg ? arg : group, &attr))
+            return false;
+        cgroup_bench_running++;
+    }
+    return true;
+}
+
+static void cgroup_bench_wait(uint32_t ms) {
+    thread_sleep(ms);
+    cgroup_bench_stop = true;
+    while (cgroup_bench_running)
+        thread_sleep(10);
+    cgroup_bench_stop = false;
+}
+
+/* Threads that stopped may not have exited yet */
+static void cgroup_bench_destroy(struct cgroup_bench_group* groups, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        while (groups[i].cg && cgroup_destroy(groups[i].cg) == -EBUSY)
+            thread_sleep(10);
+        groups[i].cg = NULL;
+    }
+}
+
+static void cgroup_bench_cpu_run(void) {
+    uint64_t total = 0;
+    bool ok = true;
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(cgroup_bench_cpu) && ok; i++) {
+        struct cgroup_bench_group* group = &cgroup_bench_cpu[i];
+
+        group->runtime = 0;
+        group->cg = cgroup_create(NULL, group->name);
+        ok = group->cg && !cgroup_set_cpu_shares(group->cg, group->shares);
+        if (ok && group->quota_us)
+            ok = !cgroup_set_cpu_quota(group->cg, group->quota_us, CPU_PERIOD_DEFAULT_US);
+        if (ok)
+            ok = cgroup_bench_spawn(group, CGROUP_BENCH_HOGS, cgroup_bench_hog, NULL, SCHED_FAIR);
+    }
+    cgroup_bench_wait(CGROUP_BENCH_CPU_MS);
+
+    if (!ok) {
+        kprintf("cgroup: CPU benchmark groups unavailable\n");
+    } else {
+        for (uint32_t i = 0; i < ARRAY_SIZE(cgroup_bench_cpu); i++)
+            total += cgroup_bench_cpu[i].runtime;
+        for (uint32_t i = 0; i < ARRAY_SIZE(cgroup_bench_cpu) && total; i++) {
+            bench_report("cgroup", cgroup_bench_cpu[i].metric,
+                         (uint32_t)div_u64(cgroup_bench_cpu[i].runtime * 100, total), "%");
+        }
+        bench_report("cgroup", "capped_throttled", cgroup_bench_cpu[2].cg->cpu_nr_throttled, "periods");
+    }
+    cgroup_bench_destroy(cgroup_bench_cpu, ARRAY_SIZE(cgroup_bench_cpu));
+}
+
+/* Pages the benchmark thread gets in cg, allocating up to max one at a time */
+static uint32_t cgroup_bench_alloc(struct cgroup* cg, uint32_t max) {
+    struct thread* self = current_thread();
+    struct cgroup* saved = self->cgroup;
+    void* pages[CGROUP_BENCH_MEM_LIMIT * 2];
+    uint32_t count = 0;
+
+    cgroup_attach(cg, self);
+    while (count < max && (pages[count] = page_alloc(1)))
+        count++;
+    for (uint32_t i = 0; i < count; i++)
+        page_free(pages[i], 1);
+    cgroup_attach(saved, self);
+    return count;
+}
+
+static void cgroup_bench_mem_run(void) {
+    struct cgroup* limited = cgroup_create(NULL, "limited");
+    struct cgroup* unlimited = cgroup_create(NULL, "unlimited");
+
+    if (limited && unlimited && !cgroup_set_mem_limit(limited, CGROUP_BENCH_MEM_LIMIT)) {
+        uint32_t max = CGROUP_BENCH_MEM_LIMIT * 2;
+
+        bench_report("cgroup", "mem_limited_pages", cgroup_bench_alloc(limited, max), "pages");
+        bench_report("cgroup", "mem_limited_failcnt", limited->mem_failcnt, "");
+        bench_report("cgroup", "mem_unlimited_pages", cgroup_bench_alloc(unlimited, max), "pages");
+    } else {
+        kprintf("cgroup: memory benchmark groups unavailable\n");
+    }
+    if (limited)
+        cgroup_destroy(limited);
+    if (unlimited)
+        cgroup_destroy(unlimited);
+}
+
+static void cgroup_bench_io_run(void) {
+    uint8_t* buffers = page_alloc(ARRAY_SIZE(cgroup_bench_io) * CGROUP_BENCH_READERS);
+    uint32_t total = 0;
+    bool ok = buffers != NULL;
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(cgroup_bench_io) && ok; i++) {
+        struct cgroup_bench_group* group = &cgroup_bench_io[i];
+
+        group->cg = cgroup_create(NULL, group->name);
+        ok = group->cg && !cgroup_set_io_weight(group->cg, group->io_weight);
+        for (uint32_t j = 0; j < CGROUP_BENCH_READERS && ok; j++) {
+            uint8_t* buffer = buffers + (i * CGROUP_BENCH_READERS + j) * PAGE_SIZE;
+            ok = cgroup_bench_spawn(group, 1, cgroup_bench_reader, buffer, SCHED_FAIR);
+        }
+    }
+    cgroup_bench_wait(CGROUP_BENCH_IO_MS);
+
+    if (!ok) {
+        kprintf("cgroup: I/O benchmark groups unavailable\n");
+    } else {
+        for (uint32_t i = 0; i < ARRAY_SIZE(cgroup_bench_io); i++)
+            total += cgroup_bench_io[i].cg->io_requests;
+        for (uint32_t i = 0; i < ARRAY_SIZE(cgroup_bench_io) && total; i++) {
+            bench_report("cgroup", cgroup_bench_io[i].metric,
+                         cgroup_bench_io[i].cg->io_requests * 100 / total, "%");
+        }
+    }
+    cgroup_bench_destroy(cgroup_bench_io, ARRAY_SIZE(cgroup_bench_io));
+    if (buffers)
+        page_free(buffers, ARRAY_SIZE(cgroup_bench_io) * CGROUP_BENCH_READERS);
+}
+
+static void cgroup_benchmark(void) {
+    struct thread* self = current_thread();
+    uint32_t policy = self->policy, priority = self->priority;
+
+    /* Above every thread being measured, so they all start together */
+    sched_setscheduler(self, SCHED_PRIO, THREAD_PRIO_HIGH);
+    cgroup_bench_cpu_run();
+    cgroup_bench_mem_run();
+    cgroup_bench_io_run();
+    sched_setscheduler(self, policy, priority);
+}
+KERNEL_BENCH("cgroup", cgroup_benchmark);
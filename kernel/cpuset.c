@@ -0,0 +1,199 @@
+/*
+ * CPU sets for nekkoOS
+ * A cpuset confines its threads to a set of CPUs and allocates their
+ * memory from a set of NUMA nodes. Threads inherit the cpuset of the
+ * thread that created them and start in the top cpuset, which holds the
+ * housekeeping CPUs and all nodes. A thread runs on the CPUs in both its
+ * cpuset and its own affinity mask (sched_setaffinity), or on its
+ * cpuset's CPUs if the two do not meet.
+ *
+ * isolcpus= takes CPUs out of the top cpuset, out of unbound work items
+ * and away from new unbound threads: only threads placed there on
+ * purpose, by affinity or by a cpuset that names them, run on an
+ * isolated CPU, next to that CPU's own bound kernel threads. The boot
+ * CPU takes the timer and all device interrupts (8259A) and cannot be
+ * isolated. Only the boot CPU is brought up for now, so with no CPU left
+ * to isolate everything shares it.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "errno.h"
+#include "irqflags.h"
+#include "cpumask.h"
+#include "cpuset.h"
+#include "numa.h"
+#include "sched.h"
+#include "param.h"
+#include "init.h"
+#include "kernel.h"
+
+cpumask_t cpu_online_mask = BIT(0);
+cpumask_t cpu_isolated_mask = CPU_MASK_NONE;
+
+struct cpuset top_cpuset = {
+    .name = "top",
+    .cpus = BIT(0),
+    .mems = BIT(MAX_NUMNODES) - 1,
+    .in_use = true,
+};
+
+static struct cpuset cpusets[CPUSET_MAX];
+
+static char isolcpus[32];
+param_string("isolcpus", isolcpus);
+
+static int parse_number(const char** list, uint32_t* value) {
+    const char* p = *list;
+    uint32_t n = 0;
+
+    if (!isdigit(*p))
+        return -EINVAL;
+    while (isdigit(*p) && n < 1000)
+        n = n * 10 + (uint32_t)(*p++ - '0');
+    *list = p;
+    *value = n;
+    return 0;
+}
+
+int cpulist_parse(const char* list, uint32_t* mask, uint32_t limit) {
+    uint32_t result = 0;
+
+    while (*list) {
+        uint32_t first, last;
+
+        if (parse_number(&list, &first))
+            return -EINVAL;
+        last = first;
+        if (*list == '-') {
+            list++;
+            if (parse_number(&list, &last) || last < first)
+                return -EINVAL;
+        }
+        if (last >= limit)
+            return -EINVAL;
+        for (uint32_t i = first; i <= last; i++)
+            result |= BIT(i);
+
+        if (*list == ',')
+            list++;
+        else if (*list)
+            return -EINVAL;
+    }
+    *mask = result;
+    return 0;
+}
+
+static nodemask_t node_present_mask(void) {
+    return (nodemask_t)(BIT(nr_node_ids) - 1);
+}
+
+/*
+ * A new cpuset may name isolated CPUs; that is how threads get onto
+ * them. NULL if no CPU or node is usable or all cpusets are taken.
+ */
+struct cpuset* cpuset_create(const char* name, cpumask_t cpus, nodemask_t mems) {
+    if (!(cpus & cpu_online_mask) || !(mems & node_present_mask()))
+        return NULL;
+
+    uint32_t flags = local_irq_save();
+    struct cpuset* cs = NULL;
+    for (int i = 0; i < CPUSET_MAX; i++) {
+        if (!cpusets[i].in_use) {
+            cs = &cpusets[i];
+            cs->name = name;
+            cs->cpus = cpus & cpu_online_mask;
+            cs->mems = mems & node_present_mask();
+            cs->nr_threads = 0;
+            cs->in_use = true;
+            break;
+        }
+    }
+    local_irq_restore(flags);
+    return cs;
+}
+
+/* -EBUSY while threads are attached */
+int cpuset_destroy(struct cpuset* cs) {
+    if (cs == &top_cpuset)
+        return -EINVAL;
+
+    uint32_t flags = local_irq_save();
+    int err = cs->nr_threads ? -EBUSY : 0;
+    if (!err)
+        cs->in_use = false;
+    local_irq_restore(flags);
+    return err;
+}
+
+/* A home node outside the set's nodes moves to the nearest one inside */
+static void cpuset_move_node(struct thread* thread, struct cpuset* cs) {
+    if (!CHECK_BIT(cs->mems, thread->numa_node)) {
+        uint32_t best = 0, best_distance = 0xFFFFFFFF;
+        for (uint32_t nid = 0; nid < nr_node_ids; nid++) {
+            uint32_t distance = node_distance(thread->numa_node, nid);
+            if (CHECK_BIT(cs->mems, nid) && distance < best_distance) {
+                best = nid;
+                best_distance = distance;
+            }
+        }
+        thread->numa_node = best;
+    }
+}
+
+/*
+ * Move a thread into a cpuset: it leaves CPUs outside the set at its
+ * next reschedule, and a home node outside the set's nodes moves to the
+ * nearest one inside. Threads bound to a CPU stay out of cpusets.
+ */
+int cpuset_attach(struct cpuset* cs, struct thread* thread) {
+    if (!cs->in_use || (thread->flags & THREAD_BOUND))
+        return -EINVAL;
+
+    uint32_t flags = local_irq_save();
+    thread->cpuset->nr_threads--;
+    thread->cpuset = cs;
+    cs->nr_threads++;
+
+    cpuset_move_node(thread, cs);
+    sched_cpus_changed(thread);
+    local_irq_restore(flags);
+    return 0;
+}
+
+/* Scheduler hooks for thread creation and exit (sched.c) */
+void cpuset_fork(struct thread* thread, struct cpuset* cs) {
+    thread->cpuset = cs;
+    cs->nr_threads++;
+    cpuset_move_node(thread, cs);
+}
+
+void cpuset_exit(struct thread* thread) {
+    thread->cpuset->nr_threads--;
+}
+
+/* Runs before the scheduler, so every thread finds its CPUs in place */
+int __init init_cpusets(void) {
+    uint32_t isolated = CPU_MASK_NONE;
+
+    if (isolcpus[0] && cpulist_parse(isolcpus, &isolated, 32)) {
+        kprintf("cpuset: bad isolcpus list, ignored\n");
+        isolated = CPU_MASK_NONE;
+    }
+    if (isolated & ~cpu_online_mask)
+        kprintf("cpuset: isolcpus names CPUs that are not up\n");
+    if (CHECK_BIT(isolated, 0)) {
+        kprintf("cpuset: the boot CPU cannot be isolated\n");
+        CLEAR_BIT(isolated, 0);
+    }
+
+    cpu_isolated_mask = isolated & cpu_online_mask;
+    top_cpuset.cpus = housekeeping_cpumask();
+    if (cpu_isolated_mask) {
+        kprintf("cpuset: ");
+        kprintf_dec(cpumask_weight(cpu_isolated_mask));
+        kprintf(" CPUs isolated\n");
+    }
+    return 0;
+}
+core_initcall(init_cpusets);
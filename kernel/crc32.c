@@ -0,0 +1,34 @@
+/*
+ * CRC-32 for nekkoOS
+ * Table driven, one byte per step. The table is built on first use.
+ */
+
+#include "types.h"
+#include "crc32.h"
+
+#define CRC32_POLY          0xEDB88320
+
+static uint32_t crc32_table[256];
+static bool crc32_ready;
+
+static void crc32_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLY : 0);
+        crc32_table[i] = crc;
+    }
+    crc32_ready = true;
+}
+
+uint32_t crc32(uint32_t crc, const void* data, size_t length) {
+    const uint8_t* bytes = data;
+
+    if (!crc32_ready)
+        crc32_init();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+        crc = crc32_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
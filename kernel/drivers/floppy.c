@@ -0,0 +1,516 @@
+/*
+ * Floppy disk driver for nekkoOS
+ * Intel 82077AA compatible controller, 1.44MB 3.5" drive 0
+ *
+ * Data moves through ISA DMA channel 2 a whole cylinder (both heads,
+ * 36 sectors) at a time. The last cylinder stays in the DMA buffer as a
+ * track cache and every cylinder read is handed to the buffer cache.
+ * Motor spin-up overlaps with seeking, the head is moved to the next
+ * cylinder while the caller consumes the current one, and the motor is
+ * switched off lazily once the drive has been idle for a while.
+ */
+
+#include "types.h"
+#include "io.h"
+#include "dma.h"
+#include "timer.h"
+#include "block.h"
+#include "floppy.h"
+#include "string.h"
+#include "errno.h"
+#include "param.h"
+#include "bench.h"
+#include "init.h"
+#include "kernel.h"
+
+#define FLOPPY_DRIVE        0
+#define CMOS_ADDRESS        0x70
+#define CMOS_DATA           0x71
+#define CMOS_FLOPPY_TYPE    0x10
+#define CMOS_FLOPPY_144     4
+
+/* Tunables */
+static uint32_t floppy_spinup_us = FLOPPY_SPINUP_US;
+static uint32_t floppy_idle_us = FLOPPY_MOTOR_IDLE_US;
+param_uint("floppy.spinup_us", floppy_spinup_us);
+param_uint("floppy.idle_us", floppy_idle_us);
+
+/* One cylinder of DMA buffer; 32KB alignment keeps it inside one 64KB page */
+static uint8_t floppy_dma_buffer[FLOPPY_TRACK_SIZE] ALIGN(32768);
+
+/* Driver state */
+static struct {
+    bool present;
+    bool motor_on;
+    uint64_t motor_ready_us;    /* Spin-up complete at this time */
+    uint64_t last_use_us;
+    int current_cylinder;       /* Head position, -1 if unknown */
+    int seek_target;            /* Seek in flight, -1 if none */
+    int cached_cylinder;        /* Cylinder held in the DMA buffer, -1 if none */
+} fdc;
+
+static int floppy_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buffer);
+static int floppy_write(struct block_device* dev, uint32_t lba, uint32_t count, const void* buffer);
+
+static const struct block_ops floppy_ops = {
+    .read = floppy_read,
+    .write = floppy_write,
+};
+
+static struct block_device floppy_dev = {
+    .name = "fd0",
+    .sector_size = FLOPPY_SECTOR_SIZE,
+    .sector_count = FLOPPY_SECTORS,
+    .fill_sectors = FLOPPY_TRACK_SECTORS,
+    .ops = &floppy_ops,
+    .driver_data = NULL,
+};
+
+/* Wait until the controller is ready for a data byte; returns MSR or -ETIMEDOUT */
+static int fdc_wait_rqm(void) {
+    uint64_t start = timer_now_us();
+    do {
+        uint8_t msr = inb(FDC_MSR);
+        if (msr & MSR_RQM)
+            return msr;
+    } while (timer_elapsed_us(start) < FLOPPY_TIMEOUT_US);
+    return -ETIMEDOUT;
+}
+
+static int fdc_write_byte(uint8_t value) {
+    int msr = fdc_wait_rqm();
+    if (msr < 0)
+        return msr;
+    if (msr & MSR_DIO)
+        return -EIO;
+    outb(FDC_FIFO, value);
+    return 0;
+}
+
+static int fdc_read_byte(void) {
+    int msr = fdc_wait_rqm();
+    if (msr < 0)
+        return msr;
+    if (!(msr & MSR_DIO))
+        return -EIO;
+    return inb(FDC_FIFO);
+}
+
+static int fdc_command(const uint8_t* bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        int ret = fdc_write_byte(bytes[i]);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+static int fdc_sense_interrupt(uint8_t* st0, uint8_t* cylinder) {
+    int ret = fdc_write_byte(FDC_CMD_SENSE_INT);
+    if (ret < 0)
+        return ret;
+
+    int value = fdc_read_byte();
+    if (value < 0)
+        return value;
+    *st0 = (uint8_t)value;
+
+    value = fdc_read_byte();
+    if (value < 0)
+        return value;
+    *cylinder = (uint8_t)value;
+    return 0;
+}
+
+/* Wait for the execution phase to end and collect the 7 result bytes */
+static int fdc_result(uint8_t* result) {
+    uint64_t start = timer_now_us();
+    while ((inb(FDC_MSR) & (MSR_RQM | MSR_DIO)) != (MSR_RQM | MSR_DIO)) {
+        if (timer_elapsed_us(start) >= FLOPPY_TIMEOUT_US)
+            return -ETIMEDOUT;
+    }
+
+    for (int i = 0; i < 7; i++) {
+        int value = fdc_read_byte();
+        if (value < 0)
+            return value;
+        result[i] = (uint8_t)value;
+    }
+    return 0;
+}
+
+static inline uint8_t fdc_dor(void) {
+    uint8_t dor = DOR_RESET | DOR_DMA_IRQ | FLOPPY_DRIVE;
+    if (fdc.motor_on)
+        dor |= DOR_MOTOR(FLOPPY_DRIVE);
+    return dor;
+}
+
+/* Start the motor without waiting for it to reach speed */
+static void floppy_motor_start(void) {
+    uint64_t now = timer_now_us();
+
+    if (!fdc.motor_on) {
+        fdc.motor_on = true;
+        fdc.motor_ready_us = now + floppy_spinup_us;
+        outb(FDC_DOR, fdc_dor());
+    }
+    fdc.last_use_us = now;
+}
+
+static void floppy_motor_wait(void) {
+    while (timer_now_us() < fdc.motor_ready_us)
+        __asm__ volatile ("pause");
+}
+
+/* Begin moving the head; completion is collected by floppy_seek_finish() */
+static int floppy_seek_start(int cylinder) {
+    if (fdc.seek_target < 0 && fdc.current_cylinder == cylinder)
+        return 0;
+
+    uint8_t cmd[3] = { FDC_CMD_SEEK, FLOPPY_DRIVE, (uint8_t)cylinder };
+    int ret = fdc_command(cmd, sizeof(cmd));
+    if (ret < 0)
+        return ret;
+
+    fdc.seek_target = cylinder;
+    return 0;
+}
+
+static int floppy_seek_finish(void) {
+    if (fdc.seek_target < 0)
+        return 0;
+
+    int target = fdc.seek_target;
+    fdc.seek_target = -1;
+    fdc.current_cylinder = -1;
+
+    uint64_t start = timer_now_us();
+    while (inb(FDC_MSR) & (MSR_ACTA << FLOPPY_DRIVE)) {
+        if (timer_elapsed_us(start) >= FLOPPY_TIMEOUT_US)
+            return -ETIMEDOUT;
+    }
+
+    uint8_t st0, cylinder;
+    int ret = fdc_sense_interrupt(&st0, &cylinder);
+    if (ret < 0)
+        return ret;
+    if ((st0 & 0xE0) != 0x20 || cylinder != target)
+        return -EIO;
+
+    fdc.current_cylinder = cylinder;
+    return 0;
+}
+
+static int floppy_recalibrate(void) {
+    /* An 80 track drive may need two passes (old FDCs step at most 77 times) */
+    for (int pass = 0; pass < 2; pass++) {
+        uint8_t cmd[2] = { FDC_CMD_RECALIBRATE, FLOPPY_DRIVE };
+        int ret = fdc_command(cmd, sizeof(cmd));
+        if (ret < 0)
+            return ret;
+
+        fdc.seek_target = 0;
+        if (floppy_seek_finish() == 0)
+            return 0;
+    }
+    return -EIO;
+}
+
+static int floppy_seek(int cylinder) {
+    int ret = floppy_seek_finish();
+    if (ret < 0 || fdc.current_cylinder < 0) {
+        ret = floppy_recalibrate();
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = floppy_seek_start(cylinder);
+    if (ret < 0)
+        return ret;
+    return floppy_seek_finish();
+}
+
+/* Reset the controller and program the drive parameters */
+static int fdc_reset(void) {
+    fdc.seek_target = -1;
+    fdc.current_cylinder = -1;
+    fdc.cached_cylinder = -1;
+
+    outb(FDC_DOR, 0x00);
+    timer_udelay(10);
+    outb(FDC_DOR, fdc_dor());
+
+    /* Drive polling mode reports a reset interrupt for every drive */
+    for (int i = 0; i < 4; i++) {
+        uint8_t st0, cylinder;
+        int ret = fdc_sense_interrupt(&st0, &cylinder);
+        if (ret < 0)
+            return ret;
+    }
+
+    /* 500 kbps for 1.44MB media */
+    outb(FDC_CCR, 0x00);
+
+    /* SRT = 8ms, HUT = max, HLT = 10ms, DMA mode */
+    uint8_t specify[3] = { FDC_CMD_SPECIFY, 0x80, 0x0A };
+    return fdc_command(specify, sizeof(specify));
+}
+
+/* Enable the FIFO and turn off drive polling on controllers that support it */
+static void fdc_configure(void) {
+    if (fdc_write_byte(FDC_CMD_VERSION) < 0 || fdc_read_byte() != FDC_VERSION_82077AA)
+        return;
+
+    /* No implied seek (the driver tracks the head), FIFO on, polling off, threshold 8 */
+    uint8_t configure[4] = { FDC_CMD_CONFIGURE, 0x00, 0x17, 0x00 };
+    if (fdc_command(configure, sizeof(configure)) < 0)
+        return;
+
+    /* Keep the configuration across resets */
+    if (fdc_write_byte(FDC_CMD_LOCK) == 0)
+        fdc_read_byte();
+}
+
+/* Transfer sectors [sector, sector + count) of one cylinder through the DMA buffer */
+static int floppy_transfer(int cylinder, uint32_t sector, uint32_t count, bool write) {
+    uint8_t head = sector / FLOPPY_SPT;
+    uint8_t result[7];
+    int ret = -EIO;
+
+    for (int attempt = 0; attempt < FLOPPY_RETRIES; attempt++) {
+        floppy_motor_start();
+
+        /* The seek runs while the motor is still spinning up */
+        ret = floppy_seek(cylinder);
+        if (ret < 0)
+            continue;
+        floppy_motor_wait();
+
+        ret = dma_setup(DMA_CHANNEL_FLOPPY, (uintptr_t)floppy_dma_buffer,
+                        count * FLOPPY_SECTOR_SIZE,
+                        write ? DMA_MODE_WRITE : DMA_MODE_READ);
+        if (ret < 0)
+            return ret;
+
+        uint8_t cmd[9] = {
+            FDC_MT | FDC_MFM | (write ? FDC_CMD_WRITE : FDC_CMD_READ),
+            (uint8_t)((head << 2) | FLOPPY_DRIVE),
+            (uint8_t)cylinder,
+            head,
+            (uint8_t)(sector % FLOPPY_SPT + 1),
+            2,                      /* 512 bytes per sector */
+            FLOPPY_SPT,             /* Last sector on a track */
+            0x1B,                   /* Gap length */
+            0xFF,
+        };
+
+        ret = fdc_command(cmd, sizeof(cmd));
+        if (ret == 0)
+            ret = fdc_result(result);
+        if (ret == 0 && (result[0] & 0xC0) == 0)
+            break;
+
+        ret = -EIO;
+        dma_mask(DMA_CHANNEL_FLOPPY);
+        if (fdc_reset() < 0)
+            break;
+    }
+
+    fdc.last_use_us = timer_now_us();
+    return ret;
+}
+
+/* Fill the track cache with a whole cylinder */
+static int floppy_read_cylinder(int cylinder) {
+    if (fdc.cached_cylinder == cylinder)
+        return 0;
+
+    fdc.cached_cylinder = -1;
+    int ret = floppy_transfer(cylinder, 0, FLOPPY_TRACK_SECTORS, false);
+    if (ret < 0)
+        return ret;
+    fdc.cached_cylinder = cylinder;
+
+    /* Sequential readers want the next cylinder; get the head moving now */
+    if (cylinder + 1 < FLOPPY_CYLINDERS)
+        floppy_seek_start(cylinder + 1);
+    return 0;
+}
+
+static int floppy_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buffer) {
+    uint8_t* dest = (uint8_t*)buffer;
+
+    if (dev != &floppy_dev || !fdc.present || lba + count > FLOPPY_SECTORS)
+        return -EINVAL;
+
+    while (count > 0) {
+        int cylinder = lba / FLOPPY_TRACK_SECTORS;
+        uint32_t sector = lba % FLOPPY_TRACK_SECTORS;
+        uint32_t chunk = MIN(count, FLOPPY_TRACK_SECTORS - sector);
+
+        int ret = floppy_read_cylinder(cylinder);
+        if (ret < 0)
+            return ret;
+
+        memcpy(dest, floppy_dma_buffer + sector * FLOPPY_SECTOR_SIZE, chunk * FLOPPY_SECTOR_SIZE);
+        dest += chunk * FLOPPY_SECTOR_SIZE;
+        lba += chunk;
+        count -= chunk;
+    }
+    return 0;
+}
+
+static int floppy_write(struct block_device* dev, uint32_t lba, uint32_t count, const void* buffer) {
+    const uint8_t* src = (const uint8_t*)buffer;
+
+    if (dev != &floppy_dev || !fdc.present || lba + count > FLOPPY_SECTORS)
+        return -EINVAL;
+
+    while (count > 0) {
+        int cylinder = lba / FLOPPY_TRACK_SECTORS;
+        uint32_t sector = lba % FLOPPY_TRACK_SECTORS;
+        uint32_t chunk = MIN(count, FLOPPY_TRACK_SECTORS - sector);
+
+        /* The DMA buffer is reused for the write, so the track cache is lost */
+        fdc.cached_cylinder = -1;
+        memcpy(floppy_dma_buffer, src, chunk * FLOPPY_SECTOR_SIZE);
+
+        int ret = floppy_transfer(cylinder, sector, chunk, true);
+        if (ret < 0)
+            return ret;
+
+        src += chunk * FLOPPY_SECTOR_SIZE;
+        lba += chunk;
+        count -= chunk;
+    }
+    return 0;
+}
+
+/*
+ * Floppy initialization, run as an asynchronous initcall: the first call
+ * starts the motor and a recalibrate, later calls return -EAGAIN until
+ * the head has reached track 0, so the rest of the boot carries on.
+ */
+static int __init floppy_probe(void) {
+    static bool recalibrating = false;
+    static uint64_t recalibrate_start_us;
+
+    if (!recalibrating) {
+        kprintf("Initializing floppy controller...\n");
+
+        fdc.present = false;
+        fdc.motor_on = false;
+        fdc.seek_target = -1;
+        fdc.current_cylinder = -1;
+        fdc.cached_cylinder = -1;
+
+        outb(CMOS_ADDRESS, CMOS_FLOPPY_TYPE);
+        uint8_t type = inb(CMOS_DATA) >> 4;
+        if (type != CMOS_FLOPPY_144) {
+            kprintf("Floppy: no 1.44MB drive 0\n");
+            return -ENODEV;
+        }
+
+        if (fdc_reset() < 0) {
+            kprintf("Floppy: controller reset failed\n");
+            return -EIO;
+        }
+        fdc_configure();
+
+        /* Recalibrate while the motor spins up */
+        floppy_motor_start();
+        uint8_t cmd[2] = { FDC_CMD_RECALIBRATE, FLOPPY_DRIVE };
+        if (fdc_command(cmd, sizeof(cmd)) < 0) {
+            kprintf("Floppy: recalibrate failed\n");
+            floppy_motor_off();
+            return -EIO;
+        }
+        fdc.seek_target = 0;
+        recalibrate_start_us = timer_now_us();
+        recalibrating = true;
+        return -EAGAIN;
+    }
+
+    /* Head still stepping towards track 0 */
+    if ((inb(FDC_MSR) & (MSR_ACTA << FLOPPY_DRIVE)) &&
+        timer_elapsed_us(recalibrate_start_us) < FLOPPY_TIMEOUT_US)
+        return -EAGAIN;
+
+    /* An 80 track drive may need another pass */
+    if (floppy_seek_finish() < 0 && floppy_recalibrate() < 0) {
+        kprintf("Floppy: recalibrate failed\n");
+        floppy_motor_off();
+        return -EIO;
+    }
+
+    fdc.present = true;
+    kprintf("Floppy: fd0 1.44MB\n");
+    kprintf("Floppy controller initialized.\n");
+    return 0;
+}
+device_initcall_async(floppy_probe);
+
+struct block_device* floppy_get_device(void) {
+    return fdc.present ? &floppy_dev : NULL;
+}
+
+void floppy_motor_off(void) {
+    floppy_seek_finish();
+    fdc.motor_on = false;
+    outb(FDC_DOR, fdc_dor());
+}
+
+/*
+ * Bring the controller back after a boot snapshot was restored: the BIOS
+ * has reset it since, so the head position and the track cache are gone.
+ */
+void floppy_resume(void) {
+    if (!fdc.present)
+        return;
+
+    fdc.motor_on = false;
+    if (fdc_reset() < 0) {
+        kprintf("Floppy: controller reset failed\n");
+        fdc.present = false;
+        return;
+    }
+    fdc_configure();
+}
+
+/* Stop the motor once the drive has gone idle */
+void floppy_poll(void) {
+    if (fdc.motor_on && timer_elapsed_us(fdc.last_use_us) >= floppy_idle_us)
+        floppy_motor_off();
+}
+
+/* Read the whole disk through the buffer cache and report throughput */
+static void floppy_benchmark(void) {
+    if (!fdc.present)
+        return;
+
+    struct bcache_stats before, after;
+    bcache_invalidate(&floppy_dev);
+    fdc.cached_cylinder = -1;
+    bcache_get_stats(&before);
+
+    uint64_t start = timer_now_us();
+    for (uint32_t lba = 0; lba < FLOPPY_SECTORS; lba++) {
+        struct buffer_head* bh = bread(&floppy_dev, lba);
+        if (!bh) {
+            kprintf("Floppy: read error at sector ");
+            kprintf_dec(lba);
+            kprintf("\n");
+            return;
+        }
+        brelse(bh);
+    }
+    uint32_t elapsed = timer_elapsed_us(start);
+    bcache_get_stats(&after);
+
+    bench_report("floppy", "disk_read_ms", elapsed / 1000, "ms");
+    bench_report("floppy", "throughput", elapsed ? (uint32_t)div_u64((uint64_t)FLOPPY_SECTORS * FLOPPY_SECTOR_SIZE * 1000, elapsed) : 0, "KB/s");
+    bench_report("floppy", "cache_hits", after.hits - before.hits, "blocks");
+    bench_report("floppy", "cache_misses", after.misses - before.misses, "blocks");
+}
+KERNEL_BENCH("floppy", floppy_benchmark);
@@ -0,0 +1,160 @@
+/*
+ * PS/2 keyboard driver for nekkoOS
+ * The interrupt handler only drains the controller into a scancode ring
+ * and schedules a tasklet; decoding to characters and waking readers
+ * happen in the tasklet with interrupts enabled.
+ */
+
+#include "types.h"
+#include "io.h"
+#include "irq.h"
+#include "irqflags.h"
+#include "sched.h"
+#include "softirq.h"
+#include "keyboard.h"
+#include "init.h"
+#include "kernel.h"
+
+/* US layout, scancode set 1 */
+static const char keymap[128] = {
+    0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
+    '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
+    0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`',
+    0, '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,
+    '*', 0, ' ',
+};
+
+static const char keymap_shift[128] = {
+    0, 27, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
+    '\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
+    0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~',
+    0, '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0,
+    '*', 0, ' ',
+};
+
+/* Top half to bottom half: written only by the IRQ handler */
+static uint8_t raw_ring[KBD_RAW_SIZE];
+static volatile uint32_t raw_head;
+static volatile uint32_t raw_tail;
+
+/* Bottom half to readers */
+static char input_ring[KBD_INPUT_SIZE];
+static volatile uint32_t input_head;
+static volatile uint32_t input_tail;
+static struct wait_queue_head input_wait = WAIT_QUEUE_HEAD_INIT(input_wait);
+
+static struct tasklet keyboard_tasklet;
+
+static struct {
+    bool shift;
+    bool ctrl;
+    bool capslock;
+    bool extended;
+} kbd;
+
+static void keyboard_interrupt(int irq, void* data) {
+    (void)irq;
+    (void)data;
+
+    while (inb(KBD_STATUS) & KBD_STATUS_OUTPUT) {
+        uint8_t scancode = inb(KBD_DATA);
+        if (raw_head - raw_tail < KBD_RAW_SIZE)
+            raw_ring[raw_head++ % KBD_RAW_SIZE] = scancode;
+    }
+    tasklet_schedule(&keyboard_tasklet);
+}
+
+static void keyboard_decode(uint8_t scancode) {
+    bool release = scancode & KBD_RELEASE;
+    uint8_t key = scancode & ~KBD_RELEASE;
+
+    if (scancode == KBD_EXTENDED) {
+        kbd.extended = true;
+        return;
+    }
+    if (kbd.extended) {
+        /* Right control shares the code; other extended keys are ignored */
+        kbd.extended = false;
+        if (key == KBD_CTRL)
+            kbd.ctrl = !release;
+        return;
+    }
+
+    switch (key) {
+    case KBD_LSHIFT:
+    case KBD_RSHIFT:
+        kbd.shift = !release;
+        return;
+    case KBD_CTRL:
+        kbd.ctrl = !release;
+        return;
+    case KBD_CAPSLOCK:
+        if (!release)
+            kbd.capslock = !kbd.capslock;
+        return;
+    }
+    if (release)
+        return;
+
+    char c = kbd.shift ? keymap_shift[key] : keymap[key];
+    if (kbd.capslock && c >= 'a' && c <= 'z')
+        c -= 'a' - 'A';
+    else if (kbd.capslock && c >= 'A' && c <= 'Z')
+        c += 'a' - 'A';
+    if (kbd.ctrl && c >= 'a' && c <= 'z')
+        c -= 'a' - 1;
+    else if (kbd.ctrl && c >= 'A' && c <= 'Z')
+        c -= 'A' - 1;
+
+    if (c && input_head - input_tail < KBD_INPUT_SIZE)
+        input_ring[input_head++ % KBD_INPUT_SIZE] = c;
+}
+
+/* Bottom half */
+static void keyboard_bottom_half(uint32_t data) {
+    (void)data;
+    uint32_t head = input_head;
+
+    while (raw_tail != raw_head)
+        keyboard_decode(raw_ring[raw_tail++ % KBD_RAW_SIZE]);
+
+    if (input_head != head)
+        wake_up(&input_wait);
+}
+
+bool keyboard_poll(char* c) {
+    uint32_t flags = local_irq_save();
+    bool available = input_tail != input_head;
+
+    if (available)
+        *c = input_ring[input_tail++ % KBD_INPUT_SIZE];
+    local_irq_restore(flags);
+    return available;
+}
+
+/* Block until a character is typed */
+int keyboard_getc(void) {
+    char c;
+
+    wait_event(input_wait, keyboard_poll(&c));
+    return (unsigned char)c;
+}
+
+/* Keyboard initialization */
+static int __init init_keyboard(void) {
+    kprintf("Initializing keyboard...\n");
+
+    tasklet_init(&keyboard_tasklet, keyboard_bottom_half, 0);
+
+    /* Discard anything typed before the handler was installed */
+    while (inb(KBD_STATUS) & KBD_STATUS_OUTPUT)
+        inb(KBD_DATA);
+
+    int ret = request_irq(IRQ_KEYBOARD, keyboard_interrupt, NULL, "keyboard");
+    if (ret < 0)
+        return ret;
+
+    kprintf("Keyboard initialized.\n");
+    return 0;
+}
+initcall_depends(init_keyboard, 4, "init_softirq");
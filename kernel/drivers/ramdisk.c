@@ -0,0 +1,74 @@
+/*
+ * RAM disk driver for nekkoOS
+ * A block device backed by physically contiguous pages. Used for scratch
+ * filesystems (benchmarks, tests) where the device itself should cost
+ * nothing but a memory copy.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "block.h"
+#include "ramdisk.h"
+#include "pmm.h"
+#include "kmalloc.h"
+#include "errno.h"
+#include "kernel.h"
+
+struct ramdisk {
+    struct block_device dev;
+    uint8_t* data;
+    uint32_t pages;
+};
+
+static int ramdisk_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buffer) {
+    struct ramdisk* rd = dev->driver_data;
+
+    if (lba >= dev->sector_count || count > dev->sector_count - lba)
+        return -EIO;
+    memcpy(buffer, rd->data + lba * RAMDISK_SECTOR_SIZE, count * RAMDISK_SECTOR_SIZE);
+    return 0;
+}
+
+static int ramdisk_write(struct block_device* dev, uint32_t lba, uint32_t count, const void* buffer) {
+    struct ramdisk* rd = dev->driver_data;
+
+    if (lba >= dev->sector_count || count > dev->sector_count - lba)
+        return -EIO;
+    memcpy(rd->data + lba * RAMDISK_SECTOR_SIZE, buffer, count * RAMDISK_SECTOR_SIZE);
+    return 0;
+}
+
+static const struct block_ops ramdisk_ops = {
+    .read = ramdisk_read,
+    .write = ramdisk_write,
+};
+
+/* Create a zeroed RAM disk; NULL if there is not enough memory */
+struct block_device* ramdisk_create(const char* name, uint32_t size_kb) {
+    struct ramdisk* rd = kzalloc(sizeof(*rd));
+    if (!rd)
+        return NULL;
+
+    rd->pages = ALIGN_UP(size_kb, PAGE_SIZE / 1024) / (PAGE_SIZE / 1024);
+    rd->data = page_alloc(rd->pages);
+    if (!rd->data) {
+        kfree(rd);
+        return NULL;
+    }
+    memset(rd->data, 0, rd->pages * PAGE_SIZE);
+
+    rd->dev.name = name;
+    rd->dev.sector_size = RAMDISK_SECTOR_SIZE;
+    rd->dev.sector_count = rd->pages * (PAGE_SIZE / RAMDISK_SECTOR_SIZE);
+    rd->dev.fill_sectors = 1;
+    rd->dev.ops = &ramdisk_ops;
+    rd->dev.driver_data = rd;
+    return &rd->dev;
+}
+
+void ramdisk_destroy(struct block_device* dev) {
+    struct ramdisk* rd = dev->driver_data;
+
+    page_free(rd->data, rd->pages);
+    kfree(rd);
+}
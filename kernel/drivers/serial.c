@@ -0,0 +1,61 @@
+/*
+ * Serial console for nekkoOS
+ * serial=1 mirrors everything printed on the VGA console to COM1
+ * (115200 8N1, polled), so that scripts can collect the bench: and
+ * profile: lines from QEMU's -serial output. The UART is programmed on
+ * the first write; output before the command line is parsed only goes to
+ * the screen.
+ */
+
+#include "types.h"
+#include "io.h"
+#include "serial.h"
+#include "param.h"
+
+/* Transmitter polls before a character is dropped (no UART present) */
+#define SERIAL_TX_SPINS     100000
+
+static bool serial_enabled = false;
+param_bool("serial", serial_enabled);
+
+static bool serial_ready;
+
+static void serial_init(void) {
+    uint16_t divisor = SERIAL_BAUD_BASE / 115200;
+
+    outb(COM1_PORT + UART_IER, 0);
+    outb(COM1_PORT + UART_LCR, UART_LCR_DLAB);
+    outb(COM1_PORT + UART_DATA, divisor & 0xFF);
+    outb(COM1_PORT + UART_IER, divisor >> 8);
+    outb(COM1_PORT + UART_LCR, UART_LCR_8N1);
+    outb(COM1_PORT + UART_FCR, UART_FCR_ENABLE);
+    outb(COM1_PORT + UART_MCR, UART_MCR_DTR_RTS);
+    serial_ready = true;
+}
+
+static void serial_putchar(char c) {
+    for (uint32_t spins = 0; spins < SERIAL_TX_SPINS; spins++) {
+        if (inb(COM1_PORT + UART_LSR) & UART_LSR_THRE) {
+            outb(COM1_PORT + UART_DATA, c);
+            return;
+        }
+    }
+}
+
+void serial_console_write(const char* data, size_t size) {
+    if (!serial_enabled)
+        return;
+    if (!serial_ready)
+        serial_init();
+
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == '\n')
+            serial_putchar('\r');
+        serial_putchar(data[i]);
+    }
+}
+
+/* The BIOS has reset the UART since the snapshot: program it again */
+void serial_resume(void) {
+    serial_ready = false;
+}
@@ -0,0 +1,68 @@
+/*
+ * Exception table for nekkoOS
+ * Instructions that touch user memory register a fixup address in the
+ * __ex_table section. When one of them faults in kernel mode the
+ * exception path looks the faulting EIP up here and resumes at the fixup
+ * instead of panicking, so user pointers need no validation walk before
+ * they are used.
+ */
+
+#include "types.h"
+#include "gdt.h"
+#include "idt.h"
+#include "extable.h"
+#include "init.h"
+
+/* Exception table bounds (kernel.ld) */
+extern struct exception_table_entry __start___ex_table[];
+extern struct exception_table_entry __stop___ex_table[];
+
+/*
+ * Entries arrive in link order, which is almost sorted already, so an
+ * insertion sort finishes in close to one pass.
+ */
+void __init sort_main_extable(void) {
+    struct exception_table_entry* start = __start___ex_table;
+    struct exception_table_entry* end = __stop___ex_table;
+
+    for (struct exception_table_entry* entry = start + 1; entry < end; entry++) {
+        struct exception_table_entry key = *entry;
+        struct exception_table_entry* pos = entry;
+
+        while (pos > start && pos[-1].insn > key.insn) {
+            *pos = pos[-1];
+            pos--;
+        }
+        *pos = key;
+    }
+}
+
+const struct exception_table_entry* search_exception_tables(uint32_t addr) {
+    const struct exception_table_entry* low = __start___ex_table;
+    const struct exception_table_entry* high = __stop___ex_table;
+
+    while (low < high) {
+        const struct exception_table_entry* mid = low + (high - low) / 2;
+
+        if (mid->insn == addr)
+            return mid;
+        if (mid->insn < addr)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return NULL;
+}
+
+/* Resume a faulting kernel-mode user access at its fixup; false if there is none */
+bool fixup_exception(struct interrupt_frame* frame) {
+    if (frame->cs != GDT_KERNEL_CODE)
+        return false;
+
+    const struct exception_table_entry* entry = search_exception_tables(frame->eip);
+    if (!entry)
+        return false;
+
+    frame->eip = entry->fixup;
+    return true;
+}
@@ -0,0 +1,238 @@
+/*
+ * Block buffer cache for nekkoOS
+ * Caches device sectors in a fixed pool of buffers with LRU replacement.
+ * A miss reads a whole fill window (one track for floppies) so the
+ * following sequential reads are served from memory.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "block.h"
+#include "errno.h"
+#include "param.h"
+#include "init.h"
+#include "kernel.h"
+
+/* Buffer pool */
+static uint8_t bcache_data[BCACHE_BUFFERS][BCACHE_BLOCK_SIZE];
+static struct buffer_head bcache_buffers[BCACHE_BUFFERS];
+static struct buffer_head* bcache_hash[BCACHE_HASH_SIZE];
+
+/* LRU list sentinel: lru_next is most recently used */
+static struct buffer_head bcache_lru;
+
+/* Staging area for multi-sector fills */
+static uint8_t bcache_staging[BCACHE_MAX_FILL * BCACHE_BLOCK_SIZE];
+
+static struct bcache_stats bcache_stats;
+
+/* Tunables: buffers in use and largest fill window */
+static uint32_t bcache_nr_buffers = BCACHE_BUFFERS;
+static uint32_t bcache_max_fill = BCACHE_MAX_FILL;
+param_uint("bcache.buffers", bcache_nr_buffers);
+param_uint("bcache.fill", bcache_max_fill);
+
+static inline uint32_t bcache_hashfn(struct block_device* dev, uint32_t block) {
+    return (((uintptr_t)dev >> 4) ^ block) & (BCACHE_HASH_SIZE - 1);
+}
+
+static void lru_remove(struct buffer_head* bh) {
+    bh->lru_prev->lru_next = bh->lru_next;
+    bh->lru_next->lru_prev = bh->lru_prev;
+}
+
+static void lru_add_head(struct buffer_head* bh) {
+    bh->lru_next = bcache_lru.lru_next;
+    bh->lru_prev = &bcache_lru;
+    bcache_lru.lru_next->lru_prev = bh;
+    bcache_lru.lru_next = bh;
+}
+
+static struct buffer_head* hash_lookup(struct block_device* dev, uint32_t block) {
+    struct buffer_head* bh = bcache_hash[bcache_hashfn(dev, block)];
+    while (bh) {
+        if (bh->dev == dev && bh->block == block)
+            return bh;
+        bh = bh->hash_next;
+    }
+    return NULL;
+}
+
+static void hash_insert(struct buffer_head* bh) {
+    uint32_t index = bcache_hashfn(bh->dev, bh->block);
+    bh->hash_next = bcache_hash[index];
+    bcache_hash[index] = bh;
+}
+
+static void hash_remove(struct buffer_head* bh) {
+    struct buffer_head** link = &bcache_hash[bcache_hashfn(bh->dev, bh->block)];
+    while (*link) {
+        if (*link == bh) {
+            *link = bh->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    bh->hash_next = NULL;
+}
+
+/* Take the least recently used unreferenced buffer */
+static struct buffer_head* get_free_buffer(void) {
+    struct buffer_head* bh = bcache_lru.lru_prev;
+    while (bh != &bcache_lru) {
+        if (bh->count == 0) {
+            if (bh->flags & BH_VALID) {
+                hash_remove(bh);
+                bcache_stats.evictions++;
+            }
+            bh->flags = 0;
+            bh->dev = NULL;
+            return bh;
+        }
+        bh = bh->lru_prev;
+    }
+    return NULL;
+}
+
+/* Insert a sector that was just read from the device */
+static void bcache_install(struct block_device* dev, uint32_t block, const uint8_t* data) {
+    if (hash_lookup(dev, block))
+        return;
+
+    struct buffer_head* bh = get_free_buffer();
+    if (!bh)
+        return;
+
+    memcpy(bh->data, data, BCACHE_BLOCK_SIZE);
+    bh->dev = dev;
+    bh->block = block;
+    bh->flags = BH_VALID;
+    hash_insert(bh);
+    lru_remove(bh);
+    lru_add_head(bh);
+}
+
+/* Read the fill window containing block into the cache */
+static int bcache_fill(struct block_device* dev, uint32_t block) {
+    uint32_t fill = dev->fill_sectors ? dev->fill_sectors : 1;
+    if (fill > bcache_max_fill)
+        fill = bcache_max_fill;
+
+    uint32_t start = block - (block % fill);
+    uint32_t count = MIN(fill, dev->sector_count - start);
+
+    int ret = blk_read(dev, start, count, bcache_staging);
+    if (ret < 0)
+        return ret;
+
+    bcache_stats.fills++;
+    for (uint32_t i = 0; i < count; i++) {
+        if (start + i != block)
+            bcache_install(dev, start + i, bcache_staging + i * BCACHE_BLOCK_SIZE);
+    }
+    /* Install the requested block last so it is most recently used */
+    bcache_install(dev, block, bcache_staging + (block - start) * BCACHE_BLOCK_SIZE);
+    return 0;
+}
+
+/* Buffer cache initialization */
+int __init init_bcache(void) {
+    kprintf("Initializing buffer cache...\n");
+
+    /* Keep at least two fill windows worth of buffers */
+    if (bcache_nr_buffers > BCACHE_BUFFERS)
+        bcache_nr_buffers = BCACHE_BUFFERS;
+    if (bcache_nr_buffers < 2 * BCACHE_MAX_FILL)
+        bcache_nr_buffers = 2 * BCACHE_MAX_FILL;
+    if (bcache_max_fill == 0 || bcache_max_fill > BCACHE_MAX_FILL)
+        bcache_max_fill = BCACHE_MAX_FILL;
+
+    bcache_lru.lru_next = &bcache_lru;
+    bcache_lru.lru_prev = &bcache_lru;
+
+    for (size_t i = 0; i < bcache_nr_buffers; i++) {
+        struct buffer_head* bh = &bcache_buffers[i];
+        bh->dev = NULL;
+        bh->flags = 0;
+        bh->count = 0;
+        bh->hash_next = NULL;
+        bh->data = bcache_data[i];
+        lru_add_head(bh);
+    }
+    memset(bcache_hash, 0, sizeof(bcache_hash));
+    memset(&bcache_stats, 0, sizeof(bcache_stats));
+
+    kprintf("Buffer cache: ");
+    kprintf_dec(bcache_nr_buffers * BCACHE_BLOCK_SIZE / 1024);
+    kprintf("KB\n");
+    kprintf("Buffer cache initialized.\n");
+    return 0;
+}
+subsys_initcall(init_bcache);
+
+/* Get a referenced buffer for a block, reading it if necessary */
+struct buffer_head* bread(struct block_device* dev, uint32_t block) {
+    if (!dev || dev->sector_size != BCACHE_BLOCK_SIZE || block >= dev->sector_count)
+        return NULL;
+
+    struct buffer_head* bh = hash_lookup(dev, block);
+    if (bh) {
+        bcache_stats.hits++;
+    } else {
+        bcache_stats.misses++;
+        if (bcache_fill(dev, block) < 0)
+            return NULL;
+        bh = hash_lookup(dev, block);
+        if (!bh)
+            return NULL;
+    }
+
+    bh->count++;
+    lru_remove(bh);
+    lru_add_head(bh);
+    return bh;
+}
+
+/* Drop a reference obtained from bread() */
+void brelse(struct buffer_head* bh) {
+    if (bh && bh->count > 0)
+        bh->count--;
+}
+
+/* Write a buffer through to its device */
+int bwrite(struct buffer_head* bh) {
+    if (!bh || !bh->dev || !bh->dev->ops->write)
+        return -EINVAL;
+    return blk_write(bh->dev, bh->block, 1, bh->data);
+}
+
+/* Copy a run of blocks out of the cache */
+int bcache_read(struct block_device* dev, uint32_t block, uint32_t count, void* buffer) {
+    uint8_t* dest = (uint8_t*)buffer;
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct buffer_head* bh = bread(dev, block + i);
+        if (!bh)
+            return -EIO;
+        memcpy(dest, bh->data, BCACHE_BLOCK_SIZE);
+        dest += BCACHE_BLOCK_SIZE;
+        brelse(bh);
+    }
+    return 0;
+}
+
+/* Drop all unreferenced buffers belonging to a device */
+void bcache_invalidate(struct block_device* dev) {
+    for (size_t i = 0; i < bcache_nr_buffers; i++) {
+        struct buffer_head* bh = &bcache_buffers[i];
+        if (bh->dev == dev && bh->count == 0) {
+            hash_remove(bh);
+            bh->flags = 0;
+            bh->dev = NULL;
+        }
+    }
+}
+
+void bcache_get_stats(struct bcache_stats* stats) {
+    *stats = bcache_stats;
+}
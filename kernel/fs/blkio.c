@@ -0,0 +1,112 @@
+/*
+ * Block I/O dispatch for nekkoOS
+ * A device serves one request at a time. Requests that find it busy
+ * wait in order of virtual start time: each request moves its control
+ * group's virtual clock on by its size divided by the group's I/O
+ * weight, so groups with work queued get the device in proportion to
+ * their weights however many threads each has. A group coming back from
+ * idle starts at the device's current virtual time and gets no credit
+ * for the time it did not use. Group clocks are shared by all devices.
+ *
+ * Requests from interrupt context or with interrupts disabled (e.g.
+ * hibernation) cannot wait and go straight to the driver.
+ */
+
+#include "types.h"
+#include "list.h"
+#include "irqflags.h"
+#include "smp.h"
+#include "block.h"
+#include "cgroup.h"
+#include "sched.h"
+#include "errno.h"
+#include "kernel.h"
+#include "export.h"
+
+struct blk_waiter {
+    struct list_head entry;
+    uint64_t start;
+    volatile bool granted;
+    struct wait_queue_head wait;
+};
+
+/* Wait until the device is ours, in virtual start time order */
+static void blk_queue_enter(struct block_device* dev, uint32_t count) {
+    struct blk_queue* q = &dev->queue;
+    struct cgroup* cg = current_cgroup();
+    uint32_t flags = local_irq_save();
+
+    if (!q->waiters.next)
+        list_init(&q->waiters);
+
+    uint64_t start = MAX(q->vtime, cg->io_vtime);
+    cg->io_vtime = start + div_u64((uint64_t)count * IO_WEIGHT_MAX, cg->io_weight);
+    cg->io_requests++;
+    cg->io_sectors += count;
+
+    if (!q->busy) {
+        q->busy = true;
+        q->vtime = start;
+        local_irq_restore(flags);
+        return;
+    }
+
+    struct blk_waiter waiter = { .start = start, .granted = false };
+    struct list_head* pos;
+
+    wait_queue_init(&waiter.wait);
+    list_for_each(pos, &q->waiters) {
+        if (list_entry(pos, struct blk_waiter, entry)->start > start)
+            break;
+    }
+    list_add_tail(&waiter.entry, pos);
+    local_irq_restore(flags);
+
+    wait_event(waiter.wait, waiter.granted);
+}
+
+/* Hand the device to the earliest waiter */
+static void blk_queue_leave(struct block_device* dev) {
+    struct blk_queue* q = &dev->queue;
+    uint32_t flags = local_irq_save();
+
+    if (list_empty(&q->waiters)) {
+        q->busy = false;
+    } else {
+        struct blk_waiter* next = list_first_entry(&q->waiters, struct blk_waiter, entry);
+
+        list_del(&next->entry);
+        q->vtime = next->start;
+        next->granted = true;
+        wake_up(&next->wait);
+    }
+    local_irq_restore(flags);
+}
+
+static inline bool blk_can_wait(void) {
+    return !in_interrupt() && !irqs_disabled() && current_thread();
+}
+
+int blk_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buffer) {
+    if (!blk_can_wait())
+        return dev->ops->read(dev, lba, count, buffer);
+
+    blk_queue_enter(dev, count);
+    int ret = dev->ops->read(dev, lba, count, buffer);
+    blk_queue_leave(dev);
+    return ret;
+}
+EXPORT_SYMBOL(blk_read);
+
+int blk_write(struct block_device* dev, uint32_t lba, uint32_t count, const void* buffer) {
+    if (!dev->ops->write)
+        return -EINVAL;
+    if (!blk_can_wait())
+        return dev->ops->write(dev, lba, count, buffer);
+
+    blk_queue_enter(dev, count);
+    int ret = dev->ops->write(dev, lba, count, buffer);
+    blk_queue_leave(dev);
+    return ret;
+}
+EXPORT_SYMBOL(blk_write);
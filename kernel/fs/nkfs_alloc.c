@@ -0,0 +1,152 @@
+/*
+ * nkfs block and inode allocation for nekkoOS
+ * Allocation works on the in-memory bitmaps. Writeback asks for a whole
+ * run of delayed pages at once, with a goal block right after the file's
+ * previous extent: the allocator extends the file in place when it can,
+ * else takes the first free run long enough for the request, else the
+ * longest run it saw. Whole words of the bitmap are skipped at a time.
+ * Freed blocks stay allocated until the transaction that freed them has
+ * committed (see nkfs_journal.c).
+ */
+
+#include "types.h"
+#include "nkfs.h"
+#include "kernel.h"
+
+/* Bitmap bytes read a word at a time */
+typedef uint32_t __attribute__((may_alias)) bitmap_word_t;
+
+static inline bool bit_test(const uint8_t* bitmap, uint32_t bit) {
+    return bitmap[bit / 8] & (1 << (bit % 8));
+}
+
+static void bits_set(uint8_t* bitmap, uint32_t start, uint32_t count) {
+    for (uint32_t bit = start; bit < start + count; bit++)
+        bitmap[bit / 8] |= 1 << (bit % 8);
+}
+
+static void bits_clear(uint8_t* bitmap, uint32_t start, uint32_t count) {
+    for (uint32_t bit = start; bit < start + count; bit++)
+        bitmap[bit / 8] &= ~(1 << (bit % 8));
+}
+
+/* Remember which bitmap blocks the next commit has to log */
+static void bitmap_changed(struct nkfs_fs* fs, uint32_t area, uint32_t start, uint32_t count) {
+    uint32_t first = area - fs->super.block_bitmap + start / NKFS_BITS_PER_BLOCK;
+    uint32_t last = area - fs->super.block_bitmap + (start + count - 1) / NKFS_BITS_PER_BLOCK;
+
+    for (uint32_t i = first; i <= last; i++)
+        fs->bitmap_dirty[i] = true;
+}
+
+/* Length of the free run at start, up to max */
+static uint32_t free_run(const uint8_t* bitmap, uint32_t start, uint32_t end, uint32_t max) {
+    uint32_t length = 0;
+
+    while (start + length < end && length < max && !bit_test(bitmap, start + length))
+        length++;
+    return length;
+}
+
+/* First free block in [start, end), or end */
+static uint32_t find_free(const uint8_t* bitmap, uint32_t start, uint32_t end) {
+    const bitmap_word_t* words = (const bitmap_word_t*)bitmap;
+    uint32_t bit = start;
+
+    while (bit < end) {
+        if ((bit & 31) == 0 && words[bit / 32] == 0xFFFFFFFF) {
+            bit += 32;
+            continue;
+        }
+        if (!bit_test(bitmap, bit))
+            return bit;
+        bit++;
+    }
+    return end;
+}
+
+/*
+ * Allocate up to count contiguous blocks near goal. Returns the first
+ * block and stores the run length in *allocated; returns 0 when full.
+ */
+uint32_t nkfs_alloc_blocks(struct nkfs_fs* fs, uint32_t goal, uint32_t count, uint32_t* allocated) {
+    uint32_t first = fs->super.data_start;
+    uint32_t end = fs->super.blocks_count;
+    uint32_t best = 0;
+    uint32_t best_length = 0;
+
+    *allocated = 0;
+    if (count == 0 || fs->super.free_blocks == 0)
+        return 0;
+    if (goal < first || goal >= end)
+        goal = first;
+
+    /* Extending the previous extent beats any other placement */
+    uint32_t length = free_run(fs->block_bitmap, goal, end, count);
+    if (length) {
+        best = goal;
+        best_length = length;
+    }
+
+    /* Scan from goal to the end, then wrap around */
+    for (int pass = 0; pass < 2 && best_length < count; pass++) {
+        uint32_t bit = pass == 0 ? goal : first;
+        uint32_t stop = pass == 0 ? end : goal;
+
+        while (best_length < count) {
+            bit = find_free(fs->block_bitmap, bit, stop);
+            if (bit >= stop)
+                break;
+            length = free_run(fs->block_bitmap, bit, stop, count);
+            if (length > best_length) {
+                best = bit;
+                best_length = length;
+            }
+            bit += length;
+        }
+    }
+
+    if (!best_length)
+        return 0;
+
+    bits_set(fs->block_bitmap, best, best_length);
+    bitmap_changed(fs, fs->super.block_bitmap, best, best_length);
+    fs->super.free_blocks -= best_length;
+    fs->alloc_goal = best + best_length;
+    *allocated = best_length;
+    return best;
+}
+
+void nkfs_free_blocks(struct nkfs_fs* fs, uint32_t start, uint32_t count) {
+    if (start < fs->super.data_start || start + count > fs->super.blocks_count)
+        panic("nkfs: freeing blocks outside the data area");
+
+    /* Without memory to defer the free, give the blocks back right away */
+    if (nkfs_journal_free(fs, start, count) < 0)
+        nkfs_release_blocks(fs, start, count);
+}
+
+/* Return blocks to the bitmap; called once their free has committed */
+void nkfs_release_blocks(struct nkfs_fs* fs, uint32_t start, uint32_t count) {
+    bits_clear(fs->block_bitmap, start, count);
+    bitmap_changed(fs, fs->super.block_bitmap, start, count);
+    fs->super.free_blocks += count;
+}
+
+/* Returns a free inode number, or 0 when the inode table is full */
+uint32_t nkfs_alloc_inode(struct nkfs_fs* fs) {
+    uint32_t ino = find_free(fs->inode_bitmap, NKFS_ROOT_INO + 1, fs->super.inodes_count);
+
+    if (ino >= fs->super.inodes_count)
+        return 0;
+    bits_set(fs->inode_bitmap, ino, 1);
+    bitmap_changed(fs, fs->super.inode_bitmap, ino, 1);
+    fs->super.free_inodes--;
+    return ino;
+}
+
+void nkfs_free_inode(struct nkfs_fs* fs, uint32_t ino) {
+    bits_clear(fs->inode_bitmap, ino, 1);
+    bitmap_changed(fs, fs->super.inode_bitmap, ino, 1);
+    fs->super.free_inodes++;
+}
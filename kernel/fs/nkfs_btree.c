@@ -0,0 +1,386 @@
+/*
+ * nkfs B+tree for nekkoOS
+ * One implementation serves directories and extent maps: nodes are whole
+ * blocks, leaves hold fixed size records whose first 32-bit word is the
+ * key, and leaves are chained in key order for scans. Keys may repeat
+ * (directory name hashes collide), so a search for the first match
+ * descends left of equal separators and walks the leaf chain from there.
+ *
+ * A full node splits in half, except when the new entry goes at its end:
+ * then only the new entry moves, so trees that grow at the right edge
+ * (extent maps, sorted loads) keep full nodes. Deleting a record never
+ * merges nodes; an emptied leaf stays in the chain until the tree is
+ * freed.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "nkfs.h"
+#include "errno.h"
+#include "kernel.h"
+
+static inline struct nkfs_btree_header* node_header(struct nkfs_buf* buf) {
+    return (struct nkfs_btree_header*)buf->data;
+}
+
+static inline uint8_t* node_entries(struct nkfs_buf* buf) {
+    return buf->data + sizeof(struct nkfs_btree_header);
+}
+
+static inline struct nkfs_btree_index* node_index(struct nkfs_buf* buf) {
+    return (struct nkfs_btree_index*)node_entries(buf);
+}
+
+static inline uint32_t record_key(const void* record) {
+    return *(const uint32_t*)record;
+}
+
+static struct nkfs_buf* read_node(struct nkfs_fs* fs, uint32_t block) {
+    struct nkfs_buf* buf = nkfs_bread(fs, block);
+
+    if (buf && node_header(buf)->magic != NKFS_BTREE_MAGIC) {
+        kprintf("nkfs: bad B+tree node at block ");
+        kprintf_dec(block);
+        kprintf("\n");
+        nkfs_brelse(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+static struct nkfs_buf* new_node(struct nkfs_inode* inode, uint16_t level) {
+    struct nkfs_fs* fs = inode->fs;
+    uint32_t allocated;
+    uint32_t goal = inode->disk.tree_root ? inode->disk.tree_root : fs->alloc_goal;
+    uint32_t block = nkfs_alloc_blocks(fs, goal, 1, &allocated);
+
+    if (!block)
+        return NULL;
+
+    struct nkfs_buf* buf = nkfs_bnew(fs, block);
+    if (!buf) {
+        nkfs_free_blocks(fs, block, 1);
+        return NULL;
+    }
+    node_header(buf)->magic = NKFS_BTREE_MAGIC;
+    node_header(buf)->level = level;
+    inode->disk.blocks++;
+    nkfs_mark_inode_dirty(inode);
+    return buf;
+}
+
+/* Give back a node that was allocated but never linked into the tree */
+static void discard_node(struct nkfs_inode* inode, struct nkfs_buf* buf) {
+    uint32_t block = buf->block;
+
+    nkfs_brelse(buf);
+    nkfs_journal_revoke(inode->fs, block);
+    nkfs_free_blocks(inode->fs, block, 1);
+    inode->disk.blocks--;
+}
+
+/*
+ * Child to descend into: the last index entry whose key is below the
+ * search key (or not above it when inclusive), entry 0 if there is none.
+ */
+static uint32_t index_search(const struct nkfs_btree_index* index, uint32_t count, uint32_t key, bool inclusive) {
+    uint32_t low = 1;
+    uint32_t high = count;
+
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        if (index[mid].key < key || (inclusive && index[mid].key == key))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low - 1;
+}
+
+/* Slot of the first record with a key >= key (> key when after) */
+static uint32_t leaf_search(const uint8_t* records, uint32_t count, uint32_t record_size, uint32_t key, bool after) {
+    uint32_t low = 0;
+    uint32_t high = count;
+
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        uint32_t mid_key = record_key(records + mid * record_size);
+        if (mid_key < key || (after && mid_key == key))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+int nkfs_btree_create(struct nkfs_inode* inode) {
+    struct nkfs_buf* root = new_node(inode, 0);
+
+    if (!root)
+        return -ENOSPC;
+    inode->disk.tree_root = root->block;
+    nkfs_brelse(root);
+    return 0;
+}
+
+/* Move the cursor forward until it sits on a record; -ENOENT at the end */
+static int cursor_settle(struct nkfs_fs* fs, struct nkfs_btree_cursor* cursor) {
+    while (cursor->index >= node_header(cursor->leaf)->count) {
+        uint32_t next = node_header(cursor->leaf)->next;
+
+        nkfs_brelse(cursor->leaf);
+        cursor->leaf = NULL;
+        if (!next)
+            return -ENOENT;
+        cursor->leaf = read_node(fs, next);
+        if (!cursor->leaf)
+            return -EIO;
+        cursor->index = 0;
+    }
+    return 0;
+}
+
+/*
+ * Position the cursor on the first record >= key (NKFS_BTREE_GE) or the
+ * last record <= key (NKFS_BTREE_LE). LE searches are meant for trees
+ * that never delete (extent maps): they do not look back across leaves.
+ */
+int nkfs_btree_find(struct nkfs_inode* inode, uint32_t record_size, uint32_t key, int mode,
+                    struct nkfs_btree_cursor* cursor) {
+    struct nkfs_fs* fs = inode->fs;
+    uint32_t block = inode->disk.tree_root;
+    struct nkfs_buf* buf;
+
+    cursor->leaf = NULL;
+    if (!block)
+        return -ENOENT;
+
+    for (;;) {
+        buf = read_node(fs, block);
+        if (!buf)
+            return -EIO;
+
+        struct nkfs_btree_header* header = node_header(buf);
+        if (header->level == 0)
+            break;
+
+        uint32_t slot = index_search(node_index(buf), header->count, key, mode == NKFS_BTREE_LE);
+        block = node_index(buf)[slot].child;
+        nkfs_brelse(buf);
+    }
+
+    uint32_t count = node_header(buf)->count;
+    cursor->leaf = buf;
+    if (mode == NKFS_BTREE_GE) {
+        cursor->index = leaf_search(node_entries(buf), count, record_size, key, false);
+        return cursor_settle(fs, cursor);
+    }
+
+    uint32_t slot = leaf_search(node_entries(buf), count, record_size, key, true);
+    if (slot == 0) {
+        nkfs_btree_release(cursor);
+        return -ENOENT;
+    }
+    cursor->index = slot - 1;
+    return 0;
+}
+
+int nkfs_btree_next(struct nkfs_inode* inode, uint32_t record_size, struct nkfs_btree_cursor* cursor) {
+    (void)record_size;
+    cursor->index++;
+    return cursor_settle(inode->fs, cursor);
+}
+
+void* nkfs_btree_record(struct nkfs_btree_cursor* cursor, uint32_t record_size) {
+    return node_entries(cursor->leaf) + cursor->index * record_size;
+}
+
+void nkfs_btree_release(struct nkfs_btree_cursor* cursor) {
+    nkfs_brelse(cursor->leaf);
+    cursor->leaf = NULL;
+}
+
+/* Insert entry (entry_size bytes) at slot, shifting the entries after it */
+static void node_insert(struct nkfs_buf* buf, uint32_t slot, const void* entry, uint32_t entry_size) {
+    struct nkfs_btree_header* header = node_header(buf);
+    uint8_t* at = node_entries(buf) + slot * entry_size;
+
+    memmove(at + entry_size, at, (header->count - slot) * entry_size);
+    memcpy(at, entry, entry_size);
+    header->count++;
+    nkfs_bdirty(buf);
+}
+
+int nkfs_btree_insert(struct nkfs_inode* inode, uint32_t record_size, const void* record) {
+    struct nkfs_fs* fs = inode->fs;
+    struct nkfs_buf* path[NKFS_BTREE_MAX_DEPTH];
+    uint32_t slots[NKFS_BTREE_MAX_DEPTH];
+    uint32_t key = record_key(record);
+    int depth = 0;
+    int nr_path = 0;
+    int ret = 0;
+
+    if (record_size > NKFS_BTREE_MAX_RECORD)
+        return -EINVAL;
+    if (!inode->disk.tree_root && (ret = nkfs_btree_create(inode)) < 0)
+        return ret;
+
+    /* Descend to the leaf, after any records with an equal key */
+    uint32_t block = inode->disk.tree_root;
+    for (;;) {
+        struct nkfs_buf* buf = read_node(fs, block);
+        if (!buf) {
+            ret = -EIO;
+            goto out;
+        }
+        path[nr_path++] = buf;
+
+        struct nkfs_btree_header* header = node_header(buf);
+        if (header->level == 0) {
+            slots[depth] = leaf_search(node_entries(buf), header->count, record_size, key, true);
+            break;
+        }
+        if (depth + 1 == NKFS_BTREE_MAX_DEPTH) {
+            ret = -EIO;
+            goto out;
+        }
+        slots[depth] = index_search(node_index(buf), header->count, key, true) + 1;
+        block = node_index(buf)[slots[depth] - 1].child;
+        depth++;
+    }
+
+    /*
+     * Allocate every node the insert needs before changing any node: a
+     * right sibling for each full node from the leaf up, and a new root
+     * when the root is full too. Spare node i sits at tree level i.
+     * Running out of space then leaves the tree as it was.
+     */
+    struct nkfs_buf* spare[NKFS_BTREE_MAX_DEPTH + 1];
+    uint32_t size = record_size;
+    int needed = 0;
+    for (int level = depth; level >= 0; level--) {
+        if (node_header(path[level])->count < NKFS_BTREE_SPACE / size)
+            break;
+        needed += level == 0 ? 2 : 1;
+        size = sizeof(struct nkfs_btree_index);
+    }
+    for (int i = 0; i < needed; i++) {
+        if (!(spare[i] = new_node(inode, i))) {
+            while (i > 0)
+                discard_node(inode, spare[--i]);
+            ret = -ENOSPC;
+            goto out;
+        }
+    }
+
+    /* Insert at the leaf and split upwards while nodes are full */
+    uint8_t entry[NKFS_BTREE_MAX_RECORD];
+    uint32_t entry_size = record_size;
+    memcpy(entry, record, record_size);
+
+    for (int level = depth; level >= 0; level--) {
+        struct nkfs_buf* buf = path[level];
+        struct nkfs_btree_header* header = node_header(buf);
+        uint32_t capacity = NKFS_BTREE_SPACE / entry_size;
+        uint32_t slot = slots[level];
+
+        if (header->count < capacity) {
+            node_insert(buf, slot, entry, entry_size);
+            break;
+        }
+
+        struct nkfs_buf* right = spare[header->level];
+        struct nkfs_buf* root = level == 0 ? spare[header->level + 1] : NULL;
+
+        /* Appending moves only the new entry; anything else splits in half */
+        uint32_t split = slot == header->count ? header->count : header->count / 2;
+        struct nkfs_btree_header* right_header = node_header(right);
+        memcpy(node_entries(right), node_entries(buf) + split * entry_size, (header->count - split) * entry_size);
+        right_header->count = header->count - split;
+        header->count = split;
+        if (header->level == 0) {
+            right_header->next = header->next;
+            header->next = right->block;
+        }
+
+        if (slot <= split && split < capacity)
+            node_insert(buf, slot, entry, entry_size);
+        else
+            node_insert(right, slot - split, entry, entry_size);
+        nkfs_bdirty(buf);
+
+        /* The parent gets the right node under its first key */
+        struct nkfs_btree_index separator = {
+            .key = record_key(node_entries(right)),
+            .child = right->block,
+        };
+        nkfs_brelse(right);
+
+        if (root) {
+            struct nkfs_btree_index left = {
+                .key = record_key(node_entries(buf)),
+                .child = buf->block,
+            };
+            node_insert(root, 0, &left, sizeof(left));
+            node_insert(root, 1, &separator, sizeof(separator));
+            inode->disk.tree_root = root->block;
+            nkfs_mark_inode_dirty(inode);
+            nkfs_brelse(root);
+            break;
+        }
+
+        memcpy(entry, &separator, sizeof(separator));
+        entry_size = sizeof(separator);
+    }
+
+out:
+    for (int level = 0; level < nr_path; level++)
+        nkfs_brelse(path[level]);
+    return ret;
+}
+
+/* Remove the record under the cursor; the cursor stays on the next slot */
+void nkfs_btree_delete(struct nkfs_btree_cursor* cursor, uint32_t record_size) {
+    struct nkfs_btree_header* header = node_header(cursor->leaf);
+    uint8_t* at = nkfs_btree_record(cursor, record_size);
+
+    memmove(at, at + record_size, (header->count - cursor->index - 1) * record_size);
+    header->count--;
+    nkfs_bdirty(cursor->leaf);
+}
+
+static void free_node(struct nkfs_inode* inode, uint32_t block) {
+    struct nkfs_buf* buf = read_node(inode->fs, block);
+
+    if (buf) {
+        struct nkfs_btree_header* header = node_header(buf);
+        for (uint32_t i = 0; header->level > 0 && i < header->count; i++)
+            free_node(inode, node_index(buf)[i].child);
+        nkfs_brelse(buf);
+    }
+    nkfs_journal_revoke(inode->fs, block);
+    nkfs_free_blocks(inode->fs, block, 1);
+    inode->disk.blocks--;
+}
+
+/* Free every node of the tree; the records must already be dealt with */
+void nkfs_btree_free(struct nkfs_inode* inode) {
+    if (!inode->disk.tree_root)
+        return;
+    free_node(inode, inode->disk.tree_root);
+    inode->disk.tree_root = 0;
+    nkfs_mark_inode_dirty(inode);
+}
+
+/* Levels from the root to the leaves, 0 for no tree */
+uint32_t nkfs_btree_depth(struct nkfs_inode* inode) {
+    if (!inode->disk.tree_root)
+        return 0;
+
+    struct nkfs_buf* root = read_node(inode->fs, inode->disk.tree_root);
+    if (!root)
+        return 0;
+    uint32_t depth = node_header(root)->level + 1;
+    nkfs_brelse(root);
+    return depth;
+}
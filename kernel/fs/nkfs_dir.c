@@ -0,0 +1,259 @@
+/*
+ * nkfs directories for nekkoOS
+ * A directory is a B+tree of fixed size records keyed by the FNV-1a hash
+ * of the name, so a lookup reads one node per tree level no matter how
+ * many entries the directory has. Colliding names sit next to each other
+ * and are told apart by comparing the names. A directory's size is its
+ * number of entries; "." and ".." are not stored, the parent is kept in
+ * the inode instead.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "hashtable.h"
+#include "nkfs.h"
+#include "errno.h"
+#include "kernel.h"
+
+#define DIRENT_SIZE         sizeof(struct nkfs_dirent)
+
+static int make_dirent(const char* name, size_t length, struct nkfs_dirent* dirent) {
+    if (length == 0)
+        return -EINVAL;
+    if (length > NKFS_NAME_MAX)
+        return -ENAMETOOLONG;
+
+    memset(dirent, 0, sizeof(*dirent));
+    dirent->hash = hash_bytes(name, length);
+    dirent->name_len = length;
+    memcpy(dirent->name, name, length);
+    return 0;
+}
+
+/* Leave the cursor on the record for a name; -ENOENT if there is none */
+static int dir_find(struct nkfs_inode* dir, const struct nkfs_dirent* key, struct nkfs_btree_cursor* cursor) {
+    int ret = nkfs_btree_find(dir, DIRENT_SIZE, key->hash, NKFS_BTREE_GE, cursor);
+
+    while (ret == 0) {
+        struct nkfs_dirent* dirent = nkfs_btree_record(cursor, DIRENT_SIZE);
+
+        if (dirent->hash != key->hash) {
+            nkfs_btree_release(cursor);
+            return -ENOENT;
+        }
+        if (dirent->name_len == key->name_len && memcmp(dirent->name, key->name, key->name_len) == 0)
+            return 0;
+        ret = nkfs_btree_next(dir, DIRENT_SIZE, cursor);
+    }
+    return ret;
+}
+
+int nkfs_lookup(struct nkfs_inode* dir, const char* name, uint32_t* ino) {
+    struct nkfs_btree_cursor cursor;
+    struct nkfs_dirent key;
+    int ret;
+
+    if (!NKFS_S_ISDIR(dir->disk.mode))
+        return -ENOTDIR;
+    if ((ret = make_dirent(name, strlen(name), &key)) < 0)
+        return ret;
+    if ((ret = dir_find(dir, &key, &cursor)) < 0)
+        return ret;
+
+    *ino = ((struct nkfs_dirent*)nkfs_btree_record(&cursor, DIRENT_SIZE))->ino;
+    nkfs_btree_release(&cursor);
+    return 0;
+}
+
+static int dir_link(struct nkfs_inode* dir, const char* name, struct nkfs_inode* inode) {
+    struct nkfs_btree_cursor cursor;
+    struct nkfs_dirent dirent;
+    int ret;
+
+    if (!NKFS_S_ISDIR(dir->disk.mode))
+        return -ENOTDIR;
+    if ((ret = make_dirent(name, strlen(name), &dirent)) < 0)
+        return ret;
+
+    ret = dir_find(dir, &dirent, &cursor);
+    if (ret == 0) {
+        nkfs_btree_release(&cursor);
+        return -EEXIST;
+    }
+    if (ret != -ENOENT)
+        return ret;
+
+    dirent.ino = inode->ino;
+    dirent.type = NKFS_S_ISDIR(inode->disk.mode) ? NKFS_FT_DIR : NKFS_FT_REG;
+    if ((ret = nkfs_btree_insert(dir, DIRENT_SIZE, &dirent)) < 0)
+        return ret;
+
+    inode->disk.links++;
+    nkfs_mark_inode_dirty(inode);
+    dir->disk.size++;
+    nkfs_mark_inode_dirty(dir);
+    return 0;
+}
+
+/* Add a name for an existing inode */
+int nkfs_link(struct nkfs_inode* dir, const char* name, struct nkfs_inode* inode) {
+    nkfs_journal_start(dir->fs);
+    int ret = dir_link(dir, name, inode);
+    nkfs_journal_stop(dir->fs);
+    return ret;
+}
+
+/* Create a new inode and link it; an unlinked inode is freed by iput */
+static int create_inode(struct nkfs_inode* dir, const char* name, uint16_t mode, struct nkfs_inode** result) {
+    struct nkfs_inode* inode;
+    int ret;
+
+    if (!NKFS_S_ISDIR(dir->disk.mode))
+        return -ENOTDIR;
+
+    nkfs_journal_start(dir->fs);
+    if (!(inode = nkfs_new_inode(dir->fs, mode))) {
+        nkfs_journal_stop(dir->fs);
+        return -ENOSPC;
+    }
+
+    if (dir->disk.flags & NKFS_INODE_COMPRESS)
+        inode->disk.flags |= NKFS_INODE_COMPRESS;
+
+    ret = 0;
+    if (NKFS_S_ISDIR(mode)) {
+        inode->disk.parent = dir->ino;
+        ret = nkfs_btree_create(inode);
+    }
+    if (ret == 0)
+        ret = dir_link(dir, name, inode);
+    if (ret < 0)
+        nkfs_iput(inode);
+    else
+        *result = inode;
+    nkfs_journal_stop(dir->fs);
+    return ret;
+}
+
+int nkfs_create(struct nkfs_inode* dir, const char* name, struct nkfs_inode** result) {
+    return create_inode(dir, name, NKFS_S_IFREG | 0644, result);
+}
+
+int nkfs_mkdir(struct nkfs_inode* dir, const char* name, struct nkfs_inode** result) {
+    return create_inode(dir, name, NKFS_S_IFDIR | 0755, result);
+}
+
+static int dir_unlink(struct nkfs_inode* dir, const char* name) {
+    struct nkfs_btree_cursor cursor;
+    struct nkfs_dirent key;
+    int ret;
+
+    if (!NKFS_S_ISDIR(dir->disk.mode))
+        return -ENOTDIR;
+    if ((ret = make_dirent(name, strlen(name), &key)) < 0)
+        return ret;
+    if ((ret = dir_find(dir, &key, &cursor)) < 0)
+        return ret;
+
+    struct nkfs_dirent* dirent = nkfs_btree_record(&cursor, DIRENT_SIZE);
+    struct nkfs_inode* inode = nkfs_iget(dir->fs, dirent->ino);
+    if (!inode) {
+        nkfs_btree_release(&cursor);
+        return -EIO;
+    }
+    if (NKFS_S_ISDIR(inode->disk.mode) && inode->disk.size > 0) {
+        nkfs_btree_release(&cursor);
+        nkfs_iput(inode);
+        return -ENOTEMPTY;
+    }
+
+    nkfs_btree_delete(&cursor, DIRENT_SIZE);
+    nkfs_btree_release(&cursor);
+    dir->disk.size--;
+    nkfs_mark_inode_dirty(dir);
+
+    inode->disk.links--;
+    nkfs_mark_inode_dirty(inode);
+    nkfs_iput(inode);
+    return 0;
+}
+
+/* Remove a name; the inode goes away with its last link and reference */
+int nkfs_unlink(struct nkfs_inode* dir, const char* name) {
+    nkfs_journal_start(dir->fs);
+    int ret = dir_unlink(dir, name);
+    nkfs_journal_stop(dir->fs);
+    return ret;
+}
+
+/* Call filldir for every entry in hash order until it returns non-zero */
+int nkfs_readdir(struct nkfs_inode* dir, nkfs_filldir_t filldir, void* arg) {
+    struct nkfs_btree_cursor cursor;
+
+    if (!NKFS_S_ISDIR(dir->disk.mode))
+        return -ENOTDIR;
+
+    int ret = nkfs_btree_find(dir, DIRENT_SIZE, 0, NKFS_BTREE_GE, &cursor);
+    while (ret == 0) {
+        struct nkfs_dirent* dirent = nkfs_btree_record(&cursor, DIRENT_SIZE);
+
+        if (filldir(arg, dirent->name, dirent->name_len, dirent->ino, dirent->type)) {
+            nkfs_btree_release(&cursor);
+            return 0;
+        }
+        ret = nkfs_btree_next(dir, DIRENT_SIZE, &cursor);
+    }
+    return ret == -ENOENT ? 0 : ret;
+}
+
+/* Resolve an absolute or root-relative path to a referenced inode */
+int nkfs_namei(struct nkfs_fs* fs, const char* path, struct nkfs_inode** result) {
+    struct nkfs_inode* inode = nkfs_iget(fs, fs->super.root_ino);
+    char name[NKFS_NAME_MAX + 1];
+
+    if (!inode)
+        return -EIO;
+
+    while (*path) {
+        while (*path == '/')
+            path++;
+        if (!*path)
+            break;
+
+        size_t length = 0;
+        while (path[length] && path[length] != '/')
+            length++;
+        if (length > NKFS_NAME_MAX) {
+            nkfs_iput(inode);
+            return -ENAMETOOLONG;
+        }
+        memcpy(name, path, length);
+        name[length] = '\0';
+        path += length;
+
+        if (strcmp(name, ".") == 0)
+            continue;
+
+        uint32_t ino;
+        int ret;
+        if (!NKFS_S_ISDIR(inode->disk.mode))
+            ret = -ENOTDIR;
+        else if (strcmp(name, "..") == 0)
+            ret = (ino = inode->disk.parent) ? 0 : -ENOENT;
+        else
+            ret = nkfs_lookup(inode, name, &ino);
+        if (ret < 0) {
+            nkfs_iput(inode);
+            return ret;
+        }
+
+        struct nkfs_inode* next = nkfs_iget(fs, ino);
+        nkfs_iput(inode);
+        if (!next)
+            return -EIO;
+        inode = next;
+    }
+
+    *result = inode;
+    return 0;
+}
@@ -0,0 +1,863 @@
+/*
+ * nkfs inodes and file data for nekkoOS
+ * Files up to NKFS_INLINE_DATA_SIZE bytes keep their data inside the
+ * inode. Larger files are mapped by extents: up to NKFS_INLINE_EXTENTS in
+ * the inode, then an extent B+tree. Writes only fill page cache pages;
+ * blocks for pages beyond the mapped range are chosen at writeback, when
+ * the whole run of dirty pages is known, so a file written sequentially
+ * lands in one extent. Data blocks are written before the transaction
+ * that maps them commits, so a crash never exposes stale block contents.
+ *
+ * Compressed files are read and written a cluster at a time. Writeback
+ * packs the whole cluster into newly allocated blocks and frees the old
+ * ones, so a cluster never changes size in place.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "list.h"
+#include "hashtable.h"
+#include "radix_tree.h"
+#include "lz4.h"
+#include "nkfs.h"
+#include "pmm.h"
+#include "kmalloc.h"
+#include "errno.h"
+#include "kernel.h"
+
+static struct kmem_cache nkfs_page_cache;
+
+static bool inode_match(const struct hash_node* node, const void* key) {
+    return hash_entry(node, struct nkfs_inode, node)->ino == *(const uint32_t*)key;
+}
+
+static struct nkfs_buf* inode_block(struct nkfs_inode* inode) {
+    return nkfs_bread(inode->fs, inode->fs->super.inode_table + inode->ino / NKFS_INODES_PER_BLOCK);
+}
+
+static inline uint32_t inode_offset(uint32_t ino) {
+    return (ino % NKFS_INODES_PER_BLOCK) * NKFS_INODE_SIZE;
+}
+
+static struct nkfs_inode* inode_alloc(struct nkfs_fs* fs, uint32_t ino) {
+    struct nkfs_inode* inode = kzalloc(sizeof(*inode));
+
+    if (!inode)
+        return NULL;
+    inode->fs = fs;
+    inode->ino = ino;
+    inode->count = 1;
+    inode->pages = RADIX_TREE_INIT;
+    list_init(&inode->dirty_entry);
+    return inode;
+}
+
+/* Referenced in-memory inode, read from the inode table on first use */
+struct nkfs_inode* nkfs_iget(struct nkfs_fs* fs, uint32_t ino) {
+    if (ino == 0 || ino >= fs->super.inodes_count)
+        return NULL;
+
+    struct hash_node* node = hash_lookup(&fs->inode_table, hash_u32(ino), inode_match, &ino);
+    if (node) {
+        struct nkfs_inode* inode = hash_entry(node, struct nkfs_inode, node);
+        inode->count++;
+        return inode;
+    }
+
+    struct nkfs_inode* inode = inode_alloc(fs, ino);
+    if (!inode)
+        return NULL;
+
+    struct nkfs_buf* buf = inode_block(inode);
+    if (!buf) {
+        kfree(inode);
+        return NULL;
+    }
+    memcpy(&inode->disk, buf->data + inode_offset(ino), sizeof(inode->disk));
+    nkfs_brelse(buf);
+
+    hash_insert(&fs->inode_table, &inode->node, hash_u32(ino));
+    return inode;
+}
+
+/* New inode with no links; regular files start out with inline data */
+struct nkfs_inode* nkfs_new_inode(struct nkfs_fs* fs, uint16_t mode) {
+    uint32_t ino = nkfs_alloc_inode(fs);
+    if (!ino)
+        return NULL;
+
+    struct nkfs_inode* inode = inode_alloc(fs, ino);
+    if (!inode) {
+        nkfs_free_inode(fs, ino);
+        return NULL;
+    }
+    inode->disk.mode = mode;
+    if (NKFS_S_ISREG(mode))
+        inode->disk.flags = NKFS_INODE_INLINE_DATA;
+
+    hash_insert(&fs->inode_table, &inode->node, hash_u32(ino));
+    nkfs_mark_inode_dirty(inode);
+    return inode;
+}
+
+/* Inodes with dirty metadata or dirty pages sit on the mount's dirty list */
+static void inode_track_dirty(struct nkfs_inode* inode) {
+    if (list_empty(&inode->dirty_entry))
+        list_add_tail(&inode->dirty_entry, &inode->fs->dirty_inodes);
+}
+
+static void inode_untrack_dirty(struct nkfs_inode* inode) {
+    if (!inode->dirty && !inode->nr_dirty)
+        list_del(&inode->dirty_entry);
+}
+
+void nkfs_mark_inode_dirty(struct nkfs_inode* inode) {
+    inode->dirty = true;
+    inode_track_dirty(inode);
+}
+
+int nkfs_write_inode(struct nkfs_inode* inode) {
+    if (!inode->dirty)
+        return 0;
+
+    struct nkfs_buf* buf = inode_block(inode);
+    if (!buf)
+        return -EIO;
+    memcpy(buf->data + inode_offset(inode->ino), &inode->disk, sizeof(inode->disk));
+    nkfs_bdirty(buf);
+    nkfs_brelse(buf);
+
+    inode->trans = inode->fs->journal.running.seq;
+    inode->dirty = false;
+    inode_untrack_dirty(inode);
+    return 0;
+}
+
+/* Compression applies to a file only while it has no blocks */
+int nkfs_set_compress(struct nkfs_inode* inode, bool compress) {
+    if (!NKFS_S_ISDIR(inode->disk.mode) && inode->disk.blocks)
+        return -EBUSY;
+
+    if (compress)
+        inode->disk.flags |= NKFS_INODE_COMPRESS;
+    else
+        inode->disk.flags &= ~NKFS_INODE_COMPRESS;
+    nkfs_mark_inode_dirty(inode);
+    return 0;
+}
+
+/* Extent containing a logical block; -ENOENT for a hole */
+static int find_extent(struct nkfs_inode* inode, uint32_t logical, struct nkfs_extent* extent) {
+    if (inode->disk.flags & NKFS_INODE_EXTENT_TREE) {
+        struct nkfs_btree_cursor cursor;
+        int ret = nkfs_btree_find(inode, sizeof(*extent), logical, NKFS_BTREE_LE, &cursor);
+        if (ret < 0)
+            return ret;
+        memcpy(extent, nkfs_btree_record(&cursor, sizeof(*extent)), sizeof(*extent));
+        nkfs_btree_release(&cursor);
+    } else {
+        /* Last inline extent starting at or before the block */
+        uint32_t low = 0;
+        uint32_t high = inode->disk.nr_extents;
+        while (low < high) {
+            uint32_t mid = (low + high) / 2;
+            if (inode->disk.i.extents[mid].logical <= logical)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        if (low == 0)
+            return -ENOENT;
+        *extent = inode->disk.i.extents[low - 1];
+    }
+    return logical - extent->logical < nkfs_extent_span(extent) ? 0 : -ENOENT;
+}
+
+/*
+ * Disk block behind a logical file block; *block is 0 for a hole. Blocks
+ * inside a compressed cluster have no block of their own (-EINVAL).
+ */
+int nkfs_map_block(struct nkfs_inode* inode, uint32_t logical, uint32_t* block) {
+    struct nkfs_extent extent;
+    int ret = find_extent(inode, logical, &extent);
+
+    *block = 0;
+    if (ret == -ENOENT)
+        return 0;
+    if (ret < 0)
+        return ret;
+    if (extent.len & NKFS_EXTENT_COMPRESSED)
+        return -EINVAL;
+    *block = extent.start + (logical - extent.logical);
+    return 0;
+}
+
+/* Move the inline extents into a new extent tree */
+static int extents_to_tree(struct nkfs_inode* inode) {
+    struct nkfs_extent extents[NKFS_INLINE_EXTENTS];
+    uint32_t count = inode->disk.nr_extents;
+
+    memcpy(extents, inode->disk.i.extents, sizeof(extents));
+    memset(&inode->disk.i, 0, sizeof(inode->disk.i));
+    inode->disk.nr_extents = 0;
+    inode->disk.flags |= NKFS_INODE_EXTENT_TREE;
+    nkfs_mark_inode_dirty(inode);
+
+    for (uint32_t i = 0; i < count; i++) {
+        int ret = nkfs_btree_insert(inode, sizeof(extents[i]), &extents[i]);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+/*
+ * Map a new run of blocks, growing the previous extent when it is
+ * contiguous. Compressed files keep one extent per cluster.
+ */
+static int add_extent(struct nkfs_inode* inode, uint32_t logical, uint32_t start, uint32_t len) {
+    struct nkfs_extent extent = { .logical = logical, .start = start, .len = len };
+    bool merge = !(inode->disk.flags & NKFS_INODE_COMPRESS);
+
+    if (!(inode->disk.flags & NKFS_INODE_EXTENT_TREE)) {
+        struct nkfs_extent* extents = inode->disk.i.extents;
+        uint32_t count = inode->disk.nr_extents;
+        uint32_t pos = 0;
+
+        while (pos < count && extents[pos].logical < logical)
+            pos++;
+        if (merge && pos > 0 && extents[pos - 1].logical + extents[pos - 1].len == logical &&
+            extents[pos - 1].start + extents[pos - 1].len == start) {
+            extents[pos - 1].len += len;
+            nkfs_mark_inode_dirty(inode);
+            return 0;
+        }
+        if (count < NKFS_INLINE_EXTENTS) {
+            memmove(&extents[pos + 1], &extents[pos], (count - pos) * sizeof(extent));
+            extents[pos] = extent;
+            inode->disk.nr_extents++;
+            nkfs_mark_inode_dirty(inode);
+            return 0;
+        }
+
+        int ret = extents_to_tree(inode);
+        if (ret < 0)
+            return ret;
+    }
+
+    struct nkfs_btree_cursor cursor;
+    if (merge && nkfs_btree_find(inode, sizeof(extent), logical, NKFS_BTREE_LE, &cursor) == 0) {
+        struct nkfs_extent* prev = nkfs_btree_record(&cursor, sizeof(extent));
+        if (prev->logical + prev->len == logical && prev->start + prev->len == start) {
+            prev->len += len;
+            nkfs_bdirty(cursor.leaf);
+            nkfs_btree_release(&cursor);
+            return 0;
+        }
+        nkfs_btree_release(&cursor);
+    }
+    return nkfs_btree_insert(inode, sizeof(extent), &extent);
+}
+
+/* Unmap the extent starting at logical; its blocks are left to the caller */
+static int remove_extent(struct nkfs_inode* inode, uint32_t logical) {
+    if (!(inode->disk.flags & NKFS_INODE_EXTENT_TREE)) {
+        struct nkfs_extent* extents = inode->disk.i.extents;
+        uint32_t count = inode->disk.nr_extents;
+
+        for (uint32_t pos = 0; pos < count; pos++) {
+            if (extents[pos].logical == logical) {
+                memmove(&extents[pos], &extents[pos + 1], (count - pos - 1) * sizeof(*extents));
+                inode->disk.nr_extents--;
+                nkfs_mark_inode_dirty(inode);
+                return 0;
+            }
+        }
+        return -ENOENT;
+    }
+
+    struct nkfs_btree_cursor cursor;
+    int ret = nkfs_btree_find(inode, sizeof(struct nkfs_extent), logical, NKFS_BTREE_LE, &cursor);
+    if (ret < 0)
+        return ret;
+    if (((struct nkfs_extent*)nkfs_btree_record(&cursor, sizeof(struct nkfs_extent)))->logical != logical)
+        ret = -ENOENT;
+    else
+        nkfs_btree_delete(&cursor, sizeof(struct nkfs_extent));
+    nkfs_btree_release(&cursor);
+    return ret;
+}
+
+/* Number of extents mapping the file */
+uint32_t nkfs_extent_count(struct nkfs_inode* inode) {
+    struct nkfs_btree_cursor cursor;
+    uint32_t count = 0;
+
+    if (!(inode->disk.flags & NKFS_INODE_EXTENT_TREE))
+        return inode->disk.flags & NKFS_INODE_INLINE_DATA ? 0 : inode->disk.nr_extents;
+
+    if (nkfs_btree_find(inode, sizeof(struct nkfs_extent), 0, NKFS_BTREE_GE, &cursor) == 0) {
+        do {
+            count++;
+        } while (nkfs_btree_next(inode, sizeof(struct nkfs_extent), &cursor) == 0);
+    }
+    return count;
+}
+
+/* Release every data block and tree node of an inode */
+static void free_inode_blocks(struct nkfs_inode* inode) {
+    struct nkfs_fs* fs = inode->fs;
+
+    if (NKFS_S_ISDIR(inode->disk.mode)) {
+        nkfs_btree_free(inode);
+    } else if (inode->disk.flags & NKFS_INODE_EXTENT_TREE) {
+        struct nkfs_btree_cursor cursor;
+        if (nkfs_btree_find(inode, sizeof(struct nkfs_extent), 0, NKFS_BTREE_GE, &cursor) == 0) {
+            do {
+                struct nkfs_extent* extent = nkfs_btree_record(&cursor, sizeof(*extent));
+                nkfs_free_blocks(fs, extent->start, nkfs_extent_blocks(extent));
+                inode->disk.blocks -= nkfs_extent_blocks(extent);
+            } while (nkfs_btree_next(inode, sizeof(struct nkfs_extent), &cursor) == 0);
+        }
+        nkfs_btree_free(inode);
+    } else if (!(inode->disk.flags & NKFS_INODE_INLINE_DATA)) {
+        for (uint32_t i = 0; i < inode->disk.nr_extents; i++) {
+            struct nkfs_extent* extent = &inode->disk.i.extents[i];
+            nkfs_free_blocks(fs, extent->start, nkfs_extent_blocks(extent));
+            inode->disk.blocks -= nkfs_extent_blocks(extent);
+        }
+    }
+}
+
+/* Compression buffers: cluster data, packed cluster and LZ4 scratch */
+#define CLUSTER_BUF_PAGES   (2 * NKFS_CLUSTER_BLOCKS + LZ4_WORKMEM_SIZE / PAGE_SIZE)
+
+static int cluster_buffers(struct nkfs_fs* fs) {
+    if (fs->cluster_data)
+        return 0;
+
+    uint8_t* buffers = page_alloc(CLUSTER_BUF_PAGES);
+    if (!buffers)
+        return -ENOMEM;
+    fs->cluster_data = buffers;
+    fs->cluster_packed = buffers + NKFS_CLUSTER_SIZE;
+    fs->lz4_work = buffers + 2 * NKFS_CLUSTER_SIZE;
+    return 0;
+}
+
+void nkfs_free_cluster_buffers(struct nkfs_fs* fs) {
+    if (fs->cluster_data)
+        page_free(fs->cluster_data, CLUSTER_BUF_PAGES);
+    fs->cluster_data = NULL;
+}
+
+/* Page cache */
+static int page_insert(struct nkfs_inode* inode, uint32_t index, uint8_t* data, struct nkfs_page** result) {
+    if (!nkfs_page_cache.size)
+        kmem_cache_init(&nkfs_page_cache, "nkfs_page", sizeof(struct nkfs_page));
+
+    struct nkfs_page* page = kmem_cache_alloc(&nkfs_page_cache);
+    if (!page)
+        return -ENOMEM;
+    page->flags = 0;
+    page->data = data;
+
+    int ret = radix_tree_insert(&inode->pages, index, page);
+    if (ret < 0) {
+        kmem_cache_free(&nkfs_page_cache, page);
+        return ret;
+    }
+    inode->nr_pages++;
+    *result = page;
+    return 0;
+}
+
+/* Decompress a cluster stored at extent into NKFS_CLUSTER_SIZE bytes at data */
+static int cluster_unpack(struct nkfs_fs* fs, const struct nkfs_extent* extent, uint8_t* data) {
+    struct nkfs_cluster_header* header = (struct nkfs_cluster_header*)fs->cluster_packed;
+    uint32_t blocks = nkfs_extent_blocks(extent);
+    int ret = 0;
+
+    if (blocks >= NKFS_CLUSTER_BLOCKS)
+        return -EIO;
+    for (uint32_t i = 0; i < blocks && ret == 0; i++)
+        ret = nkfs_block_read(fs, extent->start + i, fs->cluster_packed + i * NKFS_BLOCK_SIZE);
+    if (ret < 0)
+        return ret;
+    if (header->length > blocks * NKFS_BLOCK_SIZE - sizeof(*header))
+        return -EIO;
+
+    ssize_t length = lz4_decompress(header + 1, header->length, data, NKFS_CLUSTER_SIZE);
+    if (length < 0)
+        return -EIO;
+    memset(data + length, 0, NKFS_CLUSTER_SIZE - length);
+    return 0;
+}
+
+/*
+ * Bring a cluster of a compressed file into the page cache. It is read or
+ * decompressed straight into a fresh run of pages, which become the cache
+ * pages; copies of pages that were already cached are freed.
+ */
+static int cluster_read(struct nkfs_inode* inode, uint32_t cluster) {
+    struct nkfs_fs* fs = inode->fs;
+    uint32_t first = cluster << NKFS_CLUSTER_SHIFT;
+    struct nkfs_extent extent;
+
+    uint8_t* data = page_alloc(NKFS_CLUSTER_BLOCKS);
+    if (!data)
+        return -ENOMEM;
+
+    int ret = find_extent(inode, first, &extent);
+    if (ret == -ENOENT) {
+        memset(data, 0, NKFS_CLUSTER_SIZE);
+        ret = 0;
+    } else if (ret == 0 && (extent.logical != first || nkfs_extent_span(&extent) > NKFS_CLUSTER_BLOCKS)) {
+        ret = -EIO;
+    } else if (ret == 0 && (extent.len & NKFS_EXTENT_COMPRESSED)) {
+        if ((ret = cluster_buffers(fs)) == 0)
+            ret = cluster_unpack(fs, &extent, data);
+    } else if (ret == 0) {
+        memset(data + extent.len * NKFS_BLOCK_SIZE, 0, (NKFS_CLUSTER_BLOCKS - extent.len) * NKFS_BLOCK_SIZE);
+        for (uint32_t i = 0; i < extent.len && ret == 0; i++)
+            ret = nkfs_block_read(fs, extent.start + i, data + i * NKFS_BLOCK_SIZE);
+    }
+    if (ret < 0) {
+        page_free(data, NKFS_CLUSTER_BLOCKS);
+        return ret;
+    }
+
+    for (uint32_t i = 0; i < NKFS_CLUSTER_BLOCKS; i++) {
+        uint8_t* page_data = data + i * PAGE_SIZE;
+        struct nkfs_page* page;
+
+        if (radix_tree_lookup(&inode->pages, first + i) || page_insert(inode, first + i, page_data, &page) < 0)
+            page_free(page_data, 1);
+    }
+    return 0;
+}
+
+static int page_get(struct nkfs_inode* inode, uint32_t index, bool fill, struct nkfs_page** result) {
+    struct nkfs_page* page = radix_tree_lookup(&inode->pages, index);
+
+    if (page) {
+        *result = page;
+        return 0;
+    }
+
+    if (fill && (inode->disk.flags & NKFS_INODE_COMPRESS)) {
+        int ret = cluster_read(inode, index >> NKFS_CLUSTER_SHIFT);
+        if (ret < 0)
+            return ret;
+        *result = radix_tree_lookup(&inode->pages, index);
+        return *result ? 0 : -ENOMEM;
+    }
+
+    uint8_t* data = page_alloc(1);
+    if (!data)
+        return -ENOMEM;
+
+    /* Pages about to be overwritten completely are not read */
+    int ret = 0;
+    if (fill) {
+        uint32_t block;
+        ret = nkfs_map_block(inode, index, &block);
+        if (ret == 0 && block)
+            ret = nkfs_block_read(inode->fs, block, data);
+        else if (ret == 0)
+            memset(data, 0, PAGE_SIZE);
+    }
+    if (ret == 0)
+        ret = page_insert(inode, index, data, result);
+    if (ret < 0)
+        page_free(data, 1);
+    return ret;
+}
+
+static void page_set_dirty(struct nkfs_inode* inode, struct nkfs_page* page) {
+    if (page->flags & NKFS_PAGE_DIRTY)
+        return;
+    page->flags |= NKFS_PAGE_DIRTY;
+    inode->nr_dirty++;
+    inode->fs->nr_dirty_pages++;
+    inode_track_dirty(inode);
+}
+
+static void page_clear_dirty(struct nkfs_inode* inode, struct nkfs_page* page) {
+    if (!(page->flags & NKFS_PAGE_DIRTY))
+        return;
+    page->flags &= ~NKFS_PAGE_DIRTY;
+    inode->nr_dirty--;
+    inode->fs->nr_dirty_pages--;
+    inode_untrack_dirty(inode);
+}
+
+/* Free cached pages: clean ones only, or all of them (dirty data is lost) */
+static void drop_pages(struct nkfs_inode* inode, bool all) {
+    uint32_t index = 0;
+    struct nkfs_page* page;
+
+    while ((page = radix_tree_find_next(&inode->pages, &index))) {
+        if (all || !(page->flags & NKFS_PAGE_DIRTY)) {
+            page_clear_dirty(inode, page);
+            radix_tree_delete(&inode->pages, index);
+            page_free(page->data, 1);
+            kmem_cache_free(&nkfs_page_cache, page);
+            inode->nr_pages--;
+        }
+        if (++index == 0)
+            break;
+    }
+}
+
+struct reclaim_control {
+    struct cgroup* cg;
+    uint32_t nr_pages;
+    uint32_t freed;
+};
+
+static void reclaim_inode_pages(struct hash_node* node, void* arg) {
+    struct nkfs_inode* inode = hash_entry(node, struct nkfs_inode, node);
+    struct reclaim_control* rc = arg;
+    uint32_t index = 0;
+    struct nkfs_page* page;
+
+    while (rc->freed < rc->nr_pages && (page = radix_tree_find_next(&inode->pages, &index))) {
+        if (!(page->flags & NKFS_PAGE_DIRTY) && mem_cgroup_page_in(rc->cg, page->data)) {
+            radix_tree_delete(&inode->pages, index);
+            page_free(page->data, 1);
+            kmem_cache_free(&nkfs_page_cache, page);
+            inode->nr_pages--;
+            rc->freed++;
+        }
+        if (++index == 0)
+            break;
+    }
+}
+
+/*
+ * Memory limit reclaim: clean cached pages charged to a group. Skips the
+ * mount while an operation holds it, since that operation may be the one
+ * allocating and may be using the pages.
+ */
+uint32_t nkfs_reclaim(struct mem_shrinker* shrinker, struct cgroup* cg, uint32_t nr_pages) {
+    struct nkfs_fs* fs = CONTAINER_OF(shrinker, struct nkfs_fs, shrinker);
+    struct reclaim_control rc = { .cg = cg, .nr_pages = nr_pages, .freed = 0 };
+
+    if (!nkfs_trylock(fs))
+        return 0;
+    hash_table_foreach(&fs->inode_table, reclaim_inode_pages, &rc);
+    nkfs_unlock(fs);
+    return rc.freed;
+}
+
+void nkfs_iput(struct nkfs_inode* inode) {
+    if (!inode || --inode->count > 0)
+        return;
+
+    struct nkfs_fs* fs = inode->fs;
+    nkfs_journal_start(fs);
+    if (inode->disk.links == 0) {
+        /* Last reference to an unlinked inode: give everything back */
+        drop_pages(inode, true);
+        free_inode_blocks(inode);
+        memset(&inode->disk, 0, sizeof(inode->disk));
+        inode->dirty = true;
+        nkfs_write_inode(inode);
+        nkfs_free_inode(fs, inode->ino);
+    } else {
+        nkfs_writeback(inode);
+        nkfs_write_inode(inode);
+        drop_pages(inode, true);
+    }
+    nkfs_journal_stop(fs);
+
+    inode->dirty = false;
+    inode_untrack_dirty(inode);
+    hash_remove(&fs->inode_table, &inode->node);
+    kfree(inode);
+}
+
+ssize_t nkfs_read(struct nkfs_inode* inode, uint32_t offset, void* buffer, size_t length) {
+    uint8_t* dest = buffer;
+
+    if (NKFS_S_ISDIR(inode->disk.mode))
+        return -EISDIR;
+    if (offset >= inode->disk.size)
+        return 0;
+    length = MIN(length, (size_t)(inode->disk.size - offset));
+
+    if (inode->disk.flags & NKFS_INODE_INLINE_DATA) {
+        memcpy(dest, inode->disk.i.data + offset, length);
+        return length;
+    }
+
+    size_t done = 0;
+    while (done < length) {
+        uint32_t pos = offset + done;
+        uint32_t in_page = pos & (PAGE_SIZE - 1);
+        size_t chunk = MIN(PAGE_SIZE - in_page, length - done);
+        struct nkfs_page* page;
+
+        int ret = page_get(inode, pos >> PAGE_SHIFT, true, &page);
+        if (ret < 0)
+            return done ? (ssize_t)done : ret;
+        memcpy(dest + done, page->data + in_page, chunk);
+        done += chunk;
+    }
+
+    if (inode->nr_pages > NKFS_CACHE_PAGES)
+        drop_pages(inode, false);
+    return done;
+}
+
+/* Inline data outgrew the inode: it becomes the first (dirty) page */
+static int inline_to_pages(struct nkfs_inode* inode) {
+    struct nkfs_page* page;
+    int ret = page_get(inode, 0, false, &page);
+
+    if (ret < 0)
+        return ret;
+    memset(page->data, 0, PAGE_SIZE);
+    memcpy(page->data, inode->disk.i.data, inode->disk.size);
+    page_set_dirty(inode, page);
+
+    memset(&inode->disk.i, 0, sizeof(inode->disk.i));
+    inode->disk.flags &= ~NKFS_INODE_INLINE_DATA;
+    inode->disk.nr_extents = 0;
+    nkfs_mark_inode_dirty(inode);
+    return 0;
+}
+
+ssize_t nkfs_write(struct nkfs_inode* inode, uint32_t offset, const void* buffer, size_t length) {
+    const uint8_t* src = buffer;
+    uint32_t end = offset + length;
+    int ret;
+
+    if (NKFS_S_ISDIR(inode->disk.mode))
+        return -EISDIR;
+    if (end < offset)
+        return -EINVAL;
+    if (length == 0)
+        return 0;
+
+    if (inode->disk.flags & NKFS_INODE_INLINE_DATA) {
+        if (end <= NKFS_INLINE_DATA_SIZE) {
+            if (offset > inode->disk.size)
+                memset(inode->disk.i.data + inode->disk.size, 0, offset - inode->disk.size);
+            memcpy(inode->disk.i.data + offset, src, length);
+            inode->disk.size = MAX(inode->disk.size, end);
+            nkfs_mark_inode_dirty(inode);
+            return length;
+        }
+        if ((ret = inline_to_pages(inode)) < 0)
+            return ret;
+    }
+
+    size_t done = 0;
+    while (done < length) {
+        uint32_t pos = offset + done;
+        uint32_t in_page = pos & (PAGE_SIZE - 1);
+        size_t chunk = MIN(PAGE_SIZE - in_page, length - done);
+        struct nkfs_page* page;
+
+        ret = page_get(inode, pos >> PAGE_SHIFT, chunk != PAGE_SIZE, &page);
+        if (ret < 0)
+            break;
+        memcpy(page->data + in_page, src + done, chunk);
+        page_set_dirty(inode, page);
+        done += chunk;
+    }
+
+    if (offset + done > inode->disk.size) {
+        inode->disk.size = offset + done;
+        nkfs_mark_inode_dirty(inode);
+    }
+    if (inode->fs->nr_dirty_pages > NKFS_DIRTY_LIMIT)
+        nkfs_writeback(inode);
+    return done ? (ssize_t)done : ret;
+}
+
+/*
+ * Write back one cluster of a compressed file into new blocks, then swap
+ * the mapping and free the old blocks. A cluster that does not shrink by
+ * at least a block is stored raw.
+ */
+static int cluster_write(struct nkfs_inode* inode, uint32_t cluster) {
+    struct nkfs_fs* fs = inode->fs;
+    struct nkfs_page* pages[NKFS_CLUSTER_BLOCKS];
+    uint32_t first = cluster << NKFS_CLUSTER_SHIFT;
+    uint32_t offset = first << PAGE_SHIFT;
+    struct nkfs_extent extent;
+    int ret;
+
+    if ((ret = cluster_buffers(fs)) < 0)
+        return ret;
+
+    uint32_t length = inode->disk.size > offset ? MIN(inode->disk.size - offset, NKFS_CLUSTER_SIZE) : 0;
+    uint32_t count = (length + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    for (uint32_t i = 0; i < count; i++) {
+        if ((ret = page_get(inode, first + i, true, &pages[i])) < 0)
+            return ret;
+        memcpy(fs->cluster_data + (i << PAGE_SHIFT), pages[i]->data, PAGE_SIZE);
+    }
+
+    struct nkfs_cluster_header* header = (struct nkfs_cluster_header*)fs->cluster_packed;
+    size_t packed = 0;
+    if (count > 1)
+        packed = lz4_compress(fs->cluster_data, length, header + 1,
+                              (count - 1) * NKFS_BLOCK_SIZE - sizeof(*header), fs->lz4_work);
+    uint32_t blocks = count;
+    if (packed) {
+        blocks = (sizeof(*header) + packed + NKFS_BLOCK_SIZE - 1) / NKFS_BLOCK_SIZE;
+        header->length = packed;
+        memset((uint8_t*)(header + 1) + packed, 0, blocks * NKFS_BLOCK_SIZE - sizeof(*header) - packed);
+    }
+
+    /* Place the cluster after the previous one */
+    uint32_t goal = fs->alloc_goal;
+    if (first > 0 && find_extent(inode, first - 1, &extent) == 0)
+        goal = extent.start + nkfs_extent_blocks(&extent);
+
+    uint32_t allocated = 0;
+    uint32_t start = blocks ? nkfs_alloc_blocks(fs, goal, blocks, &allocated) : 0;
+    if (allocated < blocks) {
+        if (start)
+            nkfs_release_blocks(fs, start, allocated);
+        return -ENOSPC;
+    }
+    for (uint32_t i = 0; i < blocks && ret == 0; i++)
+        ret = nkfs_block_write(fs, start + i, packed ? fs->cluster_packed + i * NKFS_BLOCK_SIZE : pages[i]->data);
+    if (ret < 0) {
+        nkfs_release_blocks(fs, start, blocks);
+        return ret;
+    }
+
+    if (find_extent(inode, first, &extent) == 0 && (ret = remove_extent(inode, first)) == 0) {
+        nkfs_free_blocks(fs, extent.start, nkfs_extent_blocks(&extent));
+        inode->disk.blocks -= nkfs_extent_blocks(&extent);
+    }
+    if (ret == 0 && blocks)
+        ret = add_extent(inode, first, start, packed ? blocks | NKFS_EXTENT_COMPRESSED : blocks);
+    if (ret < 0) {
+        nkfs_free_blocks(fs, start, blocks);
+        return ret;
+    }
+    inode->disk.blocks += blocks;
+    nkfs_mark_inode_dirty(inode);
+
+    for (uint32_t i = 0; i < NKFS_CLUSTER_BLOCKS; i++) {
+        struct nkfs_page* page = radix_tree_lookup(&inode->pages, first + i);
+        if (page)
+            page_clear_dirty(inode, page);
+    }
+    return 0;
+}
+
+/* Dirty pages from index on that have no block yet, at most max */
+static uint32_t delalloc_run(struct nkfs_inode* inode, uint32_t index, uint32_t max) {
+    uint32_t run = 1;
+
+    while (run < max) {
+        struct nkfs_page* page = radix_tree_lookup(&inode->pages, index + run);
+        uint32_t block;
+
+        if (!page || !(page->flags & NKFS_PAGE_DIRTY))
+            break;
+        if (nkfs_map_block(inode, index + run, &block) < 0 || block)
+            break;
+        run++;
+    }
+    return run;
+}
+
+/*
+ * Write every dirty page. Mapped pages go back in place; each run of
+ * unmapped pages gets one allocation, placed right after the block that
+ * maps the page before it when possible.
+ */
+int nkfs_writeback(struct nkfs_inode* inode) {
+    struct nkfs_fs* fs = inode->fs;
+    struct nkfs_page* page;
+    uint32_t index = 0;
+    int ret = 0;
+
+    nkfs_journal_start(fs);
+    while (inode->nr_dirty && (page = radix_tree_find_next(&inode->pages, &index))) {
+        uint32_t block;
+
+        if (!(page->flags & NKFS_PAGE_DIRTY)) {
+            index++;
+            continue;
+        }
+        if (inode->disk.flags & NKFS_INODE_COMPRESS) {
+            uint32_t cluster = index >> NKFS_CLUSTER_SHIFT;
+            if ((ret = cluster_write(inode, cluster)) < 0)
+                break;
+            index = (cluster + 1) << NKFS_CLUSTER_SHIFT;
+            continue;
+        }
+        if ((ret = nkfs_map_block(inode, index, &block)) < 0)
+            break;
+
+        if (block) {
+            if ((ret = nkfs_block_write(fs, block, page->data)) < 0)
+                break;
+            page_clear_dirty(inode, page);
+            index++;
+            continue;
+        }
+
+        uint32_t run = delalloc_run(inode, index, inode->nr_dirty);
+        uint32_t goal = fs->alloc_goal;
+        uint32_t prev;
+        if (index > 0 && nkfs_map_block(inode, index - 1, &prev) == 0 && prev)
+            goal = prev + 1;
+
+        uint32_t allocated;
+        uint32_t start = nkfs_alloc_blocks(fs, goal, run, &allocated);
+        if (!start) {
+            ret = -ENOSPC;
+            break;
+        }
+        if ((ret = add_extent(inode, index, start, allocated)) < 0) {
+            nkfs_free_blocks(fs, start, allocated);
+            break;
+        }
+        inode->disk.blocks += allocated;
+        nkfs_mark_inode_dirty(inode);
+
+        for (uint32_t i = 0; i < allocated; i++) {
+            page = radix_tree_lookup(&inode->pages, index + i);
+            if ((ret = nkfs_block_write(fs, start + i, page->data)) < 0)
+                break;
+            page_clear_dirty(inode, page);
+        }
+        if (ret < 0)
+            break;
+        index += allocated;
+    }
+    nkfs_journal_stop(fs);
+
+    if (inode->nr_pages > NKFS_CACHE_PAGES)
+        drop_pages(inode, false);
+    return ret;
+}
+
+/*
+ * Make a file's data and metadata durable: wait for the transaction that
+ * last logged the inode. Concurrent fsyncs share one commit.
+ */
+int nkfs_fsync(struct nkfs_inode* inode) {
+    struct nkfs_fs* fs = inode->fs;
+
+    nkfs_journal_start(fs);
+    int ret = nkfs_writeback(inode);
+    if (ret == 0)
+        ret = nkfs_write_inode(inode);
+    nkfs_journal_stop(fs);
+
+    if (ret == 0)
+        ret = nkfs_journal_wait(fs, inode->trans);
+    return ret;
+}
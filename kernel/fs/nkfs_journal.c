@@ -0,0 +1,613 @@
+/*
+ * nkfs metadata journal for nekkoOS
+ * Every metadata block an operation dirties joins the running transaction
+ * and stays pinned in the block cache until the transaction is in the
+ * log; only then is it written in place (checkpointed). A commit runs
+ * when fsync waits for one, when the running transaction gets too big
+ * for the log, and NKFS_COMMIT_INTERVAL_MS after the transaction started.
+ *
+ * fsync does not commit by itself: it queues the commit work and sleeps,
+ * so every operation that gets the mount lock before the work does rides
+ * on the same commit (group commit). Checkpoints run from their own work
+ * item once half of the log is in use, and advance the tail recorded in
+ * the journal superblock.
+ *
+ * File data is written in place before the metadata pointing at it is
+ * committed, and blocks freed by a transaction are not reused before it
+ * has committed, so recovery never exposes stale data. The bitmap update
+ * for those blocks goes into the next transaction; a crash in between
+ * leaks them.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "list.h"
+#include "hashtable.h"
+#include "crc32.h"
+#include "nkfs.h"
+#include "kmalloc.h"
+#include "pmm.h"
+#include "sched.h"
+#include "workqueue.h"
+#include "errno.h"
+#include "kernel.h"
+
+static inline struct nkfs_fs* journal_fs(struct nkfs_journal* journal) {
+    return CONTAINER_OF(journal, struct nkfs_fs, journal);
+}
+
+static inline uint32_t log_block(struct nkfs_journal* journal, uint32_t pos) {
+    return journal->start + pos;
+}
+
+static inline uint32_t log_next(struct nkfs_journal* journal, uint32_t pos) {
+    return pos + 1 == journal->size ? 0 : pos + 1;
+}
+
+static uint32_t log_used(struct nkfs_journal* journal) {
+    if (journal->head >= journal->tail)
+        return journal->head - journal->tail;
+    return journal->size - journal->tail + journal->head;
+}
+
+/* Log blocks a transaction needs: descriptors, block copies and the commit */
+static uint32_t trans_blocks(const struct nkfs_transaction* trans) {
+    uint32_t tags = trans->nr_buffers + trans->nr_revokes;
+    return (tags + NKFS_JOURNAL_TAGS - 1) / NKFS_JOURNAL_TAGS + trans->nr_buffers + 1;
+}
+
+static void trans_init(struct nkfs_transaction* trans, uint32_t seq) {
+    trans->seq = seq;
+    list_init(&trans->buffers);
+    trans->nr_buffers = 0;
+    trans->nr_revokes = 0;
+    list_init(&trans->frees);
+}
+
+static int write_journal_super(struct nkfs_fs* fs, void* block) {
+    struct nkfs_journal_super* super = block;
+
+    memset(block, 0, NKFS_BLOCK_SIZE);
+    super->header.magic = NKFS_JOURNAL_MAGIC;
+    super->header.type = NKFS_JOURNAL_SUPER;
+    super->tail = fs->journal.tail;
+    super->tail_seq = fs->journal.tail_seq;
+    return nkfs_block_write(fs, fs->super.journal_start, block);
+}
+
+/* Write an empty journal; the log blocks must already be zeroed */
+int nkfs_journal_format(struct nkfs_fs* fs, void* block) {
+    fs->journal.tail = 0;
+    fs->journal.tail_seq = 1;
+    return write_journal_super(fs, block);
+}
+
+static int journal_abort(struct nkfs_fs* fs, int error) {
+    if (!fs->journal.error) {
+        kprintf("nkfs: journal aborted, metadata is no longer written\n");
+        fs->journal.error = error;
+    }
+    wake_up(&fs->journal.commit_wait);
+    return error;
+}
+
+/* Recovery */
+enum {
+    PASS_SCAN,                      /* Check checksums, find the end of the log */
+    PASS_REVOKE,                    /* Collect revoke tags */
+    PASS_REPLAY,                    /* Write block copies home */
+};
+
+struct revoke_entry {
+    struct hash_node node;
+    uint32_t block;
+    uint32_t seq;                   /* Latest transaction that revoked it */
+};
+
+struct recovery {
+    struct hash_table revoked;
+    uint8_t* data;
+    uint32_t end_pos;               /* After the last committed transaction */
+    uint32_t end_seq;
+};
+
+static bool revoke_match(const struct hash_node* node, const void* key) {
+    return hash_entry(node, struct revoke_entry, node)->block == *(const uint32_t*)key;
+}
+
+static struct revoke_entry* revoke_find(struct recovery* rec, uint32_t block) {
+    struct hash_node* node = hash_lookup(&rec->revoked, hash_u32(block), revoke_match, &block);
+    return node ? hash_entry(node, struct revoke_entry, node) : NULL;
+}
+
+static int revoke_add(struct recovery* rec, uint32_t block, uint32_t seq) {
+    struct revoke_entry* entry = revoke_find(rec, block);
+
+    if (!entry) {
+        if (!(entry = kmalloc(sizeof(*entry))))
+            return -ENOMEM;
+        entry->block = block;
+        hash_insert(&rec->revoked, &entry->node, hash_u32(block));
+    }
+    entry->seq = seq;
+    return 0;
+}
+
+static void revoke_free_one(struct hash_node* node, void* arg) {
+    (void)arg;
+    kfree(hash_entry(node, struct revoke_entry, node));
+}
+
+static bool tag_valid(struct nkfs_fs* fs, const struct nkfs_journal_tag* tag) {
+    return tag->block < fs->super.blocks_count &&
+           (tag->block < fs->super.journal_start ||
+            tag->block >= fs->super.journal_start + fs->super.journal_blocks);
+}
+
+/*
+ * One pass over the transaction starting at *pos. Returns 1 and moves
+ * *pos past it if it is complete, 0 where the log ends.
+ */
+static int recover_transaction(struct nkfs_fs* fs, struct recovery* rec, int pass, uint32_t* pos, uint32_t seq) {
+    struct nkfs_journal* journal = &fs->journal;
+    struct nkfs_journal_descriptor* desc = (struct nkfs_journal_descriptor*)journal->block;
+    uint32_t at = *pos;
+    uint32_t crc = 0;
+
+    for (;;) {
+        if (nkfs_block_read(fs, log_block(journal, at), journal->block) < 0)
+            return -EIO;
+        if (desc->header.magic != NKFS_JOURNAL_MAGIC || desc->header.seq != seq)
+            return 0;
+        if (desc->header.type == NKFS_JOURNAL_COMMIT)
+            break;
+        if (desc->header.type != NKFS_JOURNAL_DESCRIPTOR || desc->count > NKFS_JOURNAL_TAGS)
+            return 0;
+
+        crc = crc32(crc, journal->block, NKFS_BLOCK_SIZE);
+        at = log_next(journal, at);
+
+        for (uint32_t i = 0; i < desc->count; i++) {
+            struct nkfs_journal_tag* tag = &desc->tags[i];
+
+            if (!tag_valid(fs, tag))
+                return 0;
+            if (tag->flags & NKFS_TAG_REVOKE) {
+                if (pass == PASS_REVOKE && revoke_add(rec, tag->block, seq) < 0)
+                    return -ENOMEM;
+                continue;
+            }
+
+            if (pass != PASS_REVOKE) {
+                if (nkfs_block_read(fs, log_block(journal, at), rec->data) < 0)
+                    return -EIO;
+                if (pass == PASS_SCAN && crc32(0, rec->data, NKFS_BLOCK_SIZE) != tag->checksum)
+                    return 0;
+                if (pass == PASS_REPLAY) {
+                    struct revoke_entry* revoke = revoke_find(rec, tag->block);
+                    if ((!revoke || revoke->seq <= seq) && nkfs_block_write(fs, tag->block, rec->data) < 0)
+                        return -EIO;
+                }
+            }
+            at = log_next(journal, at);
+        }
+    }
+
+    if (((struct nkfs_journal_commit*)journal->block)->checksum != crc)
+        return 0;
+    *pos = log_next(journal, at);
+    return 1;
+}
+
+static int recover_pass(struct nkfs_fs* fs, struct recovery* rec, int pass) {
+    uint32_t pos = fs->journal.tail;
+    uint32_t seq = fs->journal.tail_seq;
+
+    while (pass == PASS_SCAN || seq != rec->end_seq) {
+        int ret = recover_transaction(fs, rec, pass, &pos, seq);
+        if (ret < 0)
+            return ret;
+        if (ret == 0)
+            return pass == PASS_SCAN ? 0 : -EIO;
+
+        seq++;
+        if (pass == PASS_SCAN) {
+            rec->end_pos = pos;
+            rec->end_seq = seq;
+        }
+    }
+    return 0;
+}
+
+/* Replay every committed transaction between the tail and the end of the log */
+static int journal_recover(struct nkfs_fs* fs) {
+    struct nkfs_journal* journal = &fs->journal;
+    struct recovery rec;
+    int ret = -ENOMEM;
+
+    rec.end_pos = journal->tail;
+    rec.end_seq = journal->tail_seq;
+    rec.data = page_alloc(1);
+    if (!rec.data)
+        return -ENOMEM;
+    if (hash_table_init(&rec.revoked, 0) < 0)
+        goto out_data;
+
+    ret = recover_pass(fs, &rec, PASS_SCAN);
+    if (ret == 0 && rec.end_seq != journal->tail_seq) {
+        kprintf("nkfs: replaying ");
+        kprintf_dec(rec.end_seq - journal->tail_seq);
+        kprintf(" journal transactions\n");
+
+        ret = recover_pass(fs, &rec, PASS_REVOKE);
+        if (ret == 0)
+            ret = recover_pass(fs, &rec, PASS_REPLAY);
+        if (ret == 0) {
+            journal->tail = rec.end_pos;
+            journal->tail_seq = rec.end_seq;
+            ret = write_journal_super(fs, journal->block);
+        }
+    }
+
+    hash_table_foreach(&rec.revoked, revoke_free_one, NULL);
+    hash_table_destroy(&rec.revoked);
+out_data:
+    page_free(rec.data, 1);
+    return ret;
+}
+
+static void commit_work_fn(struct work_struct* work) {
+    struct nkfs_journal* journal = CONTAINER_OF(work, struct nkfs_journal, commit_work.work);
+    struct nkfs_fs* fs = journal_fs(journal);
+
+    nkfs_lock(fs);
+    nkfs_journal_commit(fs);
+    nkfs_unlock(fs);
+}
+
+static void checkpoint_work_fn(struct work_struct* work) {
+    struct nkfs_journal* journal = CONTAINER_OF(work, struct nkfs_journal, checkpoint_work);
+    struct nkfs_fs* fs = journal_fs(journal);
+
+    nkfs_lock(fs);
+    if (!journal->error && nkfs_journal_checkpoint(fs) < 0)
+        journal_abort(fs, -EIO);
+    nkfs_unlock(fs);
+}
+
+/* Read the journal superblock and recover; runs before anything else is read */
+int nkfs_journal_load(struct nkfs_fs* fs) {
+    struct nkfs_journal* journal = &fs->journal;
+    struct nkfs_super* super = &fs->super;
+
+    if (super->journal_blocks < NKFS_JOURNAL_MIN || super->journal_start < super->inode_table ||
+        super->journal_start + super->journal_blocks > super->data_start)
+        return -EINVAL;
+
+    journal->start = super->journal_start + 1;
+    journal->size = super->journal_blocks - 1;
+    journal->group_commit = true;
+    list_init(&journal->checkpoint);
+    wait_queue_init(&journal->commit_wait);
+    delayed_work_init(&journal->commit_work, commit_work_fn);
+    work_init(&journal->checkpoint_work, checkpoint_work_fn);
+
+    journal->block = page_alloc(1);
+    if (!journal->block)
+        return -ENOMEM;
+
+    struct nkfs_journal_super* jsuper = (struct nkfs_journal_super*)journal->block;
+    int ret = nkfs_block_read(fs, super->journal_start, journal->block);
+    if (ret == 0 && (jsuper->header.magic != NKFS_JOURNAL_MAGIC ||
+                     jsuper->header.type != NKFS_JOURNAL_SUPER || jsuper->tail >= journal->size ||
+                     jsuper->tail_seq == 0))
+        ret = -EINVAL;
+    if (ret == 0) {
+        journal->tail = jsuper->tail;
+        journal->tail_seq = jsuper->tail_seq;
+        ret = journal_recover(fs);
+    }
+    if (ret < 0) {
+        page_free(journal->block, 1);
+        journal->block = NULL;
+        return ret;
+    }
+
+    journal->head = journal->tail;
+    journal->free = journal->size;
+    journal->commit_seq = journal->tail_seq - 1;
+    trans_init(&journal->running, journal->tail_seq);
+    return 0;
+}
+
+/* Stop the work items and free the journal; the log must be idle */
+void nkfs_journal_destroy(struct nkfs_fs* fs) {
+    struct nkfs_journal* journal = &fs->journal;
+
+    cancel_delayed_work(&journal->commit_work);
+    flush_work(&journal->commit_work.work);
+    flush_work(&journal->checkpoint_work);
+    if (journal->running.revokes)
+        kfree(journal->running.revokes);
+    page_free(journal->block, 1);
+}
+
+/*
+ * Bracket an operation that changes metadata. When the outermost one
+ * starts, a transaction with less than NKFS_TRANS_RESERVE blocks left of
+ * its share of the log is committed first, so an operation never
+ * straddles two transactions.
+ */
+void nkfs_journal_start(struct nkfs_fs* fs) {
+    struct nkfs_journal* journal = &fs->journal;
+
+    if (journal->handles++ == 0 &&
+        trans_blocks(&journal->running) + NKFS_TRANS_RESERVE > journal->size / 4)
+        nkfs_journal_commit(fs);
+}
+
+void nkfs_journal_stop(struct nkfs_fs* fs) {
+    fs->journal.handles--;
+}
+
+/* Add a dirty buffer to the running transaction */
+void nkfs_journal_dirty(struct nkfs_buf* buf) {
+    struct nkfs_journal* journal = &buf->fs->journal;
+    struct nkfs_transaction* trans = &journal->running;
+
+    buf->dirty = true;
+    if (buf->trans == trans->seq)
+        return;
+
+    buf->trans = trans->seq;
+    buf->count++;
+    list_add_tail(&buf->trans_entry, &trans->buffers);
+    if (trans->nr_buffers++ == 0)
+        queue_delayed_work(system_wq, &journal->commit_work, NKFS_COMMIT_INTERVAL_MS);
+}
+
+/* Drop a buffer whose block was freed from the transaction and the checkpoint list */
+void nkfs_journal_forget(struct nkfs_buf* buf) {
+    if (buf->trans) {
+        list_del(&buf->trans_entry);
+        buf->trans = 0;
+        buf->fs->journal.running.nr_buffers--;
+        nkfs_brelse(buf);
+    }
+    if (!list_empty(&buf->checkpoint_entry)) {
+        list_del(&buf->checkpoint_entry);
+        nkfs_brelse(buf);
+    }
+    buf->dirty = false;
+}
+
+/* A metadata block was freed: older copies in the log must not be replayed */
+void nkfs_journal_revoke(struct nkfs_fs* fs, uint32_t block) {
+    struct nkfs_transaction* trans = &fs->journal.running;
+
+    nkfs_bforget(fs, block);
+    if (trans->nr_revokes == trans->max_revokes) {
+        uint32_t max = trans->max_revokes ? trans->max_revokes * 2 : 64;
+        uint32_t* revokes = kmalloc(max * sizeof(uint32_t));
+
+        if (!revokes) {
+            journal_abort(fs, -ENOMEM);
+            return;
+        }
+        if (trans->revokes) {
+            memcpy(revokes, trans->revokes, trans->nr_revokes * sizeof(uint32_t));
+            kfree(trans->revokes);
+        }
+        trans->revokes = revokes;
+        trans->max_revokes = max;
+    }
+    trans->revokes[trans->nr_revokes++] = block;
+}
+
+/* Hold freed blocks back until the running transaction has committed */
+int nkfs_journal_free(struct nkfs_fs* fs, uint32_t start, uint32_t count) {
+    struct list_head* frees = &fs->journal.running.frees;
+
+    if (!list_empty(frees)) {
+        struct nkfs_free_run* last = list_entry(frees->prev, struct nkfs_free_run, entry);
+        if (last->start + last->count == start) {
+            last->count += count;
+            return 0;
+        }
+    }
+
+    struct nkfs_free_run* run = kmalloc(sizeof(*run));
+    if (!run)
+        return -ENOMEM;
+    run->start = start;
+    run->count = count;
+    list_add_tail(&run->entry, frees);
+    return 0;
+}
+
+/* Write descriptors, block copies and the commit block at the log head */
+static int write_transaction(struct nkfs_fs* fs, struct nkfs_transaction* trans) {
+    struct nkfs_journal* journal = &fs->journal;
+    struct nkfs_journal_descriptor* desc = (struct nkfs_journal_descriptor*)journal->block;
+    struct list_head* next = trans->buffers.next;
+    uint32_t pos = journal->head;
+    uint32_t revoke = 0;
+    uint32_t crc = 0;
+
+    while (revoke < trans->nr_revokes || next != &trans->buffers) {
+        struct list_head* first = next;
+
+        memset(journal->block, 0, NKFS_BLOCK_SIZE);
+        desc->header.magic = NKFS_JOURNAL_MAGIC;
+        desc->header.type = NKFS_JOURNAL_DESCRIPTOR;
+        desc->header.seq = trans->seq;
+
+        /* Revokes first, then as many block copies as fit */
+        while (desc->count < NKFS_JOURNAL_TAGS && revoke < trans->nr_revokes) {
+            struct nkfs_journal_tag* tag = &desc->tags[desc->count++];
+            tag->block = trans->revokes[revoke++];
+            tag->flags = NKFS_TAG_REVOKE;
+        }
+        while (desc->count < NKFS_JOURNAL_TAGS && next != &trans->buffers) {
+            struct nkfs_buf* buf = list_entry(next, struct nkfs_buf, trans_entry);
+            struct nkfs_journal_tag* tag = &desc->tags[desc->count++];
+            tag->block = buf->block;
+            tag->checksum = crc32(0, buf->data, NKFS_BLOCK_SIZE);
+            next = next->next;
+        }
+
+        crc = crc32(crc, journal->block, NKFS_BLOCK_SIZE);
+        if (nkfs_block_write(fs, log_block(journal, pos), journal->block) < 0)
+            return -EIO;
+        pos = log_next(journal, pos);
+
+        for (struct list_head* entry = first; entry != next; entry = entry->next) {
+            struct nkfs_buf* buf = list_entry(entry, struct nkfs_buf, trans_entry);
+            if (nkfs_block_write(fs, log_block(journal, pos), buf->data) < 0)
+                return -EIO;
+            pos = log_next(journal, pos);
+        }
+    }
+
+    struct nkfs_journal_commit* commit = (struct nkfs_journal_commit*)journal->block;
+    memset(journal->block, 0, NKFS_BLOCK_SIZE);
+    commit->header.magic = NKFS_JOURNAL_MAGIC;
+    commit->header.type = NKFS_JOURNAL_COMMIT;
+    commit->header.seq = trans->seq;
+    commit->checksum = crc;
+    if (nkfs_block_write(fs, log_block(journal, pos), journal->block) < 0)
+        return -EIO;
+
+    journal->head = log_next(journal, pos);
+    journal->free -= trans_blocks(trans);
+    return 0;
+}
+
+/* Committed buffers wait for the checkpoint; freed blocks become usable */
+static void finish_transaction(struct nkfs_fs* fs, struct nkfs_transaction* trans, uint32_t start) {
+    struct nkfs_journal* journal = &fs->journal;
+    struct list_head* pos;
+    struct list_head* tmp;
+
+    list_for_each_safe(pos, tmp, &trans->buffers) {
+        struct nkfs_buf* buf = list_entry(pos, struct nkfs_buf, trans_entry);
+
+        list_del(&buf->trans_entry);
+        buf->trans = 0;
+        buf->log_seq = trans->seq;
+        buf->log_pos = start;
+        /* The transaction's reference moves to the checkpoint list */
+        if (list_empty(&buf->checkpoint_entry))
+            list_add_tail(&buf->checkpoint_entry, &journal->checkpoint);
+        else
+            nkfs_brelse(buf);
+    }
+
+    list_for_each_safe(pos, tmp, &trans->frees) {
+        struct nkfs_free_run* run = list_entry(pos, struct nkfs_free_run, entry);
+
+        nkfs_release_blocks(fs, run->start, run->count);
+        list_del(&run->entry);
+        kfree(run);
+    }
+}
+
+/* Commit the running transaction; called with the mount lock held */
+int nkfs_journal_commit(struct nkfs_fs* fs) {
+    struct nkfs_journal* journal = &fs->journal;
+    struct nkfs_transaction* trans = &journal->running;
+    int ret;
+
+    if (journal->error)
+        return journal->error;
+    if ((ret = nkfs_stage_metadata(fs)) < 0)
+        return journal_abort(fs, ret);
+
+    if (trans->nr_buffers || trans->nr_revokes) {
+        uint32_t needed = trans_blocks(trans);
+        uint32_t start = journal->head;
+
+        if (needed >= journal->free && nkfs_journal_checkpoint(fs) < 0)
+            return journal_abort(fs, -EIO);
+        if (needed >= journal->free)
+            return journal_abort(fs, -ENOSPC);
+        if ((ret = write_transaction(fs, trans)) < 0)
+            return journal_abort(fs, ret);
+
+        journal->commit_seq = trans->seq;
+        journal->commits++;
+        finish_transaction(fs, trans, start);
+        trans_init(trans, trans->seq + 1);
+        cancel_delayed_work(&journal->commit_work);
+    } else {
+        finish_transaction(fs, trans, journal->head);
+    }
+
+    wake_up(&journal->commit_wait);
+    if (journal->free < journal->size / 2)
+        schedule_work(&journal->checkpoint_work);
+    return 0;
+}
+
+/*
+ * Write committed buffers in place and move the tail past them. A buffer
+ * the running transaction changed again holds the tail at the commit that
+ * logged it, as its block must not be written before the next commit.
+ */
+int nkfs_journal_checkpoint(struct nkfs_fs* fs) {
+    struct nkfs_journal* journal = &fs->journal;
+    uint32_t tail = journal->head;
+    uint32_t tail_seq = journal->running.seq;
+    struct list_head* pos;
+    struct list_head* tmp;
+    int ret = 0;
+
+    list_for_each_safe(pos, tmp, &journal->checkpoint) {
+        struct nkfs_buf* buf = list_entry(pos, struct nkfs_buf, checkpoint_entry);
+
+        if (buf->trans || nkfs_block_write(fs, buf->block, buf->data) < 0) {
+            if (!buf->trans)
+                ret = -EIO;
+            if (buf->log_seq < tail_seq) {
+                tail = buf->log_pos;
+                tail_seq = buf->log_seq;
+            }
+            continue;
+        }
+        buf->dirty = false;
+        buf->log_seq = 0;
+        list_del(&buf->checkpoint_entry);
+        nkfs_brelse(buf);
+    }
+
+    if (tail_seq != journal->tail_seq) {
+        journal->tail = tail;
+        journal->tail_seq = tail_seq;
+        journal->free = journal->size - log_used(journal);
+        if (write_journal_super(fs, journal->block) < 0)
+            ret = -EIO;
+    }
+    return ret;
+}
+
+/*
+ * Wait until transaction seq is on disk. Called with the mount lock held
+ * and outside any journal handle; the lock is dropped while waiting so
+ * other operations can join the commit.
+ */
+int nkfs_journal_wait(struct nkfs_fs* fs, uint32_t seq) {
+    struct nkfs_journal* journal = &fs->journal;
+
+    if (seq <= journal->commit_seq || journal->error)
+        return journal->error;
+    if (!journal->group_commit)
+        return nkfs_journal_commit(fs);
+
+    cancel_delayed_work(&journal->commit_work);
+    queue_delayed_work(system_wq, &journal->commit_work, 0);
+
+    nkfs_unlock(fs);
+    wait_event(journal->commit_wait, journal->commit_seq >= seq || journal->error);
+    nkfs_lock(fs);
+    return journal->error;
+}
@@ -0,0 +1,198 @@
+/*
+ * gcov runtime for nekkoOS profile-guided builds
+ * A PGO=gen kernel is compiled with -fprofile-arcs: every object gets arc
+ * counters and a constructor that hands them to __gcov_init.
+ * gcov_dump() prints each object's counters, in .gcda format, as hex
+ * "gcov:" lines on the console. kernel_gcov.py turns a serial log of them
+ * back into the .gcda files the PGO=use build reads. This file itself is
+ * never instrumented.
+ *
+ * The structures mirror libgcov's for the compiler building the kernel
+ * (GCC 10 or newer writes the object summary -fprofile-use relies on).
+ */
+
+#include "types.h"
+#include "gcov.h"
+#include "kernel.h"
+
+#if (__GNUC__ >= 14)
+#define GCOV_COUNTERS           9
+#elif (__GNUC__ >= 10)
+#define GCOV_COUNTERS           8
+#elif (__GNUC__ >= 7)
+#define GCOV_COUNTERS           9
+#else
+#define GCOV_COUNTERS           10
+#endif
+
+/* Record lengths are in bytes since GCC 12, in 32-bit words before */
+#if (__GNUC__ >= 12)
+#define GCOV_UNIT_SIZE          4
+#else
+#define GCOV_UNIT_SIZE          1
+#endif
+
+#define GCOV_DATA_MAGIC         0x67636461      /* "gcda" */
+#define GCOV_TAG_FUNCTION       0x01000000
+#define GCOV_TAG_FUNCTION_LENGTH 3
+#define GCOV_TAG_COUNTER_BASE   0x01A10000
+#define GCOV_TAG_FOR_COUNTER(n) (GCOV_TAG_COUNTER_BASE + ((uint32_t)(n) << 17))
+#define GCOV_TAG_OBJECT_SUMMARY 0xA1000000
+#define GCOV_TAG_SUMMARY_LENGTH 2
+#define GCOV_COUNTER_ARCS       0
+
+/* Words per console line */
+#define GCOV_LINE_WORDS         16
+
+typedef int64_t gcov_type;
+
+struct gcov_info;
+
+struct gcov_ctr_info {
+    uint32_t num;
+    gcov_type* values;
+};
+
+struct gcov_fn_info {
+    const struct gcov_info* key;
+    uint32_t ident;
+    uint32_t lineno_checksum;
+    uint32_t cfg_checksum;
+    struct gcov_ctr_info ctrs[];        /* One per active counter kind */
+};
+
+struct gcov_info {
+    uint32_t version;
+    struct gcov_info* next;
+    uint32_t stamp;
+#if (__GNUC__ >= 12)
+    uint32_t checksum;
+#endif
+    const char* filename;
+    void (*merge[GCOV_COUNTERS])(gcov_type*, uint32_t);
+    uint32_t n_functions;
+    const struct gcov_fn_info* const* functions;
+};
+
+static struct gcov_info* gcov_list;
+
+/* Output state of the line being printed */
+static char gcov_line[GCOV_LINE_WORDS * 8 + 1];
+static uint32_t gcov_line_words;
+
+/* Called by the constructor of every instrumented object */
+void __gcov_init(struct gcov_info* info) {
+    info->next = gcov_list;
+    gcov_list = info;
+}
+
+/*
+ * Referenced through gcov_info.merge and by the exit hook, never called:
+ * the kernel neither merges profiles nor exits.
+ */
+void __gcov_merge_add(gcov_type* counters, uint32_t count) {
+    (void)counters;
+    (void)count;
+}
+
+void __gcov_exit(void) {
+}
+
+static void gcov_flush_line(void) {
+    if (!gcov_line_words)
+        return;
+
+    gcov_line[gcov_line_words * 8] = '\0';
+    kprintf("gcov: ");
+    kprintf(gcov_line);
+    kprintf("\n");
+    gcov_line_words = 0;
+}
+
+static void gcov_write_u32(uint32_t value) {
+    static const char digits[] = "0123456789abcdef";
+    char* p = &gcov_line[gcov_line_words * 8];
+
+    for (int shift = 28; shift >= 0; shift -= 4)
+        *p++ = digits[(value >> shift) & 0xF];
+    if (++gcov_line_words == GCOV_LINE_WORDS)
+        gcov_flush_line();
+}
+
+static void gcov_write_u64(uint64_t value) {
+    gcov_write_u32((uint32_t)value);
+    gcov_write_u32((uint32_t)(value >> 32));
+}
+
+/* Largest arc counter of the object, for the summary */
+static gcov_type gcov_sum_max(const struct gcov_info* info) {
+    gcov_type max = 0;
+
+    if (!info->merge[GCOV_COUNTER_ARCS])
+        return 0;
+    for (uint32_t i = 0; i < info->n_functions; i++) {
+        const struct gcov_fn_info* fn = info->functions[i];
+        if (!fn || fn->key != info)
+            continue;
+        for (uint32_t j = 0; j < fn->ctrs[0].num; j++)
+            max = MAX(max, fn->ctrs[0].values[j]);
+    }
+    return max;
+}
+
+static void gcov_write_info(const struct gcov_info* info) {
+    kprintf("gcov: file ");
+    kprintf(info->filename);
+    kprintf("\n");
+
+    gcov_write_u32(GCOV_DATA_MAGIC);
+    gcov_write_u32(info->version);
+    gcov_write_u32(info->stamp);
+#if (__GNUC__ >= 12)
+    gcov_write_u32(info->checksum);
+#endif
+#if (__GNUC__ >= 10)
+    gcov_write_u32(GCOV_TAG_OBJECT_SUMMARY);
+    gcov_write_u32(GCOV_TAG_SUMMARY_LENGTH * GCOV_UNIT_SIZE);
+    gcov_write_u32(1);                                  /* runs */
+    gcov_write_u32((uint32_t)gcov_sum_max(info));
+#endif
+
+    for (uint32_t i = 0; i < info->n_functions; i++) {
+        const struct gcov_fn_info* fn = info->functions[i];
+
+        gcov_write_u32(GCOV_TAG_FUNCTION);
+        if (!fn || fn->key != info) {
+            /* Emitted by another object (COMDAT) */
+            gcov_write_u32(0);
+            continue;
+        }
+        gcov_write_u32(GCOV_TAG_FUNCTION_LENGTH * GCOV_UNIT_SIZE);
+        gcov_write_u32(fn->ident);
+        gcov_write_u32(fn->lineno_checksum);
+        gcov_write_u32(fn->cfg_checksum);
+
+        const struct gcov_ctr_info* ctr = fn->ctrs;
+        for (uint32_t kind = 0; kind < GCOV_COUNTERS; kind++) {
+            if (!info->merge[kind])
+                continue;
+            gcov_write_u32(GCOV_TAG_FOR_COUNTER(kind));
+            gcov_write_u32(ctr->num * 2 * GCOV_UNIT_SIZE);
+            for (uint32_t j = 0; j < ctr->num; j++)
+                gcov_write_u64(ctr->values[j]);
+            ctr++;
+        }
+    }
+    gcov_flush_line();
+}
+
+/* Print the counters of every instrumented object; nothing in normal builds */
+void gcov_dump(void) {
+    if (!gcov_list)
+        return;
+
+    kprintf("gcov: begin\n");
+    for (const struct gcov_info* info = gcov_list; info; info = info->next)
+        gcov_write_info(info);
+    kprintf("gcov: end\n");
+}
@@ -0,0 +1,252 @@
+/*
+ * Incrementally resized hash table for nekkoOS
+ * While a resize is in progress, bucket i of the old table has either
+ * been moved already (i < rehash_index) or not, which tells every
+ * operation the one bucket an entry can be in. The new table is not
+ * zeroed up front either: the buckets an old bucket moves into are
+ * cleared just before it moves, so starting a resize costs one
+ * allocation and nothing else.
+ */
+
+#include "types.h"
+#include "kmalloc.h"
+#include "pmm.h"
+#include "hashtable.h"
+#include "timer.h"
+#include "bench.h"
+#include "errno.h"
+#include "kernel.h"
+
+static inline bool hash_rehashing(const struct hash_table* table) {
+    return table->rehash_index >= 0;
+}
+
+static struct hash_node** hash_bucket(struct hash_table* table, uint32_t hash) {
+    uint32_t index = hash & (table->size[0] - 1);
+
+    if (hash_rehashing(table) && index < (uint32_t)table->rehash_index)
+        return &table->buckets[1][hash & (table->size[1] - 1)];
+    return &table->buckets[0][index];
+}
+
+/* Move up to HASH_REHASH_STEP buckets into the new table */
+static void hash_rehash_step(struct hash_table* table) {
+    if (!hash_rehashing(table))
+        return;
+
+    uint32_t old_size = table->size[0];
+    uint32_t new_size = table->size[1];
+
+    for (int step = 0; step < HASH_REHASH_STEP && (uint32_t)table->rehash_index < old_size; step++) {
+        uint32_t index = table->rehash_index++;
+
+        /* Clear the destination buckets on first use */
+        if (new_size > old_size) {
+            table->buckets[1][index] = NULL;
+            table->buckets[1][index + old_size] = NULL;
+        } else if (index < new_size) {
+            table->buckets[1][index] = NULL;
+        }
+
+        struct hash_node* node = table->buckets[0][index];
+        while (node) {
+            struct hash_node* next = node->next;
+            struct hash_node** bucket = &table->buckets[1][node->hash & (new_size - 1)];
+            node->next = *bucket;
+            *bucket = node;
+            node = next;
+        }
+    }
+
+    if ((uint32_t)table->rehash_index == old_size) {
+        kfree(table->buckets[0]);
+        table->buckets[0] = table->buckets[1];
+        table->size[0] = new_size;
+        table->buckets[1] = NULL;
+        table->size[1] = 0;
+        table->rehash_index = -1;
+    }
+}
+
+/* Start moving to a table of new_size buckets; on failure keep the current one */
+static void hash_resize(struct hash_table* table, uint32_t new_size) {
+    if (hash_rehashing(table))
+        return;
+
+    struct hash_node** buckets = kmalloc(new_size * sizeof(struct hash_node*));
+    if (!buckets)
+        return;
+
+    table->buckets[1] = buckets;
+    table->size[1] = new_size;
+    table->rehash_index = 0;
+}
+
+int hash_table_init(struct hash_table* table, uint32_t size_hint) {
+    uint32_t size = HASH_TABLE_MIN_SIZE;
+    while (size < size_hint && size < 0x40000000)
+        size <<= 1;
+
+    table->buckets[0] = kzalloc(size * sizeof(struct hash_node*));
+    if (!table->buckets[0])
+        return -ENOMEM;
+    table->size[0] = size;
+    table->buckets[1] = NULL;
+    table->size[1] = 0;
+    table->count = 0;
+    table->rehash_index = -1;
+    return 0;
+}
+
+/* Free the bucket arrays; the entries belong to the caller */
+void hash_table_destroy(struct hash_table* table) {
+    kfree(table->buckets[0]);
+    kfree(table->buckets[1]);
+    table->buckets[0] = NULL;
+    table->buckets[1] = NULL;
+    table->count = 0;
+}
+
+void hash_insert(struct hash_table* table, struct hash_node* node, uint32_t hash) {
+    hash_rehash_step(table);
+    if (!hash_rehashing(table) && table->count >= table->size[0] && table->size[0] < 0x40000000)
+        hash_resize(table, table->size[0] * 2);
+
+    struct hash_node** bucket = hash_bucket(table, hash);
+    node->hash = hash;
+    node->next = *bucket;
+    *bucket = node;
+    table->count++;
+}
+
+struct hash_node* hash_lookup(struct hash_table* table, uint32_t hash, hash_match_t match, const void* key) {
+    hash_rehash_step(table);
+
+    for (struct hash_node* node = *hash_bucket(table, hash); node; node = node->next) {
+        if (node->hash == hash && match(node, key))
+            return node;
+    }
+    return NULL;
+}
+
+bool hash_remove(struct hash_table* table, struct hash_node* node) {
+    hash_rehash_step(table);
+
+    struct hash_node** link = hash_bucket(table, node->hash);
+    while (*link && *link != node)
+        link = &(*link)->next;
+    if (!*link)
+        return false;
+
+    *link = node->next;
+    table->count--;
+    if (!hash_rehashing(table) && table->size[0] > HASH_TABLE_MIN_SIZE && table->count < table->size[0] / 8)
+        hash_resize(table, table->size[0] / 2);
+    return true;
+}
+
+static void hash_bucket_foreach(struct hash_node* node, void (*fn)(struct hash_node* node, void* arg), void* arg) {
+    while (node) {
+        struct hash_node* next = node->next;
+        fn(node, arg);
+        node = next;
+    }
+}
+
+/* Call fn for every entry; fn must not insert or remove entries */
+void hash_table_foreach(struct hash_table* table, void (*fn)(struct hash_node* node, void* arg), void* arg) {
+    uint32_t moved = hash_rehashing(table) ? (uint32_t)table->rehash_index : 0;
+    uint32_t old_size = table->size[0];
+    uint32_t new_size = table->size[1];
+
+    for (uint32_t i = moved; i < old_size; i++)
+        hash_bucket_foreach(table->buckets[0][i], fn, arg);
+
+    /* Only the buckets that moved buckets landed in are initialized */
+    for (uint32_t i = 0; i < moved; i++) {
+        if (new_size > old_size) {
+            hash_bucket_foreach(table->buckets[1][i], fn, arg);
+            hash_bucket_foreach(table->buckets[1][i + old_size], fn, arg);
+        } else if (i < new_size) {
+            hash_bucket_foreach(table->buckets[1][i], fn, arg);
+        }
+    }
+}
+
+/* FNV-1a */
+uint32_t hash_bytes(const void* data, size_t length) {
+    const uint8_t* bytes = data;
+    uint32_t hash = 2166136261U;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+uint32_t hash_string(const char* str) {
+    uint32_t hash = 2166136261U;
+
+    while (*str) {
+        hash ^= (uint8_t)*str++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/* Inserts through several resizes, then lookups; also the worst single insert */
+#define HASH_BENCH_ENTRIES  65536
+
+struct hash_bench_entry {
+    struct hash_node node;
+    uint32_t key;
+};
+
+static bool hash_bench_match(const struct hash_node* node, const void* key) {
+    return hash_entry(node, struct hash_bench_entry, node)->key == *(const uint32_t*)key;
+}
+
+static void hashtable_benchmark(void) {
+    uint32_t pages = (HASH_BENCH_ENTRIES * sizeof(struct hash_bench_entry) + PAGE_SIZE - 1) / PAGE_SIZE;
+    struct hash_bench_entry* entries = page_alloc(pages);
+    struct hash_table table;
+    uint64_t worst = 0;
+
+    if (!entries)
+        return;
+    if (hash_table_init(&table, 0) < 0) {
+        page_free(entries, pages);
+        return;
+    }
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < HASH_BENCH_ENTRIES; i++) {
+        uint64_t before = rdtsc();
+        entries[i].key = i * 2654435761U;
+        hash_insert(&table, &entries[i].node, hash_u32(entries[i].key));
+        uint64_t cycles = rdtsc() - before;
+        if (cycles > worst)
+            worst = cycles;
+    }
+    uint64_t insert_cycles = rdtsc() - start;
+
+    uint32_t hits = 0;
+    start = rdtsc();
+    for (uint32_t i = 0; i < HASH_BENCH_ENTRIES; i++) {
+        uint32_t key = entries[i].key;
+        hits += hash_lookup(&table, hash_u32(key), hash_bench_match, &key) != NULL;
+    }
+    uint64_t lookup_cycles = rdtsc() - start;
+
+    hash_table_destroy(&table);
+    page_free(entries, pages);
+    if (hits != HASH_BENCH_ENTRIES)
+        kprintf("hashtable: lookup mismatch\n");
+
+    uint32_t khz = timer_tsc_khz();
+    bench_report("hashtable", "inserts", bench_rate(HASH_BENCH_ENTRIES, insert_cycles), "ops/s");
+    bench_report("hashtable", "lookups", bench_rate(HASH_BENCH_ENTRIES, lookup_cycles), "ops/s");
+    bench_report("hashtable", "worst_insert", khz ? (uint32_t)div_u64(worst * 1000000, khz) : 0, "ns");
+}
+KERNEL_BENCH("hashtable", hashtable_benchmark);
@@ -0,0 +1,230 @@
+/*
+ * Boot snapshots for nekkoOS
+ * hibernate=1 saves the machine once it has reached the ready point:
+ * every used page of RAM above the low megabyte is LZ4 compressed, in
+ * runs of up to HIBERNATE_CHUNK_PAGES, into a staging buffer that is then
+ * written to the snapshot area of the boot floppy behind a header sector.
+ * On the next boot stage 2 finds the header, loads the image back to the
+ * staging buffer's address, decompresses each run into place and jumps to
+ * hibernate_resume (arch/i386/hibernate.s) instead of the kernel entry
+ * point. The kernel carries on from the snapshot point without probing
+ * hardware or running initcalls; only device state that lives outside
+ * RAM (the PICs, the PIT, the floppy controller and the UART) is set up
+ * again. hibernate_check.py takes a snapshot and resumes it in QEMU.
+ *
+ * A snapshot belongs to the kernel and memory size that wrote it and is
+ * used on every boot until it is overwritten or the boot image rebuilt.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "hibernate.h"
+#include "block.h"
+#include "floppy.h"
+#include "serial.h"
+#include "irq.h"
+#include "irqflags.h"
+#include "timer.h"
+#include "pmm.h"
+#include "lz4.h"
+#include "init.h"
+#include "param.h"
+#include "bench.h"
+#include "errno.h"
+#include "kernel.h"
+
+/* LZ4 scratch space, then the compressed image */
+#define STAGING_WORK_PAGES  (ALIGN_UP(LZ4_WORKMEM_SIZE, PAGE_SIZE) / PAGE_SIZE)
+#define STAGING_IMAGE_PAGES (ALIGN_UP(HIBERNATE_IMAGE_MAX, PAGE_SIZE) / PAGE_SIZE)
+#define STAGING_PAGES       (STAGING_WORK_PAGES + STAGING_IMAGE_PAGES)
+
+/* Referenced by hibernate_resume */
+struct hibernate_context hibernate_context;
+
+static bool hibernate_enabled = false;
+param_bool("hibernate", hibernate_enabled);
+
+/*
+ * The staging buffer is left out of the image: stage 2 loads the image to
+ * the same place, so on resume it is simply still allocated.
+ */
+static uint8_t* staging;
+static uint32_t image_pages;
+static uint32_t image_bytes;
+
+static inline uint8_t* staging_image(void) {
+    return staging + STAGING_WORK_PAGES * PAGE_SIZE;
+}
+
+static bool page_saved(uint32_t pfn) {
+    uint32_t staging_pfn = (uint32_t)staging >> PAGE_SHIFT;
+
+    if (pfn < (HIBERNATE_LOW_MEMORY >> PAGE_SHIFT))
+        return false;
+    if (pfn >= staging_pfn && pfn < staging_pfn + STAGING_PAGES)
+        return false;
+    return pmm_page_in_use(pfn);
+}
+
+static uint32_t count_saved_pages(void) {
+    uint32_t count = 0;
+
+    for (uint32_t pfn = 0; pfn < pmm_max_pfn(); pfn++) {
+        if (page_saved(pfn))
+            count++;
+    }
+    return count;
+}
+
+/* Compress the saved pages into the staging buffer; interrupts are off */
+static int compress_image(void) {
+    uint8_t* image = staging_image();
+    uint32_t max_pfn = pmm_max_pfn();
+    uint32_t pfn = 0;
+
+    image_bytes = 0;
+    while (pfn < max_pfn) {
+        if (!page_saved(pfn)) {
+            pfn++;
+            continue;
+        }
+
+        uint32_t first = pfn;
+        while (pfn < max_pfn && pfn - first < HIBERNATE_CHUNK_PAGES && page_saved(pfn))
+            pfn++;
+
+        struct hibernate_chunk* chunk = (struct hibernate_chunk*)(image + image_bytes);
+        if (image_bytes + sizeof(*chunk) >= HIBERNATE_IMAGE_MAX)
+            return -ENOSPC;
+
+        chunk->addr = first << PAGE_SHIFT;
+        chunk->length = (pfn - first) * PAGE_SIZE;
+        chunk->packed = lz4_compress((const void*)chunk->addr, chunk->length, chunk + 1,
+                                     HIBERNATE_IMAGE_MAX - image_bytes - sizeof(*chunk), staging);
+        if (!chunk->packed)
+            return -ENOSPC;
+        image_bytes += sizeof(*chunk) + chunk->packed;
+    }
+    return 0;
+}
+
+/* Write the image, then the header that makes stage 2 use it */
+static int write_image(struct block_device* dev) {
+    uint8_t sector[HIBERNATE_SECTOR_SIZE];
+    struct hibernate_header* header = (struct hibernate_header*)sector;
+    uint32_t sectors = ALIGN_UP(image_bytes, HIBERNATE_SECTOR_SIZE) / HIBERNATE_SECTOR_SIZE;
+
+    /* Drop the old header first so that a torn write is never resumed */
+    memset(sector, 0, sizeof(sector));
+    int ret = dev->ops->write(dev, HIBERNATE_START_LBA, 1, sector);
+    if (ret < 0)
+        return ret;
+
+    ret = dev->ops->write(dev, HIBERNATE_START_LBA + 1, sectors, staging_image());
+    if (ret < 0)
+        return ret;
+
+    header->magic = HIBERNATE_MAGIC;
+    header->version = HIBERNATE_VERSION;
+    header->image_addr = (uint32_t)staging_image();
+    header->image_bytes = image_bytes;
+    header->image_sectors = sectors;
+    header->entry = (uint32_t)hibernate_resume;
+    header->pages = image_pages;
+    return dev->ops->write(dev, HIBERNATE_START_LBA, 1, sector);
+}
+
+/* Reprogram the devices whose state the reboot lost */
+static void resume_devices(void) {
+    irq_resume();
+    timer_resume();
+    floppy_resume();
+    serial_resume();
+}
+
+static void report_resume(uint64_t ready_cycles) {
+    uint32_t khz = timer_tsc_khz();
+
+    kprintf("Resumed from boot snapshot (");
+    kprintf_dec(image_pages);
+    kprintf(" pages)\n");
+    if (!khz)
+        return;
+
+    bench_report("hibernate", "cold_ready_since_reset", (uint32_t)div_u64(initcall_ready_cycles(), khz), "ms");
+    bench_report("hibernate", "resume_ready_since_reset", (uint32_t)div_u64(ready_cycles, khz), "ms");
+}
+
+/*
+ * Save a snapshot; returns 0 once it is on disk, 1 when the kernel has
+ * just been resumed from it, or a negative error code.
+ */
+static int hibernate_snapshot(void) {
+    struct block_device* dev = floppy_get_device();
+    int ret;
+
+    if (!dev)
+        return -ENODEV;
+
+    /* The resumed kernel still reads its boot modules and memory map */
+    ret = kernel_copy_boot_info();
+    if (ret < 0)
+        return ret;
+
+    staging = page_alloc(STAGING_PAGES);
+    if (!staging)
+        return -ENOMEM;
+    image_pages = count_saved_pages();
+
+    /*
+     * Not traced by the irqs-off tracer: seen from the resumed kernel the
+     * section spans a reboot and the TSC went back to zero.
+     */
+    uint32_t flags = arch_local_save_flags();
+    uint64_t start = rdtsc();
+    arch_local_irq_disable();
+    irq_suspend();
+    timer_suspend();
+
+    if (hibernate_save(&hibernate_context)) {
+        resume_devices();
+        uint64_t ready = rdtsc();
+        if (flags & EFLAGS_IF)
+            arch_local_irq_enable();
+        page_free(staging, STAGING_PAGES);
+        report_resume(ready);
+        return 1;
+    }
+
+    /* Everything after this point is lost on resume */
+    ret = compress_image();
+    if (flags & EFLAGS_IF)
+        arch_local_irq_enable();
+    if (ret == 0)
+        ret = write_image(dev);
+    page_free(staging, STAGING_PAGES);
+    if (ret < 0)
+        return ret;
+
+    uint32_t khz = timer_tsc_khz();
+    kprintf("Boot snapshot saved: ");
+    kprintf_dec(image_pages);
+    kprintf(" pages in ");
+    kprintf_dec(image_bytes / 1024);
+    kprintf(" KB\n");
+    if (khz)
+        bench_report("hibernate", "snapshot", (uint32_t)div_u64(rdtsc() - start, khz), "ms");
+    return 0;
+}
+
+void hibernate_boot_ready(void) {
+    if (!hibernate_enabled)
+        return;
+
+    int ret = hibernate_snapshot();
+    if (ret < 0) {
+        kprintf("Boot snapshot failed: error ");
+        kprintf_dec(-ret);
+        kprintf("\n");
+    }
+}
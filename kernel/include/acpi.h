@@ -0,0 +1,85 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "types.h"
+
+/* Root System Description Pointer, found in the EBDA or the BIOS area */
+struct acpi_rsdp {
+    char signature[8];          /* "RSD PTR " */
+    uint8_t checksum;           /* Over the first 20 bytes */
+    char oem_id[6];
+    uint8_t revision;           /* 0 for ACPI 1.0, 2 for 2.0 and later */
+    uint32_t rsdt_address;
+    /* ACPI 2.0 */
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;  /* Over the whole structure */
+    uint8_t reserved[3];
+} PACKED;
+
+/* Common header of every system description table */
+struct acpi_table_header {
+    char signature[4];
+    uint32_t length;            /* Including the header */
+    uint8_t revision;
+    uint8_t checksum;           /* Over length bytes */
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} PACKED;
+
+/* System Resource Affinity Table: CPUs and memory by proximity domain */
+struct acpi_srat {
+    struct acpi_table_header header;
+    uint32_t table_revision;
+    uint64_t reserved;
+    /* Affinity structures follow */
+} PACKED;
+
+#define ACPI_SRAT_CPU_AFFINITY      0
+#define ACPI_SRAT_MEMORY_AFFINITY   1
+
+/* Affinity flags */
+#define ACPI_SRAT_ENABLED           0x01
+
+struct acpi_srat_entry {
+    uint8_t type;
+    uint8_t length;
+} PACKED;
+
+struct acpi_srat_cpu_affinity {
+    uint8_t type;
+    uint8_t length;
+    uint8_t proximity_domain_lo;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t local_sapic_eid;
+    uint8_t proximity_domain_hi[3];
+    uint32_t clock_domain;
+} PACKED;
+
+struct acpi_srat_memory_affinity {
+    uint8_t type;
+    uint8_t length;
+    uint32_t proximity_domain;
+    uint16_t reserved1;
+    uint64_t base_address;
+    uint64_t length_bytes;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint64_t reserved3;
+} PACKED;
+
+/* System Locality Information Table: relative distance between domains, 10 is local */
+struct acpi_slit {
+    struct acpi_table_header header;
+    uint64_t locality_count;
+    uint8_t entry[];            /* locality_count x locality_count, row major */
+} PACKED;
+
+/* Table lookup, NULL if there is no valid table with that signature */
+const struct acpi_table_header* acpi_find_table(const char* signature);
+
+#endif /* ACPI_H */
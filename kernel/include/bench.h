@@ -0,0 +1,27 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "types.h"
+
+/* In-kernel benchmark descriptor, collected in the .kbench section */
+struct kernel_bench {
+    const char* name;
+    void (*run)(void);
+};
+
+/*
+ * Register a benchmark. Benchmarks run after initialization when selected
+ * on the command line: bench=all or bench=name1,name2
+ */
+#define KERNEL_BENCH(name_str, fn)                                     \
+    static const struct kernel_bench __bench_##fn                      \
+    __attribute__((used, section(".kbench"), aligned(4))) = {          \
+        .name = name_str, .run = fn                                    \
+    }
+
+/* Benchmark interface */
+void run_benchmarks(void);
+void bench_report(const char* name, const char* metric, uint32_t value, const char* unit);
+uint32_t bench_rate(uint32_t count, uint64_t cycles);
+
+#endif /* BENCH_H */
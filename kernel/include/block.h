@@ -0,0 +1,76 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "types.h"
+#include "list.h"
+
+struct block_device;
+
+/* Driver operations on whole sectors */
+struct block_ops {
+    int (*read)(struct block_device* dev, uint32_t lba, uint32_t count, void* buffer);
+    int (*write)(struct block_device* dev, uint32_t lba, uint32_t count, const void* buffer);
+};
+
+/*
+ * Requests waiting for a busy device, in order of virtual start time
+ * (blkio.c); zeroed devices start idle
+ */
+struct blk_queue {
+    bool busy;
+    uint64_t vtime;                 /* Start time of the request in service */
+    struct list_head waiters;
+};
+
+/* Block device descriptor */
+struct block_device {
+    const char* name;
+    uint32_t sector_size;
+    uint32_t sector_count;
+    uint32_t fill_sectors;          /* Sectors read per cache miss (e.g. one track) */
+    const struct block_ops* ops;
+    void* driver_data;
+    struct blk_queue queue;
+};
+
+/* Buffer cache */
+#define BCACHE_BLOCK_SIZE   512
+#define BCACHE_BUFFERS      512
+#define BCACHE_HASH_SIZE    256
+#define BCACHE_MAX_FILL     64
+
+/* Buffer state flags */
+#define BH_VALID            0x01
+
+struct buffer_head {
+    struct block_device* dev;
+    uint32_t block;
+    uint32_t flags;
+    uint32_t count;                 /* References held by callers */
+    struct buffer_head* hash_next;
+    struct buffer_head* lru_prev;
+    struct buffer_head* lru_next;
+    uint8_t* data;
+};
+
+struct bcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t fills;
+    uint32_t evictions;
+};
+
+/* Sector I/O shared out between control groups by I/O weight (blkio.c) */
+int blk_read(struct block_device* dev, uint32_t lba, uint32_t count, void* buffer);
+int blk_write(struct block_device* dev, uint32_t lba, uint32_t count, const void* buffer);
+
+/* Buffer cache interface */
+int init_bcache(void);
+struct buffer_head* bread(struct block_device* dev, uint32_t block);
+void brelse(struct buffer_head* bh);
+int bwrite(struct buffer_head* bh);
+int bcache_read(struct block_device* dev, uint32_t block, uint32_t count, void* buffer);
+void bcache_invalidate(struct block_device* dev);
+void bcache_get_stats(struct bcache_stats* stats);
+
+#endif /* BLOCK_H */
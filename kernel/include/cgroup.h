@@ -0,0 +1,107 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include "types.h"
+#include "list.h"
+#include "timer.h"
+
+struct thread;
+
+#define CGROUP_MAX          8       /* Including the root */
+#define CGROUP_ROOT_ID      0
+
+/* CPU controller limits */
+#define CPU_SHARES_DEFAULT  1024
+#define CPU_SHARES_MIN      2
+#define CPU_SHARES_MAX      262144
+#define CPU_PERIOD_DEFAULT_US 100000
+#define CPU_PERIOD_MIN_US   10000   /* One tick */
+#define CPU_PERIOD_MAX_US   1000000
+
+/* I/O controller weights */
+#define IO_WEIGHT_DEFAULT   100
+#define IO_WEIGHT_MIN       1
+#define IO_WEIGHT_MAX       1000
+
+/*
+ * Control group: a node in a tree of thread groups that share out CPU
+ * time, memory and disk time. Each thread is in exactly one group; a
+ * group's limits cover its threads and all the groups below it.
+ */
+struct cgroup {
+    const char* name;
+    struct cgroup* parent;          /* NULL for the root */
+    uint32_t id;                    /* Slot in the group table, CGROUP_ROOT_ID for the root */
+    uint32_t depth;                 /* 0 for the root */
+    bool in_use;
+    uint32_t nr_children;
+    uint32_t nr_threads;
+
+    /* CPU: weight against sibling groups, and an optional quota per period */
+    uint32_t cpu_shares;
+    uint32_t cpu_quota_us;          /* 0 for no quota */
+    uint32_t cpu_period_us;
+    int64_t cpu_runtime;            /* Quota left in this period, in ns */
+    uint32_t cpu_nr_periods;
+    uint32_t cpu_nr_throttled;      /* Periods in which the quota ran out */
+    struct timer_list cpu_period_timer;
+
+    /* Memory, in pages */
+    uint32_t mem_limit;             /* 0 for no limit */
+    uint32_t mem_usage;
+    uint32_t mem_max_usage;
+    uint32_t mem_failcnt;           /* Charges refused at the limit */
+    uint32_t mem_reclaimed;         /* Pages reclaimed to stay within it */
+
+    /* I/O: weight against other groups on the same device */
+    uint32_t io_weight;
+    uint64_t io_vtime;              /* Virtual finish time of its last request */
+    uint32_t io_requests;
+    uint32_t io_sectors;
+};
+
+/*
+ * Reclaimable memory, e.g. clean page cache pages. reclaim() frees up to
+ * nr_pages pages charged to cg or the groups below it and returns how
+ * many it freed. It is called from page allocation in process context and
+ * must not sleep or free memory a caller might still be using.
+ */
+struct mem_shrinker {
+    uint32_t (*reclaim)(struct mem_shrinker* shrinker, struct cgroup* cg, uint32_t nr_pages);
+    struct list_head entry;
+};
+
+extern struct cgroup root_cgroup;
+
+/* Cgroup interface */
+int init_cgroups(void);
+struct cgroup* cgroup_create(struct cgroup* parent, const char* name);
+int cgroup_destroy(struct cgroup* cg);
+int cgroup_attach(struct cgroup* cg, struct thread* thread);
+int cgroup_set_cpu_shares(struct cgroup* cg, uint32_t shares);
+int cgroup_set_cpu_quota(struct cgroup* cg, uint32_t quota_us, uint32_t period_us);
+int cgroup_set_mem_limit(struct cgroup* cg, uint32_t pages);
+int cgroup_set_io_weight(struct cgroup* cg, uint32_t weight);
+struct cgroup* cgroup_from_id(uint32_t id);
+
+/* Scheduler hooks for thread creation and exit (sched.c) */
+void cgroup_fork(struct thread* thread, struct cgroup* cg);
+void cgroup_exit(struct thread* thread);
+
+/*
+ * Memory controller hooks for the page allocator (pmm.c). A charge is
+ * taken before the pages are allocated and committed to them after, or
+ * cancelled if the allocation failed.
+ */
+int mem_cgroup_charge(uint32_t count, struct cgroup** memcg);
+void mem_cgroup_commit(struct cgroup* memcg, void* addr, uint32_t count);
+void mem_cgroup_cancel(struct cgroup* memcg, uint32_t count);
+void mem_cgroup_uncharge(void* addr, uint32_t count);
+bool mem_cgroup_page_in(struct cgroup* cg, const void* addr);
+void register_mem_shrinker(struct mem_shrinker* shrinker);
+void unregister_mem_shrinker(struct mem_shrinker* shrinker);
+
+/* Group of the running thread, the root in interrupt context */
+struct cgroup* current_cgroup(void);
+
+#endif /* CGROUP_H */
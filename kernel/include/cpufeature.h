@@ -0,0 +1,22 @@
+#ifndef CPUFEATURE_H
+#define CPUFEATURE_H
+
+#include "types.h"
+
+/*
+ * CPU features the kernel picks code paths by, read once with CPUID at
+ * boot (cpufeature.c). Until then every feature reads as absent, so
+ * early code takes the baseline i686 paths.
+ */
+#define X86_FEATURE_ERMS    BIT(0)  /* Enhanced rep movsb/stosb (leaf 7, EBX bit 9) */
+#define X86_FEATURE_FSRM    BIT(1)  /* Fast short rep movsb (leaf 7, EDX bit 4) */
+
+extern uint32_t boot_cpu_features;
+
+static inline bool boot_cpu_has(uint32_t feature) {
+    return boot_cpu_features & feature;
+}
+
+int init_cpu_features(void);
+
+#endif /* CPUFEATURE_H */
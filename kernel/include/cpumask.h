@@ -0,0 +1,54 @@
+#ifndef CPUMASK_H
+#define CPUMASK_H
+
+#include "types.h"
+#include "smp.h"
+
+/* Set of CPUs, bit n for CPU n; NR_CPUS stays within one word */
+typedef uint32_t cpumask_t;
+
+/* Set of NUMA nodes, bit n for node n */
+typedef uint32_t nodemask_t;
+
+#define CPU_MASK_ALL        ((cpumask_t)(BIT(NR_CPUS) - 1))
+#define CPU_MASK_NONE       ((cpumask_t)0)
+
+/* CPUs that are up, and CPUs taken out of unbound work by isolcpus= (cpuset.c) */
+extern cpumask_t cpu_online_mask;
+extern cpumask_t cpu_isolated_mask;
+
+static inline cpumask_t cpumask_of(uint32_t cpu) {
+    return BIT(cpu);
+}
+
+static inline bool cpumask_test_cpu(uint32_t cpu, cpumask_t mask) {
+    return cpu < NR_CPUS && CHECK_BIT(mask, cpu);
+}
+
+/* Lowest CPU in the mask, NR_CPUS if it is empty */
+static inline uint32_t cpumask_first(cpumask_t mask) {
+    return mask ? (uint32_t)__builtin_ctz(mask) : NR_CPUS;
+}
+
+/* No libgcc for __builtin_popcount */
+static inline uint32_t cpumask_weight(cpumask_t mask) {
+    uint32_t weight = 0;
+
+    for (; mask; mask &= mask - 1)
+        weight++;
+    return weight;
+}
+
+/* Online CPUs left for unbound threads, work items and interrupts */
+static inline cpumask_t housekeeping_cpumask(void) {
+    return cpu_online_mask & ~cpu_isolated_mask;
+}
+
+static inline bool cpu_is_isolated(uint32_t cpu) {
+    return cpumask_test_cpu(cpu, cpu_isolated_mask);
+}
+
+/* Parse a CPU or node list such as "1-3,6"; -EINVAL on syntax or range errors */
+int cpulist_parse(const char* list, uint32_t* mask, uint32_t limit);
+
+#endif /* CPUMASK_H */
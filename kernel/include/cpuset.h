@@ -0,0 +1,31 @@
+#ifndef CPUSET_H
+#define CPUSET_H
+
+#include "types.h"
+#include "cpumask.h"
+
+struct thread;
+
+#define CPUSET_MAX          8
+
+/* A group of threads confined to some CPUs and some NUMA nodes' memory */
+struct cpuset {
+    const char* name;
+    cpumask_t cpus;
+    nodemask_t mems;
+    uint32_t nr_threads;
+    bool in_use;
+};
+
+/* Every thread starts here: the housekeeping CPUs and all memory */
+extern struct cpuset top_cpuset;
+
+/* Cpuset interface */
+int init_cpusets(void);
+struct cpuset* cpuset_create(const char* name, cpumask_t cpus, nodemask_t mems);
+int cpuset_destroy(struct cpuset* cs);
+int cpuset_attach(struct cpuset* cs, struct thread* thread);
+void cpuset_fork(struct thread* thread, struct cpuset* cs);
+void cpuset_exit(struct thread* thread);
+
+#endif /* CPUSET_H */
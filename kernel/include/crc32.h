@@ -0,0 +1,12 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include "types.h"
+
+/*
+ * CRC-32 (IEEE 802.3, reflected), compatible with zlib's crc32(): pass 0
+ * to start and the previous result to continue over more data.
+ */
+uint32_t crc32(uint32_t crc, const void* data, size_t length);
+
+#endif /* CRC32_H */
@@ -0,0 +1,22 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include "types.h"
+
+/* ISA (8237A) DMA controller - 8-bit channels 0-3 */
+#define DMA_CHANNEL_FLOPPY  2
+
+/* Transfer direction */
+#define DMA_MODE_READ       0x44    /* Single mode, device -> memory */
+#define DMA_MODE_WRITE      0x48    /* Single mode, memory -> device */
+
+/* ISA DMA can only address the first 16MB and must not cross 64KB */
+#define DMA_LIMIT           0x1000000
+#define DMA_BOUNDARY        0x10000
+
+/* DMA interface */
+int dma_setup(uint8_t channel, uintptr_t addr, uint32_t length, uint8_t mode);
+void dma_mask(uint8_t channel);
+uint32_t dma_residue(uint8_t channel);
+
+#endif /* DMA_H */
@@ -0,0 +1,67 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include "types.h"
+
+/* ELF32 identification */
+#define ELF_MAGIC           0x464C457F      /* "\x7FELF" */
+#define ELF_CLASS_32        1
+#define ELF_DATA_LSB        1
+#define ELF_VERSION_CURRENT 1
+
+/* Object types and machines */
+#define ET_EXEC             2
+#define ET_DYN              3
+#define EM_386              3
+
+/* Program header types and flags */
+#define PT_NULL             0
+#define PT_LOAD             1
+#define PT_DYNAMIC          2
+#define PT_INTERP           3
+
+#define PF_X                0x1
+#define PF_W                0x2
+#define PF_R                0x4
+
+struct elf32_ehdr {
+    uint32_t e_magic;
+    uint8_t e_class;
+    uint8_t e_data;
+    uint8_t e_ident_version;
+    uint8_t e_pad[9];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;
+    uint32_t e_phoff;
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} PACKED;
+
+struct elf32_phdr {
+    uint32_t p_type;
+    uint32_t p_offset;
+    uint32_t p_vaddr;
+    uint32_t p_paddr;
+    uint32_t p_filesz;
+    uint32_t p_memsz;
+    uint32_t p_flags;
+    uint32_t p_align;
+} PACKED;
+
+/* Header sanity checks for a 32-bit little endian i386 image of the given type */
+static inline bool elf_header_ok(const struct elf32_ehdr* ehdr, uint16_t type) {
+    return ehdr->e_magic == ELF_MAGIC && ehdr->e_class == ELF_CLASS_32 &&
+           ehdr->e_data == ELF_DATA_LSB && ehdr->e_ident_version == ELF_VERSION_CURRENT &&
+           ehdr->e_type == type && ehdr->e_machine == EM_386 &&
+           ehdr->e_phentsize == sizeof(struct elf32_phdr);
+}
+
+#endif /* ELF_H */
@@ -0,0 +1,28 @@
+#ifndef ERRNO_H
+#define ERRNO_H
+
+/* Kernel error codes (returned negated, e.g. return -EIO) */
+#define EPERM       1   /* Operation not permitted */
+#define ENOENT      2   /* No such file or directory */
+#define EIO         5   /* I/O error */
+#define ENXIO       6   /* No such device or address */
+#define E2BIG       7   /* Argument list too long */
+#define ENOEXEC     8   /* Exec format error */
+#define EAGAIN      11  /* Try again */
+#define ENOMEM      12  /* Out of memory */
+#define EFAULT      14  /* Bad address */
+#define EBUSY       16  /* Device or resource busy */
+#define EEXIST      17  /* File exists */
+#define ENODEV      19  /* No such device */
+#define ENOTDIR     20  /* Not a directory */
+#define EISDIR      21  /* Is a directory */
+#define EINVAL      22  /* Invalid argument */
+#define ENOSPC      28  /* No space left on device */
+#define EROFS       30  /* Read-only file system */
+#define ERANGE      34  /* Result out of range */
+#define ENAMETOOLONG 36 /* File name too long */
+#define ENOSYS      38  /* Function not implemented */
+#define ENOTEMPTY   39  /* Directory not empty */
+#define ETIMEDOUT   110 /* Operation timed out */
+
+#endif /* ERRNO_H */
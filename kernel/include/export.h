@@ -0,0 +1,27 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "types.h"
+
+/* Kernel symbol modules may link against, collected in the .ksymtab section */
+struct kernel_symbol {
+    const char* name;
+    const void* addr;
+};
+
+/*
+ * Export a function or variable to modules (module.c). Modules resolve
+ * undefined symbols only against this table, not the whole kernel.
+ * Modules themselves export nothing.
+ */
+#ifdef MODULE
+#define EXPORT_SYMBOL(sym)
+#else
+#define EXPORT_SYMBOL(sym)                                              \
+    static const struct kernel_symbol __ksymtab_##sym                   \
+    __attribute__((used, section(".ksymtab"), aligned(4))) = {          \
+        .name = #sym, .addr = (const void*)&sym                         \
+    }
+#endif
+
+#endif /* EXPORT_H */
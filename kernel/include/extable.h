@@ -0,0 +1,30 @@
+#ifndef EXTABLE_H
+#define EXTABLE_H
+
+#include "types.h"
+#include "idt.h"
+
+/*
+ * Exception table: each entry pairs an instruction that may fault on a
+ * user address with the code to resume at when it does. Entries are
+ * collected in the __ex_table section (kernel.ld) and sorted at boot so
+ * the fault path can binary search them.
+ */
+struct exception_table_entry {
+    uint32_t insn;
+    uint32_t fixup;
+};
+
+/* Emit an entry for the instruction at label from, resuming at label to */
+#define _ASM_EXTABLE(from, to)                  \
+    ".pushsection __ex_table, \"a\"\n"          \
+    ".balign 4\n"                               \
+    ".long " #from ", " #to "\n"                \
+    ".popsection\n"
+
+/* Exception table interface */
+void sort_main_extable(void);
+const struct exception_table_entry* search_exception_tables(uint32_t addr);
+bool fixup_exception(struct interrupt_frame* frame);
+
+#endif /* EXTABLE_H */
@@ -0,0 +1,66 @@
+#ifndef FLOPPY_H
+#define FLOPPY_H
+
+#include "types.h"
+#include "block.h"
+
+/* 82077AA floppy disk controller registers (primary controller) */
+#define FDC_BASE            0x3F0
+#define FDC_DOR             (FDC_BASE + 2)  /* Digital output register */
+#define FDC_MSR             (FDC_BASE + 4)  /* Main status register (read) */
+#define FDC_DSR             (FDC_BASE + 4)  /* Data rate select (write) */
+#define FDC_FIFO            (FDC_BASE + 5)  /* Data FIFO */
+#define FDC_DIR             (FDC_BASE + 7)  /* Digital input register (read) */
+#define FDC_CCR             (FDC_BASE + 7)  /* Configuration control (write) */
+
+/* Digital output register bits */
+#define DOR_RESET           0x04            /* 0 = controller in reset */
+#define DOR_DMA_IRQ         0x08
+#define DOR_MOTOR(drive)    (0x10 << (drive))
+
+/* Main status register bits */
+#define MSR_ACTA            0x01            /* Drive 0 seeking */
+#define MSR_CB              0x10            /* Command busy */
+#define MSR_NDMA            0x20
+#define MSR_DIO             0x40            /* 1 = controller -> CPU */
+#define MSR_RQM             0x80            /* Data register ready */
+
+/* Commands */
+#define FDC_CMD_SPECIFY     0x03
+#define FDC_CMD_WRITE       0x05
+#define FDC_CMD_READ        0x06
+#define FDC_CMD_RECALIBRATE 0x07
+#define FDC_CMD_SENSE_INT   0x08
+#define FDC_CMD_SEEK        0x0F
+#define FDC_CMD_VERSION     0x10
+#define FDC_CMD_CONFIGURE   0x13
+#define FDC_CMD_LOCK        0x94
+
+/* Command modifiers */
+#define FDC_MT              0x80            /* Multi-track (both heads) */
+#define FDC_MFM             0x40
+
+#define FDC_VERSION_82077AA 0x90
+
+/* 1.44MB 3.5" geometry */
+#define FLOPPY_CYLINDERS    80
+#define FLOPPY_HEADS        2
+#define FLOPPY_SPT          18
+#define FLOPPY_SECTOR_SIZE  512
+#define FLOPPY_TRACK_SECTORS (FLOPPY_HEADS * FLOPPY_SPT)
+#define FLOPPY_TRACK_SIZE   (FLOPPY_TRACK_SECTORS * FLOPPY_SECTOR_SIZE)
+#define FLOPPY_SECTORS      (FLOPPY_CYLINDERS * FLOPPY_TRACK_SECTORS)
+
+/* Timing defaults (floppy.spinup_us and floppy.idle_us override) */
+#define FLOPPY_SPINUP_US    300000          /* Motor spin-up before transfers */
+#define FLOPPY_MOTOR_IDLE_US 2000000        /* Motor off after this much idle time */
+#define FLOPPY_TIMEOUT_US   1000000
+#define FLOPPY_RETRIES      3
+
+/* Floppy driver interface */
+struct block_device* floppy_get_device(void);
+void floppy_poll(void);
+void floppy_motor_off(void);
+void floppy_resume(void);
+
+#endif /* FLOPPY_H */
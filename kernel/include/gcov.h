@@ -0,0 +1,9 @@
+#ifndef GCOV_H
+#define GCOV_H
+
+#include "types.h"
+
+/* Print the profile counters of a PGO=gen kernel over the console (gcov.c) */
+void gcov_dump(void);
+
+#endif /* GCOV_H */
@@ -0,0 +1,41 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include "types.h"
+
+/* Segment selectors */
+#define GDT_KERNEL_CODE     0x08
+#define GDT_KERNEL_DATA     0x10
+#define GDT_USER_CODE       0x1B    /* RPL 3 */
+#define GDT_USER_DATA       0x23    /* RPL 3 */
+#define GDT_ENTRIES         5
+
+/* Access byte */
+#define GDT_PRESENT         0x80
+#define GDT_RING3           0x60
+#define GDT_SEGMENT         0x10    /* Code or data, not system */
+#define GDT_EXECUTABLE      0x08
+#define GDT_READ_WRITE      0x02
+
+/* Flags nibble */
+#define GDT_GRANULARITY_4K  0x80
+#define GDT_SIZE_32         0x40
+
+struct gdt_entry {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_middle;
+    uint8_t access;
+    uint8_t granularity;        /* Flags and limit bits 16-19 */
+    uint8_t base_high;
+} PACKED;
+
+struct gdt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} PACKED;
+
+/* GDT interface */
+int init_gdt(void);
+
+#endif /* GDT_H */
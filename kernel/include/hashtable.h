@@ -0,0 +1,47 @@
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+#include "types.h"
+
+/*
+ * Intrusive chained hash table that resizes incrementally. When the load
+ * factor crosses one, a table twice the size is allocated and every later
+ * operation moves a few buckets across, so no single insert pays for the
+ * whole rehash. Each entry lives in exactly one bucket at any time.
+ */
+#define HASH_TABLE_MIN_SIZE 16
+#define HASH_REHASH_STEP    4       /* Buckets moved per operation */
+
+struct hash_node {
+    struct hash_node* next;
+    uint32_t hash;
+};
+
+struct hash_table {
+    struct hash_node** buckets[2];  /* [1] is the resize target */
+    uint32_t size[2];
+    uint32_t count;
+    int32_t rehash_index;           /* Next bucket of [0] to move, -1 if idle */
+};
+
+typedef bool (*hash_match_t)(const struct hash_node* node, const void* key);
+
+#define hash_entry(ptr, type, member) CONTAINER_OF(ptr, type, member)
+
+/* Multiplicative hash of a 32-bit value */
+static inline uint32_t hash_u32(uint32_t value) {
+    value *= 0x9E3779B9;
+    return value ^ (value >> 16);
+}
+
+/* Hash table interface */
+int hash_table_init(struct hash_table* table, uint32_t size_hint);
+void hash_table_destroy(struct hash_table* table);
+void hash_insert(struct hash_table* table, struct hash_node* node, uint32_t hash);
+struct hash_node* hash_lookup(struct hash_table* table, uint32_t hash, hash_match_t match, const void* key);
+bool hash_remove(struct hash_table* table, struct hash_node* node);
+void hash_table_foreach(struct hash_table* table, void (*fn)(struct hash_node* node, void* arg), void* arg);
+uint32_t hash_string(const char* str);
+uint32_t hash_bytes(const void* data, size_t length);
+
+#endif /* HASHTABLE_H */
@@ -0,0 +1,70 @@
+#ifndef HIBERNATE_H
+#define HIBERNATE_H
+
+#include "types.h"
+
+/*
+ * Boot snapshot area on the boot floppy: the second half of the disk,
+ * which create_fat12.py keeps out of the FAT. The first sector holds a
+ * struct hibernate_header, the compressed image follows. Stage 2 reads
+ * the same layout (SNAPSHOT_* in stage2.asm).
+ */
+#define HIBERNATE_START_LBA 1440
+#define HIBERNATE_SECTORS   1440
+#define HIBERNATE_SECTOR_SIZE 512
+#define HIBERNATE_IMAGE_MAX ((HIBERNATE_SECTORS - 1) * HIBERNATE_SECTOR_SIZE)
+
+#define HIBERNATE_MAGIC     0x50414E53      /* "SNAP" */
+#define HIBERNATE_VERSION   1
+
+/* Only RAM above the low megabyte is saved; the boot loaders run below it */
+#define HIBERNATE_LOW_MEMORY 0x100000
+
+/* Pages compressed together, bounded by the 64KB LZ4 match window */
+#define HIBERNATE_CHUNK_PAGES 16
+
+struct hibernate_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t image_addr;        /* Physical address stage 2 loads the image to */
+    uint32_t image_bytes;
+    uint32_t image_sectors;
+    uint32_t entry;             /* Resume trampoline (hibernate_resume) */
+    uint32_t pages;             /* Pages in the image */
+} PACKED;
+
+/*
+ * The image is a series of chunks, each a run of contiguous pages: this
+ * header followed by packed bytes of LZ4 block data that decompress to
+ * length bytes at addr.
+ */
+struct hibernate_chunk {
+    uint32_t addr;
+    uint32_t length;
+    uint32_t packed;
+} PACKED;
+
+/* CPU state saved by hibernate_save() (layout used by hibernate.s) */
+struct hibernate_context {
+    uint32_t ebx;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t ebp;
+    uint32_t esp;
+    uint32_t eip;
+    uint32_t eflags;
+    uint8_t gdtr[6];
+    uint8_t idtr[6];
+} PACKED;
+
+/*
+ * Save the context like setjmp: returns 0, then 1 a second time when
+ * stage 2 has restored a snapshot and jumped to hibernate_resume.
+ */
+int hibernate_save(struct hibernate_context* context) __attribute__((returns_twice));
+void hibernate_resume(void) NORETURN;
+
+/* Called by kernel_main at the ready point; saves a snapshot with hibernate=1 */
+void hibernate_boot_ready(void);
+
+#endif /* HIBERNATE_H */
@@ -0,0 +1,50 @@
+#ifndef IDT_H
+#define IDT_H
+
+#include "types.h"
+
+#define IDT_ENTRIES         256
+#define IDT_EXCEPTIONS      32
+
+/* Gate type and attributes */
+#define IDT_PRESENT         0x80
+#define IDT_RING3           0x60
+#define IDT_INTERRUPT_GATE  0x0E
+
+/* Exception vectors with special handling */
+#define EXCEPTION_DEBUG     1
+#define EXCEPTION_NMI       2
+#define EXCEPTION_GP        13
+#define EXCEPTION_PAGE_FAULT 14
+
+struct idt_entry {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t type_attr;
+    uint16_t offset_high;
+} PACKED;
+
+struct idt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} PACKED;
+
+/* Register state saved by interrupt_common (interrupt.s) */
+struct interrupt_frame {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp_unused, ebx, edx, ecx, eax;
+    uint32_t vector, error_code;
+    uint32_t eip, cs, eflags;
+    uint32_t user_esp, user_ss;     /* Only pushed on a privilege change */
+};
+
+typedef void (*exception_handler_t)(struct interrupt_frame* frame);
+
+/* IDT interface */
+int init_idt(void);
+void idt_set_gate(uint8_t vector, void (*handler)(void), uint8_t type_attr);
+void set_exception_handler(uint8_t vector, exception_handler_t handler);
+void interrupt_dispatch(struct interrupt_frame* frame);
+
+#endif /* IDT_H */
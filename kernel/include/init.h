@@ -0,0 +1,80 @@
+#ifndef INIT_H
+#define INIT_H
+
+#include "types.h"
+
+/*
+ * Initcall levels, run in this order. Within a level calls run in link
+ * order unless dependencies say otherwise.
+ */
+#define INITCALL_CORE       0   /* Memory, descriptor tables, interrupts */
+#define INITCALL_ARCH       1   /* Timekeeping and CPU features */
+#define INITCALL_SUBSYS     2   /* Caches and subsystem cores */
+#define INITCALL_FS         3   /* Filesystems */
+#define INITCALL_DEVICE     4   /* Driver probes */
+#define INITCALL_LATE       5
+#define INITCALL_LEVELS     6
+
+/*
+ * Boot-only code: placed in .init.text (kernel.ld), whose pages go back to
+ * the page allocator once the initcalls have run. Only for functions that
+ * nothing calls after do_initcalls() returns.
+ */
+#define __init              __attribute__((section(".init.text"), cold))
+
+/* Initcall flags */
+#define INITCALL_ASYNC      0x01    /* Later levels do not wait for this call */
+
+/*
+ * An initcall returns 0 on success, a negative error code on failure, or
+ * -EAGAIN while it is waiting on hardware. Calls returning -EAGAIN are
+ * polled again, so probes that wait on devices overlap with each other
+ * and with the rest of initialization.
+ */
+typedef int (*initcall_t)(void);
+
+struct initcall {
+    const char* name;
+    initcall_t fn;
+    uint32_t level;
+    uint32_t flags;
+    const char* depends;        /* Comma separated initcall names, or NULL */
+};
+
+/*
+ * Built with -DMODULE (module.h), a file's one initcall becomes the
+ * module's entry point instead, called when the module is loaded.
+ */
+#ifdef MODULE
+#define __define_initcall(func, lvl, call_flags, deps)                         \
+    int __module_init(void) __attribute__((alias(#func), copy(func)))
+#else
+#define __define_initcall(func, lvl, call_flags, deps)                         \
+    static const struct initcall __initcall_##func                             \
+    __attribute__((used, section(".initcall" #lvl), aligned(4))) = {           \
+        .name = #func, .fn = func, .level = lvl, .flags = call_flags,          \
+        .depends = deps                                                        \
+    }
+#endif
+
+#define core_initcall(fn)           __define_initcall(fn, 0, 0, NULL)
+#define arch_initcall(fn)           __define_initcall(fn, 1, 0, NULL)
+#define subsys_initcall(fn)         __define_initcall(fn, 2, 0, NULL)
+#define fs_initcall(fn)             __define_initcall(fn, 3, 0, NULL)
+#define device_initcall(fn)         __define_initcall(fn, 4, 0, NULL)
+#define late_initcall(fn)           __define_initcall(fn, 5, 0, NULL)
+
+/* Asynchronous probe: only calls naming it in their dependencies wait */
+#define device_initcall_async(fn)   __define_initcall(fn, 4, INITCALL_ASYNC, NULL)
+
+/* Explicit dependencies, e.g. initcall_depends(mount_root, 3, "floppy_probe") */
+#define initcall_depends(fn, lvl, deps) __define_initcall(fn, lvl, 0, deps)
+#define initcall_depends_async(fn, lvl, deps) __define_initcall(fn, lvl, INITCALL_ASYNC, deps)
+
+/* Initcall executor interface */
+void run_constructors(void);
+void do_initcalls(void);
+uint64_t initcall_ready_cycles(void);
+void free_initmem(void);
+
+#endif /* INIT_H */
@@ -0,0 +1,47 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include "types.h"
+
+struct interrupt_frame;
+
+/* 8259A Programmable Interrupt Controllers */
+#define PIC1_COMMAND        0x20
+#define PIC1_DATA           0x21
+#define PIC2_COMMAND        0xA0
+#define PIC2_DATA           0xA1
+
+#define PIC_ICW1_INIT       0x11    /* Edge triggered, cascade, ICW4 follows */
+#define PIC_ICW4_8086       0x01
+#define PIC_EOI             0x20
+#define PIC_READ_ISR        0x0B
+#define PIC_CASCADE_IRQ     2
+
+/* IRQ lines are remapped above the CPU exception vectors */
+#define IRQ_BASE            32
+#define IRQ_LINES           16
+
+#define IRQ_TIMER           0
+#define IRQ_KEYBOARD        1
+#define IRQ_FLOPPY          6
+
+/*
+ * Hardware interrupt handler ("top half"). Runs with interrupts disabled,
+ * so it should only acknowledge the device, grab what cannot wait and
+ * hand the rest to a softirq, tasklet or workqueue (softirq.h,
+ * workqueue.h).
+ */
+typedef void (*irq_handler_t)(int irq, void* data);
+
+/* IRQ interface */
+int init_interrupts(void);
+int request_irq(int irq, irq_handler_t handler, void* data, const char* name);
+void irq_mask(int irq);
+void irq_unmask(int irq);
+void irq_dispatch(struct interrupt_frame* frame);
+
+/* PIC state across a boot snapshot (hibernate.c), called with interrupts off */
+void irq_suspend(void);
+void irq_resume(void);
+
+#endif /* IRQ_H */
@@ -0,0 +1,63 @@
+#ifndef IRQFLAGS_H
+#define IRQFLAGS_H
+
+#include "types.h"
+
+#define EFLAGS_IF           0x200
+
+/*
+ * Interrupt enable/disable. Every transition from enabled to disabled and
+ * back is reported to the irqs-off tracer (irqsoff.c), which keeps the
+ * longest interrupts-disabled section seen since boot.
+ */
+void trace_irqs_off(void* caller);
+void trace_irqs_on(void* caller);
+uint32_t irqsoff_max_us(void);
+
+static inline uint32_t arch_local_save_flags(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushfl; popl %0" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline bool irqs_disabled(void) {
+    return !(arch_local_save_flags() & EFLAGS_IF);
+}
+
+static inline void arch_local_irq_disable(void) {
+    __asm__ volatile ("cli" : : : "memory");
+}
+
+static inline void arch_local_irq_enable(void) {
+    __asm__ volatile ("sti" : : : "memory");
+}
+
+static inline void local_irq_disable(void) {
+    bool was_enabled = !irqs_disabled();
+    arch_local_irq_disable();
+    if (was_enabled)
+        trace_irqs_off(__builtin_return_address(0));
+}
+
+static inline void local_irq_enable(void) {
+    if (irqs_disabled())
+        trace_irqs_on(__builtin_return_address(0));
+    arch_local_irq_enable();
+}
+
+static inline uint32_t local_irq_save(void) {
+    uint32_t flags = arch_local_save_flags();
+    arch_local_irq_disable();
+    if (flags & EFLAGS_IF)
+        trace_irqs_off(__builtin_return_address(0));
+    return flags;
+}
+
+static inline void local_irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+        trace_irqs_on(__builtin_return_address(0));
+        arch_local_irq_enable();
+    }
+}
+
+#endif /* IRQFLAGS_H */
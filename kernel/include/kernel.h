@@ -0,0 +1,19 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include "types.h"
+
+/* Console output (kernel.c) */
+void kprintf(const char* format, ...);
+void kprintf_hex(uint32_t value);
+void kprintf_dec(uint32_t value);
+
+/* Print a message and halt the machine */
+void panic(const char* message) NORETURN;
+
+/* Multiboot information from the boot loader (kernel.c) */
+struct multiboot_info;
+struct multiboot_info* kernel_boot_info(void);
+int kernel_copy_boot_info(void);
+
+#endif /* KERNEL_H */
@@ -0,0 +1,60 @@
+#ifndef KEXEC_H
+#define KEXEC_H
+
+#include "types.h"
+#include "multiboot.h"
+
+#define KEXEC_MAX_SEGMENTS  16
+#define KEXEC_MAX_MODULES   8
+#define KEXEC_MAX_MMAP      32
+#define KEXEC_CMDLINE_SIZE  512
+#define KEXEC_MODULE_CMDLINE_SIZE 64
+
+/* One PT_LOAD segment: size bytes copied from src to dest, then zeroed up to memsz */
+struct kexec_segment {
+    uint32_t src;
+    uint32_t dest;
+    uint32_t size;
+    uint32_t memsz;
+} PACKED;
+
+/*
+ * Read by kexec_relocate (kexec.s) from the control page, after the copy
+ * of its own code. Layout shared with the assembly.
+ */
+struct kexec_control {
+    uint32_t entry;
+    uint32_t boot_info;         /* struct multiboot_info* for the new kernel */
+    uint32_t count;
+    struct kexec_segment segments[KEXEC_MAX_SEGMENTS];
+} PACKED;
+
+/* Multiboot information handed to the new kernel, in one staging block */
+struct kexec_boot_info {
+    struct multiboot_info mbi;
+    struct multiboot_mod_list mods[KEXEC_MAX_MODULES];
+    struct multiboot_mmap_entry mmap[KEXEC_MAX_MMAP];
+    char mod_cmdlines[KEXEC_MAX_MODULES][KEXEC_MODULE_CMDLINE_SIZE];
+    char loader_name[16];
+    char cmdline[KEXEC_CMDLINE_SIZE];
+} PACKED;
+
+/* Relocation trampoline (kexec.s), copied to the control page before use */
+extern const uint8_t kexec_relocate[];
+extern const uint8_t kexec_relocate_end[];
+
+/*
+ * Stage an ELF32 multiboot kernel (e.g. build/kernel.elf) to replace the
+ * running one. cmdline may be NULL to keep the current command line; the
+ * boot modules and the memory map are carried over.
+ */
+int kexec_load(const void* image, size_t length, const char* cmdline);
+void kexec_unload(void);
+
+/* Quiesce the devices and start the staged kernel; returns only on error */
+int kernel_kexec(void);
+
+/* Reset the machine through the keyboard controller */
+void kernel_restart(void) NORETURN;
+
+#endif /* KEXEC_H */
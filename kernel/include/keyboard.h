@@ -0,0 +1,26 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include "types.h"
+
+/* 8042 PS/2 controller */
+#define KBD_DATA            0x60
+#define KBD_STATUS          0x64
+#define KBD_STATUS_OUTPUT   0x01    /* Output buffer full */
+
+/* Scancode set 1 */
+#define KBD_RELEASE         0x80
+#define KBD_EXTENDED        0xE0
+#define KBD_LSHIFT          0x2A
+#define KBD_RSHIFT          0x36
+#define KBD_CTRL            0x1D
+#define KBD_CAPSLOCK        0x3A
+
+#define KBD_RAW_SIZE        64      /* Scancodes buffered by the top half */
+#define KBD_INPUT_SIZE      256     /* Decoded characters */
+
+/* Keyboard interface */
+int keyboard_getc(void);
+bool keyboard_poll(char* c);
+
+#endif /* KEYBOARD_H */
@@ -0,0 +1,44 @@
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+#include "types.h"
+#include "list.h"
+#include "numa.h"
+
+/* Slab lists of one NUMA node */
+struct kmem_cache_node {
+    struct list_head partial;   /* Slabs with free objects */
+    struct list_head full;
+    struct list_head empty;     /* At most one, kept to avoid page churn */
+};
+
+/*
+ * Slab cache: fixed size objects carved out of single pages. Each slab
+ * page starts with a struct slab header, which lets kfree() find the
+ * owning cache from the object address alone. Slabs are kept per node
+ * and allocations take objects from the running CPU's node.
+ */
+struct kmem_cache {
+    const char* name;
+    uint32_t size;              /* Object size including alignment */
+    uint32_t objects_per_slab;
+    uint32_t active_objects;
+    struct kmem_cache_node node[MAX_NUMNODES];
+};
+
+#define KMALLOC_MIN_SIZE    16
+#define KMALLOC_MAX_SIZE    1024    /* Larger requests get whole pages */
+#define KMALLOC_CACHES      7       /* 16, 32, ... 1024 */
+
+/* Slab allocator interface */
+void kmem_cache_init(struct kmem_cache* cache, const char* name, size_t size);
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* object);
+
+/* General purpose allocator */
+void kmalloc_init(void);
+void* kmalloc(size_t size);
+void* kzalloc(size_t size);
+void kfree(void* ptr);
+
+#endif /* KMALLOC_H */
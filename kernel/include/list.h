@@ -0,0 +1,57 @@
+#ifndef LIST_H
+#define LIST_H
+
+#include "types.h"
+
+/* Intrusive circular doubly linked list */
+struct list_head {
+    struct list_head* next;
+    struct list_head* prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+#define list_entry(ptr, type, member) CONTAINER_OF(ptr, type, member)
+#define list_first_entry(head, type, member) list_entry((head)->next, type, member)
+
+#define list_for_each(pos, head) \
+    for (pos = (head)->next; pos != (head); pos = pos->next)
+
+#define list_for_each_safe(pos, tmp, head) \
+    for (pos = (head)->next, tmp = pos->next; pos != (head); pos = tmp, tmp = pos->next)
+
+static inline void list_init(struct list_head* head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static inline bool list_empty(const struct list_head* head) {
+    return head->next == head;
+}
+
+static inline void __list_add(struct list_head* entry, struct list_head* prev, struct list_head* next) {
+    next->prev = entry;
+    entry->next = next;
+    entry->prev = prev;
+    prev->next = entry;
+}
+
+/* Insert after head (stack order) */
+static inline void list_add(struct list_head* entry, struct list_head* head) {
+    __list_add(entry, head, head->next);
+}
+
+/* Insert before head (queue order) */
+static inline void list_add_tail(struct list_head* entry, struct list_head* head) {
+    __list_add(entry, head->prev, head);
+}
+
+/* Unlink an entry and leave it pointing at itself, so list_empty() on it is true */
+static inline void list_del(struct list_head* entry) {
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    list_init(entry);
+}
+
+#endif /* LIST_H */
@@ -0,0 +1,23 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include "types.h"
+
+/*
+ * LZ4 block format (no frame header), compatible with LZ4_compress_default()
+ * and LZ4_decompress_safe(). The compressor is the greedy single-pass one;
+ * it needs LZ4_WORKMEM_SIZE bytes of scratch memory from the caller.
+ */
+#define LZ4_HASH_BITS       12
+#define LZ4_WORKMEM_SIZE    ((1 << LZ4_HASH_BITS) * sizeof(uint32_t))
+
+/* Worst case output size for length bytes of incompressible input */
+#define LZ4_COMPRESS_BOUND(length) ((length) + (length) / 255 + 16)
+
+/* Bytes written to dest, or 0 if the result does not fit in capacity */
+size_t lz4_compress(const void* src, size_t length, void* dest, size_t capacity, void* workmem);
+
+/* Bytes written to dest, or -EINVAL for malformed or oversized input */
+ssize_t lz4_decompress(const void* src, size_t length, void* dest, size_t capacity);
+
+#endif /* LZ4_H */
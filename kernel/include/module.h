@@ -0,0 +1,39 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "types.h"
+#include "list.h"
+#include "export.h"
+
+#define MODULE_NAME_LEN     32
+#define MODULE_MAX_IMAGE    (1024 * 1024)   /* Largest image sys_init_module accepts */
+
+/*
+ * Loadable kernel module: a NEF_SYS or NEF_DRIVER image (nef.h), built
+ * from a driver's object file by nef_ld.py. The driver's one initcall
+ * becomes the entry point (init.h); module_exit() names the function
+ * that undoes it. A module without one cannot be unloaded.
+ */
+struct module {
+    char name[MODULE_NAME_LEN];
+    uint8_t type;               /* NEF_SYS or NEF_DRIVER */
+    void* base;
+    uint32_t pages;
+    void (*exit)(void);
+    struct list_head list;
+};
+
+#ifdef MODULE
+#define module_exit(fn)     void __module_exit(void) __attribute__((alias(#fn), copy(fn)))
+#else
+#define module_exit(fn)
+#endif
+
+/* Module interface */
+int init_modules(void);
+const void* kernel_symbol_lookup(const char* name);
+int module_load(const void* image, size_t length, const char* name, struct module** result);
+int module_unload(struct module* mod);
+struct module* module_find(const char* name);
+
+#endif /* MODULE_H */
@@ -0,0 +1,118 @@
+#ifndef NEF_H
+#define NEF_H
+
+#include "types.h"
+
+/*
+ * Nekko Executable Format, see executable-format/NEF_specification.md.
+ * Layout: header, section headers, section data, symbol table, string
+ * table, relocation table, and a trailing copy of the checksum. The
+ * checksum is the CRC32 of everything between the header and the
+ * trailer; the relocation table runs up to the trailer and the string
+ * table up to the relocation table.
+ */
+#define NEF_MAGIC           0x4E454646      /* "NEFF" */
+#define NEF_VERSION         1
+
+/* Executable types */
+#define NEF_EXEC            0x01
+#define NEF_DYN             0x02
+#define NEF_SYS             0x03            /* Kernel module */
+#define NEF_DRIVER          0x04            /* Kernel module that probes for hardware */
+
+/* File flags */
+#define NEF_F_COMPRESSED    0x0001
+#define NEF_F_RELOCATABLE   0x0002
+#define NEF_F_STRIPPED      0x0004
+#define NEF_F_SIGNED        0x0008
+#define NEF_F_PIE           0x0010
+
+/* Section types */
+#define NEF_SECT_NULL       0x00
+#define NEF_SECT_TEXT       0x01
+#define NEF_SECT_DATA       0x02
+#define NEF_SECT_BSS        0x03
+#define NEF_SECT_RODATA     0x04
+#define NEF_SECT_STACK      0x05
+#define NEF_SECT_HEAP       0x06
+#define NEF_SECT_DEBUG      0x07
+
+/*
+ * Section flags. A compressed section holds its size in memory as 4
+ * bytes followed by an LZ4 block; its size field covers both.
+ */
+#define NEF_SF_READ         0x01
+#define NEF_SF_WRITE        0x02
+#define NEF_SF_EXEC         0x04
+#define NEF_SF_COMPRESSED   0x08
+
+/* Symbol types, bindings and special section indices */
+#define NEF_SYM_NOTYPE      0x00
+#define NEF_SYM_OBJECT      0x01
+#define NEF_SYM_FUNC        0x02
+#define NEF_SYM_SECTION     0x03
+
+#define NEF_BIND_LOCAL      0x00
+#define NEF_BIND_GLOBAL     0x01
+#define NEF_BIND_WEAK       0x02
+
+#define NEF_SECTION_UNDEF   0xFFFF          /* Resolved against the kernel */
+#define NEF_SECTION_ABS     0xFFFE
+
+/* Relocation types; the addend is read from the place being relocated */
+#define NEF_R_386_32        0x01
+#define NEF_R_386_PC32      0x02
+#define NEF_R_386_GOT32     0x03
+#define NEF_R_386_PLT32     0x04
+
+struct nef_header {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t type;
+    uint16_t flags;
+    uint32_t entry_point;
+    uint32_t load_address;
+    uint32_t file_size;
+    uint32_t memory_size;
+    uint16_t section_count;
+    uint16_t symbol_count;
+    uint32_t symbol_offset;
+    uint32_t string_offset;
+    uint32_t reloc_offset;
+    uint32_t checksum;
+    uint8_t reserved[16];
+    uint32_t timestamp;
+} PACKED;
+
+struct nef_section {
+    uint32_t name_offset;
+    uint32_t type;
+    uint32_t flags;
+    uint32_t virtual_addr;
+    uint32_t file_offset;
+    uint32_t size;
+    uint32_t alignment;
+    uint32_t reserved;
+} PACKED;
+
+struct nef_symbol {
+    uint32_t name_offset;
+    uint32_t value;             /* Virtual address, relative to load_address */
+    uint32_t size;
+    uint16_t section;
+    uint8_t type;
+    uint8_t binding;
+} PACKED;
+
+struct nef_reloc {
+    uint32_t offset;            /* Virtual address of the place */
+    uint32_t symbol;
+    uint32_t type;
+} PACKED;
+
+/* Header sanity checks for an image of the given type */
+static inline bool nef_header_ok(const struct nef_header* hdr, uint8_t type) {
+    return hdr->magic == NEF_MAGIC && hdr->version == NEF_VERSION && hdr->type == type;
+}
+
+#endif /* NEF_H */
@@ -0,0 +1,231 @@
+#ifndef NKFS_H
+#define NKFS_H
+
+#include "types.h"
+#include "list.h"
+#include "hashtable.h"
+#include "radix_tree.h"
+#include "block.h"
+#include "sched.h"
+#include "workqueue.h"
+#include "cgroup.h"
+#include "nkfs_format.h"
+
+/*
+ * nkfs: the native nekkoOS filesystem (on-disk format in nkfs_format.h)
+ *
+ * Metadata blocks go through a small per-mount block cache. File data goes
+ * through a per-inode page cache, and writes only dirty pages: blocks are
+ * allocated when the pages are written back, one contiguous extent per run
+ * of dirty pages (delayed allocation). Files marked for compression are
+ * written back a cluster at a time instead. Metadata changes are journaled
+ * (nkfs_journal.c). Callers hold nkfs_lock() around every call except
+ * format, mount and unmount.
+ */
+#define NKFS_BUF_MAX        512     /* Cached metadata blocks per mount */
+#define NKFS_DIRTY_LIMIT    1024    /* Dirty pages per mount before writeback */
+#define NKFS_CACHE_PAGES    2048    /* Pages an inode keeps after writeback */
+#define NKFS_BTREE_MAX_DEPTH 8
+#define NKFS_BTREE_MAX_RECORD 64     /* Largest B+tree record */
+#define NKFS_COMMIT_INTERVAL_MS 5000 /* Longest a transaction stays open */
+#define NKFS_TRANS_RESERVE  32      /* Blocks one operation may add to a transaction */
+
+/* Cached metadata block */
+struct nkfs_buf {
+    struct hash_node node;
+    struct list_head lru;           /* On the LRU list while unreferenced */
+    struct nkfs_fs* fs;
+    uint32_t block;
+    uint32_t count;
+    bool dirty;
+    uint8_t* data;
+    /* Journal state; each list holds a reference */
+    struct list_head trans_entry;   /* On the running transaction */
+    struct list_head checkpoint_entry; /* Committed, not yet written in place */
+    uint32_t trans;                 /* Running transaction it is part of, 0 if none */
+    uint32_t log_seq;               /* Last transaction that logged it */
+    uint32_t log_pos;               /* Where that transaction starts in the log */
+};
+
+/* Page cache page of a file */
+#define NKFS_PAGE_DIRTY     0x01
+
+struct nkfs_page {
+    uint8_t* data;
+    uint32_t flags;
+};
+
+struct nkfs_inode {
+    struct hash_node node;
+    struct nkfs_fs* fs;
+    uint32_t ino;
+    uint32_t count;
+    bool dirty;
+    struct list_head dirty_entry;   /* On fs->dirty_inodes while dirty */
+    struct nkfs_disk_inode disk;
+    struct radix_tree_root pages;   /* struct nkfs_page by page index */
+    uint32_t nr_pages;
+    uint32_t nr_dirty;
+    uint32_t trans;                 /* Last transaction the inode was written in */
+};
+
+/* Blocks freed by the running transaction, reusable once it commits */
+struct nkfs_free_run {
+    struct list_head entry;
+    uint32_t start;
+    uint32_t count;
+};
+
+struct nkfs_transaction {
+    uint32_t seq;
+    struct list_head buffers;       /* struct nkfs_buf by trans_entry */
+    uint32_t nr_buffers;
+    uint32_t* revokes;
+    uint32_t nr_revokes;
+    uint32_t max_revokes;
+    struct list_head frees;         /* struct nkfs_free_run */
+};
+
+struct nkfs_journal {
+    uint32_t start;                 /* First log block (after the journal superblock) */
+    uint32_t size;                  /* Log blocks */
+    uint32_t head;                  /* Next log block to write */
+    uint32_t tail;                  /* Oldest log block still needed */
+    uint32_t tail_seq;
+    uint32_t free;                  /* Log blocks between head and tail */
+    uint32_t commit_seq;            /* Last transaction on disk */
+    uint32_t handles;               /* Open nkfs_journal_start() calls */
+    uint32_t commits;
+    int error;                      /* Set when a commit failed; the journal stops */
+    bool group_commit;              /* fsync joins the next commit instead of running one */
+    struct nkfs_transaction running;
+    struct list_head checkpoint;    /* struct nkfs_buf by checkpoint_entry */
+    struct delayed_work commit_work;
+    struct work_struct checkpoint_work;
+    struct wait_queue_head commit_wait;
+    uint8_t* block;                 /* Descriptor or commit block being built */
+};
+
+struct nkfs_fs {
+    struct block_device* dev;
+    struct nkfs_super super;
+    uint8_t* block_bitmap;
+    uint8_t* inode_bitmap;
+    bool* bitmap_dirty;             /* Per bitmap block, from super.block_bitmap */
+    bool super_dirty;
+    uint32_t alloc_goal;            /* Where the next unrelated allocation starts */
+    struct hash_table buf_table;
+    struct list_head buf_lru;
+    uint32_t nr_bufs;
+    struct hash_table inode_table;
+    struct list_head dirty_inodes;
+    uint32_t nr_dirty_pages;
+    struct nkfs_inode* root;
+    struct nkfs_journal journal;
+    bool locked;
+    struct wait_queue_head lock_wait;
+    struct mem_shrinker shrinker;   /* Clean page cache pages, for memory limits */
+    uint8_t* cluster_data;          /* Compression buffers, allocated on first use */
+    uint8_t* cluster_packed;
+    void* lz4_work;
+};
+
+/* Blocks an extent holds on disk, and logical blocks it maps */
+static inline uint32_t nkfs_extent_blocks(const struct nkfs_extent* extent) {
+    return extent->len & ~NKFS_EXTENT_COMPRESSED;
+}
+
+static inline uint32_t nkfs_extent_span(const struct nkfs_extent* extent) {
+    return extent->len & NKFS_EXTENT_COMPRESSED ? NKFS_CLUSTER_BLOCKS : extent->len;
+}
+
+/* B+tree cursor: a referenced leaf and a record slot in it */
+struct nkfs_btree_cursor {
+    struct nkfs_buf* leaf;
+    uint32_t index;
+};
+
+/* Search modes */
+#define NKFS_BTREE_GE       0       /* First record with key >= search key */
+#define NKFS_BTREE_LE       1       /* Last record with key <= search key */
+
+/* Mount interface (nkfs_super.c) */
+int nkfs_format(struct block_device* dev, uint32_t inodes);
+int nkfs_mount(struct block_device* dev, struct nkfs_fs** result);
+int nkfs_sync(struct nkfs_fs* fs);
+int nkfs_unmount(struct nkfs_fs* fs);
+void nkfs_lock(struct nkfs_fs* fs);
+bool nkfs_trylock(struct nkfs_fs* fs);
+void nkfs_unlock(struct nkfs_fs* fs);
+int nkfs_stage_metadata(struct nkfs_fs* fs);
+
+/* Block I/O and the metadata block cache (nkfs_super.c) */
+int nkfs_block_read(struct nkfs_fs* fs, uint32_t block, void* data);
+int nkfs_block_write(struct nkfs_fs* fs, uint32_t block, const void* data);
+struct nkfs_buf* nkfs_bread(struct nkfs_fs* fs, uint32_t block);
+struct nkfs_buf* nkfs_bnew(struct nkfs_fs* fs, uint32_t block);
+void nkfs_brelse(struct nkfs_buf* buf);
+void nkfs_bdirty(struct nkfs_buf* buf);
+void nkfs_bforget(struct nkfs_fs* fs, uint32_t block);
+
+/* Block and inode allocation (nkfs_alloc.c) */
+uint32_t nkfs_alloc_blocks(struct nkfs_fs* fs, uint32_t goal, uint32_t count, uint32_t* allocated);
+void nkfs_free_blocks(struct nkfs_fs* fs, uint32_t start, uint32_t count);
+void nkfs_release_blocks(struct nkfs_fs* fs, uint32_t start, uint32_t count);
+uint32_t nkfs_alloc_inode(struct nkfs_fs* fs);
+void nkfs_free_inode(struct nkfs_fs* fs, uint32_t ino);
+
+/* Metadata journal (nkfs_journal.c) */
+int nkfs_journal_format(struct nkfs_fs* fs, void* block);
+int nkfs_journal_load(struct nkfs_fs* fs);
+void nkfs_journal_destroy(struct nkfs_fs* fs);
+void nkfs_journal_start(struct nkfs_fs* fs);
+void nkfs_journal_stop(struct nkfs_fs* fs);
+void nkfs_journal_dirty(struct nkfs_buf* buf);
+void nkfs_journal_forget(struct nkfs_buf* buf);
+void nkfs_journal_revoke(struct nkfs_fs* fs, uint32_t block);
+int nkfs_journal_free(struct nkfs_fs* fs, uint32_t start, uint32_t count);
+int nkfs_journal_commit(struct nkfs_fs* fs);
+int nkfs_journal_checkpoint(struct nkfs_fs* fs);
+int nkfs_journal_wait(struct nkfs_fs* fs, uint32_t seq);
+
+/* B+tree rooted at inode->disk.tree_root (nkfs_btree.c) */
+int nkfs_btree_create(struct nkfs_inode* inode);
+int nkfs_btree_find(struct nkfs_inode* inode, uint32_t record_size, uint32_t key, int mode,
+                    struct nkfs_btree_cursor* cursor);
+int nkfs_btree_next(struct nkfs_inode* inode, uint32_t record_size, struct nkfs_btree_cursor* cursor);
+void* nkfs_btree_record(struct nkfs_btree_cursor* cursor, uint32_t record_size);
+void nkfs_btree_release(struct nkfs_btree_cursor* cursor);
+int nkfs_btree_insert(struct nkfs_inode* inode, uint32_t record_size, const void* record);
+void nkfs_btree_delete(struct nkfs_btree_cursor* cursor, uint32_t record_size);
+void nkfs_btree_free(struct nkfs_inode* inode);
+uint32_t nkfs_btree_depth(struct nkfs_inode* inode);
+
+/* Inodes and file data (nkfs_inode.c) */
+struct nkfs_inode* nkfs_iget(struct nkfs_fs* fs, uint32_t ino);
+void nkfs_iput(struct nkfs_inode* inode);
+struct nkfs_inode* nkfs_new_inode(struct nkfs_fs* fs, uint16_t mode);
+void nkfs_mark_inode_dirty(struct nkfs_inode* inode);
+int nkfs_write_inode(struct nkfs_inode* inode);
+int nkfs_set_compress(struct nkfs_inode* inode, bool compress);
+void nkfs_free_cluster_buffers(struct nkfs_fs* fs);
+int nkfs_map_block(struct nkfs_inode* inode, uint32_t logical, uint32_t* block);
+uint32_t nkfs_extent_count(struct nkfs_inode* inode);
+ssize_t nkfs_read(struct nkfs_inode* inode, uint32_t offset, void* buffer, size_t length);
+ssize_t nkfs_write(struct nkfs_inode* inode, uint32_t offset, const void* buffer, size_t length);
+int nkfs_writeback(struct nkfs_inode* inode);
+int nkfs_fsync(struct nkfs_inode* inode);
+uint32_t nkfs_reclaim(struct mem_shrinker* shrinker, struct cgroup* cg, uint32_t nr_pages);
+
+/* Directories (nkfs_dir.c) */
+typedef int (*nkfs_filldir_t)(void* arg, const char* name, uint32_t name_len, uint32_t ino, uint32_t type);
+
+int nkfs_lookup(struct nkfs_inode* dir, const char* name, uint32_t* ino);
+int nkfs_link(struct nkfs_inode* dir, const char* name, struct nkfs_inode* inode);
+int nkfs_create(struct nkfs_inode* dir, const char* name, struct nkfs_inode** result);
+int nkfs_mkdir(struct nkfs_inode* dir, const char* name, struct nkfs_inode** result);
+int nkfs_unlink(struct nkfs_inode* dir, const char* name);
+int nkfs_readdir(struct nkfs_inode* dir, nkfs_filldir_t filldir, void* arg);
+int nkfs_namei(struct nkfs_fs* fs, const char* path, struct nkfs_inode** result);
+
+#endif /* NKFS_H */
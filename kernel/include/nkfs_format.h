@@ -0,0 +1,198 @@
+#ifndef NKFS_FORMAT_H
+#define NKFS_FORMAT_H
+
+#include "types.h"
+
+/*
+ * nkfs on-disk format (little endian), shared with mkfs_nkfs.py
+ *
+ *   block 0            boot area, superblock at byte NKFS_SUPER_OFFSET
+ *   block_bitmap       one bit per block, set = in use
+ *   inode_bitmap       one bit per inode, inode 0 is never used
+ *   inode_table        NKFS_INODE_SIZE bytes per inode
+ *   journal_start      journal superblock, then the circular log
+ *   data_start..       file data, directory and extent tree nodes
+ *
+ * Directories and large extent maps are B+trees of fixed size records
+ * whose first 32-bit word is the key. Directory records are keyed by the
+ * FNV-1a hash of the name, extent records by their first logical block.
+ *
+ * Files with NKFS_INODE_COMPRESS set are stored in clusters of
+ * NKFS_CLUSTER_BLOCKS blocks, one extent per cluster. A cluster that LZ4
+ * shrinks by at least a block is stored as a struct nkfs_cluster_header
+ * followed by the compressed data; others are stored raw.
+ */
+#define NKFS_MAGIC          0x53464B4E      /* "NKFS" */
+#define NKFS_VERSION        3
+#define NKFS_BLOCK_SIZE     4096
+#define NKFS_BLOCK_SHIFT    12
+#define NKFS_SECTOR_SIZE    512
+#define NKFS_SECTORS_PER_BLOCK (NKFS_BLOCK_SIZE / NKFS_SECTOR_SIZE)
+#define NKFS_SUPER_OFFSET   1024
+#define NKFS_BITS_PER_BLOCK (NKFS_BLOCK_SIZE * 8)
+
+#define NKFS_ROOT_INO       1
+#define NKFS_INODE_SIZE     256
+#define NKFS_INODES_PER_BLOCK (NKFS_BLOCK_SIZE / NKFS_INODE_SIZE)
+
+/* Superblock state */
+#define NKFS_STATE_CLEAN    0x0001          /* Unmounted cleanly */
+
+struct nkfs_super {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t blocks_count;
+    uint32_t inodes_count;
+    uint32_t free_blocks;
+    uint32_t free_inodes;
+    uint32_t block_bitmap;          /* First block of each area */
+    uint32_t inode_bitmap;
+    uint32_t inode_table;
+    uint32_t data_start;
+    uint32_t root_ino;
+    uint32_t state;
+    uint32_t journal_start;
+    uint32_t journal_blocks;        /* Including the journal superblock */
+    uint32_t reserved[113];
+} PACKED;
+
+/* Inode mode: file type in the top bits, as in POSIX */
+#define NKFS_S_IFMT         0xF000
+#define NKFS_S_IFDIR        0x4000
+#define NKFS_S_IFREG        0x8000
+#define NKFS_S_ISDIR(mode)  (((mode) & NKFS_S_IFMT) == NKFS_S_IFDIR)
+#define NKFS_S_ISREG(mode)  (((mode) & NKFS_S_IFMT) == NKFS_S_IFREG)
+
+/* Inode flags */
+#define NKFS_INODE_INLINE_DATA 0x0001       /* File data lives in i.data */
+#define NKFS_INODE_EXTENT_TREE 0x0002       /* Extents in the B+tree at tree_root */
+#define NKFS_INODE_COMPRESS 0x0004          /* Compressed clusters; directories pass it on */
+
+#define NKFS_INLINE_DATA_SIZE 192
+#define NKFS_INLINE_EXTENTS 16
+
+/* Run of len blocks of a file starting at logical block logical */
+struct nkfs_extent {
+    uint32_t logical;
+    uint32_t start;
+    uint32_t len;
+} PACKED;
+
+/* Compression clusters */
+#define NKFS_CLUSTER_SHIFT  2
+#define NKFS_CLUSTER_BLOCKS (1 << NKFS_CLUSTER_SHIFT)
+#define NKFS_CLUSTER_SIZE   (NKFS_CLUSTER_BLOCKS * NKFS_BLOCK_SIZE)
+
+/* Set in len: the extent maps a whole cluster, compressed into len blocks */
+#define NKFS_EXTENT_COMPRESSED 0x80000000
+
+struct nkfs_cluster_header {
+    uint32_t length;                /* Bytes of LZ4 block data that follow */
+} PACKED;
+
+struct nkfs_disk_inode {
+    uint16_t mode;
+    uint16_t flags;
+    uint32_t links;
+    uint64_t size;
+    uint32_t blocks;                /* Data and tree blocks allocated */
+    uint32_t parent;                /* Directories: parent directory inode */
+    uint32_t tree_root;             /* Directory or extent B+tree root, 0 if none */
+    uint32_t nr_extents;            /* Extents held in i.extents */
+    uint32_t reserved[8];
+    union {
+        uint8_t data[NKFS_INLINE_DATA_SIZE];
+        struct nkfs_extent extents[NKFS_INLINE_EXTENTS];
+    } i;
+} PACKED;
+
+/* B+tree node: header followed by records (leaves) or index entries */
+#define NKFS_BTREE_MAGIC    0x45455254      /* "TREE" */
+
+struct nkfs_btree_header {
+    uint32_t magic;
+    uint16_t level;                 /* 0 for leaves */
+    uint16_t count;
+    uint32_t next;                  /* Leaves: next leaf in key order, 0 at the end */
+    uint32_t reserved;
+} PACKED;
+
+/* Index entry: child holds keys >= key (the first entry covers everything below) */
+struct nkfs_btree_index {
+    uint32_t key;
+    uint32_t child;
+} PACKED;
+
+#define NKFS_BTREE_SPACE    (NKFS_BLOCK_SIZE - sizeof(struct nkfs_btree_header))
+
+/* Directory record */
+#define NKFS_NAME_MAX       54
+
+#define NKFS_FT_REG         1
+#define NKFS_FT_DIR         2
+
+struct nkfs_dirent {
+    uint32_t hash;                  /* FNV-1a of the name, the B+tree key */
+    uint32_t ino;
+    uint8_t name_len;
+    uint8_t type;                   /* NKFS_FT_* */
+    char name[NKFS_NAME_MAX];
+} PACKED;
+
+/*
+ * Metadata journal. Each transaction is written to the log as descriptor
+ * blocks, each followed by copies of the blocks its tags list, and ends
+ * with a commit block. A tag carries the CRC-32 of its block copy and the
+ * commit block the CRC-32 of all descriptors, so recovery replays a
+ * transaction only if every block of it made it to disk. Revoke tags
+ * have no copy: they stop older copies of a freed block from being
+ * replayed over whatever the block holds now.
+ */
+#define NKFS_JOURNAL_MAGIC  0x4C4E524A      /* "JRNL" */
+#define NKFS_JOURNAL_MIN    256             /* Journal size limits in blocks */
+#define NKFS_JOURNAL_MAX    8192
+
+/* Journal block types */
+#define NKFS_JOURNAL_SUPER  1
+#define NKFS_JOURNAL_DESCRIPTOR 2
+#define NKFS_JOURNAL_COMMIT 3
+
+struct nkfs_journal_header {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t seq;                   /* Transaction sequence number */
+} PACKED;
+
+/* First journal block: where recovery starts */
+struct nkfs_journal_super {
+    struct nkfs_journal_header header;
+    uint32_t tail;                  /* Log block of the oldest live transaction */
+    uint32_t tail_seq;              /* Its sequence number */
+} PACKED;
+
+/* Tag flags */
+#define NKFS_TAG_REVOKE     0x0001
+
+struct nkfs_journal_tag {
+    uint32_t block;                 /* Home location */
+    uint32_t flags;
+    uint32_t checksum;              /* CRC-32 of the logged copy */
+} PACKED;
+
+struct nkfs_journal_descriptor {
+    struct nkfs_journal_header header;
+    uint32_t count;
+    uint32_t reserved;
+    struct nkfs_journal_tag tags[];
+} PACKED;
+
+#define NKFS_JOURNAL_TAGS   ((NKFS_BLOCK_SIZE - sizeof(struct nkfs_journal_descriptor)) / \
+                             sizeof(struct nkfs_journal_tag))
+
+struct nkfs_journal_commit {
+    struct nkfs_journal_header header;
+    uint32_t checksum;              /* CRC-32 over the descriptor blocks */
+} PACKED;
+
+#endif /* NKFS_FORMAT_H */
@@ -0,0 +1,26 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include "types.h"
+#include "smp.h"
+
+#define MAX_NUMNODES        4
+
+/* SLIT distances: a node to itself, and to others when there is no SLIT */
+#define LOCAL_DISTANCE      10
+#define REMOTE_DISTANCE     20
+
+/* Nodes found by numa_init(), 1 without an SRAT */
+extern uint32_t nr_node_ids;
+
+int numa_init(void);
+uint32_t cpu_to_node(uint32_t cpu);
+uint32_t node_distance(uint32_t from, uint32_t to);
+uint32_t numa_mem_id(void);
+
+/* Node of the running CPU */
+static inline uint32_t numa_node_id(void) {
+    return cpu_to_node(smp_processor_id());
+}
+
+#endif /* NUMA_H */
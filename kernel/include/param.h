@@ -0,0 +1,47 @@
+#ifndef PARAM_H
+#define PARAM_H
+
+#include "types.h"
+
+struct multiboot_info;
+
+/* Parameter value types */
+enum param_type {
+    PARAM_BOOL,
+    PARAM_UINT,
+    PARAM_INT,
+    PARAM_STRING,
+};
+
+/* Boot parameter descriptor, collected in the .kparam section */
+struct kernel_param {
+    const char* name;
+    uint32_t type;
+    void* value;
+    uint32_t size;              /* Buffer size for PARAM_STRING */
+};
+
+#define KERNEL_PARAM(name_str, param_type, var, var_size)                      \
+    static const struct kernel_param __param_##var                             \
+    __attribute__((used, section(".kparam"), aligned(4))) = {                  \
+        .name = name_str, .type = param_type, .value = &(var), .size = var_size \
+    }
+
+/*
+ * Declare a boot parameter backed by a variable, e.g.
+ *     static uint32_t spinup_us = 300000;
+ *     param_uint("floppy.spinup_us", spinup_us);
+ * Values are stored before any subsystem is initialized.
+ */
+#define param_bool(name, var)   KERNEL_PARAM(name, PARAM_BOOL, var, sizeof(bool))
+#define param_uint(name, var)   KERNEL_PARAM(name, PARAM_UINT, var, sizeof(uint32_t))
+#define param_int(name, var)    KERNEL_PARAM(name, PARAM_INT, var, sizeof(int32_t))
+#define param_string(name, var) KERNEL_PARAM(name, PARAM_STRING, var, sizeof(var))
+
+/* Command line parser interface */
+void init_params(struct multiboot_info* mboot_info);
+void params_parse(const char* cmdline);
+const char* params_cmdline(void);
+void params_set_cmdline(const char* cmdline);
+
+#endif /* PARAM_H */
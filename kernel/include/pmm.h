@@ -0,0 +1,48 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include "types.h"
+#include "multiboot.h"
+
+#define PAGE_SIZE           4096
+#define PAGE_SHIFT          12
+
+/* Physical memory above this is ignored (bitmap size) */
+#define PMM_MAX_MEMORY      0x40000000
+#define PMM_MAX_PAGES       (PMM_MAX_MEMORY / PAGE_SIZE)
+
+/* NUMA node granularity: 4MB sections */
+#define PMM_SECTION_SHIFT   10
+#define PMM_SECTION_PAGES   (1 << PMM_SECTION_SHIFT)
+
+struct pmm_node_stats {
+    uint32_t present_pages;
+    uint32_t free_pages;
+    uint32_t local_allocs;      /* Allocations for the node served from it */
+    uint32_t remote_allocs;     /* Allocations for the node served by another */
+};
+
+/* Kernel image bounds (kernel.ld) */
+extern char _kernel_start[];
+extern char _kernel_end[];
+
+/*
+ * Physical page allocator. Memory is identity mapped, so the returned
+ * addresses can be used as pointers directly.
+ */
+void pmm_init(struct multiboot_info* mboot_info);
+void* page_alloc(uint32_t count);
+void* page_alloc_node(uint32_t nid, uint32_t count);
+void page_free(void* addr, uint32_t count);
+uint32_t pmm_free_pages(void);
+uint32_t pmm_total_pages(void);
+uint32_t pmm_max_pfn(void);
+bool pmm_page_in_use(uint32_t pfn);
+
+/* NUMA layout, set up by numa_init() */
+void pmm_set_node(uint32_t nid, uint64_t base, uint64_t length);
+void pmm_init_nodes(uint32_t nr_nodes);
+uint32_t pfn_to_nid(uint32_t pfn);
+void pmm_node_stats(uint32_t nid, struct pmm_node_stats* stats);
+
+#endif /* PMM_H */
@@ -0,0 +1,20 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "types.h"
+
+/* One histogram counter per 16 bytes of kernel text */
+#define PROFILE_SHIFT       4
+#define PROFILE_BUCKET_SIZE (1U << PROFILE_SHIFT)
+
+/* Footprint granularity for the I-cache proxy */
+#define CACHE_LINE_SHIFT    6
+
+/* Percentage of the samples the hot page count covers */
+#define PROFILE_HOT_PERCENT 90
+
+/* Sampling profiler interface (profile=1) */
+void profile_tick(uint32_t eip);
+void profile_report(void);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,41 @@
+#ifndef RADIX_TREE_H
+#define RADIX_TREE_H
+
+#include "types.h"
+
+/*
+ * Radix tree mapping 32-bit indices to pointers. Each node has 64 slots
+ * and a bitmap of the occupied ones, so empty ranges are skipped with a
+ * bit scan instead of a slot walk. The tree is only as tall as the
+ * largest index needs and shrinks back as entries are removed.
+ */
+#define RADIX_TREE_MAP_SHIFT 6
+#define RADIX_TREE_MAP_SIZE (1U << RADIX_TREE_MAP_SHIFT)
+#define RADIX_TREE_MAP_MASK (RADIX_TREE_MAP_SIZE - 1)
+
+struct radix_tree_node {
+    uint64_t bitmap;                /* Occupied slots */
+    struct radix_tree_node* parent;
+    uint8_t shift;                  /* Index bits below this level */
+    uint8_t offset;                 /* Slot in the parent */
+    uint8_t count;                  /* Occupied slots */
+    void* slots[RADIX_TREE_MAP_SIZE];
+};
+
+struct radix_tree_root {
+    struct radix_tree_node* node;
+    uint32_t count;
+};
+
+#define RADIX_TREE_INIT     (struct radix_tree_root){ NULL, 0 }
+
+/* Radix tree interface */
+int radix_tree_insert(struct radix_tree_root* root, uint32_t index, void* item);
+void* radix_tree_lookup(const struct radix_tree_root* root, uint32_t index);
+void* radix_tree_delete(struct radix_tree_root* root, uint32_t index);
+void* radix_tree_find_next(const struct radix_tree_root* root, uint32_t* index);
+uint32_t radix_tree_gang_lookup(const struct radix_tree_root* root, void** results,
+                                uint32_t first_index, uint32_t max_items);
+void radix_tree_destroy(struct radix_tree_root* root);
+
+#endif /* RADIX_TREE_H */
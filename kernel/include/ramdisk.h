@@ -0,0 +1,13 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include "types.h"
+#include "block.h"
+
+#define RAMDISK_SECTOR_SIZE 512
+
+/* RAM disk interface */
+struct block_device* ramdisk_create(const char* name, uint32_t size_kb);
+void ramdisk_destroy(struct block_device* dev);
+
+#endif /* RAMDISK_H */
@@ -0,0 +1,61 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include "types.h"
+
+/*
+ * Intrusive red-black tree. The caller embeds struct rb_node in its own
+ * structure, walks the tree to find the insertion point with its own key
+ * comparison, links the node with rb_link_node() and rebalances with
+ * rb_insert_color(). Nothing is allocated.
+ */
+#define RB_RED              0
+#define RB_BLACK            1
+
+struct rb_node {
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    uint32_t color;
+};
+
+struct rb_root {
+    struct rb_node* node;
+};
+
+/* Root with the leftmost node cached, for O(1) minimum lookups */
+struct rb_root_cached {
+    struct rb_root root;
+    struct rb_node* leftmost;
+};
+
+#define RB_ROOT             (struct rb_root){ NULL }
+#define RB_ROOT_CACHED      (struct rb_root_cached){ { NULL }, NULL }
+
+#define rb_entry(ptr, type, member) CONTAINER_OF(ptr, type, member)
+#define rb_empty(root)      ((root)->node == NULL)
+
+static inline void rb_link_node(struct rb_node* node, struct rb_node* parent, struct rb_node** link) {
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+}
+
+/* Red-black tree interface */
+void rb_insert_color(struct rb_node* node, struct rb_root* root);
+void rb_erase(struct rb_node* node, struct rb_root* root);
+struct rb_node* rb_first(const struct rb_root* root);
+struct rb_node* rb_last(const struct rb_root* root);
+struct rb_node* rb_next(const struct rb_node* node);
+struct rb_node* rb_prev(const struct rb_node* node);
+
+void rb_insert_color_cached(struct rb_node* node, struct rb_root_cached* root, bool leftmost);
+void rb_erase_cached(struct rb_node* node, struct rb_root_cached* root);
+
+static inline struct rb_node* rb_first_cached(const struct rb_root_cached* root) {
+    return root->leftmost;
+}
+
+#endif /* RBTREE_H */
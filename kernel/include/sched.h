@@ -0,0 +1,190 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "types.h"
+#include "list.h"
+#include "smp.h"
+#include "timer.h"
+#include "rbtree.h"
+#include "cpumask.h"
+
+/*
+ * Scheduling policies, each served by a scheduling class (sched_class.h).
+ * Runnable SCHED_DEADLINE threads run first, then SCHED_PRIO, then
+ * SCHED_FAIR.
+ */
+#define SCHED_PRIO          0       /* Fixed priority, round-robin within a level */
+#define SCHED_FAIR          1       /* CPU shared by weight, see sched_fair.c */
+#define SCHED_DEADLINE      2       /* Earliest deadline first, see sched_deadline.c */
+
+/* Thread priorities, lower runs first; the idle thread runs below all of them */
+#define THREAD_PRIO_HIGH    0
+#define THREAD_PRIO_NORMAL  1
+#define THREAD_PRIO_LOW     2
+#define THREAD_PRIO_LEVELS  3
+
+#define THREAD_MAX          32
+#define THREAD_STACK_SIZE   8192
+#define SCHED_TIMESLICE     2       /* Ticks before round-robin preemption */
+
+/* Nice levels of SCHED_FAIR threads, lower gets a larger share */
+#define NICE_MIN            (-20)
+#define NICE_MAX            19
+#define NICE_0_WEIGHT       1024
+
+enum thread_state {
+    THREAD_UNUSED,
+    THREAD_RUNNABLE,
+    THREAD_SLEEPING,
+    THREAD_DEAD,
+};
+
+/* Thread flags */
+#define THREAD_WORKER       0x01    /* Workqueue worker, see workqueue.c */
+#define THREAD_BOUND        0x02    /* Per-CPU thread, see thread_bind() */
+
+typedef void (*thread_fn_t)(void* arg);
+
+struct sched_class;
+struct cpuset;
+struct cgroup;
+struct cfs_rq;
+
+/* thread_spawn() attributes to apply, the rest are as for thread_create() */
+#define SPAWN_SETPOLICY     0x01    /* policy */
+#define SPAWN_SETNICE       0x02    /* nice, after the priority's own */
+#define SPAWN_SETAFFINITY   0x04    /* cpus */
+#define SPAWN_BIND          0x08    /* Per-CPU thread on cpu, as thread_bind() */
+#define SPAWN_SETCPUSET     0x10    /* cpuset */
+#define SPAWN_SETCGROUP     0x20    /* cgroup */
+
+/*
+ * Settings a new thread starts with. They are in place before the thread
+ * is first queued, so it never runs, or is queued, with its creator's.
+ */
+struct spawn_attr {
+    uint32_t flags;
+    uint32_t priority;          /* Always used, as thread_create()'s */
+    uint32_t policy;            /* SCHED_PRIO or SCHED_FAIR */
+    int32_t nice;
+    cpumask_t cpus;
+    uint32_t cpu;
+    struct cpuset* cpuset;
+    struct cgroup* cgroup;
+};
+
+/*
+ * SCHED_FAIR state of a thread, or of a control group in its parent's
+ * run queue; times are in nanoseconds
+ */
+struct sched_entity {
+    struct rb_node run_node;    /* In the fair run queue, ordered by vruntime */
+    struct sched_entity* parent;    /* The group's entity, NULL in the root group */
+    struct cfs_rq* cfs_rq;      /* Run queue it is queued on */
+    struct cfs_rq* my_q;        /* Run queue a group entity stands for, NULL for threads */
+    uint32_t depth;             /* Levels below the root run queue */
+    uint64_t vruntime;          /* Runtime scaled by NICE_0_WEIGHT / weight */
+    uint64_t exec_start;        /* TSC when the runtime was last accounted */
+    uint64_t sum_exec_runtime;
+    uint64_t slice_start;       /* sum_exec_runtime when last picked */
+    uint32_t weight;
+    bool on_rq;
+};
+
+/* SCHED_DEADLINE state of a thread; times are in nanoseconds */
+struct sched_dl_entity {
+    uint32_t dl_runtime;        /* Budget per period */
+    uint32_t dl_deadline;       /* Relative deadline */
+    uint32_t dl_period;
+    uint32_t dl_bw;             /* dl_runtime / dl_period, fixed point */
+    int64_t runtime;            /* Budget left for the current deadline */
+    uint64_t deadline;          /* Absolute, on the sched_clock() scale */
+    uint64_t exec_start;        /* TSC when the runtime was last accounted */
+    uint32_t heap_index;        /* In the deadline heap, DL_NOT_QUEUED if not */
+    bool throttled;             /* Out of budget until the next period */
+    uint32_t overruns;          /* Times the budget ran out before a yield */
+    struct timer_list timer;    /* Replenishment at the next period */
+};
+
+struct thread {
+    uint32_t esp;               /* Saved stack pointer while switched out */
+    uint32_t state;
+    uint32_t priority;
+    uint32_t policy;
+    int32_t nice;
+    const struct sched_class* sched_class;
+    uint32_t flags;
+    uint32_t timeslice;
+    const char* name;
+    struct list_head run_entry;
+    struct list_head wait_entry;
+    struct timer_list sleep_timer;
+    void* worker;               /* struct worker for THREAD_WORKER threads */
+    uint32_t numa_node;         /* Home node, page_alloc() prefers its memory */
+    uint32_t cpu;               /* CPU it runs or last ran on */
+    cpumask_t cpus_mask;        /* Affinity asked for by sched_setaffinity() */
+    cpumask_t cpus_allowed;     /* CPUs it may run on: cpus_mask within its cpuset */
+    struct cpuset* cpuset;
+    struct cgroup* cgroup;
+    struct sched_entity se;
+    struct sched_dl_entity dl;
+    uint8_t* stack;
+};
+
+struct wait_queue_head {
+    struct list_head waiters;
+};
+
+#define WAIT_QUEUE_HEAD_INIT(name) { LIST_HEAD_INIT((name).waiters) }
+
+/*
+ * Sleep until condition is true. The condition is checked again after
+ * the thread is queued, so a wake_up() between the check and schedule()
+ * is not lost.
+ */
+#define wait_event(wq, condition)                                   \
+    do {                                                            \
+        while (!(condition)) {                                      \
+            prepare_to_wait(&(wq));                                 \
+            if (condition)                                          \
+                break;                                              \
+            schedule();                                             \
+        }                                                           \
+        finish_wait(&(wq));                                         \
+    } while (0)
+
+static inline struct thread* current_thread(void) {
+    return this_cpu()->current;
+}
+
+/* Scheduler interface */
+int init_sched(void);
+struct thread* thread_create(const char* name, thread_fn_t fn, void* arg, uint32_t priority);
+struct thread* thread_spawn(const char* name, thread_fn_t fn, void* arg, const struct spawn_attr* attr);
+void thread_exit(void) NORETURN;
+void thread_wake(struct thread* thread);
+void thread_sleep(uint32_t ms);
+void thread_yield(void);
+void schedule(void);
+void preempt_enable(void);
+void preempt_schedule_irq(void);
+void sched_tick(void);
+int sched_setscheduler(struct thread* thread, uint32_t policy, uint32_t priority);
+int thread_set_nice(struct thread* thread, int32_t nice);
+int sched_setdeadline(struct thread* thread, uint32_t runtime_ns, uint32_t deadline_ns, uint32_t period_ns);
+int sched_setaffinity(struct thread* thread, cpumask_t mask);
+cpumask_t sched_getaffinity(struct thread* thread);
+void thread_bind(struct thread* thread, uint32_t cpu);
+void sched_cpus_changed(struct thread* thread);
+void sched_move_group(struct thread* thread, struct cgroup* cg);
+
+void wait_queue_init(struct wait_queue_head* wq);
+void prepare_to_wait(struct wait_queue_head* wq);
+void finish_wait(struct wait_queue_head* wq);
+void wake_up(struct wait_queue_head* wq);
+
+/* Context switch (switch.s) */
+void switch_context(uint32_t* prev_esp, uint32_t next_esp);
+void thread_trampoline(void);
+
+#endif /* SCHED_H */
@@ -0,0 +1,77 @@
+#ifndef SCHED_CLASS_H
+#define SCHED_CLASS_H
+
+#include "types.h"
+#include "smp.h"
+#include "sched.h"
+#include "timer.h"
+
+/*
+ * Scheduling class interface between the scheduler core (sched.c) and the
+ * policies. Every runnable thread except the running one sits on the run
+ * queue of its class; pick_next takes the chosen thread off it again.
+ * A queued thread whose priority, nice level, policy or control group
+ * changes is dequeued and enqueued again around the change. All operations are
+ * called with interrupts disabled and never see the idle thread.
+ */
+
+/* enqueue flags */
+#define ENQUEUE_WAKEUP      0x01    /* Woken from sleep */
+#define ENQUEUE_NEW         0x02    /* Created by thread_create */
+
+struct sched_class {
+    const char* name;
+    void (*init)(struct cpu* cpu);
+    void (*enqueue)(struct cpu* cpu, struct thread* thread, uint32_t flags);
+    void (*dequeue)(struct cpu* cpu, struct thread* thread);
+    /* Take the next thread off the run queue and set it running, NULL if none */
+    struct thread* (*pick_next)(struct cpu* cpu);
+    /* The running thread joined the class or changed its priority or nice */
+    void (*set_curr)(struct cpu* cpu, struct thread* thread);
+    /* The running thread switches out; it is enqueued again if runnable */
+    void (*put_prev)(struct cpu* cpu, struct thread* thread);
+    /* Timer tick while the thread runs, sets need_resched to preempt it */
+    void (*tick)(struct cpu* cpu, struct thread* curr);
+    /* Would the newly runnable thread preempt curr of the same class? */
+    bool (*check_preempt)(struct cpu* cpu, struct thread* curr, struct thread* thread);
+    bool (*has_runnable)(struct cpu* cpu);
+    /* The running thread gives up the CPU in thread_yield() */
+    void (*yield)(struct cpu* cpu, struct thread* curr);
+    /* The thread moved here from another class */
+    void (*switched_to)(struct cpu* cpu, struct thread* thread);
+    /* The thread moves to another class or exits */
+    void (*switched_from)(struct cpu* cpu, struct thread* thread);
+};
+
+extern const struct sched_class dl_sched_class;
+extern const struct sched_class prio_sched_class;
+extern const struct sched_class fair_sched_class;
+
+/* Make a thread runnable on its class and preempt for it if it should run first */
+void enqueue_thread(struct cpu* cpu, struct thread* thread, uint32_t flags);
+
+/* SCHED_DEADLINE admission control, sched_deadline.c */
+int dl_admit(struct cpu* cpu, struct thread* thread, uint32_t runtime, uint32_t deadline, uint32_t period);
+
+/* Control group run queues and CPU bandwidth, sched_fair.c */
+void fair_group_init(struct cgroup* cg);
+void fair_group_set_shares(struct cgroup* cg);
+void fair_group_set_bandwidth(struct cgroup* cg);
+
+/* TSC cycles to nanoseconds, for the short intervals the classes account */
+static inline uint64_t sched_cycles_to_ns(uint64_t cycles) {
+    uint32_t khz = timer_tsc_khz();
+
+    return khz ? div_u64(cycles * 1000000, khz) : cycles;
+}
+
+/* Nanoseconds since boot */
+static inline uint64_t sched_clock(void) {
+    return timer_now_us() * 1000;
+}
+
+static inline uint32_t cpu_index(const struct cpu* cpu) {
+    return (uint32_t)(cpu - cpus);
+}
+
+#endif /* SCHED_CLASS_H */
@@ -0,0 +1,29 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "types.h"
+
+/* 16550 UART on COM1 */
+#define COM1_PORT           0x3F8
+#define UART_DATA           0       /* Divisor low byte while DLAB is set */
+#define UART_IER            1       /* Divisor high byte while DLAB is set */
+#define UART_FCR            2
+#define UART_LCR            3
+#define UART_MCR            4
+#define UART_LSR            5
+
+#define UART_LCR_8N1        0x03
+#define UART_LCR_DLAB       0x80
+#define UART_FCR_ENABLE     0xC7    /* Enable and clear the FIFOs, 14 byte threshold */
+#define UART_MCR_DTR_RTS    0x03
+#define UART_LSR_THRE       0x20    /* Transmit holding register empty */
+
+#define SERIAL_BAUD_BASE    115200
+
+/* Console mirror, a no-op unless serial=1 */
+void serial_console_write(const char* data, size_t size);
+
+/* Reprogram the UART after a boot snapshot was restored (hibernate.c) */
+void serial_resume(void);
+
+#endif /* SERIAL_H */
@@ -0,0 +1,52 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "types.h"
+
+/* Only the boot CPU is brought up; per-CPU state is indexed all the same */
+#define NR_CPUS             1
+
+struct thread;
+
+/* Per-CPU state */
+struct cpu {
+    uint32_t preempt_count;     /* Preemption, softirq and hardirq nesting */
+    bool need_resched;
+    uint32_t softirq_pending;
+    struct thread* current;
+    struct thread* idle;
+};
+
+extern struct cpu cpus[NR_CPUS];
+
+static inline uint32_t smp_processor_id(void) {
+    return 0;
+}
+
+static inline struct cpu* this_cpu(void) {
+    return &cpus[smp_processor_id()];
+}
+
+/* preempt_count layout */
+#define PREEMPT_OFFSET      0x00000001
+#define SOFTIRQ_OFFSET      0x00000100
+#define HARDIRQ_OFFSET      0x00010000
+#define PREEMPT_MASK        0x000000FF
+#define SOFTIRQ_MASK        0x0000FF00
+#define HARDIRQ_MASK        0x00FF0000
+
+#define in_irq()            (this_cpu()->preempt_count & HARDIRQ_MASK)
+#define in_softirq()        (this_cpu()->preempt_count & SOFTIRQ_MASK)
+#define in_interrupt()      (this_cpu()->preempt_count & (HARDIRQ_MASK | SOFTIRQ_MASK))
+
+static inline void preempt_disable(void) {
+    this_cpu()->preempt_count += PREEMPT_OFFSET;
+    __asm__ volatile ("" : : : "memory");
+}
+
+static inline void preempt_enable_no_resched(void) {
+    __asm__ volatile ("" : : : "memory");
+    this_cpu()->preempt_count -= PREEMPT_OFFSET;
+}
+
+#endif /* SMP_H */
@@ -0,0 +1,48 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include "types.h"
+
+/*
+ * Softirq vectors, run in this order. Pending softirqs are processed on
+ * interrupt exit with interrupts enabled; whatever is still pending when
+ * the budget runs out is left to the per-CPU ksoftirqd thread.
+ */
+enum {
+    HI_SOFTIRQ,                 /* High priority tasklets */
+    TIMER_SOFTIRQ,              /* Expired kernel timers */
+    TASKLET_SOFTIRQ,            /* Tasklets */
+    NR_SOFTIRQS
+};
+
+#define SOFTIRQ_MAX_RESTART 10
+#define SOFTIRQ_BUDGET_US   2000    /* Default for softirq.budget_us */
+
+typedef void (*softirq_action_t)(void);
+
+/*
+ * Tasklet: a driver bottom half. Scheduling an already scheduled tasklet
+ * is a no-op, and a tasklet never runs concurrently with itself.
+ */
+struct tasklet {
+    struct tasklet* next;
+    uint32_t state;
+    void (*func)(uint32_t data);
+    uint32_t data;
+};
+
+#define TASKLET_SCHEDULED   0x01
+
+/* Softirq interface */
+int init_softirq(void);
+void open_softirq(int nr, softirq_action_t action);
+void raise_softirq(int nr);
+void raise_softirq_irqoff(int nr);
+void do_softirq(void);
+void invoke_softirq(void);
+
+void tasklet_init(struct tasklet* tasklet, void (*func)(uint32_t data), uint32_t data);
+void tasklet_schedule(struct tasklet* tasklet);
+void tasklet_hi_schedule(struct tasklet* tasklet);
+
+#endif /* SOFTIRQ_H */
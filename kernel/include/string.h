@@ -22,6 +22,11 @@ void* memmove(void* dest, const void* src, size_t num);
 int memcmp(const void* ptr1, const void* ptr2, size_t num);
 void* memchr(const void* ptr, int value, size_t num);
 
+/* Word-at-a-time helper: non-zero if any byte of the word is zero */
+static inline uint32_t has_zero_byte(uint32_t v) {
+    return (v - 0x01010101) & ~v & 0x80808080;
+}
+
 /* Memory zeroing utility */
 void bzero(void* ptr, size_t num);
 
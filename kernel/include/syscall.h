@@ -0,0 +1,38 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "types.h"
+
+struct interrupt_frame;
+
+/*
+ * System calls enter through int $0x80 with the number in EAX and up to
+ * five arguments in EBX, ECX, EDX, ESI and EDI. The result, a negative
+ * error code on failure, is returned in EAX.
+ */
+#define SYSCALL_VECTOR      0x80
+
+#define SYS_REBOOT          1
+#define SYS_KEXEC_LOAD      2
+#define SYS_INIT_MODULE     3
+#define SYS_DELETE_MODULE   4
+#define SYSCALL_COUNT       5
+
+/* reboot() commands */
+#define REBOOT_CMD_RESTART  0x01234567  /* Reset through the keyboard controller */
+#define REBOOT_CMD_KEXEC    0x45584543  /* Start the image staged by kexec_load */
+
+typedef int32_t (*syscall_t)(uint32_t arg1, uint32_t arg2, uint32_t arg3,
+                             uint32_t arg4, uint32_t arg5);
+
+/* System call interface */
+int init_syscalls(void);
+void syscall_dispatch(struct interrupt_frame* frame);
+
+/* System calls */
+int32_t sys_reboot(uint32_t cmd);
+int32_t sys_kexec_load(const void* image, size_t length, const char* cmdline);
+int32_t sys_init_module(const void* image, size_t length, const char* name);
+int32_t sys_delete_module(const char* name);
+
+#endif /* SYSCALL_H */
@@ -0,0 +1,66 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "types.h"
+#include "list.h"
+
+/* 8253/8254 Programmable Interval Timer */
+#define PIT_FREQUENCY       1193182
+#define PIT_CHANNEL0        0x40
+#define PIT_CHANNEL2        0x42
+#define PIT_COMMAND         0x43
+#define PIT_GATE_PORT       0x61
+
+/* Periodic tick on PIT channel 0 */
+#define HZ                  100
+
+/* Wrap-safe jiffies comparison */
+#define time_after_eq(a, b) ((int32_t)((a) - (b)) >= 0)
+
+extern volatile uint32_t jiffies;
+
+static inline uint32_t msecs_to_jiffies(uint32_t ms) {
+    return (ms * HZ + 999) / 1000;
+}
+
+/* Kernel timer, run from TIMER_SOFTIRQ once jiffies reaches expires */
+struct timer_list {
+    struct list_head entry;
+    uint32_t expires;
+    void (*fn)(struct timer_list* timer);
+};
+
+/* Read the CPU timestamp counter */
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    __asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/* 64-by-32 bit unsigned division without libgcc */
+static inline uint64_t div_u64(uint64_t dividend, uint32_t divisor) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t quot_high = high / divisor;
+    uint32_t quot_low;
+
+    high %= divisor;
+    __asm__ ("divl %4" : "=a"(quot_low), "=d"(high) : "a"(low), "d"(high), "rm"(divisor));
+    return ((uint64_t)quot_high << 32) | quot_low;
+}
+
+/* Timer interface */
+int init_timer(void);
+uint32_t timer_tsc_khz(void);
+uint64_t timer_now_us(void);
+uint32_t timer_elapsed_us(uint64_t start_us);
+void timer_udelay(uint32_t us);
+void timer_setup(struct timer_list* timer, void (*fn)(struct timer_list* timer));
+void mod_timer(struct timer_list* timer, uint32_t expires);
+bool del_timer(struct timer_list* timer);
+
+/* Timekeeping across a boot snapshot (hibernate.c), called with interrupts off */
+void timer_suspend(void);
+void timer_resume(void);
+
+#endif /* TIMER_H */
@@ -0,0 +1,29 @@
+#ifndef UACCESS_H
+#define UACCESS_H
+
+#include "types.h"
+
+/* User space ends where the kernel half of every address space begins */
+#define USER_SPACE_END      0xC0000000
+
+/*
+ * Range check for a user buffer. This is the only validation done before
+ * a copy: a bad address inside the range faults in the copy itself and is
+ * recovered through the exception table (extable.h).
+ */
+static inline bool access_ok(const void* addr, size_t size) {
+    return size <= USER_SPACE_END && (uint32_t)addr <= USER_SPACE_END - size;
+}
+
+/*
+ * User copy interface. copy_to_user and copy_from_user return the number
+ * of bytes that could not be copied (0 on success); copy_from_user zeroes
+ * the part of the kernel buffer it could not fill. strncpy_from_user
+ * returns the string length, count if no terminator was found within
+ * count bytes, or -EFAULT.
+ */
+size_t copy_to_user(void* to, const void* from, size_t n);
+size_t copy_from_user(void* to, const void* from, size_t n);
+ssize_t strncpy_from_user(char* dst, const char* src, size_t count);
+
+#endif /* UACCESS_H */
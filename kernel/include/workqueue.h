@@ -0,0 +1,62 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "types.h"
+#include "list.h"
+#include "timer.h"
+
+struct thread;
+struct worker_pool;
+struct workqueue_struct;
+struct work_struct;
+
+typedef void (*work_func_t)(struct work_struct* work);
+
+/* Deferred work, run in process context by a pool worker thread */
+struct work_struct {
+    struct list_head entry;
+    work_func_t func;
+    uint32_t flags;
+    struct worker_pool* pool;   /* Pool it was last queued on */
+};
+
+#define WORK_PENDING        0x01
+
+struct delayed_work {
+    struct work_struct work;
+    struct timer_list timer;
+    struct workqueue_struct* wq;
+};
+
+/* Workqueue flags */
+#define WQ_HIGHPRI          0x01    /* Served by the high priority worker pool */
+
+#define WORKQUEUE_MAX       8
+#define WORKER_POOL_MAX     8       /* Worker threads per pool */
+
+extern struct workqueue_struct* system_wq;
+extern struct workqueue_struct* system_highpri_wq;
+
+/* Workqueue interface */
+int init_workqueues(void);
+struct workqueue_struct* alloc_workqueue(const char* name, uint32_t flags);
+void work_init(struct work_struct* work, work_func_t func);
+void delayed_work_init(struct delayed_work* dwork, work_func_t func);
+bool queue_work(struct workqueue_struct* wq, struct work_struct* work);
+bool queue_delayed_work(struct workqueue_struct* wq, struct delayed_work* dwork, uint32_t delay_ms);
+bool cancel_delayed_work(struct delayed_work* dwork);
+void flush_work(struct work_struct* work);
+
+static inline bool schedule_work(struct work_struct* work) {
+    return queue_work(system_wq, work);
+}
+
+static inline bool schedule_delayed_work(struct delayed_work* dwork, uint32_t delay_ms) {
+    return queue_delayed_work(system_wq, dwork, delay_ms);
+}
+
+/* Scheduler hooks for worker concurrency management (sched.c) */
+void wq_worker_sleeping(struct thread* thread);
+void wq_worker_waking_up(struct thread* thread);
+
+#endif /* WORKQUEUE_H */
@@ -0,0 +1,355 @@
+/*
+ * Initcall executor for nekkoOS
+ * Runs the leveled initcalls collected by kernel.ld. A level starts once
+ * every synchronous call of the lower levels has finished; asynchronous
+ * calls only hold back calls that name them as dependencies. Calls that
+ * return -EAGAIN are polled round-robin, so device probes waiting on
+ * hardware overlap instead of serializing the boot.
+ *
+ * initcall.serial=1 runs every call to completion in link order instead,
+ * which gives the baseline for comparing boot times.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "timer.h"
+#include "pmm.h"
+#include "init.h"
+#include "param.h"
+#include "bench.h"
+#include "errno.h"
+#include "kernel.h"
+
+#define MAX_INITCALLS       128
+
+/* Initcall table bounds (kernel.ld) */
+extern const struct initcall __initcall_start[];
+extern const struct initcall __initcall_end[];
+
+/* Constructor table bounds (kernel.ld) */
+extern void (*const __ctors_start[])(void);
+extern void (*const __ctors_end[])(void);
+
+/* Boot-only code bounds (kernel.ld), page aligned */
+extern char __init_begin[];
+extern char __init_end[];
+
+enum initcall_state {
+    INITCALL_WAITING,
+    INITCALL_RUNNING,
+    INITCALL_DONE,
+    INITCALL_FAILED,
+};
+
+static uint8_t initcall_state[MAX_INITCALLS];
+static uint64_t initcall_cycles[MAX_INITCALLS];
+static uint32_t pending_sync[INITCALL_LEVELS];
+
+static bool initcall_serial = false;
+static bool initcall_debug = false;
+param_bool("initcall.serial", initcall_serial);
+param_bool("initcall.debug", initcall_debug);
+
+/* Boot timing, in TSC cycles */
+static uint64_t initcall_total_cycles;
+static uint64_t boot_ready_cycles;
+
+static size_t initcall_count(void) {
+    size_t count = __initcall_end - __initcall_start;
+    return MIN(count, MAX_INITCALLS);
+}
+
+static int initcall_find(const char* name, size_t length) {
+    size_t count = initcall_count();
+    for (size_t i = 0; i < count; i++) {
+        const char* candidate = __initcall_start[i].name;
+        if (strncmp(candidate, name, length) == 0 && candidate[length] == '\0')
+            return (int)i;
+    }
+    return -1;
+}
+
+/* Index of the next dependency in a depends list (-1 if unknown); NULL at the end */
+static const char* initcall_next_dep(const char* p, int* index) {
+    const char* end = strchr(p, ',');
+    size_t length = end ? (size_t)(end - p) : strlen(p);
+
+    *index = initcall_find(p, length);
+    return end ? end + 1 : NULL;
+}
+
+/* Returns 1 when all dependencies finished, 0 while waiting, -1 if one failed */
+static int initcall_deps_ready(const struct initcall* call) {
+    const char* p = call->depends;
+    int ready = 1;
+
+    while (p && *p) {
+        int index;
+
+        p = initcall_next_dep(p, &index);
+        if (index >= 0) {
+            if (initcall_state[index] == INITCALL_FAILED)
+                return -1;
+            if (initcall_state[index] != INITCALL_DONE)
+                ready = 0;
+        }
+    }
+    return ready;
+}
+
+static bool initcall_level_ready(uint32_t level) {
+    for (uint32_t i = 0; i < level && i < INITCALL_LEVELS; i++) {
+        if (pending_sync[i])
+            return false;
+    }
+    return true;
+}
+
+static void initcall_finish(size_t index, int ret) {
+    const struct initcall* call = &__initcall_start[index];
+
+    initcall_cycles[index] = rdtsc() - initcall_cycles[index];
+    initcall_state[index] = ret == 0 ? INITCALL_DONE : INITCALL_FAILED;
+    if (!(call->flags & INITCALL_ASYNC) && call->level < INITCALL_LEVELS)
+        pending_sync[call->level]--;
+
+    if (ret < 0 && ret != -ENODEV) {
+        kprintf("Initcall failed: ");
+        kprintf(call->name);
+        kprintf("\n");
+    }
+}
+
+/* Run each call to completion in link order */
+static void __init run_serial(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const struct initcall* call = &__initcall_start[i];
+        int ret;
+
+        if (initcall_deps_ready(call) < 0) {
+            initcall_finish(i, -ENODEV);
+            continue;
+        }
+
+        initcall_cycles[i] = rdtsc();
+        while ((ret = call->fn()) == -EAGAIN)
+            __asm__ volatile ("pause");
+        initcall_finish(i, ret);
+    }
+}
+
+/*
+ * waits_on[i] has bit j set when call i cannot start before call j has
+ * finished: j is an unfinished dependency of i, or, while i's level is not
+ * ready yet, a synchronous call of a lower level.
+ */
+#define INITCALL_WORDS      (MAX_INITCALLS / 32)
+
+static uint32_t waits_on[MAX_INITCALLS][INITCALL_WORDS];
+
+static inline bool initcall_waits(size_t i, size_t j) {
+    return waits_on[i][j / 32] & BIT(j % 32);
+}
+
+static void __init initcall_wait_graph(size_t count) {
+    memset(waits_on, 0, sizeof(waits_on));
+    for (size_t i = 0; i < count; i++) {
+        const struct initcall* call = &__initcall_start[i];
+
+        if (initcall_state[i] != INITCALL_WAITING)
+            continue;
+
+        if (!initcall_level_ready(call->level)) {
+            for (size_t j = 0; j < count; j++) {
+                const struct initcall* lower = &__initcall_start[j];
+                if (initcall_state[j] == INITCALL_WAITING && !(lower->flags & INITCALL_ASYNC) &&
+                    lower->level < call->level)
+                    waits_on[i][j / 32] |= BIT(j % 32);
+            }
+            continue;
+        }
+
+        for (const char* p = call->depends; p && *p;) {
+            int index;
+
+            p = initcall_next_dep(p, &index);
+            if (index >= 0 && initcall_state[index] != INITCALL_DONE)
+                waits_on[i][index / 32] |= BIT(index % 32);
+        }
+    }
+
+    /* Transitive closure: i waits on itself exactly when it is on a cycle */
+    for (size_t k = 0; k < count; k++) {
+        for (size_t i = 0; i < count; i++) {
+            if (!initcall_waits(i, k))
+                continue;
+            for (size_t word = 0; word < INITCALL_WORDS; word++)
+                waits_on[i][word] |= waits_on[k][word];
+        }
+    }
+}
+
+/*
+ * Nothing is running and nothing can start, so the waiting calls wait on
+ * each other. Fail the calls whose own dependencies lead back to them.
+ * Every cycle has one: a level only waits on lower levels, so a cycle
+ * needs a dependency edge. Calls that merely depend on a failed call then
+ * fail with -ENODEV as usual, and calls held back only by their level run
+ * once the lower levels are done. Returns the number of calls failed.
+ */
+static size_t __init initcall_break_cycles(size_t count) {
+    size_t cyclic[MAX_INITCALLS];
+    size_t failed = 0;
+
+    /* Pick them all before failing any: that can make a level ready */
+    initcall_wait_graph(count);
+    for (size_t i = 0; i < count; i++) {
+        if (initcall_state[i] == INITCALL_WAITING && initcall_level_ready(__initcall_start[i].level) &&
+            initcall_waits(i, i))
+            cyclic[failed++] = i;
+    }
+
+    for (size_t n = 0; n < failed; n++) {
+        size_t i = cyclic[n];
+
+        kprintf("Initcall dependency cycle: ");
+        kprintf(__initcall_start[i].name);
+        kprintf("\n");
+        initcall_cycles[i] = rdtsc();
+        initcall_finish(i, -EINVAL);
+    }
+    return failed;
+}
+
+/* Start every call whose level and dependencies allow it, poll the rest */
+static void __init run_parallel(size_t count) {
+    size_t finished = 0;
+
+    while (finished < count) {
+        bool progress = false;
+        size_t running = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            const struct initcall* call = &__initcall_start[i];
+
+            if (initcall_state[i] == INITCALL_DONE || initcall_state[i] == INITCALL_FAILED)
+                continue;
+
+            if (initcall_state[i] == INITCALL_WAITING) {
+                if (!initcall_level_ready(call->level))
+                    continue;
+
+                int deps = initcall_deps_ready(call);
+                if (deps == 0)
+                    continue;
+                initcall_cycles[i] = rdtsc();
+                if (deps < 0) {
+                    initcall_finish(i, -ENODEV);
+                    finished++;
+                    progress = true;
+                    continue;
+                }
+                initcall_state[i] = INITCALL_RUNNING;
+            }
+
+            int ret = call->fn();
+            if (ret == -EAGAIN) {
+                running++;
+                continue;
+            }
+
+            initcall_finish(i, ret);
+            finished++;
+            progress = true;
+        }
+
+        if (progress)
+            continue;
+
+        if (running == 0)
+            finished += initcall_break_cycles(count);
+        else
+            __asm__ volatile ("pause");
+    }
+}
+
+void __init do_initcalls(void) {
+    size_t count = initcall_count();
+    uint64_t start = rdtsc();
+
+    if ((size_t)(__initcall_end - __initcall_start) > MAX_INITCALLS)
+        kprintf("Warning: too many initcalls, some were skipped\n");
+
+    memset(initcall_state, INITCALL_WAITING, sizeof(initcall_state));
+    memset(pending_sync, 0, sizeof(pending_sync));
+    for (size_t i = 0; i < count; i++) {
+        const struct initcall* call = &__initcall_start[i];
+        if (!(call->flags & INITCALL_ASYNC) && call->level < INITCALL_LEVELS)
+            pending_sync[call->level]++;
+    }
+
+    if (initcall_serial)
+        run_serial(count);
+    else
+        run_parallel(count);
+
+    boot_ready_cycles = rdtsc();
+    initcall_total_cycles = boot_ready_cycles - start;
+
+    uint32_t khz = timer_tsc_khz();
+    if (initcall_debug && khz) {
+        for (size_t i = 0; i < count; i++) {
+            kprintf("  initcall ");
+            kprintf(__initcall_start[i].name);
+            kprintf(": ");
+            kprintf_dec((uint32_t)div_u64(initcall_cycles[i] * 1000, khz));
+            kprintf(" us\n");
+        }
+    }
+
+    kprintf("Initcalls: ");
+    kprintf_dec(count);
+    kprintf(" run in ");
+    kprintf_dec(khz ? (uint32_t)div_u64(initcall_total_cycles, khz) : 0);
+    kprintf(initcall_serial ? " ms (serial)\n" : " ms (parallel)\n");
+}
+
+/* TSC at the end of the initcalls, i.e. cycles from CPU reset to ready */
+uint64_t initcall_ready_cycles(void) {
+    return boot_ready_cycles;
+}
+
+/* Run the constructors: a PGO=gen kernel registers its counters this way */
+void __init run_constructors(void) {
+    for (void (*const* ctor)(void) = __ctors_start; ctor < __ctors_end; ctor++)
+        (*ctor)();
+}
+
+/*
+ * Give the .init.text pages back once nothing can call into them. They are
+ * filled with int3 first, so a stray call traps instead of running
+ * whatever the allocator put there.
+ */
+void free_initmem(void) {
+    uint32_t pages = (__init_end - __init_begin) / PAGE_SIZE;
+    if (!pages)
+        return;
+
+    memset(__init_begin, 0xCC, pages * PAGE_SIZE);
+    page_free(__init_begin, pages);
+    kprintf("Freed ");
+    kprintf_dec(pages * (PAGE_SIZE / 1024));
+    kprintf(" KB of init code\n");
+}
+
+/* Report initialization time and time since CPU reset to the ready point */
+static void boot_benchmark(void) {
+    uint32_t khz = timer_tsc_khz();
+    if (!khz)
+        return;
+
+    const char* mode = initcall_serial ? "initcalls_serial" : "initcalls_parallel";
+    bench_report("boot", mode, (uint32_t)div_u64(initcall_total_cycles * 1000, khz), "us");
+    bench_report("boot", "ready_since_reset", (uint32_t)div_u64(boot_ready_cycles, khz), "ms");
+}
+KERNEL_BENCH("boot", boot_benchmark);
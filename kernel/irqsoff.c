@@ -0,0 +1,52 @@
+/*
+ * Interrupts-disabled latency tracer for nekkoOS
+ * local_irq_*() and the interrupt entry path report every enabled to
+ * disabled transition here. The tracer keeps the longest section with
+ * interrupts off and the code address that started it.
+ */
+
+#include "types.h"
+#include "timer.h"
+#include "irqflags.h"
+#include "bench.h"
+#include "kernel.h"
+#include "export.h"
+
+static uint64_t irqsoff_start;
+static void* irqsoff_start_caller;
+static uint64_t irqsoff_max;
+static void* irqsoff_max_caller;
+
+void trace_irqs_off(void* caller) {
+    irqsoff_start = rdtsc();
+    irqsoff_start_caller = caller;
+}
+EXPORT_SYMBOL(trace_irqs_off);
+
+void trace_irqs_on(void* caller) {
+    (void)caller;
+    if (!irqsoff_start)
+        return;
+
+    uint64_t length = rdtsc() - irqsoff_start;
+    irqsoff_start = 0;
+    if (length > irqsoff_max) {
+        irqsoff_max = length;
+        irqsoff_max_caller = irqsoff_start_caller;
+    }
+}
+EXPORT_SYMBOL(trace_irqs_on);
+
+/* Longest interrupts-disabled section since boot, in microseconds */
+uint32_t irqsoff_max_us(void) {
+    uint32_t khz = timer_tsc_khz();
+    return khz ? (uint32_t)div_u64(irqsoff_max * 1000, khz) : 0;
+}
+
+static void irqsoff_benchmark(void) {
+    bench_report("irqsoff", "max_disabled", irqsoff_max_us(), "us");
+    kprintf("irqsoff: longest section started at ");
+    kprintf_hex((uint32_t)irqsoff_max_caller);
+    kprintf("\n");
+}
+KERNEL_BENCH("irqsoff", irqsoff_benchmark);
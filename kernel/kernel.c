@@ -9,6 +9,23 @@
 #include "vga.h"
 #include "multiboot.h"
 #include "string.h"
+#include "kernel.h"
+#include "timer.h"
+#include "block.h"
+#include "floppy.h"
+#include "param.h"
+#include "bench.h"
+#include "init.h"
+#include "sched.h"
+#include "pmm.h"
+#include "numa.h"
+#include "kmalloc.h"
+#include "hibernate.h"
+#include "serial.h"
+#include "profile.h"
+#include "gcov.h"
+#include "export.h"
+#include "errno.h"
 
 /* Global variables */
 static uint16_t* const vga_buffer = (uint16_t*)VGA_MEMORY;
@@ -23,13 +40,7 @@ void terminal_setcolor(uint8_t color);
 void terminal_putchar(char c);
 void terminal_write(const char* data, size_t size);
 void terminal_writestring(const char* data);
-void kprintf(const char* format, ...);
-void kprintf_hex(uint32_t value);
-void kprintf_dec(uint32_t value);
-void init_gdt(void);
-void init_idt(void);
-void init_memory(struct multiboot_info* mboot_info);
-void init_interrupts(void);
+int init_memory(void);
 
 
 
@@ -46,24 +57,7 @@ void uint_to_hex_string(uint32_t value, char* buffer) {
 }
 
 void uint_to_dec_string(uint32_t value, char* buffer) {
-    if (value == 0) {
-        buffer[0] = '0';
-        buffer[1] = '\0';
-        return;
-    }
-    
-    char temp[12];
-    int i = 0;
-    
-    while (value > 0) {
-        temp[i++] = '0' + (value % 10);
-        value /= 10;
-    }
-    
-    for (int j = 0; j < i; j++) {
-        buffer[j] = temp[i - 1 - j];
-    }
-    buffer[i] = '\0';
+    utoa(value, buffer, 10);
 }
 
 /* Terminal functions */
@@ -123,6 +117,7 @@ void terminal_putchar(char c) {
 void terminal_write(const char* data, size_t size) {
     for (size_t i = 0; i < size; i++)
         terminal_putchar(data[i]);
+    serial_console_write(data, size);
 }
 
 void terminal_writestring(const char* data) {
@@ -134,6 +129,7 @@ void kprintf(const char* format, ...) {
     // Simple implementation - just prints the format string for now
     terminal_writestring(format);
 }
+EXPORT_SYMBOL(kprintf);
 
 /* Print hexadecimal number */
 void kprintf_hex(uint32_t value) {
@@ -141,6 +137,7 @@ void kprintf_hex(uint32_t value) {
     uint_to_hex_string(value, buffer);
     terminal_writestring(buffer);
 }
+EXPORT_SYMBOL(kprintf_hex);
 
 /* Print decimal number */
 void kprintf_dec(uint32_t value) {
@@ -148,9 +145,110 @@ void kprintf_dec(uint32_t value) {
     uint_to_dec_string(value, buffer);
     terminal_writestring(buffer);
 }
+EXPORT_SYMBOL(kprintf_dec);
+
+/* Print a message and halt the machine */
+void panic(const char* message) {
+    __asm__ volatile ("cli");
+    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+    kprintf("\nKernel panic: ");
+    kprintf(message);
+    kprintf("\n");
+    while (1)
+        __asm__ volatile ("hlt");
+}
+EXPORT_SYMBOL(panic);
+
+/* Multiboot information, saved for the initcalls */
+static struct multiboot_info* boot_info;
+
+/* Multiboot information the kernel was started with */
+struct multiboot_info* kernel_boot_info(void) {
+    return boot_info;
+}
+
+/* Parts of the multiboot information kernel_copy_boot_info() keeps */
+#define BOOT_INFO_KEPT (MULTIBOOT_INFO_MEMORY | MULTIBOOT_INFO_BOOTDEV | MULTIBOOT_INFO_CMDLINE | \
+                        MULTIBOOT_INFO_MODS | MULTIBOOT_INFO_MEM_MAP | MULTIBOOT_INFO_BOOT_LOADER_NAME)
+
+static uint32_t boot_info_append(uint8_t** next, const void* data, size_t length) {
+    uint8_t* at = *next;
+
+    memcpy(at, data, length);
+    *next = at + length;
+    return (uint32_t)at;
+}
+
+/*
+ * Copy the multiboot information, and the tables and strings it points
+ * to, into one kmalloc block. Boot loaders mostly leave them in the low
+ * megabyte, which a boot snapshot does not save. The drive, APM, VBE and
+ * symbol tables are not read after boot and are dropped.
+ */
+int kernel_copy_boot_info(void) {
+    const struct multiboot_info* old = boot_info;
+    const struct multiboot_mod_list* mods = (const struct multiboot_mod_list*)old->mods_addr;
+    uint32_t flags = old->flags & BOOT_INFO_KEPT;
+    size_t size = sizeof(*old);
+
+    if (!old->cmdline)
+        flags &= ~MULTIBOOT_INFO_CMDLINE;
+    if (!old->boot_loader_name)
+        flags &= ~MULTIBOOT_INFO_BOOT_LOADER_NAME;
+    if (flags & MULTIBOOT_INFO_MEM_MAP)
+        size += old->mmap_length;
+    if (flags & MULTIBOOT_INFO_MODS) {
+        size += old->mods_count * sizeof(*mods);
+        for (uint32_t i = 0; i < old->mods_count; i++) {
+            if (mods[i].cmdline)
+                size += strlen((const char*)mods[i].cmdline) + 1;
+        }
+    }
+    if (flags & MULTIBOOT_INFO_CMDLINE)
+        size += strlen((const char*)old->cmdline) + 1;
+    if (flags & MULTIBOOT_INFO_BOOT_LOADER_NAME)
+        size += strlen((const char*)old->boot_loader_name) + 1;
+
+    uint8_t* copy = kmalloc(size);
+    if (!copy)
+        return -ENOMEM;
+
+    struct multiboot_info* info = (struct multiboot_info*)copy;
+    uint8_t* next = copy + sizeof(*info);
+    memcpy(info, old, sizeof(*info));
+    info->flags = flags;
+
+    if (flags & MULTIBOOT_INFO_MEM_MAP)
+        info->mmap_addr = boot_info_append(&next, (const void*)old->mmap_addr, old->mmap_length);
+    if (flags & MULTIBOOT_INFO_MODS) {
+        struct multiboot_mod_list* new_mods = (struct multiboot_mod_list*)next;
+
+        info->mods_addr = boot_info_append(&next, mods, old->mods_count * sizeof(*mods));
+        for (uint32_t i = 0; i < old->mods_count; i++) {
+            const char* cmdline = (const char*)mods[i].cmdline;
+            if (cmdline)
+                new_mods[i].cmdline = boot_info_append(&next, cmdline, strlen(cmdline) + 1);
+        }
+    }
+    if (flags & MULTIBOOT_INFO_CMDLINE) {
+        const char* cmdline = (const char*)old->cmdline;
+
+        info->cmdline = boot_info_append(&next, cmdline, strlen(cmdline) + 1);
+        params_set_cmdline((const char*)info->cmdline);
+    }
+    if (flags & MULTIBOOT_INFO_BOOT_LOADER_NAME) {
+        const char* name = (const char*)old->boot_loader_name;
+        info->boot_loader_name = boot_info_append(&next, name, strlen(name) + 1);
+    }
+
+    boot_info = info;
+    return 0;
+}
 
 /* Memory initialization */
-void init_memory(struct multiboot_info* mboot_info) {
+int __init init_memory(void) {
+    struct multiboot_info* mboot_info = boot_info;
+
     kprintf("Initializing memory management...\n");
     
     if (mboot_info->flags & MULTIBOOT_INFO_MEMORY) {
@@ -168,29 +266,19 @@ void init_memory(struct multiboot_info* mboot_info) {
         kprintf("MB)\n");
     }
     
+    pmm_init(mboot_info);
+    numa_init();
+    kmalloc_init();
+    kprintf("Free pages: ");
+    kprintf_dec(pmm_free_pages());
+    kprintf(" (");
+    kprintf_dec(pmm_free_pages() / (1024 * 1024 / PAGE_SIZE));
+    kprintf("MB)\n");
+    
     kprintf("Memory management initialized.\n");
+    return 0;
 }
-
-/* GDT initialization stub */
-void init_gdt(void) {
-    kprintf("Initializing Global Descriptor Table...\n");
-    // TODO: Implement GDT setup
-    kprintf("GDT initialized.\n");
-}
-
-/* IDT initialization stub */
-void init_idt(void) {
-    kprintf("Initializing Interrupt Descriptor Table...\n");
-    // TODO: Implement IDT setup
-    kprintf("IDT initialized.\n");
-}
-
-/* Interrupt initialization */
-void init_interrupts(void) {
-    kprintf("Initializing interrupt handlers...\n");
-    // TODO: Implement interrupt handlers
-    kprintf("Interrupts initialized.\n");
-}
+core_initcall(init_memory);
 
 /* Main kernel function */
 void kernel_main(uint32_t magic, struct multiboot_info* mboot_info) {
@@ -219,21 +307,31 @@ void kernel_main(uint32_t magic, struct multiboot_info* mboot_info) {
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
     kprintf("Multiboot magic verified.\n");
     
+    /* Constructors: only PGO=gen builds have any */
+    run_constructors();
+
+    /* Apply command line parameters before any subsystem starts */
+    init_params(mboot_info);
+    
     /* Initialize kernel subsystems */
     kprintf("\nInitializing kernel subsystems...\n");
     kprintf("==================================\n");
     
-    /* Initialize memory management */
-    init_memory(mboot_info);
-    
-    /* Initialize GDT */
-    init_gdt();
+    /* Run the initcalls, overlapping device probes */
+    boot_info = mboot_info;
+    do_initcalls();
+    free_initmem();
     
-    /* Initialize IDT */
-    init_idt();
-    
-    /* Initialize interrupts */
-    init_interrupts();
+    /* Run benchmarks selected with bench= */
+    run_benchmarks();
+
+    /* Samples for kernel_layout.py (profile=1), counters of a PGO=gen kernel */
+    profile_report();
+    gcov_dump();
+
+    /* hibernate=1 saves a boot snapshot; a resumed kernel continues here */
+    hibernate_boot_ready();
+    floppy_motor_off();
     
     /* Kernel initialization complete */
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
@@ -243,13 +341,9 @@ void kernel_main(uint32_t magic, struct multiboot_info* mboot_info) {
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK));
     kprintf("\nSystem ready. Entering idle loop...\n");
     
-    /* Main kernel loop */
+    /* The boot thread is done; the idle thread and kernel threads take over */
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
-    while (1) {
-        /* Kernel idle loop */
-        /* TODO: Implement scheduler and process management */
-        __asm__ volatile ("hlt");
-    }
+    thread_exit();
     
 halt:
     /* Halt system */
@@ -0,0 +1,458 @@
+/*
+ * In-place kernel reload for nekkoOS
+ * kexec_load() copies the PT_LOAD segments of a new multiboot kernel
+ * into staging pages, straight from the image (sys_kexec_load reads them
+ * from user memory), together with a fresh multiboot_info that carries
+ * the memory map, the boot modules and a command line over. Every staged
+ * page lies outside the window the new kernel loads into, so
+ * kernel_kexec() only has to quiesce the devices and run the relocation
+ * trampoline (arch/i386/kexec.s) from its control page: it moves the
+ * segments into place and enters the new kernel like a multiboot loader,
+ * without the BIOS, the boot loaders and their real mode disk reads.
+ *
+ * The reload is timed from kernel_kexec() to the new kernel's ready
+ * point: the TSC keeps counting, so the start is passed along on the
+ * command line as kexec.start_ms and bench=kexec reports the difference.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "io.h"
+#include "idt.h"
+#include "irq.h"
+#include "irqflags.h"
+#include "dma.h"
+#include "floppy.h"
+#include "timer.h"
+#include "pmm.h"
+#include "kmalloc.h"
+#include "elf.h"
+#include "kexec.h"
+#include "syscall.h"
+#include "uaccess.h"
+#include "init.h"
+#include "param.h"
+#include "bench.h"
+#include "errno.h"
+#include "kernel.h"
+
+/* The new kernel must stay clear of the BIOS and boot loader area */
+#define KEXEC_LOW_MEMORY    0x100000
+
+/* Largest image sys_kexec_load accepts, and most program headers in one */
+#define KEXEC_MAX_IMAGE     (16 * 1024 * 1024)
+#define KEXEC_MAX_PHDRS     64
+
+/* Room kept at the end of the command line for " kexec.start_ms=<n>" */
+#define KEXEC_CMDLINE_RESERVE 32
+
+/* Staging allocations: segments, modules, boot information and control page */
+#define KEXEC_MAX_ALLOCS    (KEXEC_MAX_SEGMENTS + KEXEC_MAX_MODULES + 2)
+
+/* 8042 keyboard controller command that pulses the CPU reset line */
+#define KBC_STATUS          0x64
+#define KBC_INPUT_FULL      0x02
+#define KBC_CMD_RESET       0xFE
+
+static struct {
+    bool loaded;
+    uint32_t window_start;      /* Physical range the new kernel loads into */
+    uint32_t window_end;
+    struct kexec_control* control;
+    struct kexec_boot_info* info;
+    uint32_t alloc_count;
+    struct {
+        void* addr;
+        uint32_t pages;
+    } allocs[KEXEC_MAX_ALLOCS];
+} kimage;
+
+static uint32_t kexec_start_ms = 0;
+param_uint("kexec.start_ms", kexec_start_ms);
+
+static bool in_window(uint32_t start, uint32_t length) {
+    return start < kimage.window_end && start + length > kimage.window_start;
+}
+
+/*
+ * Staging pages the final copy cannot overwrite. Blocks inside the load
+ * window are held on a list threaded through themselves until the
+ * allocator moves past it, then given back.
+ */
+static void* kexec_alloc(uint32_t bytes) {
+    uint32_t pages = MAX(ALIGN_UP(bytes, PAGE_SIZE) / PAGE_SIZE, 1);
+    void* rejected = NULL;
+    void* addr;
+
+    if (kimage.alloc_count == KEXEC_MAX_ALLOCS)
+        return NULL;
+
+    while ((addr = page_alloc(pages)) && in_window((uint32_t)addr, pages * PAGE_SIZE)) {
+        *(void**)addr = rejected;
+        rejected = addr;
+    }
+    while (rejected) {
+        void* next = *(void**)rejected;
+        page_free(rejected, pages);
+        rejected = next;
+    }
+
+    if (addr) {
+        kimage.allocs[kimage.alloc_count].addr = addr;
+        kimage.allocs[kimage.alloc_count].pages = pages;
+        kimage.alloc_count++;
+    }
+    return addr;
+}
+
+void kexec_unload(void) {
+    while (kimage.alloc_count) {
+        kimage.alloc_count--;
+        page_free(kimage.allocs[kimage.alloc_count].addr, kimage.allocs[kimage.alloc_count].pages);
+    }
+    memset(&kimage, 0, sizeof(kimage));
+}
+
+/* Find the load window and check the segments against the image */
+static int check_segments(const struct elf32_ehdr* ehdr, const struct elf32_phdr* phdr, size_t length) {
+    uint32_t start = 0xFFFFFFFF;
+    uint32_t end = 0;
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < ehdr->e_phnum; i++) {
+        const struct elf32_phdr* ph = &phdr[i];
+
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0)
+            continue;
+        if (ph->p_filesz > ph->p_memsz || ph->p_offset > length ||
+            ph->p_filesz > length - ph->p_offset || ph->p_paddr + ph->p_memsz < ph->p_paddr)
+            return -ENOEXEC;
+        if (++count > KEXEC_MAX_SEGMENTS)
+            return -E2BIG;
+
+        start = MIN(start, ph->p_paddr);
+        end = MAX(end, ph->p_paddr + ph->p_memsz);
+    }
+
+    if (count == 0 || start < KEXEC_LOW_MEMORY || end > (pmm_max_pfn() << PAGE_SHIFT))
+        return -ENOEXEC;
+    if (ehdr->e_entry < start || ehdr->e_entry >= end)
+        return -ENOEXEC;
+
+    kimage.window_start = start;
+    kimage.window_end = end;
+    return 0;
+}
+
+/* Copy part of the image, which sys_kexec_load leaves in user memory */
+static int image_copy(void* dest, const void* image, uint32_t offset, uint32_t size, bool user) {
+    const uint8_t* src = (const uint8_t*)image + offset;
+
+    if (user)
+        return copy_from_user(dest, src, size) ? -EFAULT : 0;
+    memcpy(dest, src, size);
+    return 0;
+}
+
+/*
+ * Each segment's file bytes go straight from the image into its staging
+ * block; the rest up to p_memsz (.bss) is never staged, the trampoline
+ * zeroes it in place.
+ */
+static int stage_segments(const void* image, const struct elf32_ehdr* ehdr,
+                          const struct elf32_phdr* phdr, bool user) {
+    struct kexec_control* control = kimage.control;
+
+    for (uint32_t i = 0; i < ehdr->e_phnum; i++) {
+        const struct elf32_phdr* ph = &phdr[i];
+
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0)
+            continue;
+
+        struct kexec_segment* segment = &control->segments[control->count++];
+        segment->dest = ph->p_paddr;
+        segment->size = ph->p_filesz;
+        segment->memsz = ph->p_memsz;
+        segment->src = 0;
+        if (ph->p_filesz) {
+            void* src = kexec_alloc(ph->p_filesz);
+            if (!src)
+                return -ENOMEM;
+            int ret = image_copy(src, image, ph->p_offset, ph->p_filesz, user);
+            if (ret < 0)
+                return ret;
+            segment->src = (uint32_t)src;
+        }
+    }
+
+    control->entry = ehdr->e_entry;
+    return 0;
+}
+
+/* Copy the memory map, normalizing the entry size */
+static void stage_memory_map(struct kexec_boot_info* info, const struct multiboot_info* current) {
+    uint32_t addr = current->mmap_addr;
+    uint32_t end = addr + current->mmap_length;
+    uint32_t count = 0;
+
+    while (addr < end && count < KEXEC_MAX_MMAP) {
+        const struct multiboot_mmap_entry* entry = (const struct multiboot_mmap_entry*)addr;
+
+        info->mmap[count] = *entry;
+        info->mmap[count].size = sizeof(*entry) - sizeof(entry->size);
+        count++;
+        addr += entry->size + sizeof(entry->size);
+    }
+
+    info->mbi.flags |= MULTIBOOT_INFO_MEM_MAP;
+    info->mbi.mmap_addr = (uint32_t)info->mmap;
+    info->mbi.mmap_length = count * sizeof(info->mmap[0]);
+}
+
+/* Modules are copied too: the new kernel may be larger than the old one */
+static int stage_modules(struct kexec_boot_info* info, const struct multiboot_info* current) {
+    const struct multiboot_mod_list* mods = (const struct multiboot_mod_list*)current->mods_addr;
+
+    if (current->mods_count > KEXEC_MAX_MODULES)
+        return -E2BIG;
+
+    for (uint32_t i = 0; i < current->mods_count; i++) {
+        uint32_t length = mods[i].mod_end - mods[i].mod_start;
+        void* data = kexec_alloc(length);
+        if (!data)
+            return -ENOMEM;
+        memcpy(data, (const void*)mods[i].mod_start, length);
+
+        info->mods[i].mod_start = (uint32_t)data;
+        info->mods[i].mod_end = (uint32_t)data + length;
+        if (mods[i].cmdline) {
+            strncpy(info->mod_cmdlines[i], (const char*)mods[i].cmdline, KEXEC_MODULE_CMDLINE_SIZE - 1);
+            info->mods[i].cmdline = (uint32_t)info->mod_cmdlines[i];
+        }
+    }
+
+    info->mbi.flags |= MULTIBOOT_INFO_MODS;
+    info->mbi.mods_count = current->mods_count;
+    info->mbi.mods_addr = (uint32_t)info->mods;
+    return 0;
+}
+
+static int stage_boot_info(const char* cmdline) {
+    const struct multiboot_info* current = kernel_boot_info();
+    struct kexec_boot_info* info;
+
+    if (!cmdline)
+        cmdline = params_cmdline();
+    if (strlen(cmdline) >= KEXEC_CMDLINE_SIZE - KEXEC_CMDLINE_RESERVE)
+        return -E2BIG;
+
+    info = kexec_alloc(sizeof(*info));
+    if (!info)
+        return -ENOMEM;
+    memset(info, 0, sizeof(*info));
+
+    strcpy(info->cmdline, cmdline);
+    strcpy(info->loader_name, "nekkoOS kexec");
+    info->mbi.flags = MULTIBOOT_INFO_CMDLINE | MULTIBOOT_INFO_BOOT_LOADER_NAME;
+    info->mbi.cmdline = (uint32_t)info->cmdline;
+    info->mbi.boot_loader_name = (uint32_t)info->loader_name;
+
+    if (current->flags & MULTIBOOT_INFO_MEMORY) {
+        info->mbi.flags |= MULTIBOOT_INFO_MEMORY;
+        info->mbi.mem_lower = current->mem_lower;
+        info->mbi.mem_upper = current->mem_upper;
+    }
+    if (current->flags & MULTIBOOT_INFO_MEM_MAP)
+        stage_memory_map(info, current);
+    if (current->flags & MULTIBOOT_INFO_MODS) {
+        int ret = stage_modules(info, current);
+        if (ret < 0)
+            return ret;
+    }
+
+    kimage.info = info;
+    kimage.control->boot_info = (uint32_t)&info->mbi;
+    return 0;
+}
+
+/* The headers are copied out first; the segments are read from the image once each */
+static int load_image(const void* image, size_t length, const char* cmdline, bool user) {
+    struct elf32_ehdr header;
+    struct elf32_ehdr* ehdr = &header;
+    struct elf32_phdr* phdr = NULL;
+    uint32_t code_size = kexec_relocate_end - kexec_relocate;
+    int ret;
+
+    kexec_unload();
+
+    if (length < sizeof(*ehdr))
+        return -ENOEXEC;
+    ret = image_copy(ehdr, image, 0, sizeof(*ehdr), user);
+    if (ret < 0)
+        return ret;
+    if (!elf_header_ok(ehdr, ET_EXEC) || ehdr->e_phnum == 0 || ehdr->e_phnum > KEXEC_MAX_PHDRS)
+        return -ENOEXEC;
+    if (ehdr->e_phoff > length || ehdr->e_phnum > (length - ehdr->e_phoff) / sizeof(*phdr))
+        return -ENOEXEC;
+
+    phdr = kmalloc(ehdr->e_phnum * sizeof(*phdr));
+    if (!phdr)
+        return -ENOMEM;
+    ret = image_copy(phdr, image, ehdr->e_phoff, ehdr->e_phnum * sizeof(*phdr), user);
+    if (ret == 0)
+        ret = check_segments(ehdr, phdr, length);
+    if (ret < 0) {
+        kfree(phdr);
+        return ret;
+    }
+
+    /* Trampoline code first, then the control block it reads */
+    uint8_t* page = kexec_alloc(PAGE_SIZE);
+    if (!page) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+    memcpy(page, kexec_relocate, code_size);
+    kimage.control = (struct kexec_control*)(page + ALIGN_UP(code_size, 16));
+    memset(kimage.control, 0, sizeof(*kimage.control));
+
+    ret = stage_segments(image, ehdr, phdr, user);
+    if (ret == 0)
+        ret = stage_boot_info(cmdline);
+    if (ret < 0)
+        goto fail;
+
+    kfree(phdr);
+    kimage.loaded = true;
+    return 0;
+
+fail:
+    kfree(phdr);
+    kexec_unload();
+    return ret;
+}
+
+int kexec_load(const void* image, size_t length, const char* cmdline) {
+    return load_image(image, length, cmdline, false);
+}
+
+int kernel_kexec(void) {
+    uint32_t khz = timer_tsc_khz();
+    char number[12];
+
+    if (!kimage.loaded)
+        return -ENOEXEC;
+
+    kprintf("kexec: starting new kernel\n");
+
+    /* Tell the new kernel when the reload started */
+    if (khz) {
+        utoa((uint32_t)div_u64(rdtsc(), khz), number, 10);
+        strcat(kimage.info->cmdline, " kexec.start_ms=");
+        strcat(kimage.info->cmdline, number);
+    }
+
+    /* Quiesce: no DMA, no motor, no interrupt lines */
+    floppy_motor_off();
+    dma_mask(DMA_CHANNEL_FLOPPY);
+    local_irq_disable();
+    for (int irq = 0; irq < IRQ_LINES; irq++) {
+        if (irq != PIC_CASCADE_IRQ)
+            irq_mask(irq);
+    }
+
+    void* code = (uint8_t*)kimage.control - ALIGN_UP(kexec_relocate_end - kexec_relocate, 16);
+    __asm__ volatile ("jmp *%1" : : "a"(kimage.control), "r"(code) : "memory");
+    __builtin_unreachable();
+}
+
+void kernel_restart(void) {
+    struct idt_ptr no_idt = { 0, 0 };
+
+    local_irq_disable();
+    while (inb(KBC_STATUS) & KBC_INPUT_FULL)
+        ;
+    outb(KBC_STATUS, KBC_CMD_RESET);
+
+    /* No keyboard controller: triple fault instead */
+    __asm__ volatile ("lidt %0; int3" : : "m"(no_idt));
+    while (1)
+        __asm__ volatile ("hlt");
+}
+
+int32_t sys_reboot(uint32_t cmd) {
+    switch (cmd) {
+    case REBOOT_CMD_RESTART:
+        kernel_restart();
+    case REBOOT_CMD_KEXEC:
+        return kernel_kexec();
+    default:
+        return -EINVAL;
+    }
+}
+
+/* The image stays in user memory; only its headers and segments are copied in */
+int32_t sys_kexec_load(const void* image, size_t length, const char* cmdline) {
+    char* kcmdline = NULL;
+    int ret;
+
+    if (length == 0 || length > KEXEC_MAX_IMAGE)
+        return -EINVAL;
+    if (!access_ok(image, length))
+        return -EFAULT;
+
+    if (cmdline) {
+        kcmdline = kmalloc(KEXEC_CMDLINE_SIZE);
+        if (!kcmdline)
+            return -ENOMEM;
+        ssize_t cmdline_length = strncpy_from_user(kcmdline, cmdline, KEXEC_CMDLINE_SIZE);
+        if (cmdline_length < 0 || cmdline_length == KEXEC_CMDLINE_SIZE) {
+            kfree(kcmdline);
+            return cmdline_length < 0 ? cmdline_length : -E2BIG;
+        }
+    }
+
+    ret = load_image(image, length, kcmdline, true);
+    kfree(kcmdline);
+    return ret;
+}
+
+/*
+ * Reload time against a full reboot. A cold boot reports its time from
+ * reset to ready and reloads the kernel passed as boot module 0 (e.g.
+ * qemu -kernel build/kernel.elf -initrd build/kernel.elf); the reloaded
+ * kernel sees kexec.start_ms and reports its own time instead.
+ */
+static void kexec_benchmark(void) {
+    const struct multiboot_info* info = kernel_boot_info();
+    uint32_t khz = timer_tsc_khz();
+
+    if (!khz)
+        return;
+
+    uint32_t ready_ms = (uint32_t)div_u64(initcall_ready_cycles(), khz);
+    if (kexec_start_ms) {
+        bench_report("kexec", "reload_to_ready", ready_ms - kexec_start_ms, "ms");
+        return;
+    }
+    bench_report("kexec", "reset_to_ready", ready_ms, "ms");
+
+    if (!(info->flags & MULTIBOOT_INFO_MODS) || info->mods_count == 0) {
+        kprintf("kexec: no boot module to reload, pass the kernel ELF as module 0\n");
+        return;
+    }
+
+    const struct multiboot_mod_list* mod = (const struct multiboot_mod_list*)info->mods_addr;
+    uint64_t start = rdtsc();
+    int ret = kexec_load((const void*)mod->mod_start, mod->mod_end - mod->mod_start, NULL);
+    if (ret == 0) {
+        /* Staging the image, before the reload itself */
+        bench_report("kexec", "load", (uint32_t)div_u64((rdtsc() - start) * 1000, khz), "us");
+        ret = kernel_kexec();
+    }
+
+    kprintf("kexec: reload failed, error ");
+    kprintf_dec(-ret);
+    kprintf("\n");
+}
+KERNEL_BENCH("kexec", kexec_benchmark);
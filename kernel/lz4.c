@@ -0,0 +1,187 @@
+/*
+ * LZ4 block compression for nekkoOS
+ * A block is a series of sequences: a token (literal count in the high
+ * nibble, match length - 4 in the low one, 15 meaning more length bytes
+ * follow), the literals, and a 16-bit little endian match offset. The
+ * last sequence has literals only. The compressor finds matches through
+ * a hash table of 4-byte prefixes and skips ahead faster the longer it
+ * goes without one, so incompressible input is given up on quickly.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "lz4.h"
+#include "errno.h"
+
+#define MIN_MATCH           4
+#define MFLIMIT             12      /* A match starts at least this far from the end */
+#define LAST_LITERALS       5       /* The last bytes are always literals */
+#define MAX_OFFSET          65535
+#define SKIP_TRIGGER        6       /* Misses before the search step grows */
+
+typedef uint32_t unaligned_u32 __attribute__((aligned(1), may_alias));
+
+static inline uint32_t read32(const uint8_t* p) {
+    return *(const unaligned_u32*)p;
+}
+
+static inline uint32_t hash4(uint32_t value) {
+    return (value * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+/* Length bytes after a nibble of 15: runs of 255, then the rest */
+static uint8_t* put_length(uint8_t* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+/* One sequence; the match is left out when match_length is 0 */
+static uint8_t* put_sequence(uint8_t* op, const uint8_t* literals, size_t literal_length,
+                             size_t offset, size_t match_length) {
+    uint8_t* token = op++;
+
+    *token = (literal_length >= 15 ? 15 : literal_length) << 4;
+    if (literal_length >= 15)
+        op = put_length(op, literal_length - 15);
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (match_length) {
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        match_length -= MIN_MATCH;
+        *token |= match_length >= 15 ? 15 : match_length;
+        if (match_length >= 15)
+            op = put_length(op, match_length - 15);
+    }
+    return op;
+}
+
+/* Worst case bytes for a sequence, so capacity is checked once per sequence */
+static inline size_t sequence_bound(size_t literal_length, size_t match_length) {
+    return 1 + literal_length / 255 + 1 + literal_length + 2 + match_length / 255 + 1;
+}
+
+size_t lz4_compress(const void* src, size_t length, void* dest, size_t capacity, void* workmem) {
+    const uint8_t* base = src;
+    const uint8_t* end = base + length;
+    const uint8_t* anchor = base;
+    uint8_t* op = dest;
+    uint32_t* table = workmem;
+
+    memset(table, 0, LZ4_WORKMEM_SIZE);
+
+    if (length > MFLIMIT) {
+        const uint8_t* match_limit = end - LAST_LITERALS;
+        const uint8_t* limit = end - MFLIMIT;
+        const uint8_t* ip = base + 1;
+        uint32_t misses = 1 << SKIP_TRIGGER;
+
+        while (ip <= limit) {
+            uint32_t hash = hash4(read32(ip));
+            const uint8_t* ref = base + table[hash];
+
+            table[hash] = ip - base;
+            if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != read32(ip)) {
+                ip += misses++ >> SKIP_TRIGGER;
+                continue;
+            }
+            misses = 1 << SKIP_TRIGGER;
+
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t* match_end = ip + MIN_MATCH;
+            ref += MIN_MATCH;
+            while (match_end < match_limit && *match_end == *ref) {
+                match_end++;
+                ref++;
+            }
+
+            size_t literal_length = ip - anchor;
+            size_t match_length = match_end - ip;
+            if ((size_t)(op - (uint8_t*)dest) + sequence_bound(literal_length, match_length) > capacity)
+                return 0;
+            op = put_sequence(op, anchor, literal_length, match_end - ref, match_length);
+
+            ip = anchor = match_end;
+            if (ip <= limit)
+                table[hash4(read32(ip - 2))] = ip - 2 - base;
+        }
+    }
+
+    size_t literal_length = end - anchor;
+    if ((size_t)(op - (uint8_t*)dest) + sequence_bound(literal_length, 0) > capacity)
+        return 0;
+    op = put_sequence(op, anchor, literal_length, 0, 0);
+    return op - (uint8_t*)dest;
+}
+
+/* Read length bytes after a nibble of 15; false if the input runs out */
+static bool get_length(const uint8_t** ip, const uint8_t* end, size_t* length) {
+    uint8_t byte;
+
+    do {
+        if (*ip >= end)
+            return false;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+ssize_t lz4_decompress(const void* src, size_t length, void* dest, size_t capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* end = ip + length;
+    uint8_t* op = dest;
+    uint8_t* op_end = op + capacity;
+
+    while (ip < end) {
+        const uint8_t* sequence = ip;
+        uint32_t token = *ip++;
+        size_t literal_length = token >> 4;
+
+        if (literal_length == 15 && !get_length(&ip, end, &literal_length))
+            return -EINVAL;
+        if (literal_length > (size_t)(end - ip) || literal_length > (size_t)(op_end - op))
+            return -EINVAL;
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        if (ip == end) {
+            /* Only a block of literals alone may end on fewer than LAST_LITERALS */
+            if (sequence != src && literal_length < LAST_LITERALS)
+                return -EINVAL;
+            break;
+        }
+
+        if (end - ip < 2)
+            return -EINVAL;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t*)dest))
+            return -EINVAL;
+
+        size_t match_length = token & 15;
+        if (match_length == 15 && !get_length(&ip, end, &match_length))
+            return -EINVAL;
+        match_length += MIN_MATCH;
+        if (match_length > (size_t)(op_end - op))
+            return -EINVAL;
+
+        /* Copies may overlap their source; words are safe 4 bytes back or more */
+        const uint8_t* ref = op - offset;
+        if (offset >= 4) {
+            for (; match_length >= 4; match_length -= 4, op += 4, ref += 4)
+                *(unaligned_u32*)op = read32(ref);
+        }
+        while (match_length--)
+            *op++ = *ref++;
+    }
+    return op - (uint8_t*)dest;
+}
@@ -0,0 +1,195 @@
+/*
+ * Kernel heap for nekkoOS
+ * Small allocations come from power-of-two slab caches, anything above
+ * KMALLOC_MAX_SIZE takes whole pages with a header in front. Both kinds
+ * start their first page with a magic number, so kfree() needs no size.
+ * Slab pages come from the running CPU's node and stay on that node's
+ * lists, so objects are handed out node-local.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "list.h"
+#include "irqflags.h"
+#include "pmm.h"
+#include "numa.h"
+#include "kmalloc.h"
+#include "init.h"
+#include "kernel.h"
+#include "export.h"
+
+#define SLAB_MAGIC          0x51AB0001
+#define LARGE_MAGIC         0x51AB0002
+#define SLAB_ALIGN          8
+
+struct slab {
+    uint32_t magic;
+    struct kmem_cache* cache;
+    struct list_head list;
+    void* free;                 /* Free object list, linked through the objects */
+    uint32_t inuse;
+    uint32_t node;              /* Lists the slab is on */
+};
+
+struct large_header {
+    uint32_t magic;
+    uint32_t pages;
+    uint32_t pad[2];
+};
+
+#define SLAB_OBJECTS_OFFSET ALIGN_UP(sizeof(struct slab), 16)
+
+static struct kmem_cache kmalloc_caches[KMALLOC_CACHES];
+static const char* const kmalloc_names[KMALLOC_CACHES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024",
+};
+
+void kmem_cache_init(struct kmem_cache* cache, const char* name, size_t size) {
+    cache->name = name;
+    cache->size = ALIGN_UP(MAX(size, sizeof(void*)), SLAB_ALIGN);
+    cache->objects_per_slab = (PAGE_SIZE - SLAB_OBJECTS_OFFSET) / cache->size;
+    cache->active_objects = 0;
+    for (uint32_t nid = 0; nid < MAX_NUMNODES; nid++) {
+        list_init(&cache->node[nid].partial);
+        list_init(&cache->node[nid].full);
+        list_init(&cache->node[nid].empty);
+    }
+}
+
+static struct slab* slab_create(struct kmem_cache* cache, uint32_t nid) {
+    struct slab* slab = page_alloc_node(nid, 1);
+    if (!slab)
+        return NULL;
+
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->node = nid;
+    slab->inuse = 0;
+    slab->free = NULL;
+
+    /* Thread the free list so objects are handed out in address order */
+    uint8_t* objects = (uint8_t*)slab + SLAB_OBJECTS_OFFSET;
+    for (uint32_t i = cache->objects_per_slab; i-- > 0;) {
+        void** object = (void**)(objects + i * cache->size);
+        *object = slab->free;
+        slab->free = object;
+    }
+    list_init(&slab->list);
+    return slab;
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    uint32_t flags = local_irq_save();
+    uint32_t nid = numa_node_id();
+    struct kmem_cache_node* n = &cache->node[nid];
+    struct slab* slab;
+
+    if (cache->objects_per_slab == 0) {
+        local_irq_restore(flags);
+        return NULL;
+    }
+
+    if (!list_empty(&n->partial)) {
+        slab = list_first_entry(&n->partial, struct slab, list);
+    } else {
+        if (!list_empty(&n->empty)) {
+            slab = list_first_entry(&n->empty, struct slab, list);
+            list_del(&slab->list);
+        } else if (!(slab = slab_create(cache, nid))) {
+            local_irq_restore(flags);
+            return NULL;
+        }
+        list_add(&slab->list, &n->partial);
+    }
+
+    void** object = slab->free;
+    slab->free = *object;
+    slab->inuse++;
+    cache->active_objects++;
+
+    if (slab->inuse == cache->objects_per_slab) {
+        list_del(&slab->list);
+        list_add(&slab->list, &n->full);
+    }
+    local_irq_restore(flags);
+    return object;
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* object) {
+    struct slab* slab = (struct slab*)ALIGN_DOWN((uint32_t)object, PAGE_SIZE);
+    struct kmem_cache_node* n = &cache->node[slab->node];
+    uint32_t flags = local_irq_save();
+
+    *(void**)object = slab->free;
+    slab->free = object;
+    cache->active_objects--;
+
+    if (slab->inuse-- == cache->objects_per_slab) {
+        /* Full slab regains a free object */
+        list_del(&slab->list);
+        list_add(&slab->list, &n->partial);
+    } else if (slab->inuse == 0) {
+        list_del(&slab->list);
+        if (list_empty(&n->empty)) {
+            list_add(&slab->list, &n->empty);
+        } else {
+            slab->magic = 0;
+            page_free(slab, 1);
+        }
+    }
+    local_irq_restore(flags);
+}
+
+void* kmalloc(size_t size) {
+    if (size == 0)
+        return NULL;
+
+    if (size <= KMALLOC_MAX_SIZE) {
+        int index = 0;
+        while ((size_t)(KMALLOC_MIN_SIZE << index) < size)
+            index++;
+        return kmem_cache_alloc(&kmalloc_caches[index]);
+    }
+
+    if (size > SIZE_MAX - sizeof(struct large_header) - PAGE_SIZE)
+        return NULL;
+    uint32_t pages = (size + sizeof(struct large_header) + PAGE_SIZE - 1) / PAGE_SIZE;
+    struct large_header* header = page_alloc(pages);
+    if (!header)
+        return NULL;
+    header->magic = LARGE_MAGIC;
+    header->pages = pages;
+    return header + 1;
+}
+EXPORT_SYMBOL(kmalloc);
+
+void* kzalloc(size_t size) {
+    void* ptr = kmalloc(size);
+    if (ptr)
+        memset(ptr, 0, size);
+    return ptr;
+}
+EXPORT_SYMBOL(kzalloc);
+
+void kfree(void* ptr) {
+    if (!ptr)
+        return;
+
+    uint32_t* page = (uint32_t*)ALIGN_DOWN((uint32_t)ptr, PAGE_SIZE);
+    if (*page == SLAB_MAGIC) {
+        kmem_cache_free(((struct slab*)page)->cache, ptr);
+    } else if (*page == LARGE_MAGIC) {
+        struct large_header* header = (struct large_header*)page;
+        header->magic = 0;
+        page_free(header, header->pages);
+    } else {
+        panic("kfree: bad pointer");
+    }
+}
+EXPORT_SYMBOL(kfree);
+
+void __init kmalloc_init(void) {
+    for (int i = 0; i < KMALLOC_CACHES; i++)
+        kmem_cache_init(&kmalloc_caches[i], kmalloc_names[i], KMALLOC_MIN_SIZE << i);
+}
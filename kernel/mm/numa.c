@@ -0,0 +1,225 @@
+/*
+ * NUMA topology for nekkoOS
+ * The ACPI SRAT names a proximity domain for every CPU and memory range,
+ * the SLIT gives the distance between domains. Domains become nodes
+ * 0..nr_node_ids-1 in the order the SRAT mentions them; the memory ranges
+ * go to the page allocator, which serves each node from its own memory
+ * first and from the nearest other nodes after that. Without an SRAT, or
+ * with numa=0, everything is node 0.
+ *
+ * Threads allocate from their home node (struct thread numa_node), which
+ * they inherit from the thread that created them; the first ones get the
+ * boot CPU's node. Only the boot CPU is brought up, so the scheduler has
+ * no CPU to choose and threads always run next to their memory.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "acpi.h"
+#include "pmm.h"
+#include "numa.h"
+#include "smp.h"
+#include "sched.h"
+#include "timer.h"
+#include "param.h"
+#include "bench.h"
+#include "init.h"
+#include "kernel.h"
+
+uint32_t nr_node_ids = 1;
+
+static uint32_t cpu_node[NR_CPUS];
+static uint8_t node_distances[MAX_NUMNODES][MAX_NUMNODES];
+
+/* Proximity domain of each node */
+static uint32_t node_pxm[MAX_NUMNODES];
+
+static bool numa_enabled = true;
+param_bool("numa", numa_enabled);
+
+static inline uint32_t cpuid_apic_id(void) {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+
+    __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return ebx >> 24;
+}
+
+/* Node of a proximity domain, allocated on first sight; -1 once all are taken */
+static int __init pxm_to_node(uint32_t pxm) {
+    for (uint32_t nid = 0; nid < nr_node_ids; nid++) {
+        if (node_pxm[nid] == pxm)
+            return (int)nid;
+    }
+    if (nr_node_ids == MAX_NUMNODES)
+        return -1;
+    node_pxm[nr_node_ids] = pxm;
+    return (int)nr_node_ids++;
+}
+
+static void __init parse_srat(const struct acpi_srat* srat) {
+    uint32_t boot_apic_id = cpuid_apic_id();
+    uint32_t offset = sizeof(*srat);
+
+    nr_node_ids = 0;
+    while (offset + sizeof(struct acpi_srat_entry) <= srat->header.length) {
+        const struct acpi_srat_entry* entry = (const struct acpi_srat_entry*)((const uint8_t*)srat + offset);
+        if (entry->length == 0 || offset + entry->length > srat->header.length)
+            break;
+
+        if (entry->type == ACPI_SRAT_CPU_AFFINITY && entry->length >= sizeof(struct acpi_srat_cpu_affinity)) {
+            const struct acpi_srat_cpu_affinity* cpu = (const void*)entry;
+            uint32_t pxm = cpu->proximity_domain_lo | (uint32_t)cpu->proximity_domain_hi[0] << 8 |
+                           (uint32_t)cpu->proximity_domain_hi[1] << 16 |
+                           (uint32_t)cpu->proximity_domain_hi[2] << 24;
+            int nid = (cpu->flags & ACPI_SRAT_ENABLED) ? pxm_to_node(pxm) : -1;
+
+            /* Only the boot CPU runs; the others are not brought up */
+            if (nid >= 0 && cpu->apic_id == boot_apic_id)
+                cpu_node[0] = (uint32_t)nid;
+        } else if (entry->type == ACPI_SRAT_MEMORY_AFFINITY &&
+                   entry->length >= sizeof(struct acpi_srat_memory_affinity)) {
+            const struct acpi_srat_memory_affinity* mem = (const void*)entry;
+            int nid = (mem->flags & ACPI_SRAT_ENABLED) ? pxm_to_node(mem->proximity_domain) : -1;
+
+            if (nid >= 0)
+                pmm_set_node((uint32_t)nid, mem->base_address, mem->length_bytes);
+        }
+        offset += entry->length;
+    }
+
+    if (nr_node_ids == 0)
+        nr_node_ids = 1;
+}
+
+static void __init parse_slit(const struct acpi_slit* slit) {
+    uint64_t count = slit->locality_count;
+
+    if (sizeof(*slit) + count * count > slit->header.length)
+        return;
+
+    for (uint32_t from = 0; from < nr_node_ids; from++) {
+        for (uint32_t to = 0; to < nr_node_ids; to++) {
+            if (node_pxm[from] < count && node_pxm[to] < count)
+                node_distances[from][to] = slit->entry[node_pxm[from] * (uint32_t)count + node_pxm[to]];
+        }
+    }
+}
+
+int __init numa_init(void) {
+    const struct acpi_srat* srat = NULL;
+
+    for (uint32_t from = 0; from < MAX_NUMNODES; from++) {
+        for (uint32_t to = 0; to < MAX_NUMNODES; to++)
+            node_distances[from][to] = from == to ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+    }
+
+    if (numa_enabled)
+        srat = (const struct acpi_srat*)acpi_find_table("SRAT");
+    if (!srat) {
+        kprintf("NUMA: no SRAT, one node\n");
+        return 0;
+    }
+
+    parse_srat(srat);
+    const struct acpi_slit* slit = (const struct acpi_slit*)acpi_find_table("SLIT");
+    if (slit)
+        parse_slit(slit);
+    pmm_init_nodes(nr_node_ids);
+
+    for (uint32_t nid = 0; nid < nr_node_ids; nid++) {
+        struct pmm_node_stats stats;
+
+        pmm_node_stats(nid, &stats);
+        kprintf("NUMA: node ");
+        kprintf_dec(nid);
+        kprintf(" ");
+        kprintf_dec(stats.present_pages / (1024 * 1024 / PAGE_SIZE));
+        kprintf("MB");
+        if (nid == cpu_node[0])
+            kprintf(", boot CPU");
+        kprintf("\n");
+    }
+    return 0;
+}
+
+uint32_t cpu_to_node(uint32_t cpu) {
+    return cpu < NR_CPUS ? cpu_node[cpu] : 0;
+}
+
+uint32_t node_distance(uint32_t from, uint32_t to) {
+    if (from >= MAX_NUMNODES || to >= MAX_NUMNODES)
+        return REMOTE_DISTANCE;
+    return node_distances[from][to];
+}
+
+/* Node page_alloc() serves first: the current thread's home node */
+uint32_t numa_mem_id(void) {
+    struct thread* thread = this_cpu()->current;
+
+    return thread ? thread->numa_node : numa_node_id();
+}
+
+/*
+ * Read and write bandwidth of each node's memory from the boot CPU, and
+ * the share of all allocations so far that had to leave their node.
+ */
+#define NUMA_BENCH_PAGES    256
+#define NUMA_BENCH_PASSES   8
+
+static const char* const numa_bench_read[MAX_NUMNODES] = {
+    "node0_read", "node1_read", "node2_read", "node3_read",
+};
+static const char* const numa_bench_write[MAX_NUMNODES] = {
+    "node0_write", "node1_write", "node2_write", "node3_write",
+};
+
+static uint32_t numa_bench_sum(const uint32_t* words, uint32_t count) {
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < count; i += 4)
+        sum += words[i] + words[i + 1] + words[i + 2] + words[i + 3];
+    return sum;
+}
+
+static void numa_benchmark(void) {
+    uint32_t kb = NUMA_BENCH_PAGES * PAGE_SIZE / 1024 * NUMA_BENCH_PASSES;
+    uint32_t local = 0, remote = 0;
+    volatile uint32_t sink = 0;
+
+    for (uint32_t nid = 0; nid < nr_node_ids; nid++) {
+        uint32_t* buffer = page_alloc_node(nid, NUMA_BENCH_PAGES);
+        if (!buffer)
+            continue;
+        if (pfn_to_nid((uint32_t)buffer >> PAGE_SHIFT) != nid) {
+            /* Node too small or full: nothing of its own to measure */
+            page_free(buffer, NUMA_BENCH_PAGES);
+            continue;
+        }
+
+        uint64_t start = rdtsc();
+        for (int pass = 0; pass < NUMA_BENCH_PASSES; pass++)
+            memset(buffer, pass, NUMA_BENCH_PAGES * PAGE_SIZE);
+        bench_report("numa", numa_bench_write[nid], bench_rate(kb, rdtsc() - start) / 1024, "MB/s");
+
+        start = rdtsc();
+        for (int pass = 0; pass < NUMA_BENCH_PASSES; pass++)
+            sink += numa_bench_sum(buffer, NUMA_BENCH_PAGES * PAGE_SIZE / sizeof(uint32_t));
+        bench_report("numa", numa_bench_read[nid], bench_rate(kb, rdtsc() - start) / 1024, "MB/s");
+
+        page_free(buffer, NUMA_BENCH_PAGES);
+    }
+    (void)sink;
+
+    for (uint32_t nid = 0; nid < nr_node_ids; nid++) {
+        struct pmm_node_stats stats;
+
+        pmm_node_stats(nid, &stats);
+        local += stats.local_allocs;
+        remote += stats.remote_allocs;
+    }
+    bench_report("numa", "nodes", nr_node_ids, "nodes");
+    bench_report("numa", "remote_allocs", remote, "allocs");
+    bench_report("numa", "remote_ratio",
+                 local + remote ? (uint32_t)div_u64((uint64_t)remote * 1000, local + remote) : 0, "permille");
+}
+KERNEL_BENCH("numa", numa_benchmark);
@@ -0,0 +1,326 @@
+/*
+ * Physical page allocator for nekkoOS
+ * One bit per 4KB page frame, set while the frame is in use. Everything
+ * starts out used; the multiboot memory map frees the available RAM and
+ * the low megabyte, the kernel image and the boot loader's data are then
+ * reserved again.
+ *
+ * Memory is split into NUMA nodes in 4MB sections (numa.c assigns them,
+ * all of it is node 0 otherwise). Each node keeps its own free count and
+ * search hint; an allocation is served from the requested node when it
+ * can be and from the other nodes nearest first when not.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "multiboot.h"
+#include "irqflags.h"
+#include "pmm.h"
+#include "numa.h"
+#include "cgroup.h"
+#include "init.h"
+#include "kernel.h"
+#include "export.h"
+
+static uint32_t page_bitmap[PMM_MAX_PAGES / 32];
+static uint32_t total_pages;
+static uint32_t free_pages;
+static uint32_t max_page;           /* One past the highest usable frame */
+
+/* Node of each section */
+static uint8_t section_node[PMM_MAX_PAGES >> PMM_SECTION_SHIFT];
+
+struct pmm_node {
+    uint32_t present_pages;
+    uint32_t free_pages;
+    uint32_t search_hint;
+    uint32_t local_allocs;              /* Requests for the node it served */
+    uint32_t remote_allocs;             /* Requests for the node served elsewhere */
+    uint8_t fallback[MAX_NUMNODES];     /* Nodes to try, this one first */
+};
+
+static struct pmm_node pmm_nodes[MAX_NUMNODES];
+static uint32_t pmm_nr_nodes = 1;
+
+/* RAM from the memory map, so that holes are not mistaken for used pages */
+#define PMM_MAX_REGIONS     16
+
+static struct {
+    uint32_t first;
+    uint32_t last;
+} ram_regions[PMM_MAX_REGIONS];
+static uint32_t ram_region_count;
+
+static inline bool page_used(uint32_t page) {
+    return page_bitmap[page / 32] & BIT(page % 32);
+}
+
+static inline struct pmm_node* page_node(uint32_t page) {
+    return &pmm_nodes[section_node[page >> PMM_SECTION_SHIFT]];
+}
+
+static void mark_free(uint32_t first, uint32_t last) {
+    for (uint32_t page = first; page < last; page++) {
+        if (page_used(page)) {
+            page_bitmap[page / 32] &= ~BIT(page % 32);
+            page_node(page)->free_pages++;
+            free_pages++;
+        }
+    }
+}
+
+static void mark_used(uint32_t first, uint32_t last) {
+    for (uint32_t page = first; page < last && page < max_page; page++) {
+        if (!page_used(page)) {
+            page_bitmap[page / 32] |= BIT(page % 32);
+            page_node(page)->free_pages--;
+            free_pages--;
+        }
+    }
+}
+
+/* Free the whole pages inside [base, base + length) */
+static void add_region(uint64_t base, uint64_t length) {
+    uint64_t end = base + length;
+
+    if (base >= PMM_MAX_MEMORY)
+        return;
+    if (end > PMM_MAX_MEMORY)
+        end = PMM_MAX_MEMORY;
+
+    uint32_t first = (uint32_t)((base + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    uint32_t last = (uint32_t)(end >> PAGE_SHIFT);
+    if (first >= last)
+        return;
+
+    mark_free(first, last);
+    if (ram_region_count < PMM_MAX_REGIONS) {
+        ram_regions[ram_region_count].first = first;
+        ram_regions[ram_region_count].last = last;
+        ram_region_count++;
+    }
+    total_pages += last - first;
+    if (last > max_page)
+        max_page = last;
+}
+
+static void reserve_region(uint32_t base, uint32_t length) {
+    if (length == 0)
+        return;
+    mark_used(base >> PAGE_SHIFT, (uint32_t)(((uint64_t)base + length + PAGE_SIZE - 1) >> PAGE_SHIFT));
+}
+
+void __init pmm_init(struct multiboot_info* mboot_info) {
+    memset(page_bitmap, 0xFF, sizeof(page_bitmap));
+    memset(section_node, 0, sizeof(section_node));
+
+    if (mboot_info->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uint32_t addr = mboot_info->mmap_addr;
+        uint32_t end = addr + mboot_info->mmap_length;
+
+        while (addr < end) {
+            struct multiboot_mmap_entry* entry = (struct multiboot_mmap_entry*)addr;
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE)
+                add_region(entry->addr, entry->len);
+            addr += entry->size + sizeof(entry->size);
+        }
+    } else if (mboot_info->flags & MULTIBOOT_INFO_MEMORY) {
+        add_region(0, (uint64_t)mboot_info->mem_lower * 1024);
+        add_region(0x100000, (uint64_t)mboot_info->mem_upper * 1024);
+    }
+
+    /* BIOS data, the boot loaders and VGA memory live in the low megabyte */
+    reserve_region(0, 0x100000);
+    reserve_region((uint32_t)_kernel_start, (uint32_t)(_kernel_end - _kernel_start));
+
+    /* Boot loader data is still referenced after boot (command line, modules) */
+    reserve_region((uint32_t)mboot_info, sizeof(*mboot_info));
+    if (mboot_info->flags & MULTIBOOT_INFO_CMDLINE)
+        reserve_region(mboot_info->cmdline, strlen((const char*)mboot_info->cmdline) + 1);
+    if (mboot_info->flags & MULTIBOOT_INFO_MEM_MAP)
+        reserve_region(mboot_info->mmap_addr, mboot_info->mmap_length);
+    if (mboot_info->flags & MULTIBOOT_INFO_MODS) {
+        struct multiboot_mod_list* mods = (struct multiboot_mod_list*)mboot_info->mods_addr;
+        reserve_region(mboot_info->mods_addr, mboot_info->mods_count * sizeof(*mods));
+        for (uint32_t i = 0; i < mboot_info->mods_count; i++) {
+            reserve_region(mods[i].mod_start, mods[i].mod_end - mods[i].mod_start);
+            if (mods[i].cmdline)
+                reserve_region(mods[i].cmdline, strlen((const char*)mods[i].cmdline) + 1);
+        }
+    }
+
+    pmm_init_nodes(1);
+}
+
+/* Give [base, base + length) to a node, in whole sections */
+void __init pmm_set_node(uint32_t nid, uint64_t base, uint64_t length) {
+    uint64_t end = base + length;
+
+    if (nid >= MAX_NUMNODES || length == 0 || base >= PMM_MAX_MEMORY)
+        return;
+    if (end > PMM_MAX_MEMORY)
+        end = PMM_MAX_MEMORY;
+
+    uint32_t first = (uint32_t)(base >> (PAGE_SHIFT + PMM_SECTION_SHIFT));
+    uint32_t last = (uint32_t)((end - 1) >> (PAGE_SHIFT + PMM_SECTION_SHIFT));
+    for (uint32_t section = first; section <= last; section++)
+        section_node[section] = (uint8_t)nid;
+}
+
+/* Recount the nodes after the sections were assigned and order their fallbacks */
+void __init pmm_init_nodes(uint32_t nr_nodes) {
+    pmm_nr_nodes = MIN(MAX(nr_nodes, 1), MAX_NUMNODES);
+    memset(pmm_nodes, 0, sizeof(pmm_nodes));
+
+    for (uint32_t i = 0; i < ram_region_count; i++) {
+        for (uint32_t page = ram_regions[i].first; page < ram_regions[i].last; page++)
+            page_node(page)->present_pages++;
+    }
+    for (uint32_t page = 0; page < max_page; page++) {
+        if (!page_used(page))
+            page_node(page)->free_pages++;
+    }
+
+    /* Insertion sort of the other nodes by distance, ties by number */
+    for (uint32_t nid = 0; nid < pmm_nr_nodes; nid++) {
+        uint8_t* order = pmm_nodes[nid].fallback;
+
+        for (uint32_t i = 0; i < pmm_nr_nodes; i++) {
+            uint32_t j = i;
+            while (j > 0 && node_distance(nid, order[j - 1]) > node_distance(nid, i)) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = (uint8_t)i;
+        }
+    }
+}
+
+/* Next fit within one node's sections from its hint, then once more from the bottom */
+static void* alloc_from_node(uint32_t nid, uint32_t count) {
+    struct pmm_node* node = &pmm_nodes[nid];
+
+    if (count > node->free_pages)
+        return NULL;
+
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t start = pass == 0 ? node->search_hint : 0;
+        uint32_t run = 0;
+
+        for (uint32_t page = start; page < max_page; page++) {
+            /* Runs stay inside the node */
+            if (section_node[page >> PMM_SECTION_SHIFT] != nid) {
+                run = 0;
+                page = ALIGN_UP(page + 1, PMM_SECTION_PAGES) - 1;
+                continue;
+            }
+            /* Skip fully used words quickly */
+            if (run == 0 && (page % 32) == 0 && page_bitmap[page / 32] == 0xFFFFFFFF) {
+                page += 31;
+                continue;
+            }
+            if (page_used(page)) {
+                run = 0;
+                continue;
+            }
+            if (++run == count) {
+                uint32_t first = page + 1 - count;
+                mark_used(first, page + 1);
+                node->search_hint = page + 1;
+                return (void*)(first << PAGE_SHIFT);
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Allocate count physically contiguous pages, preferably on node nid,
+ * charged to the current thread's control group
+ */
+void* page_alloc_node(uint32_t nid, uint32_t count) {
+    struct cgroup* memcg;
+
+    if (mem_cgroup_charge(count, &memcg))
+        return NULL;
+
+    uint32_t flags = local_irq_save();
+    void* addr = NULL;
+
+    if (nid >= pmm_nr_nodes)
+        nid = 0;
+
+    if (count != 0 && count <= free_pages) {
+        for (uint32_t i = 0; i < pmm_nr_nodes && !addr; i++)
+            addr = alloc_from_node(pmm_nodes[nid].fallback[i], count);
+    }
+
+    if (addr && pfn_to_nid((uint32_t)addr >> PAGE_SHIFT) == nid)
+        pmm_nodes[nid].local_allocs++;
+    else if (addr)
+        pmm_nodes[nid].remote_allocs++;
+
+    if (addr)
+        mem_cgroup_commit(memcg, addr, count);
+    else
+        mem_cgroup_cancel(memcg, count);
+    local_irq_restore(flags);
+    return addr;
+}
+
+/* Allocate count physically contiguous pages near the current thread */
+void* page_alloc(uint32_t count) {
+    return page_alloc_node(numa_mem_id(), count);
+}
+EXPORT_SYMBOL(page_alloc);
+
+void page_free(void* addr, uint32_t count) {
+    uint32_t first = (uint32_t)addr >> PAGE_SHIFT;
+    uint32_t flags = local_irq_save();
+
+    mem_cgroup_uncharge(addr, count);
+    mark_free(first, MIN(first + count, max_page));
+    if (first < max_page && first < page_node(first)->search_hint)
+        page_node(first)->search_hint = first;
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL(page_free);
+
+uint32_t pfn_to_nid(uint32_t pfn) {
+    return pfn < PMM_MAX_PAGES ? section_node[pfn >> PMM_SECTION_SHIFT] : 0;
+}
+
+void pmm_node_stats(uint32_t nid, struct pmm_node_stats* stats) {
+    uint32_t flags = local_irq_save();
+    struct pmm_node* node = &pmm_nodes[MIN(nid, MAX_NUMNODES - 1)];
+
+    stats->present_pages = node->present_pages;
+    stats->free_pages = node->free_pages;
+    stats->local_allocs = node->local_allocs;
+    stats->remote_allocs = node->remote_allocs;
+    local_irq_restore(flags);
+}
+
+uint32_t pmm_free_pages(void) {
+    return free_pages;
+}
+
+uint32_t pmm_total_pages(void) {
+    return total_pages;
+}
+
+uint32_t pmm_max_pfn(void) {
+    return max_page;
+}
+
+/* True for allocated frames of RAM (not holes or firmware areas) */
+bool pmm_page_in_use(uint32_t pfn) {
+    if (pfn >= max_page || !page_used(pfn))
+        return false;
+
+    for (uint32_t i = 0; i < ram_region_count; i++) {
+        if (pfn >= ram_regions[i].first && pfn < ram_regions[i].last)
+            return true;
+    }
+    return false;
+}
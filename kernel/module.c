@@ -0,0 +1,482 @@
+/*
+ * Loadable kernel modules for nekkoOS
+ * A module is a NEF_SYS or NEF_DRIVER image (nef.h): the allocated
+ * sections of one driver object, laid out from address 0 by nef_ld.py,
+ * with the symbols its relocations need. Loading copies or decompresses
+ * the sections into fresh pages, resolves undefined symbols against the
+ * symbols the kernel exports (export.h), which are hashed by name at
+ * boot, applies the relocations and calls the entry point. There is no
+ * paging, so section permissions are not enforced.
+ *
+ * A NEF_DRIVER whose entry point finds no hardware (-ENODEV) is dropped
+ * again straight away: drivers for devices a machine may not have can
+ * be passed along without costing it memory or boot time.
+ *
+ * NEF boot modules (e.g. qemu -initrd build/modules/keyboard.nef) are
+ * loaded at device level, named after their file; sys_init_module loads
+ * one from user memory.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "list.h"
+#include "irqflags.h"
+#include "hashtable.h"
+#include "pmm.h"
+#include "kmalloc.h"
+#include "crc32.h"
+#include "lz4.h"
+#include "nef.h"
+#include "module.h"
+#include "multiboot.h"
+#include "syscall.h"
+#include "uaccess.h"
+#include "timer.h"
+#include "init.h"
+#include "bench.h"
+#include "errno.h"
+#include "kernel.h"
+
+/* Symbol table (kernel.ld) */
+extern const struct kernel_symbol __ksymtab_start[];
+extern const struct kernel_symbol __ksymtab_end[];
+
+struct ksym_node {
+    struct hash_node node;
+    const struct kernel_symbol* sym;
+};
+
+static struct hash_table ksym_table;
+static struct ksym_node* ksym_nodes;
+
+static LIST_HEAD(modules);
+
+/* Boot modules, for bench=module */
+static uint32_t boot_module_count;
+static uint64_t boot_module_cycles;
+
+/* Image being loaded, checked by check_image() */
+struct load_info {
+    const uint8_t* image;
+    const struct nef_header* hdr;
+    const struct nef_section* sections;
+    const struct nef_symbol* symbols;
+    const struct nef_reloc* relocs;
+    const char* strings;
+    uint32_t strings_size;
+    uint32_t reloc_count;
+    uint32_t data_end;          /* Offset of the trailing checksum */
+    uint8_t* base;
+    uint32_t* values;           /* Resolved symbol addresses */
+};
+
+static bool ksym_match(const struct hash_node* node, const void* key) {
+    return strcmp(hash_entry(node, struct ksym_node, node)->sym->name, key) == 0;
+}
+
+const void* kernel_symbol_lookup(const char* name) {
+    struct hash_node* node = hash_lookup(&ksym_table, hash_string(name), ksym_match, name);
+
+    return node ? hash_entry(node, struct ksym_node, node)->sym->addr : NULL;
+}
+
+/* Sized for the whole table up front, so lookups never rehash */
+int __init init_modules(void) {
+    uint32_t count = __ksymtab_end - __ksymtab_start;
+
+    if (hash_table_init(&ksym_table, count) < 0)
+        return -ENOMEM;
+    ksym_nodes = kmalloc(count * sizeof(*ksym_nodes));
+    if (!ksym_nodes)
+        return -ENOMEM;
+
+    for (uint32_t i = 0; i < count; i++) {
+        ksym_nodes[i].sym = &__ksymtab_start[i];
+        hash_insert(&ksym_table, &ksym_nodes[i].node, hash_string(__ksymtab_start[i].name));
+    }
+    return 0;
+}
+initcall_depends(init_modules, 0, "init_memory");
+
+static inline bool range_ok(uint32_t offset, uint32_t size, uint32_t limit) {
+    return offset <= limit && size <= limit - offset;
+}
+
+static const char* nef_string(const struct load_info* info, uint32_t offset) {
+    return offset < info->strings_size ? info->strings + offset : "";
+}
+
+/* Tables within the file, checksum, entry point within the image */
+static int check_image(struct load_info* info, size_t length) {
+    const struct nef_header* hdr = info->hdr;
+    uint32_t strings_end;
+    uint32_t stored;
+
+    if (length < sizeof(*hdr) + sizeof(stored) || length > MODULE_MAX_IMAGE)
+        return -ENOEXEC;
+    if (!nef_header_ok(hdr, NEF_SYS) && !nef_header_ok(hdr, NEF_DRIVER))
+        return -ENOEXEC;
+    if (hdr->file_size != length || hdr->memory_size == 0 || hdr->memory_size > MODULE_MAX_IMAGE)
+        return -ENOEXEC;
+
+    info->data_end = length - sizeof(stored);
+    memcpy(&stored, info->image + info->data_end, sizeof(stored));
+    if (stored != hdr->checksum ||
+        crc32(0, info->image + sizeof(*hdr), info->data_end - sizeof(*hdr)) != stored)
+        return -ENOEXEC;
+
+    if (!range_ok(sizeof(*hdr), hdr->section_count * sizeof(struct nef_section), info->data_end) ||
+        !range_ok(hdr->symbol_offset, hdr->symbol_count * sizeof(struct nef_symbol), info->data_end))
+        return -ENOEXEC;
+
+    info->reloc_count = 0;
+    strings_end = info->data_end;
+    if (hdr->reloc_offset) {
+        if (hdr->reloc_offset > info->data_end ||
+            (info->data_end - hdr->reloc_offset) % sizeof(struct nef_reloc))
+            return -ENOEXEC;
+        info->reloc_count = (info->data_end - hdr->reloc_offset) / sizeof(struct nef_reloc);
+        strings_end = hdr->reloc_offset;
+    }
+    if (hdr->string_offset > strings_end)
+        return -ENOEXEC;
+
+    info->sections = (const struct nef_section*)(info->image + sizeof(*hdr));
+    info->symbols = (const struct nef_symbol*)(info->image + hdr->symbol_offset);
+    info->relocs = (const struct nef_reloc*)(info->image + hdr->reloc_offset);
+    info->strings = (const char*)info->image + hdr->string_offset;
+    info->strings_size = strings_end - hdr->string_offset;
+
+    /* Names are used as C strings */
+    if (info->strings_size && info->strings[info->strings_size - 1] != '\0')
+        return -ENOEXEC;
+
+    if (hdr->entry_point < hdr->load_address ||
+        hdr->entry_point - hdr->load_address >= hdr->memory_size)
+        return -ENOEXEC;
+    return 0;
+}
+
+/* Sections to their addresses in the image; .bss stays zero */
+static int load_sections(struct load_info* info) {
+    const struct nef_header* hdr = info->hdr;
+
+    for (uint32_t i = 0; i < hdr->section_count; i++) {
+        const struct nef_section* sect = &info->sections[i];
+        uint32_t addr = sect->virtual_addr - hdr->load_address;
+        const uint8_t* src = info->image + sect->file_offset;
+
+        if (sect->type != NEF_SECT_TEXT && sect->type != NEF_SECT_DATA &&
+            sect->type != NEF_SECT_RODATA && sect->type != NEF_SECT_BSS)
+            continue;
+        if (sect->virtual_addr < hdr->load_address)
+            return -ENOEXEC;
+
+        if (sect->type == NEF_SECT_BSS) {
+            if (!range_ok(addr, sect->size, hdr->memory_size))
+                return -ENOEXEC;
+            continue;
+        }
+        if (!range_ok(sect->file_offset, sect->size, info->data_end))
+            return -ENOEXEC;
+
+        if (sect->flags & NEF_SF_COMPRESSED) {
+            uint32_t size;
+
+            if (sect->size < sizeof(size))
+                return -ENOEXEC;
+            memcpy(&size, src, sizeof(size));
+            if (!range_ok(addr, size, hdr->memory_size) ||
+                lz4_decompress(src + sizeof(size), sect->size - sizeof(size), info->base + addr, size) != (ssize_t)size)
+                return -ENOEXEC;
+        } else {
+            if (!range_ok(addr, sect->size, hdr->memory_size))
+                return -ENOEXEC;
+            memcpy(info->base + addr, src, sect->size);
+        }
+    }
+    return 0;
+}
+
+/* Addresses for every symbol, undefined ones from the kernel's exports */
+static int resolve_symbols(struct load_info* info, const char* name) {
+    const struct nef_header* hdr = info->hdr;
+
+    for (uint32_t i = 0; i < hdr->symbol_count; i++) {
+        const struct nef_symbol* sym = &info->symbols[i];
+
+        if (sym->section == NEF_SECTION_UNDEF) {
+            const void* addr = kernel_symbol_lookup(nef_string(info, sym->name_offset));
+
+            if (!addr && sym->binding != NEF_BIND_WEAK) {
+                kprintf("module: ");
+                kprintf(name);
+                kprintf(": unknown symbol ");
+                kprintf(nef_string(info, sym->name_offset));
+                kprintf("\n");
+                return -ENOENT;
+            }
+            info->values[i] = (uint32_t)addr;
+        } else if (sym->section == NEF_SECTION_ABS) {
+            info->values[i] = sym->value;
+        } else {
+            if (sym->section >= hdr->section_count || sym->value < hdr->load_address ||
+                sym->value - hdr->load_address > hdr->memory_size)
+                return -ENOEXEC;
+            info->values[i] = (uint32_t)info->base + sym->value - hdr->load_address;
+        }
+    }
+    return 0;
+}
+
+/* REL relocations: the addend is already in place */
+static int apply_relocations(struct load_info* info) {
+    const struct nef_header* hdr = info->hdr;
+
+    for (uint32_t i = 0; i < info->reloc_count; i++) {
+        const struct nef_reloc* rel = &info->relocs[i];
+        uint32_t offset = rel->offset - hdr->load_address;
+
+        if (rel->symbol >= hdr->symbol_count || rel->offset < hdr->load_address ||
+            !range_ok(offset, sizeof(uint32_t), hdr->memory_size))
+            return -ENOEXEC;
+
+        uint32_t* place = (uint32_t*)(info->base + offset);
+        uint32_t value = info->values[rel->symbol];
+
+        switch (rel->type) {
+        case NEF_R_386_32:
+            *place += value;
+            break;
+        case NEF_R_386_PC32:
+        case NEF_R_386_PLT32:
+            /* Calls go straight to the kernel, there is no PLT */
+            *place += value - (uint32_t)place;
+            break;
+        default:
+            /* GOT32 needs a GOT; modules are built without -fpic */
+            return -ENOEXEC;
+        }
+    }
+    return 0;
+}
+
+/* Defined global symbol by name, 0 if there is none */
+static uint32_t find_symbol(const struct load_info* info, const char* name) {
+    for (uint32_t i = 0; i < info->hdr->symbol_count; i++) {
+        const struct nef_symbol* sym = &info->symbols[i];
+
+        if (sym->binding == NEF_BIND_GLOBAL && sym->section < info->hdr->section_count &&
+            strcmp(nef_string(info, sym->name_offset), name) == 0)
+            return info->values[i];
+    }
+    return 0;
+}
+
+struct module* module_find(const char* name) {
+    struct list_head* pos;
+
+    list_for_each(pos, &modules) {
+        struct module* mod = list_entry(pos, struct module, list);
+
+        if (strcmp(mod->name, name) == 0)
+            return mod;
+    }
+    return NULL;
+}
+
+/*
+ * Load and start a module from an image in kernel memory. An entry point
+ * returning -EAGAIN is polled like an initcall. A driver returning
+ * -ENODEV found no hardware and is freed again; so is any module whose
+ * entry point fails.
+ */
+int module_load(const void* image, size_t length, const char* name, struct module** result) {
+    struct load_info info = { .image = image, .hdr = image };
+    struct module* mod;
+    int ret;
+
+    if (module_find(name))
+        return -EEXIST;
+
+    ret = check_image(&info, length);
+    if (ret < 0)
+        return ret;
+
+    mod = kzalloc(sizeof(*mod));
+    info.values = kmalloc(MAX(info.hdr->symbol_count, 1) * sizeof(uint32_t));
+    if (!mod || !info.values) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+
+    strncpy(mod->name, name, MODULE_NAME_LEN - 1);
+    mod->type = info.hdr->type;
+    mod->pages = ALIGN_UP(info.hdr->memory_size, PAGE_SIZE) / PAGE_SIZE;
+    mod->base = info.base = page_alloc(mod->pages);
+    if (!mod->base) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+    memset(mod->base, 0, mod->pages * PAGE_SIZE);
+
+    ret = load_sections(&info);
+    if (ret == 0)
+        ret = resolve_symbols(&info, name);
+    if (ret == 0)
+        ret = apply_relocations(&info);
+    if (ret < 0)
+        goto fail;
+
+    initcall_t init = (initcall_t)(info.base + info.hdr->entry_point - info.hdr->load_address);
+    mod->exit = (void (*)(void))find_symbol(&info, "__module_exit");
+    kfree(info.values);
+    info.values = NULL;
+
+    while ((ret = init()) == -EAGAIN)
+        __asm__ volatile ("pause");
+    if (ret < 0)
+        goto fail;
+
+    uint32_t flags = local_irq_save();
+    list_add_tail(&mod->list, &modules);
+    local_irq_restore(flags);
+
+    if (result)
+        *result = mod;
+    return 0;
+
+fail:
+    if (mod && mod->base)
+        page_free(mod->base, mod->pages);
+    kfree(info.values);
+    kfree(mod);
+    return ret;
+}
+
+int module_unload(struct module* mod) {
+    if (!mod->exit)
+        return -EBUSY;
+
+    mod->exit();
+
+    uint32_t flags = local_irq_save();
+    list_del(&mod->list);
+    local_irq_restore(flags);
+
+    page_free(mod->base, mod->pages);
+    kfree(mod);
+    return 0;
+}
+
+/* The image is copied in whole: its checksum covers all of it */
+int32_t sys_init_module(const void* image, size_t length, const char* name) {
+    char kname[MODULE_NAME_LEN];
+    void* kimage;
+    int ret;
+
+    if (length == 0 || length > MODULE_MAX_IMAGE)
+        return -EINVAL;
+    if (!access_ok(image, length))
+        return -EFAULT;
+
+    ssize_t name_length = strncpy_from_user(kname, name, sizeof(kname));
+    if (name_length < 0)
+        return name_length;
+    if (name_length == 0 || name_length == sizeof(kname))
+        return -EINVAL;
+
+    kimage = kmalloc(length);
+    if (!kimage)
+        return -ENOMEM;
+    if (copy_from_user(kimage, image, length))
+        ret = -EFAULT;
+    else
+        ret = module_load(kimage, length, kname, NULL);
+    kfree(kimage);
+    return ret;
+}
+
+int32_t sys_delete_module(const char* name) {
+    char kname[MODULE_NAME_LEN];
+    struct module* mod;
+
+    ssize_t name_length = strncpy_from_user(kname, name, sizeof(kname));
+    if (name_length < 0)
+        return name_length;
+    if (name_length == sizeof(kname))
+        return -EINVAL;
+
+    mod = module_find(kname);
+    return mod ? module_unload(mod) : -ENOENT;
+}
+
+/* "/boot/keyboard.nef" -> "keyboard" */
+static void __init module_name_from_path(char* name, const char* path) {
+    const char* base = strrchr(path, '/');
+    char* dot;
+
+    strncpy(name, base ? base + 1 : path, MODULE_NAME_LEN - 1);
+    name[MODULE_NAME_LEN - 1] = '\0';
+    dot = strrchr(name, '.');
+    if (dot && dot != name)
+        *dot = '\0';
+}
+
+/* Boot modules that are not NEF images (e.g. a kernel for bench=kexec) are left alone */
+static int __init load_boot_modules(void) {
+    const struct multiboot_info* info = kernel_boot_info();
+    const struct multiboot_mod_list* mods = (const struct multiboot_mod_list*)info->mods_addr;
+    char name[MODULE_NAME_LEN];
+
+    if (!(info->flags & MULTIBOOT_INFO_MODS))
+        return 0;
+
+    for (uint32_t i = 0; i < info->mods_count; i++) {
+        const struct nef_header* hdr = (const struct nef_header*)mods[i].mod_start;
+        uint32_t length = mods[i].mod_end - mods[i].mod_start;
+
+        if (length < sizeof(*hdr) || hdr->magic != NEF_MAGIC)
+            continue;
+
+        module_name_from_path(name, mods[i].cmdline ? (const char*)mods[i].cmdline : "module");
+        uint64_t start = rdtsc();
+        int ret = module_load(hdr, length, name, NULL);
+        boot_module_cycles += rdtsc() - start;
+
+        if (ret == 0) {
+            boot_module_count++;
+        } else if (ret != -ENODEV) {
+            kprintf("module: ");
+            kprintf(name);
+            kprintf(": load failed, error ");
+            kprintf_dec(-ret);
+            kprintf("\n");
+        }
+    }
+    return 0;
+}
+device_initcall(load_boot_modules);
+
+/*
+ * Footprint and boot time. Compare a kernel built with everything in
+ * against one built with MODULES=... and booted with those modules.
+ */
+static void module_benchmark(void) {
+    uint32_t khz = timer_tsc_khz();
+    uint32_t pages = 0;
+    struct list_head* pos;
+
+    list_for_each(pos, &modules)
+        pages += list_entry(pos, struct module, list)->pages;
+
+    bench_report("module", "kernel_image", (uint32_t)(_kernel_end - _kernel_start) / 1024, "KB");
+    bench_report("module", "boot_modules", boot_module_count, "modules");
+    bench_report("module", "module_memory", pages * (PAGE_SIZE / 1024), "KB");
+    bench_report("module", "memory_in_use", (pmm_total_pages() - pmm_free_pages()) * (PAGE_SIZE / 1024), "KB");
+    if (!khz)
+        return;
+    bench_report("module", "boot_module_load", (uint32_t)div_u64(boot_module_cycles * 1000, khz), "us");
+    bench_report("module", "reset_to_ready", (uint32_t)div_u64(initcall_ready_cycles(), khz), "ms");
+}
+KERNEL_BENCH("module", module_benchmark);
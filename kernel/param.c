@@ -0,0 +1,219 @@
+/*
+ * Kernel command line parser for nekkoOS
+ * Subsystems declare typed parameters with param_*() and the parser
+ * stores "key=value" pairs from the multiboot command line into them
+ * in a single pass, before any subsystem is initialized.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "multiboot.h"
+#include "param.h"
+#include "init.h"
+#include "errno.h"
+#include "vga.h"
+#include "kernel.h"
+
+/* Parameter table bounds (kernel.ld) */
+extern const struct kernel_param __param_start[];
+extern const struct kernel_param __param_end[];
+
+static const char* kernel_cmdline = "";
+
+static const struct kernel_param* param_find(const char* key, size_t length) {
+    for (const struct kernel_param* param = __param_start; param < __param_end; param++) {
+        if (strncmp(param->name, key, length) == 0 && param->name[length] == '\0')
+            return param;
+    }
+    return NULL;
+}
+
+/* Parse an unsigned number: decimal or 0x hex, optional K/M/G suffix */
+static int parse_uint(const char* str, size_t length, uint32_t* result) {
+    uint32_t base = 10;
+    uint32_t value = 0;
+    size_t i = 0;
+
+    if (length > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        base = 16;
+        i = 2;
+    }
+    size_t first_digit = i;
+
+    for (; i < length; i++) {
+        char c = str[i];
+        uint32_t digit;
+
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (base == 16 && c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (base == 16 && c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            break;
+
+        if (value > (0xFFFFFFFFU - digit) / base)
+            return -ERANGE;
+        value = value * base + digit;
+    }
+
+    /* At least one digit, also in front of a suffix ("k" and "0xk" are not numbers) */
+    if (i == first_digit)
+        return -EINVAL;
+
+    if (i < length) {
+        uint32_t shift;
+        switch (str[i]) {
+        case 'k': case 'K': shift = 10; break;
+        case 'm': case 'M': shift = 20; break;
+        case 'g': case 'G': shift = 30; break;
+        default: return -EINVAL;
+        }
+        if (i + 1 != length)
+            return -EINVAL;
+        if (value > (0xFFFFFFFFU >> shift))
+            return -ERANGE;
+        value <<= shift;
+    }
+
+    *result = value;
+    return 0;
+}
+
+static int parse_bool(const char* str, size_t length, bool* result) {
+    static const char* const yes[] = { "1", "y", "yes", "on", "true" };
+    static const char* const no[] = { "0", "n", "no", "off", "false" };
+
+    for (size_t i = 0; i < ARRAY_SIZE(yes); i++) {
+        if (strncmp(str, yes[i], length) == 0 && yes[i][length] == '\0') {
+            *result = true;
+            return 0;
+        }
+        if (strncmp(str, no[i], length) == 0 && no[i][length] == '\0') {
+            *result = false;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+static int param_store(const struct kernel_param* param, const char* value, size_t length, bool has_value) {
+    switch (param->type) {
+    case PARAM_BOOL:
+        /* A bare "key" enables a flag */
+        if (!has_value) {
+            *(bool*)param->value = true;
+            return 0;
+        }
+        return parse_bool(value, length, (bool*)param->value);
+
+    case PARAM_UINT:
+        return parse_uint(value, length, (uint32_t*)param->value);
+
+    case PARAM_INT: {
+        bool negative = length > 0 && value[0] == '-';
+        uint32_t magnitude;
+        int ret = parse_uint(value + negative, length - negative, &magnitude);
+        if (ret < 0)
+            return ret;
+        if (magnitude > (negative ? 0x80000000U : 0x7FFFFFFFU))
+            return -ERANGE;
+        *(int32_t*)param->value = negative ? (int32_t)(0U - magnitude) : (int32_t)magnitude;
+        return 0;
+    }
+
+    case PARAM_STRING: {
+        char* dest = (char*)param->value;
+        if (param->size == 0)
+            return -EINVAL;
+        if (length >= param->size)
+            return -ERANGE;
+        memcpy(dest, value, length);
+        dest[length] = '\0';
+        return 0;
+    }
+    }
+    return -EINVAL;
+}
+
+static void param_warn(const char* message, const char* key, size_t length) {
+    kprintf(message);
+    terminal_write(key, length);
+    kprintf("\n");
+}
+
+/* Apply every key[=value] token of a command line */
+void params_parse(const char* cmdline) {
+    const char* p = cmdline;
+
+    while (*p) {
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (!*p)
+            break;
+
+        const char* key = p;
+        while (*p && *p != '=' && *p != ' ' && *p != '\t')
+            p++;
+        size_t key_length = p - key;
+
+        const char* value = p;
+        size_t value_length = 0;
+        bool has_value = false;
+
+        if (*p == '=') {
+            has_value = true;
+            value = ++p;
+            if (*p == '"') {
+                value = ++p;
+                while (*p && *p != '"')
+                    p++;
+                value_length = p - value;
+                if (*p == '"')
+                    p++;
+            } else {
+                while (*p && *p != ' ' && *p != '\t')
+                    p++;
+                value_length = p - value;
+            }
+        }
+
+        const struct kernel_param* param = param_find(key, key_length);
+        if (!param) {
+            param_warn("Unknown parameter: ", key, key_length);
+            continue;
+        }
+        if ((!has_value && param->type != PARAM_BOOL) ||
+            param_store(param, value, value_length, has_value) < 0)
+            param_warn("Invalid value for parameter: ", key, key_length);
+    }
+}
+
+/* Command line initialization (runs before all other subsystems) */
+void __init init_params(struct multiboot_info* mboot_info) {
+    if (!(mboot_info->flags & MULTIBOOT_INFO_CMDLINE) || !mboot_info->cmdline)
+        return;
+
+    kernel_cmdline = (const char*)mboot_info->cmdline;
+    kprintf("Command line: ");
+    kprintf(kernel_cmdline);
+    kprintf("\n");
+
+    /* Boot loaders usually put the kernel image path first */
+    const char* args = kernel_cmdline;
+    if (*args == '/') {
+        while (*args && *args != ' ')
+            args++;
+    }
+    params_parse(args);
+}
+
+const char* params_cmdline(void) {
+    return kernel_cmdline;
+}
+
+/* The command line was copied elsewhere (kernel_copy_boot_info) */
+void params_set_cmdline(const char* cmdline) {
+    kernel_cmdline = cmdline;
+}
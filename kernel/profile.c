@@ -0,0 +1,139 @@
+/*
+ * Sampling profiler for nekkoOS
+ * profile=1 counts the interrupted EIP of every timer tick in a histogram
+ * over the kernel text. profile_report() prints the sampled buckets as
+ * "profile: <address> <hits>" lines, which kernel_layout.py turns into
+ * the ordered section list of the profile-guided text layout (kernel.ld).
+ * It also reports how many cache lines and pages the sampled code spans:
+ * without performance counters these footprints stand in for I-cache and
+ * iTLB misses when comparing layouts.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "profile.h"
+#include "pmm.h"
+#include "kmalloc.h"
+#include "param.h"
+#include "bench.h"
+#include "init.h"
+#include "errno.h"
+#include "kernel.h"
+
+/* Kernel text bounds (kernel.ld); init code is outside */
+extern char _text_start[];
+extern char _text_end[];
+
+static bool profile_enabled = false;
+param_bool("profile", profile_enabled);
+
+static uint32_t* profile_buffer;
+static uint32_t profile_pages;          /* Allocation size of the histogram */
+static uint32_t profile_buckets;
+static uint32_t profile_samples;
+static uint32_t profile_outside;        /* Ticks that hit init code or the trampolines */
+
+/* Called from the timer interrupt with the interrupted instruction pointer */
+void profile_tick(uint32_t eip) {
+    if (!profile_buffer)
+        return;
+
+    uint32_t bucket = (eip - (uint32_t)_text_start) >> PROFILE_SHIFT;
+    profile_samples++;
+    if (bucket < profile_buckets)
+        profile_buffer[bucket]++;
+    else
+        profile_outside++;
+}
+
+static int __init init_profile(void) {
+    if (!profile_enabled)
+        return 0;
+
+    profile_buckets = (uint32_t)(_text_end - _text_start + PROFILE_BUCKET_SIZE - 1) >> PROFILE_SHIFT;
+    profile_pages = ALIGN_UP(profile_buckets * sizeof(uint32_t), PAGE_SIZE) / PAGE_SIZE;
+    uint32_t* buffer = page_alloc(profile_pages);
+    if (!buffer)
+        return -ENOMEM;
+
+    memset(buffer, 0, profile_pages * PAGE_SIZE);
+    profile_buffer = buffer;
+    return 0;
+}
+initcall_depends(init_profile, 0, "init_memory");
+
+/*
+ * Number of text pages that together hold percent of the in-text samples,
+ * taking the busiest first. Consumes page_hits.
+ */
+static uint32_t hot_pages(uint32_t* page_hits, uint32_t pages, uint32_t percent) {
+    uint64_t target = (uint64_t)(profile_samples - profile_outside) * percent;
+    uint64_t covered = 0;
+    uint32_t used = 0;
+
+    while (covered * 100 < target && used < pages) {
+        uint32_t best = 0;
+        for (uint32_t i = 1; i < pages; i++) {
+            if (page_hits[i] > page_hits[best])
+                best = i;
+        }
+        covered += page_hits[best];
+        page_hits[best] = 0;
+        used++;
+    }
+    return used;
+}
+
+void profile_report(void) {
+    if (!profile_buffer)
+        return;
+
+    uint32_t text_pages = ALIGN_UP((uint32_t)(_text_end - _text_start), PAGE_SIZE) / PAGE_SIZE;
+    uint32_t* page_hits = kmalloc(text_pages * sizeof(uint32_t));
+    uint32_t lines = 0;
+    uint32_t pages = 0;
+    uint32_t last_line = ~0U;
+    uint32_t last_page = ~0U;
+
+    /* Stop sampling so that the dump is consistent */
+    uint32_t* buffer = profile_buffer;
+    profile_buffer = NULL;
+    if (page_hits)
+        memset(page_hits, 0, text_pages * sizeof(uint32_t));
+
+    kprintf("profile: begin\n");
+    for (uint32_t i = 0; i < profile_buckets; i++) {
+        if (!buffer[i])
+            continue;
+
+        uint32_t offset = i << PROFILE_SHIFT;
+        kprintf("profile: ");
+        kprintf_hex((uint32_t)_text_start + offset);
+        kprintf(" ");
+        kprintf_dec(buffer[i]);
+        kprintf("\n");
+
+        /* Footprints relative to the page aligned start of .text */
+        if (offset >> CACHE_LINE_SHIFT != last_line) {
+            last_line = offset >> CACHE_LINE_SHIFT;
+            lines++;
+        }
+        if (offset >> PAGE_SHIFT != last_page) {
+            last_page = offset >> PAGE_SHIFT;
+            pages++;
+        }
+        if (page_hits)
+            page_hits[offset >> PAGE_SHIFT] += buffer[i];
+    }
+    kprintf("profile: end\n");
+
+    bench_report("profile", "samples", profile_samples, "ticks");
+    bench_report("profile", "outside_text", profile_outside, "ticks");
+    bench_report("profile", "text_lines_touched", lines, "lines");
+    bench_report("profile", "text_pages_touched", pages, "pages");
+    if (page_hits) {
+        bench_report("profile", "hot_pages_90", hot_pages(page_hits, text_pages, PROFILE_HOT_PERCENT), "pages");
+        kfree(page_hits);
+    }
+    page_free(buffer, profile_pages);
+}
@@ -0,0 +1,263 @@
+/*
+ * Radix tree for nekkoOS
+ * Nodes come from a dedicated slab cache. Leaves (shift 0) hold the
+ * items themselves; inner nodes hold child nodes. A node is freed as
+ * soon as its last slot empties, so lookups never meet empty subtrees.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "kmalloc.h"
+#include "radix_tree.h"
+#include "timer.h"
+#include "bench.h"
+#include "errno.h"
+#include "kernel.h"
+
+static struct kmem_cache radix_node_cache;
+
+static inline uint32_t ctz64(uint64_t value) {
+    uint32_t low = (uint32_t)value;
+    return low ? (uint32_t)__builtin_ctz(low) : 32 + (uint32_t)__builtin_ctz((uint32_t)(value >> 32));
+}
+
+/* Largest index a subtree rooted at this shift can hold */
+static inline uint32_t shift_max_index(uint32_t shift) {
+    if (shift + RADIX_TREE_MAP_SHIFT >= 32)
+        return 0xFFFFFFFF;
+    return (1U << (shift + RADIX_TREE_MAP_SHIFT)) - 1;
+}
+
+static struct radix_tree_node* node_alloc(struct radix_tree_node* parent, uint32_t offset, uint32_t shift) {
+    if (!radix_node_cache.size)
+        kmem_cache_init(&radix_node_cache, "radix_tree_node", sizeof(struct radix_tree_node));
+
+    struct radix_tree_node* node = kmem_cache_alloc(&radix_node_cache);
+    if (!node)
+        return NULL;
+
+    memset(node, 0, sizeof(*node));
+    node->parent = parent;
+    node->offset = offset;
+    node->shift = shift;
+    return node;
+}
+
+static void node_set(struct radix_tree_node* node, uint32_t offset, void* item) {
+    node->slots[offset] = item;
+    node->bitmap |= (uint64_t)1 << offset;
+    node->count++;
+}
+
+static void node_clear(struct radix_tree_node* node, uint32_t offset) {
+    node->slots[offset] = NULL;
+    node->bitmap &= ~((uint64_t)1 << offset);
+    node->count--;
+}
+
+/* Free empty nodes from node upwards, then drop needless top levels */
+static void radix_tree_prune(struct radix_tree_root* root, struct radix_tree_node* node) {
+    while (node && node->count == 0) {
+        struct radix_tree_node* parent = node->parent;
+        if (parent)
+            node_clear(parent, node->offset);
+        else
+            root->node = NULL;
+        kmem_cache_free(&radix_node_cache, node);
+        node = parent;
+    }
+
+    while (root->node && root->node->shift > 0 && root->node->bitmap == 1) {
+        struct radix_tree_node* top = root->node;
+        root->node = top->slots[0];
+        root->node->parent = NULL;
+        root->node->offset = 0;
+        kmem_cache_free(&radix_node_cache, top);
+    }
+}
+
+/* Add levels on top until the root covers index */
+static int radix_tree_extend(struct radix_tree_root* root, uint32_t index) {
+    if (!root->node) {
+        uint32_t shift = 0;
+        while (index > shift_max_index(shift))
+            shift += RADIX_TREE_MAP_SHIFT;
+        root->node = node_alloc(NULL, 0, shift);
+        return root->node ? 0 : -ENOMEM;
+    }
+
+    while (index > shift_max_index(root->node->shift)) {
+        struct radix_tree_node* top = node_alloc(NULL, 0, root->node->shift + RADIX_TREE_MAP_SHIFT);
+        if (!top)
+            return -ENOMEM;
+        root->node->parent = top;
+        root->node->offset = 0;
+        node_set(top, 0, root->node);
+        root->node = top;
+    }
+    return 0;
+}
+
+int radix_tree_insert(struct radix_tree_root* root, uint32_t index, void* item) {
+    if (!item)
+        return -EINVAL;
+
+    int ret = radix_tree_extend(root, index);
+    if (ret < 0) {
+        radix_tree_prune(root, NULL);
+        return ret;
+    }
+
+    struct radix_tree_node* node = root->node;
+    while (node->shift > 0) {
+        uint32_t offset = (index >> node->shift) & RADIX_TREE_MAP_MASK;
+        struct radix_tree_node* child = node->slots[offset];
+
+        if (!child) {
+            child = node_alloc(node, offset, node->shift - RADIX_TREE_MAP_SHIFT);
+            if (!child) {
+                radix_tree_prune(root, node);
+                return -ENOMEM;
+            }
+            node_set(node, offset, child);
+        }
+        node = child;
+    }
+
+    uint32_t offset = index & RADIX_TREE_MAP_MASK;
+    if (node->slots[offset])
+        return -EEXIST;
+    node_set(node, offset, item);
+    root->count++;
+    return 0;
+}
+
+static struct radix_tree_node* radix_tree_leaf(const struct radix_tree_root* root, uint32_t index) {
+    struct radix_tree_node* node = root->node;
+
+    if (!node || index > shift_max_index(node->shift))
+        return NULL;
+    while (node && node->shift > 0)
+        node = node->slots[(index >> node->shift) & RADIX_TREE_MAP_MASK];
+    return node;
+}
+
+void* radix_tree_lookup(const struct radix_tree_root* root, uint32_t index) {
+    struct radix_tree_node* leaf = radix_tree_leaf(root, index);
+    return leaf ? leaf->slots[index & RADIX_TREE_MAP_MASK] : NULL;
+}
+
+void* radix_tree_delete(struct radix_tree_root* root, uint32_t index) {
+    struct radix_tree_node* leaf = radix_tree_leaf(root, index);
+    uint32_t offset = index & RADIX_TREE_MAP_MASK;
+
+    if (!leaf || !leaf->slots[offset])
+        return NULL;
+
+    void* item = leaf->slots[offset];
+    node_clear(leaf, offset);
+    root->count--;
+    radix_tree_prune(root, leaf);
+    return item;
+}
+
+/* First item at or after index inside this subtree */
+static void* node_find_next(const struct radix_tree_node* node, uint32_t index, uint32_t* found) {
+    uint32_t offset = (index >> node->shift) & RADIX_TREE_MAP_MASK;
+    uint32_t span = shift_max_index(node->shift);
+    uint32_t prefix = span == 0xFFFFFFFF ? 0 : index & ~span;
+    uint64_t bits = node->bitmap & (~(uint64_t)0 << offset);
+
+    while (bits) {
+        uint32_t slot = ctz64(bits);
+        uint32_t start = slot == offset ? index : prefix | (slot << node->shift);
+
+        if (node->shift == 0) {
+            *found = start;
+            return node->slots[slot];
+        }
+
+        void* item = node_find_next(node->slots[slot], start, found);
+        if (item)
+            return item;
+        bits &= bits - 1;
+    }
+    return NULL;
+}
+
+/* Find the first item with an index >= *index and store its index there */
+void* radix_tree_find_next(const struct radix_tree_root* root, uint32_t* index) {
+    if (!root->node || *index > shift_max_index(root->node->shift))
+        return NULL;
+    return node_find_next(root->node, *index, index);
+}
+
+uint32_t radix_tree_gang_lookup(const struct radix_tree_root* root, void** results,
+                                uint32_t first_index, uint32_t max_items) {
+    uint32_t index = first_index;
+    uint32_t found = 0;
+
+    while (found < max_items) {
+        void* item = radix_tree_find_next(root, &index);
+        if (!item)
+            break;
+        results[found++] = item;
+        if (index == 0xFFFFFFFF)
+            break;
+        index++;
+    }
+    return found;
+}
+
+static void node_destroy(struct radix_tree_node* node) {
+    if (node->shift > 0) {
+        uint64_t bits = node->bitmap;
+        while (bits) {
+            node_destroy(node->slots[ctz64(bits)]);
+            bits &= bits - 1;
+        }
+    }
+    kmem_cache_free(&radix_node_cache, node);
+}
+
+/* Free every node; the items themselves belong to the caller */
+void radix_tree_destroy(struct radix_tree_root* root) {
+    if (root->node)
+        node_destroy(root->node);
+    root->node = NULL;
+    root->count = 0;
+}
+
+/* Sequential (page cache like) inserts and random lookups */
+#define RADIX_BENCH_ITEMS   65536
+
+static void radix_tree_benchmark(void) {
+    struct radix_tree_root root = RADIX_TREE_INIT;
+    uint32_t seed = 12345;
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < RADIX_BENCH_ITEMS; i++) {
+        if (radix_tree_insert(&root, i, (void*)(i + 1)) < 0) {
+            kprintf("radix_tree: insert failed\n");
+            radix_tree_destroy(&root);
+            return;
+        }
+    }
+    uint64_t insert_cycles = rdtsc() - start;
+
+    uint32_t hits = 0;
+    start = rdtsc();
+    for (uint32_t i = 0; i < RADIX_BENCH_ITEMS; i++) {
+        seed = seed * 1103515245 + 12345;
+        hits += radix_tree_lookup(&root, seed % RADIX_BENCH_ITEMS) != NULL;
+    }
+    uint64_t lookup_cycles = rdtsc() - start;
+
+    radix_tree_destroy(&root);
+    if (hits != RADIX_BENCH_ITEMS)
+        kprintf("radix_tree: lookup mismatch\n");
+
+    bench_report("radix_tree", "inserts", bench_rate(RADIX_BENCH_ITEMS, insert_cycles), "ops/s");
+    bench_report("radix_tree", "lookups", bench_rate(RADIX_BENCH_ITEMS, lookup_cycles), "ops/s");
+}
+KERNEL_BENCH("radix_tree", radix_tree_benchmark);
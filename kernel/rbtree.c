@@ -0,0 +1,324 @@
+/*
+ * Red-black tree for nekkoOS
+ * Insertion and deletion rebalancing for the intrusive trees in rbtree.h.
+ * Lookups and the insertion walk are left to the caller, which knows the
+ * key, so no comparison callback is needed.
+ */
+
+#include "types.h"
+#include "rbtree.h"
+#include "timer.h"
+#include "pmm.h"
+#include "bench.h"
+#include "kernel.h"
+
+static inline bool rb_is_black(const struct rb_node* node) {
+    return !node || node->color == RB_BLACK;
+}
+
+static void rb_set_child(struct rb_root* root, struct rb_node* parent, struct rb_node* old, struct rb_node* new) {
+    if (!parent)
+        root->node = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+}
+
+static void rb_rotate_left(struct rb_node* node, struct rb_root* root) {
+    struct rb_node* right = node->right;
+
+    node->right = right->left;
+    if (right->left)
+        right->left->parent = node;
+    right->parent = node->parent;
+    rb_set_child(root, node->parent, node, right);
+    right->left = node;
+    node->parent = right;
+}
+
+static void rb_rotate_right(struct rb_node* node, struct rb_root* root) {
+    struct rb_node* left = node->left;
+
+    node->left = left->right;
+    if (left->right)
+        left->right->parent = node;
+    left->parent = node->parent;
+    rb_set_child(root, node->parent, node, left);
+    left->right = node;
+    node->parent = left;
+}
+
+void rb_insert_color(struct rb_node* node, struct rb_root* root) {
+    struct rb_node* parent;
+
+    while ((parent = node->parent) && parent->color == RB_RED) {
+        struct rb_node* gparent = parent->parent;
+
+        if (parent == gparent->left) {
+            struct rb_node* uncle = gparent->right;
+            if (!rb_is_black(uncle)) {
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->right) {
+                rb_rotate_left(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_right(gparent, root);
+        } else {
+            struct rb_node* uncle = gparent->left;
+            if (!rb_is_black(uncle)) {
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->left) {
+                rb_rotate_right(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_left(gparent, root);
+        }
+    }
+    root->node->color = RB_BLACK;
+}
+
+/* Restore the black height after removing a black node above child */
+static void rb_erase_color(struct rb_node* node, struct rb_node* parent, struct rb_root* root) {
+    while (rb_is_black(node) && node != root->node) {
+        if (parent->left == node) {
+            struct rb_node* sibling = parent->right;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(parent, root);
+                sibling = parent->right;
+            }
+            if (rb_is_black(sibling->left) && rb_is_black(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+            } else {
+                if (rb_is_black(sibling->right)) {
+                    sibling->left->color = RB_BLACK;
+                    sibling->color = RB_RED;
+                    rb_rotate_right(sibling, root);
+                    sibling = parent->right;
+                }
+                sibling->color = parent->color;
+                parent->color = RB_BLACK;
+                sibling->right->color = RB_BLACK;
+                rb_rotate_left(parent, root);
+                node = root->node;
+                break;
+            }
+        } else {
+            struct rb_node* sibling = parent->left;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(parent, root);
+                sibling = parent->left;
+            }
+            if (rb_is_black(sibling->left) && rb_is_black(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+            } else {
+                if (rb_is_black(sibling->left)) {
+                    sibling->right->color = RB_BLACK;
+                    sibling->color = RB_RED;
+                    rb_rotate_left(sibling, root);
+                    sibling = parent->left;
+                }
+                sibling->color = parent->color;
+                parent->color = RB_BLACK;
+                sibling->left->color = RB_BLACK;
+                rb_rotate_right(parent, root);
+                node = root->node;
+                break;
+            }
+        }
+    }
+    if (node)
+        node->color = RB_BLACK;
+}
+
+void rb_erase(struct rb_node* node, struct rb_root* root) {
+    struct rb_node* child;
+    struct rb_node* parent;
+    uint32_t color;
+
+    if (node->left && node->right) {
+        /* Replace the node with its in-order successor */
+        struct rb_node* successor = node->right;
+        while (successor->left)
+            successor = successor->left;
+
+        rb_set_child(root, node->parent, node, successor);
+        child = successor->right;
+        parent = successor->parent;
+        color = successor->color;
+
+        if (parent == node) {
+            parent = successor;
+        } else {
+            if (child)
+                child->parent = parent;
+            parent->left = child;
+            successor->right = node->right;
+            node->right->parent = successor;
+        }
+
+        successor->parent = node->parent;
+        successor->color = node->color;
+        successor->left = node->left;
+        node->left->parent = successor;
+    } else {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        color = node->color;
+
+        if (child)
+            child->parent = parent;
+        rb_set_child(root, parent, node, child);
+    }
+
+    if (color == RB_BLACK)
+        rb_erase_color(child, parent, root);
+}
+
+struct rb_node* rb_first(const struct rb_root* root) {
+    struct rb_node* node = root->node;
+    if (!node)
+        return NULL;
+    while (node->left)
+        node = node->left;
+    return node;
+}
+
+struct rb_node* rb_last(const struct rb_root* root) {
+    struct rb_node* node = root->node;
+    if (!node)
+        return NULL;
+    while (node->right)
+        node = node->right;
+    return node;
+}
+
+struct rb_node* rb_next(const struct rb_node* node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return (struct rb_node*)node;
+    }
+
+    struct rb_node* parent;
+    while ((parent = node->parent) && node == parent->right)
+        node = parent;
+    return parent;
+}
+
+struct rb_node* rb_prev(const struct rb_node* node) {
+    if (node->left) {
+        node = node->left;
+        while (node->right)
+            node = node->right;
+        return (struct rb_node*)node;
+    }
+
+    struct rb_node* parent;
+    while ((parent = node->parent) && node == parent->left)
+        node = parent;
+    return parent;
+}
+
+void rb_insert_color_cached(struct rb_node* node, struct rb_root_cached* root, bool leftmost) {
+    if (leftmost)
+        root->leftmost = node;
+    rb_insert_color(node, &root->root);
+}
+
+void rb_erase_cached(struct rb_node* node, struct rb_root_cached* root) {
+    if (root->leftmost == node)
+        root->leftmost = rb_next(node);
+    rb_erase(node, &root->root);
+}
+
+/* Insert and look up random keys, report operations per second */
+#define RB_BENCH_NODES      16384
+
+struct rb_bench_node {
+    struct rb_node node;
+    uint32_t key;
+};
+
+static struct rb_bench_node* rb_bench_find(struct rb_root* root, uint32_t key) {
+    struct rb_node* node = root->node;
+
+    while (node) {
+        struct rb_bench_node* entry = rb_entry(node, struct rb_bench_node, node);
+        if (key < entry->key)
+            node = node->left;
+        else if (key > entry->key)
+            node = node->right;
+        else
+            return entry;
+    }
+    return NULL;
+}
+
+static void rbtree_benchmark(void) {
+    uint32_t pages = (RB_BENCH_NODES * sizeof(struct rb_bench_node) + PAGE_SIZE - 1) / PAGE_SIZE;
+    struct rb_bench_node* nodes = page_alloc(pages);
+    struct rb_root root = RB_ROOT;
+    uint32_t seed = 12345;
+
+    if (!nodes)
+        return;
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < RB_BENCH_NODES; i++) {
+        struct rb_node** link = &root.node;
+        struct rb_node* parent = NULL;
+
+        seed = seed * 1103515245 + 12345;
+        nodes[i].key = seed;
+        while (*link) {
+            parent = *link;
+            if (seed < rb_entry(parent, struct rb_bench_node, node)->key)
+                link = &parent->left;
+            else
+                link = &parent->right;
+        }
+        rb_link_node(&nodes[i].node, parent, link);
+        rb_insert_color(&nodes[i].node, &root);
+    }
+    uint64_t insert_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < RB_BENCH_NODES; i++)
+        found += rb_bench_find(&root, nodes[i].key) != NULL;
+    uint64_t lookup_cycles = rdtsc() - start;
+
+    page_free(nodes, pages);
+    if (found != RB_BENCH_NODES)
+        kprintf("rbtree: lookup mismatch\n");
+
+    bench_report("rbtree", "inserts", bench_rate(RB_BENCH_NODES, insert_cycles), "ops/s");
+    bench_report("rbtree", "lookups", bench_rate(RB_BENCH_NODES, lookup_cycles), "ops/s");
+}
+KERNEL_BENCH("rbtree", rbtree_benchmark);
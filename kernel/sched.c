@@ -0,0 +1,625 @@
+/*
+ * Thread scheduler for nekkoOS
+ * Kernel threads scheduled by policy: each policy is a scheduling class
+ * (sched_class.h), and the classes are asked for a thread in order: the
+ * deadline class (sched_deadline.c), the fixed priority class
+ * (sched_prio.c), then the fair class (sched_fair.c). The idle thread
+ * runs when no class has a runnable thread. Preemption happens on the way out of an interrupt, or when
+ * preempt_enable() drops the last reference with a reschedule pending.
+ *
+ * New threads take the policy named by sched.policy ("prio" or "fair").
+ * Their priority picks the nice level of fair threads: high, normal and
+ * low are nice -10, 0 and 10. They inherit the CPU affinity, cpuset
+ * (cpuset.c) and control group (cgroup.c) of the thread that creates
+ * them and are queued on a CPU the first two allow. thread_spawn() sets
+ * any of these before the thread is first queued.
+ *
+ * Threads and their stacks come from a static pool.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "list.h"
+#include "errno.h"
+#include "irqflags.h"
+#include "smp.h"
+#include "sched.h"
+#include "sched_class.h"
+#include "cpumask.h"
+#include "cpuset.h"
+#include "cgroup.h"
+#include "workqueue.h"
+#include "numa.h"
+#include "timer.h"
+#include "param.h"
+#include "init.h"
+#include "kernel.h"
+#include "export.h"
+
+struct cpu cpus[NR_CPUS];
+EXPORT_SYMBOL(cpus);
+
+static struct thread threads[THREAD_MAX];
+static uint8_t thread_stacks[THREAD_MAX][THREAD_STACK_SIZE] ALIGN(16);
+
+/* The boot thread runs kernel_main on the boot stack and is never reused */
+static struct thread boot_thread;
+
+static bool sched_running = false;
+
+/* Classes in the order they are asked for a thread */
+static const struct sched_class* const sched_classes[] = {
+    &dl_sched_class,
+    &prio_sched_class,
+    &fair_sched_class,
+};
+
+/* Class of each policy */
+static const struct sched_class* const policy_classes[] = {
+    [SCHED_PRIO] = &prio_sched_class,
+    [SCHED_FAIR] = &fair_sched_class,
+    [SCHED_DEADLINE] = &dl_sched_class,
+};
+
+static const int32_t prio_to_nice[THREAD_PRIO_LEVELS] = { -10, 0, 10 };
+
+static char sched_policy_name[8] = "prio";
+param_string("sched.policy", sched_policy_name);
+static uint32_t default_policy = SCHED_PRIO;
+
+static uint32_t class_rank(const struct sched_class* class) {
+    uint32_t rank = 0;
+
+    while (sched_classes[rank] != class)
+        rank++;
+    return rank;
+}
+
+static struct thread* pick_next_thread(struct cpu* cpu) {
+    for (uint32_t i = 0; i < ARRAY_SIZE(sched_classes); i++) {
+        struct thread* next = sched_classes[i]->pick_next(cpu);
+        if (next)
+            return next;
+    }
+    return cpu->idle;
+}
+
+/* Would a newly runnable thread preempt the current one? */
+static bool should_preempt(struct cpu* cpu, struct thread* thread) {
+    struct thread* curr = cpu->current;
+
+    if (curr == cpu->idle)
+        return true;
+    if (thread->sched_class == curr->sched_class)
+        return curr->sched_class->check_preempt(cpu, curr, thread);
+    return class_rank(thread->sched_class) < class_rank(curr->sched_class);
+}
+
+/* Run queue for a thread: where it last ran if still allowed, else the first allowed CPU */
+static struct cpu* select_task_rq(struct thread* thread) {
+    cpumask_t allowed = thread->cpus_allowed & cpu_online_mask;
+
+    if (!cpumask_test_cpu(thread->cpu, allowed))
+        thread->cpu = cpumask_first(allowed ? allowed : cpu_online_mask);
+    return &cpus[thread->cpu];
+}
+
+void enqueue_thread(struct cpu* cpu, struct thread* thread, uint32_t flags) {
+    thread->sched_class->enqueue(cpu, thread, flags);
+    if (should_preempt(cpu, thread))
+        cpu->need_resched = true;
+}
+
+void schedule(void) {
+    struct cpu* cpu = this_cpu();
+    uint32_t flags = local_irq_save();
+    struct thread* prev = cpu->current;
+
+    /* A worker about to block may hand its pending work to another worker */
+    if (prev->state == THREAD_SLEEPING && (prev->flags & THREAD_WORKER))
+        wq_worker_sleeping(prev);
+
+    cpu->need_resched = false;
+    if (prev != cpu->idle) {
+        prev->sched_class->put_prev(cpu, prev);
+        if (prev->state == THREAD_RUNNABLE) {
+            /* Affinity changed while it ran: requeue it where it may run */
+            struct cpu* target = select_task_rq(prev);
+            if (target == cpu)
+                prev->sched_class->enqueue(cpu, prev, 0);
+            else
+                enqueue_thread(target, prev, 0);
+        }
+    }
+
+    struct thread* next = pick_next_thread(cpu);
+    if (next != prev) {
+        cpu->current = next;
+        switch_context(&prev->esp, next->esp);
+    }
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL(schedule);
+
+/* Called on interrupt exit with interrupts disabled */
+void preempt_schedule_irq(void) {
+    if (sched_running)
+        schedule();
+}
+
+void preempt_enable(void) {
+    struct cpu* cpu = this_cpu();
+
+    preempt_enable_no_resched();
+    if (cpu->preempt_count == 0 && cpu->need_resched && !irqs_disabled())
+        schedule();
+}
+EXPORT_SYMBOL(preempt_enable);
+
+void thread_yield(void) {
+    struct thread* thread = current_thread();
+    uint32_t flags = local_irq_save();
+
+    thread->sched_class->yield(this_cpu(), thread);
+    local_irq_restore(flags);
+    schedule();
+}
+
+void thread_wake(struct thread* thread) {
+    struct cpu* cpu = &cpus[thread->cpu];
+    uint32_t flags = local_irq_save();
+
+    if (thread->state == THREAD_SLEEPING) {
+        thread->state = THREAD_RUNNABLE;
+        if (thread->flags & THREAD_WORKER)
+            wq_worker_waking_up(thread);
+
+        /* A thread that has not switched out yet just keeps running */
+        if (thread != cpu->current)
+            enqueue_thread(select_task_rq(thread), thread, ENQUEUE_WAKEUP);
+    }
+    local_irq_restore(flags);
+}
+
+/* Tick accounting, from the timer interrupt */
+void sched_tick(void) {
+    struct cpu* cpu = this_cpu();
+    struct thread* thread = cpu->current;
+
+    if (!sched_running)
+        return;
+
+    if (thread == cpu->idle) {
+        for (uint32_t i = 0; i < ARRAY_SIZE(sched_classes); i++) {
+            if (sched_classes[i]->has_runnable(cpu))
+                cpu->need_resched = true;
+        }
+    } else {
+        thread->sched_class->tick(cpu, thread);
+    }
+}
+
+/*
+ * Move a thread to another policy, priority or nice level. A queued
+ * thread leaves its run queue and comes back under the new settings;
+ * the running one is rescheduled to let them take effect.
+ */
+static void sched_change(struct thread* thread, uint32_t policy, uint32_t priority, int32_t nice) {
+    struct cpu* cpu = this_cpu();
+    uint32_t flags = local_irq_save();
+    const struct sched_class* prev_class = thread->sched_class;
+    bool running = thread == cpu->current;
+    bool queued = !running && thread->state == THREAD_RUNNABLE;
+
+    if (queued)
+        prev_class->dequeue(cpu, thread);
+    if (running)
+        prev_class->put_prev(cpu, thread);
+
+    thread->policy = policy;
+    thread->priority = priority;
+    thread->nice = nice;
+    thread->sched_class = policy_classes[policy];
+    if (thread->sched_class != prev_class) {
+        prev_class->switched_from(cpu, thread);
+        thread->sched_class->switched_to(cpu, thread);
+    }
+
+    if (running) {
+        thread->sched_class->set_curr(cpu, thread);
+        cpu->need_resched = true;
+    }
+    if (queued)
+        enqueue_thread(cpu, thread, 0);
+    local_irq_restore(flags);
+}
+
+/*
+ * For SCHED_FAIR the priority sets the nice level, as for new threads.
+ * SCHED_DEADLINE needs its parameters, see sched_setdeadline().
+ */
+int sched_setscheduler(struct thread* thread, uint32_t policy, uint32_t priority) {
+    if (policy >= ARRAY_SIZE(policy_classes) || policy == SCHED_DEADLINE || priority >= THREAD_PRIO_LEVELS)
+        return -EINVAL;
+    if (thread == this_cpu()->idle)
+        return -EINVAL;
+
+    sched_change(thread, policy, priority, prio_to_nice[priority]);
+    return 0;
+}
+
+int thread_set_nice(struct thread* thread, int32_t nice) {
+    if (nice < NICE_MIN || nice > NICE_MAX || thread == this_cpu()->idle)
+        return -EINVAL;
+
+    sched_change(thread, thread->policy, thread->priority, nice);
+    return 0;
+}
+
+/*
+ * Make a thread SCHED_DEADLINE: runtime_ns of CPU time in every period
+ * of period_ns, done within deadline_ns of the period start. -EBUSY if
+ * admitting it would overcommit the CPU.
+ */
+int sched_setdeadline(struct thread* thread, uint32_t runtime_ns, uint32_t deadline_ns, uint32_t period_ns) {
+    struct cpu* cpu = this_cpu();
+
+    if (thread == cpu->idle || !runtime_ns || runtime_ns > deadline_ns || deadline_ns > period_ns)
+        return -EINVAL;
+
+    uint32_t flags = local_irq_save();
+    int err = dl_admit(cpu, thread, runtime_ns, deadline_ns, period_ns);
+    if (!err)
+        sched_change(thread, SCHED_DEADLINE, thread->priority, thread->nice);
+    local_irq_restore(flags);
+    return err;
+}
+
+/* Effective CPUs: the affinity mask within the cpuset, all of the cpuset if they do not meet */
+static void update_cpus_allowed(struct thread* thread) {
+    cpumask_t allowed = thread->cpus_mask;
+
+    if (!(thread->flags & THREAD_BOUND)) {
+        allowed &= thread->cpuset->cpus;
+        if (!allowed)
+            allowed = thread->cpuset->cpus;
+    }
+    thread->cpus_allowed = allowed;
+}
+
+/*
+ * Recompute a thread's CPUs after its affinity or cpuset changed. A
+ * queued thread on a CPU it may no longer use moves at once, the running
+ * one at its next reschedule (schedule() requeues it).
+ */
+void sched_cpus_changed(struct thread* thread) {
+    uint32_t flags = local_irq_save();
+    struct cpu* cpu = &cpus[thread->cpu];
+
+    update_cpus_allowed(thread);
+    if (!cpumask_test_cpu(thread->cpu, thread->cpus_allowed & cpu_online_mask)) {
+        if (thread == cpu->current) {
+            cpu->need_resched = true;
+        } else if (thread->state == THREAD_RUNNABLE && thread != cpu->idle) {
+            thread->sched_class->dequeue(cpu, thread);
+            enqueue_thread(select_task_rq(thread), thread, 0);
+        }
+    }
+    local_irq_restore(flags);
+}
+
+/*
+ * Move a thread to another control group. Only the fair class schedules
+ * by group; a fair thread starts level with its new group's queue.
+ */
+void sched_move_group(struct thread* thread, struct cgroup* cg) {
+    struct cpu* cpu = &cpus[thread->cpu];
+    uint32_t flags = local_irq_save();
+    bool running = thread == cpu->current;
+    bool queued = !running && thread->state == THREAD_RUNNABLE && thread != cpu->idle;
+
+    if (queued)
+        thread->sched_class->dequeue(cpu, thread);
+    if (running)
+        thread->sched_class->put_prev(cpu, thread);
+
+    thread->cgroup = cg;
+    if (thread->sched_class == &fair_sched_class)
+        thread->sched_class->switched_to(cpu, thread);
+
+    if (running) {
+        thread->sched_class->set_curr(cpu, thread);
+        cpu->need_resched = true;
+    }
+    if (queued)
+        enqueue_thread(cpu, thread, 0);
+    local_irq_restore(flags);
+}
+
+/* -EINVAL if no CPU of the mask is up or in the thread's cpuset */
+int sched_setaffinity(struct thread* thread, cpumask_t mask) {
+    mask &= CPU_MASK_ALL;
+    if (!(mask & cpu_online_mask) || (thread->flags & THREAD_BOUND))
+        return -EINVAL;
+    if (!(mask & thread->cpuset->cpus))
+        return -EINVAL;
+
+    uint32_t flags = local_irq_save();
+    thread->cpus_mask = mask;
+    sched_cpus_changed(thread);
+    local_irq_restore(flags);
+    return 0;
+}
+
+cpumask_t sched_getaffinity(struct thread* thread) {
+    return thread->cpus_allowed;
+}
+
+/*
+ * Pin a per-CPU kernel thread to its CPU for good: neither affinity
+ * changes, cpusets nor isolation move it.
+ */
+void thread_bind(struct thread* thread, uint32_t cpu) {
+    thread->flags |= THREAD_BOUND;
+    thread->cpus_mask = cpumask_of(cpu);
+    sched_cpus_changed(thread);
+}
+
+static void sleep_timeout(struct timer_list* timer) {
+    thread_wake(CONTAINER_OF(timer, struct thread, sleep_timer));
+}
+
+void thread_sleep(uint32_t ms) {
+    struct thread* thread = current_thread();
+    uint32_t flags = local_irq_save();
+
+    timer_setup(&thread->sleep_timer, sleep_timeout);
+    thread->state = THREAD_SLEEPING;
+    mod_timer(&thread->sleep_timer, jiffies + msecs_to_jiffies(ms));
+    schedule();
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL(thread_sleep);
+
+/* First C code of every new thread (via thread_trampoline) */
+void thread_entry(thread_fn_t fn, void* arg) NORETURN;
+void thread_entry(thread_fn_t fn, void* arg) {
+    local_irq_enable();
+    fn(arg);
+    thread_exit();
+}
+
+static struct thread* thread_alloc(void) {
+    struct thread* self = current_thread();
+
+    for (int i = 0; i < THREAD_MAX; i++) {
+        struct thread* thread = &threads[i];
+        if (thread->state == THREAD_UNUSED || (thread->state == THREAD_DEAD && thread != self)) {
+            thread->stack = thread_stacks[i];
+            return thread;
+        }
+    }
+    return NULL;
+}
+
+static struct thread* thread_setup(const char* name, thread_fn_t fn, void* arg, uint32_t priority) {
+    struct thread* parent = current_thread();
+    struct thread* thread = thread_alloc();
+    if (!thread)
+        return NULL;
+
+    /* Initial frame popped by switch_context: edi, esi, ebx, ebp, return address */
+    uint32_t* sp = (uint32_t*)(thread->stack + THREAD_STACK_SIZE);
+    *--sp = (uint32_t)thread_trampoline;
+    *--sp = 0;
+    *--sp = (uint32_t)fn;
+    *--sp = (uint32_t)arg;
+    *--sp = 0;
+
+    thread->esp = (uint32_t)sp;
+    thread->priority = MIN(priority, THREAD_PRIO_LEVELS - 1);
+    thread->policy = default_policy;
+    thread->nice = prio_to_nice[thread->priority];
+    thread->sched_class = policy_classes[default_policy];
+    thread->flags = 0;
+    thread->timeslice = SCHED_TIMESLICE;
+    thread->name = name;
+    thread->worker = NULL;
+    thread->numa_node = numa_mem_id();
+    thread->cpu = smp_processor_id();
+    thread->cpus_mask = parent->cpus_mask;
+    cpuset_fork(thread, parent->cpuset);
+    cgroup_fork(thread, parent->cgroup);
+    update_cpus_allowed(thread);
+    memset(&thread->se, 0, sizeof(thread->se));
+    memset(&thread->dl, 0, sizeof(thread->dl));
+    list_init(&thread->run_entry);
+    list_init(&thread->wait_entry);
+    timer_setup(&thread->sleep_timer, sleep_timeout);
+    return thread;
+}
+
+struct thread* thread_create(const char* name, thread_fn_t fn, void* arg, uint32_t priority) {
+    uint32_t flags = local_irq_save();
+    struct thread* thread = thread_setup(name, fn, arg, priority);
+
+    if (thread) {
+        thread->state = THREAD_RUNNABLE;
+        enqueue_thread(select_task_rq(thread), thread, ENQUEUE_NEW);
+    }
+    local_irq_restore(flags);
+    return thread;
+}
+EXPORT_SYMBOL(thread_create);
+
+static bool spawn_attr_ok(const struct spawn_attr* attr) {
+    uint32_t flags = attr->flags;
+
+    if (attr->priority >= THREAD_PRIO_LEVELS)
+        return false;
+    if ((flags & SPAWN_SETPOLICY) && (attr->policy >= ARRAY_SIZE(policy_classes) || attr->policy == SCHED_DEADLINE))
+        return false;
+    if ((flags & SPAWN_SETNICE) && (attr->nice < NICE_MIN || attr->nice > NICE_MAX))
+        return false;
+    if ((flags & SPAWN_SETAFFINITY) && !(attr->cpus & cpu_online_mask))
+        return false;
+    if ((flags & SPAWN_BIND) && !cpumask_test_cpu(attr->cpu, cpu_online_mask))
+        return false;
+    if ((flags & SPAWN_SETCPUSET) && !attr->cpuset->in_use)
+        return false;
+    if ((flags & SPAWN_SETCGROUP) && !attr->cgroup->in_use)
+        return false;
+    return true;
+}
+
+/*
+ * Create a thread with the settings in attr, as thread_create() at
+ * attr->priority followed by the matching setters, but without
+ * queueing it first with its creator's settings and then moving it.
+ * NULL if an attribute is out of range or no thread is free.
+ */
+struct thread* thread_spawn(const char* name, thread_fn_t fn, void* arg, const struct spawn_attr* attr) {
+    if (!spawn_attr_ok(attr))
+        return NULL;
+
+    uint32_t flags = local_irq_save();
+    struct thread* thread = thread_setup(name, fn, arg, attr->priority);
+
+    if (thread) {
+        if (attr->flags & SPAWN_SETPOLICY) {
+            thread->policy = attr->policy;
+            thread->sched_class = policy_classes[attr->policy];
+        }
+        if (attr->flags & SPAWN_SETNICE)
+            thread->nice = attr->nice;
+        if (attr->flags & SPAWN_SETAFFINITY)
+            thread->cpus_mask = attr->cpus & CPU_MASK_ALL;
+        if (attr->flags & SPAWN_BIND) {
+            thread->flags |= THREAD_BOUND;
+            thread->cpus_mask = cpumask_of(attr->cpu);
+        }
+        if ((attr->flags & SPAWN_SETCPUSET) && !(thread->flags & THREAD_BOUND)) {
+            cpuset_exit(thread);
+            cpuset_fork(thread, attr->cpuset);
+        }
+        if (attr->flags & SPAWN_SETCGROUP) {
+            cgroup_exit(thread);
+            cgroup_fork(thread, attr->cgroup);
+        }
+        update_cpus_allowed(thread);
+
+        thread->state = THREAD_RUNNABLE;
+        enqueue_thread(select_task_rq(thread), thread, ENQUEUE_NEW);
+    }
+    local_irq_restore(flags);
+    return thread;
+}
+EXPORT_SYMBOL(thread_spawn);
+
+void thread_exit(void) {
+    struct thread* thread = current_thread();
+
+    local_irq_disable();
+    thread->sched_class->switched_from(this_cpu(), thread);
+    cpuset_exit(thread);
+    cgroup_exit(thread);
+    thread->state = THREAD_DEAD;
+    schedule();
+    panic("dead thread rescheduled");
+}
+
+void wait_queue_init(struct wait_queue_head* wq) {
+    list_init(&wq->waiters);
+}
+EXPORT_SYMBOL(wait_queue_init);
+
+void prepare_to_wait(struct wait_queue_head* wq) {
+    struct thread* thread = current_thread();
+    uint32_t flags = local_irq_save();
+
+    if (list_empty(&thread->wait_entry))
+        list_add_tail(&thread->wait_entry, &wq->waiters);
+    thread->state = THREAD_SLEEPING;
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL(prepare_to_wait);
+
+void finish_wait(struct wait_queue_head* wq) {
+    struct thread* thread = current_thread();
+    uint32_t flags = local_irq_save();
+
+    (void)wq;
+    thread->state = THREAD_RUNNABLE;
+    if (!list_empty(&thread->wait_entry))
+        list_del(&thread->wait_entry);
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL(finish_wait);
+
+void wake_up(struct wait_queue_head* wq) {
+    uint32_t flags = local_irq_save();
+
+    while (!list_empty(&wq->waiters)) {
+        struct thread* thread = list_first_entry(&wq->waiters, struct thread, wait_entry);
+        list_del(&thread->wait_entry);
+        thread_wake(thread);
+    }
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL(wake_up);
+
+static void idle_thread(void* arg) {
+    (void)arg;
+    for (;;) {
+        /* sti takes effect after hlt starts, so no wakeup slips in between */
+        __asm__ volatile ("sti; hlt");
+    }
+}
+
+/* Scheduler initialization: the boot thread becomes a normal thread */
+int __init init_sched(void) {
+    struct cpu* cpu = this_cpu();
+
+    kprintf("Initializing scheduler...\n");
+
+    if (strcmp(sched_policy_name, "fair") == 0)
+        default_policy = SCHED_FAIR;
+    else if (strcmp(sched_policy_name, "prio") != 0)
+        kprintf("sched: unknown policy, using prio\n");
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(sched_classes); i++)
+        sched_classes[i]->init(cpu);
+    memset(threads, 0, sizeof(threads));
+
+    boot_thread.state = THREAD_RUNNABLE;
+    boot_thread.priority = THREAD_PRIO_NORMAL;
+    boot_thread.policy = default_policy;
+    boot_thread.nice = prio_to_nice[THREAD_PRIO_NORMAL];
+    boot_thread.sched_class = policy_classes[default_policy];
+    boot_thread.numa_node = numa_node_id();
+    boot_thread.cpu = smp_processor_id();
+    boot_thread.cpus_mask = CPU_MASK_ALL;
+    cpuset_fork(&boot_thread, &top_cpuset);
+    cgroup_fork(&boot_thread, &root_cgroup);
+    update_cpus_allowed(&boot_thread);
+    boot_thread.name = "boot";
+    list_init(&boot_thread.run_entry);
+    list_init(&boot_thread.wait_entry);
+    timer_setup(&boot_thread.sleep_timer, sleep_timeout);
+    cpu->current = &boot_thread;
+    boot_thread.sched_class->set_curr(cpu, &boot_thread);
+
+    /* The idle thread never sits on a run queue */
+    uint32_t flags = local_irq_save();
+    cpu->idle = thread_setup("idle", idle_thread, NULL, THREAD_PRIO_LOW);
+    cpu->idle->state = THREAD_RUNNABLE;
+    thread_bind(cpu->idle, cpu_index(cpu));
+    sched_running = true;
+    local_irq_restore(flags);
+
+    kprintf("Scheduler initialized, policy ");
+    kprintf(policy_classes[default_policy]->name);
+    kprintf(".\n");
+    return 0;
+}
+subsys_initcall(init_sched);
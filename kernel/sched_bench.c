@@ -0,0 +1,497 @@
+/*
+ * Scheduler benchmarks for nekkoOS
+ * Wakeup latency and fairness of the prio and fair classes under CPU
+ * hogs, deadline misses of periodic threads as fair and as deadline
+ * threads (sched_deadline.c), noise on a thread in a cpuset of its own
+ * on an isolated CPU (cpuset.c), and the cost of setting a thread up by
+ * thread_create() and the setters against thread_spawn().
+ *
+ * Each benchmark runs above the threads it measures, at high priority in
+ * the prio class, and restores its own policy when it is done.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "errno.h"
+#include "irqflags.h"
+#include "sched.h"
+#include "cpumask.h"
+#include "cpuset.h"
+#include "cgroup.h"
+#include "timer.h"
+#include "bench.h"
+#include "kernel.h"
+
+/* CPU hogs for the benchmarks: SCHED_BENCH_HOGS threads that never sleep */
+#define SCHED_BENCH_HOGS        8
+
+static struct {
+    volatile bool stop;
+    volatile uint32_t running;
+    volatile uint32_t loops[SCHED_BENCH_HOGS];
+} sched_hogs;
+
+/* Policy and priority of the benchmark thread while it runs above the threads it measures */
+static struct {
+    uint32_t policy;
+    uint32_t priority;
+    int32_t nice;
+} sched_bench_saved;
+
+static void sched_hog(void* arg) {
+    volatile uint32_t* loops = arg;
+
+    while (!sched_hogs.stop)
+        (*loops)++;
+
+    uint32_t flags = local_irq_save();
+    sched_hogs.running--;
+    local_irq_restore(flags);
+}
+
+/* The caller runs above the hogs, so none of them starts before all are set up */
+static bool sched_hogs_start(uint32_t policy) {
+    struct spawn_attr attr = { .flags = SPAWN_SETPOLICY, .policy = policy, .priority = THREAD_PRIO_NORMAL };
+
+    memset(&sched_hogs, 0, sizeof(sched_hogs));
+    for (int i = 0; i < SCHED_BENCH_HOGS; i++) {
+        if (!thread_spawn("hog", sched_hog, (void*)&sched_hogs.loops[i], &attr))
+            return false;
+        sched_hogs.running++;
+    }
+    return true;
+}
+
+static void sched_hogs_stop(void) {
+    sched_hogs.stop = true;
+    while (sched_hogs.running)
+        thread_sleep(10);
+}
+
+static void sched_bench_enter(void) {
+    struct thread* self = current_thread();
+
+    sched_bench_saved.policy = self->policy;
+    sched_bench_saved.priority = self->priority;
+    sched_bench_saved.nice = self->nice;
+    sched_setscheduler(self, SCHED_PRIO, THREAD_PRIO_HIGH);
+}
+
+static void sched_bench_leave(void) {
+    struct thread* self = current_thread();
+
+    sched_setscheduler(self, sched_bench_saved.policy, sched_bench_saved.priority);
+    thread_set_nice(self, sched_bench_saved.nice);
+}
+
+/*
+ * Interactive response under load: a thread that sleeps on a timer and
+ * runs briefly, against the hogs, all of one policy. Reports the time
+ * from the wakeup to the thread running.
+ */
+#define SCHED_BENCH_WAKEUPS     20
+#define SCHED_BENCH_PERIOD_MS   30
+
+struct sched_bench {
+    volatile bool done;
+    volatile bool woken;
+    uint64_t wake_tsc;
+    uint64_t total_cycles;
+    uint64_t max_cycles;
+    struct timer_list timer;
+    struct wait_queue_head wait;
+};
+
+static struct sched_bench sched_bench;
+
+static const struct {
+    uint32_t policy;
+    const char* avg;
+    const char* max;
+    const char* spread;
+} sched_bench_policies[] = {
+    { SCHED_PRIO, "prio_wakeup_avg", "prio_wakeup_max", "prio_hog_spread" },
+    { SCHED_FAIR, "fair_wakeup_avg", "fair_wakeup_max", "fair_hog_spread" },
+};
+
+static void sched_bench_timer(struct timer_list* timer) {
+    (void)timer;
+    sched_bench.wake_tsc = rdtsc();
+    sched_bench.woken = true;
+    wake_up(&sched_bench.wait);
+}
+
+static void sched_bench_interactive(void* arg) {
+    (void)arg;
+    for (int i = 0; i < SCHED_BENCH_WAKEUPS; i++) {
+        sched_bench.woken = false;
+        mod_timer(&sched_bench.timer, jiffies + msecs_to_jiffies(SCHED_BENCH_PERIOD_MS));
+        wait_event(sched_bench.wait, sched_bench.woken);
+
+        uint64_t cycles = rdtsc() - sched_bench.wake_tsc;
+        sched_bench.total_cycles += cycles;
+        sched_bench.max_cycles = MAX(sched_bench.max_cycles, cycles);
+    }
+    sched_bench.done = true;
+}
+
+static bool sched_bench_run(uint32_t policy) {
+    struct spawn_attr attr = { .flags = SPAWN_SETPOLICY, .policy = policy, .priority = THREAD_PRIO_NORMAL };
+    struct thread* thread = NULL;
+
+    memset(&sched_bench, 0, sizeof(sched_bench));
+    wait_queue_init(&sched_bench.wait);
+    timer_setup(&sched_bench.timer, sched_bench_timer);
+
+    if (sched_hogs_start(policy))
+        thread = thread_spawn("interactive", sched_bench_interactive, NULL, &attr);
+    if (thread) {
+        while (!sched_bench.done)
+            thread_sleep(SCHED_BENCH_PERIOD_MS);
+    }
+
+    sched_hogs_stop();
+    return thread != NULL;
+}
+
+static void sched_benchmark(void) {
+    uint32_t khz = timer_tsc_khz();
+
+    if (!khz)
+        return;
+
+    sched_bench_enter();
+    for (uint32_t i = 0; i < ARRAY_SIZE(sched_bench_policies); i++) {
+        if (!sched_bench_run(sched_bench_policies[i].policy)) {
+            kprintf("sched: benchmark threads unavailable\n");
+            break;
+        }
+
+        uint32_t min_loops = 0xFFFFFFFF, max_loops = 0;
+        for (int j = 0; j < SCHED_BENCH_HOGS; j++) {
+            min_loops = MIN(min_loops, sched_hogs.loops[j]);
+            max_loops = MAX(max_loops, sched_hogs.loops[j]);
+        }
+
+        uint64_t avg = div_u64(sched_bench.total_cycles, SCHED_BENCH_WAKEUPS);
+        bench_report("sched", sched_bench_policies[i].avg, (uint32_t)div_u64(avg * 1000, khz), "us");
+        bench_report("sched", sched_bench_policies[i].max,
+                     (uint32_t)div_u64(sched_bench.max_cycles * 1000, khz), "us");
+        /* Gap between the busiest and the least served hog */
+        bench_report("sched", sched_bench_policies[i].spread,
+                     max_loops ? (uint32_t)div_u64((uint64_t)(max_loops - min_loops) * 100, max_loops) : 0, "%");
+    }
+    sched_bench_leave();
+}
+KERNEL_BENCH("sched", sched_benchmark);
+
+/*
+ * Periodic jobs under load: threads that do a fixed amount of work each
+ * period, against fair hogs, once as fair threads and once as deadline
+ * threads with a budget above the work. A job misses when it finishes
+ * later than its release plus the deadline.
+ */
+#define DL_BENCH_JOBS           20
+
+struct dl_bench_task {
+    uint32_t runtime_us;
+    uint32_t deadline_us;
+    uint32_t period_us;
+    uint32_t work_us;
+    volatile bool done;
+    uint32_t misses;
+    uint32_t worst_us;
+    uint32_t overruns;
+};
+
+static struct dl_bench_task dl_bench_tasks[] = {
+    { .runtime_us = 10000, .deadline_us = 50000, .period_us = 50000, .work_us = 4000 },
+    { .runtime_us = 20000, .deadline_us = 80000, .period_us = 100000, .work_us = 8000 },
+};
+
+static void dl_bench_task(void* arg) {
+    struct dl_bench_task* task = arg;
+    uint64_t release = timer_now_us();
+
+    for (int i = 0; i < DL_BENCH_JOBS; i++) {
+        timer_udelay(task->work_us);
+
+        uint64_t now = timer_now_us();
+        uint32_t response = (uint32_t)(now - release);
+        if (response > task->deadline_us)
+            task->misses++;
+        task->worst_us = MAX(task->worst_us, response);
+
+        release += task->period_us;
+        now = timer_now_us();
+        if (release > now)
+            thread_sleep((uint32_t)div_u64(release - now + 999, 1000));
+    }
+    task->overruns = current_thread()->dl.overruns;
+    task->done = true;
+}
+
+/*
+ * -ENOMEM if a thread could not be made, or the error of a policy change
+ * that was refused: the threads already started then run to the end as
+ * fair threads, and their results mean nothing.
+ */
+static int dl_bench_run(uint32_t policy) {
+    int ret = sched_hogs_start(SCHED_FAIR) ? 0 : -ENOMEM;
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(dl_bench_tasks); i++) {
+        struct dl_bench_task* task = &dl_bench_tasks[i];
+        struct thread* thread = NULL;
+
+        task->done = true;
+        task->misses = task->worst_us = task->overruns = 0;
+        if (ret)
+            continue;
+        thread = thread_create("periodic", dl_bench_task, task, THREAD_PRIO_NORMAL);
+        if (!thread) {
+            ret = -ENOMEM;
+            continue;
+        }
+        task->done = false;
+        if (policy == SCHED_DEADLINE)
+            ret = sched_setdeadline(thread, task->runtime_us * 1000, task->deadline_us * 1000, task->period_us * 1000);
+        else
+            ret = sched_setscheduler(thread, policy, THREAD_PRIO_NORMAL);
+    }
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(dl_bench_tasks); i++) {
+        while (!dl_bench_tasks[i].done)
+            thread_sleep(50);
+    }
+    sched_hogs_stop();
+    return ret;
+}
+
+static void deadline_benchmark(void) {
+    static const struct {
+        uint32_t policy;
+        const char* misses;
+        const char* worst;
+    } modes[] = {
+        { SCHED_FAIR, "fair_misses", "fair_worst_response" },
+        { SCHED_DEADLINE, "deadline_misses", "deadline_worst_response" },
+    };
+
+    sched_bench_enter();
+    for (uint32_t i = 0; i < ARRAY_SIZE(modes); i++) {
+        int err = dl_bench_run(modes[i].policy);
+
+        if (err == -ENOMEM) {
+            kprintf("sched: benchmark threads unavailable\n");
+            break;
+        }
+        if (err) {
+            kprintf("sched: ");
+            kprintf(modes[i].misses);
+            kprintf(" skipped, policy refused\n");
+            continue;
+        }
+
+        uint32_t misses = 0, worst = 0, overruns = 0;
+        for (uint32_t j = 0; j < ARRAY_SIZE(dl_bench_tasks); j++) {
+            misses += dl_bench_tasks[j].misses;
+            worst = MAX(worst, dl_bench_tasks[j].worst_us);
+            overruns += dl_bench_tasks[j].overruns;
+        }
+        bench_report("deadline", modes[i].misses, misses, "jobs");
+        bench_report("deadline", modes[i].worst, worst, "us");
+        if (modes[i].policy == SCHED_DEADLINE)
+            bench_report("deadline", "budget_overruns", overruns, "jobs");
+    }
+
+    /* A full CPU of bandwidth never fits next to the rest of the system */
+    int err = sched_setdeadline(current_thread(), 1000000, 1000000, 1000000);
+    bench_report("deadline", "full_cpu_rejected", err == -EBUSY, "bool");
+    if (!err)
+        sched_setscheduler(current_thread(), SCHED_PRIO, THREAD_PRIO_HIGH);
+    sched_bench_leave();
+}
+KERNEL_BENCH("deadline", deadline_benchmark);
+
+/*
+ * Noise on a latency-critical thread: it spins on the TSC and counts
+ * every gap above ISOL_BENCH_GAP_US as time taken by interrupts or other
+ * threads. Run alone, then next to fair hogs left in the top cpuset,
+ * with the thread in a cpuset of its own on the first isolated CPU, or
+ * on a housekeeping CPU it shares with the hogs when none is isolated.
+ */
+#define ISOL_BENCH_MS           300
+#define ISOL_BENCH_GAP_US       10
+
+static struct {
+    volatile bool done;
+    uint64_t max_gap;
+    uint64_t noise;
+} isol_bench;
+
+static void isol_bench_sampler(void* arg) {
+    uint32_t khz = (uint32_t)arg;
+    uint64_t threshold = div_u64((uint64_t)khz * ISOL_BENCH_GAP_US, 1000);
+    uint64_t last = rdtsc();
+    uint64_t end = last + (uint64_t)khz * ISOL_BENCH_MS;
+
+    while (last < end) {
+        uint64_t now = rdtsc();
+        uint64_t gap = now - last;
+
+        if (gap > threshold) {
+            isol_bench.noise += gap;
+            isol_bench.max_gap = MAX(isol_bench.max_gap, gap);
+        }
+        last = now;
+    }
+    isol_bench.done = true;
+}
+
+static bool isol_bench_run(struct cpuset* cs, uint32_t khz, bool loaded) {
+    struct spawn_attr attr = {
+        .flags = SPAWN_SETPOLICY | SPAWN_SETCPUSET,
+        .policy = SCHED_FAIR,
+        .priority = THREAD_PRIO_NORMAL,
+        .cpuset = cs,
+    };
+    struct thread* thread = NULL;
+
+    memset(&isol_bench, 0, sizeof(isol_bench));
+    if (!loaded || sched_hogs_start(SCHED_FAIR))
+        thread = thread_spawn("sampler", isol_bench_sampler, (void*)khz, &attr);
+    if (thread) {
+        while (!isol_bench.done)
+            thread_sleep(20);
+    }
+
+    if (loaded)
+        sched_hogs_stop();
+    return thread != NULL;
+}
+
+static void isolation_benchmark(void) {
+    static const struct {
+        bool loaded;
+        const char* max_gap;
+        const char* noise;
+    } modes[] = {
+        { false, "quiet_max_gap", "quiet_noise" },
+        { true, "loaded_max_gap", "loaded_noise" },
+    };
+    uint32_t khz = timer_tsc_khz();
+    uint32_t cpu = cpumask_first(cpu_isolated_mask);
+
+    if (!khz)
+        return;
+    if (cpu == NR_CPUS)
+        cpu = cpumask_first(housekeeping_cpumask());
+
+    struct cpuset* cs = cpuset_create("isolated", cpumask_of(cpu), top_cpuset.mems);
+    if (!cs)
+        return;
+
+    sched_bench_enter();
+    bench_report("isolation", "isolated_cpu", cpu_is_isolated(cpu), "bool");
+    for (uint32_t i = 0; i < ARRAY_SIZE(modes); i++) {
+        if (!isol_bench_run(cs, khz, modes[i].loaded)) {
+            kprintf("sched: benchmark threads unavailable\n");
+            break;
+        }
+        bench_report("isolation", modes[i].max_gap, (uint32_t)div_u64(isol_bench.max_gap * 1000, khz), "us");
+        /* Share of the sampling window lost to gaps */
+        bench_report("isolation", modes[i].noise,
+                     (uint32_t)div_u64(isol_bench.noise * 1000, (uint64_t)khz * ISOL_BENCH_MS), "permille");
+    }
+    sched_bench_leave();
+
+    /* The sampler may not have exited yet */
+    while (cpuset_destroy(cs) == -EBUSY)
+        thread_sleep(10);
+}
+KERNEL_BENCH("isolation", isolation_benchmark);
+
+/*
+ * Spawn to exit: a fair thread in its own control group and cpuset that
+ * exits at once, started by thread_create() and the setters, then by
+ * thread_spawn() with the same settings. Reports the time from the
+ * create call to the thread finishing.
+ */
+#define SPAWN_BENCH_THREADS     100
+
+static struct {
+    volatile bool done;
+    uint64_t end_tsc;
+    struct wait_queue_head wait;
+} spawn_bench;
+
+static void spawn_bench_child(void* arg) {
+    (void)arg;
+    spawn_bench.end_tsc = rdtsc();
+    spawn_bench.done = true;
+    wake_up(&spawn_bench.wait);
+}
+
+/* Average cycles from create to exit, 0 if a thread could not be made */
+static uint64_t spawn_bench_run(const struct spawn_attr* attr, bool use_spawn) {
+    uint64_t total = 0;
+
+    for (int i = 0; i < SPAWN_BENCH_THREADS; i++) {
+        struct thread* thread;
+
+        spawn_bench.done = false;
+        uint64_t start = rdtsc();
+        if (use_spawn) {
+            thread = thread_spawn("spawn", spawn_bench_child, NULL, attr);
+        } else {
+            thread = thread_create("spawn", spawn_bench_child, NULL, attr->priority);
+            if (thread) {
+                sched_setscheduler(thread, attr->policy, attr->priority);
+                cpuset_attach(attr->cpuset, thread);
+                cgroup_attach(attr->cgroup, thread);
+            }
+        }
+        if (!thread)
+            return 0;
+
+        wait_event(spawn_bench.wait, spawn_bench.done);
+        total += spawn_bench.end_tsc - start;
+    }
+    return div_u64(total, SPAWN_BENCH_THREADS);
+}
+
+static void spawn_benchmark(void) {
+    uint32_t khz = timer_tsc_khz();
+    struct cpuset* cs = cpuset_create("spawn", top_cpuset.cpus, top_cpuset.mems);
+    struct cgroup* cg = cgroup_create(NULL, "spawn");
+
+    if (khz && cs && cg) {
+        struct spawn_attr attr = {
+            .flags = SPAWN_SETPOLICY | SPAWN_SETCPUSET | SPAWN_SETCGROUP,
+            .policy = SCHED_FAIR,
+            .priority = THREAD_PRIO_NORMAL,
+            .cpuset = cs,
+            .cgroup = cg,
+        };
+
+        wait_queue_init(&spawn_bench.wait);
+        sched_bench_enter();
+        uint64_t create = spawn_bench_run(&attr, false);
+        uint64_t spawn = spawn_bench_run(&attr, true);
+        sched_bench_leave();
+
+        if (create && spawn) {
+            bench_report("spawn", "create_setup_exit", (uint32_t)div_u64(create * 1000000, khz), "ns");
+            bench_report("spawn", "spawn_exit", (uint32_t)div_u64(spawn * 1000000, khz), "ns");
+        } else {
+            kprintf("sched: benchmark threads unavailable\n");
+        }
+    }
+
+    /* The last child may not have exited yet */
+    while (cs && cpuset_destroy(cs) == -EBUSY)
+        thread_sleep(10);
+    while (cg && cgroup_destroy(cg) == -EBUSY)
+        thread_sleep(10);
+}
+KERNEL_BENCH("spawn", spawn_benchmark);
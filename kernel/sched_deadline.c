@@ -0,0 +1,320 @@
+/*
+ * Deadline scheduling class for nekkoOS
+ * SCHED_DEADLINE threads declare a runtime budget, a relative deadline
+ * and a period (sched_setdeadline) and run earliest deadline first,
+ * ahead of every other class. Runnable threads sit in a per-CPU binary
+ * min-heap keyed by absolute deadline.
+ *
+ * Each thread is a constant bandwidth server: running consumes its
+ * budget, and a thread that runs out is throttled until its next period
+ * starts, when the budget is replenished and the deadline moves one
+ * period on. A thread that wakes with more budget than it could use
+ * before its deadline at its declared bandwidth gets a fresh budget and
+ * deadline instead, so sleeping cannot be used to bank CPU time.
+ * thread_yield() ends the current job: the thread gives up what is left
+ * of the budget and waits for the next period.
+ *
+ * Admission control keeps the sum of runtime / period of all deadline
+ * threads on a CPU within sched.dl_bw_percent of it, which leaves the
+ * other classes the rest. Budgets are enforced from the tick and
+ * replenished from a kernel timer, both with jiffy resolution.
+ */
+
+#include "types.h"
+#include "errno.h"
+#include "irqflags.h"
+#include "smp.h"
+#include "sched.h"
+#include "sched_class.h"
+#include "timer.h"
+#include "param.h"
+
+#define DL_NOT_QUEUED       0xFFFFFFFF
+#define DL_BW_SHIFT         20
+#define NSEC_PER_JIFFY      (1000000000 / HZ)
+
+/* Per-CPU deadline run queue */
+struct dl_rq {
+    struct thread* heap[THREAD_MAX];    /* Min-heap on dl.deadline */
+    uint32_t nr_running;                /* Threads in the heap */
+    struct thread* curr;                /* Running deadline thread, or NULL */
+    uint32_t total_bw;                  /* Admitted bandwidth, DL_BW_SHIFT fixed point */
+};
+
+static struct dl_rq dl_rqs[NR_CPUS];
+
+static uint32_t sched_dl_bw_percent = 95;
+param_uint("sched.dl_bw_percent", sched_dl_bw_percent);
+
+static inline struct dl_rq* dl_rq_of(struct cpu* cpu) {
+    return &dl_rqs[cpu_index(cpu)];
+}
+
+static inline bool dl_before(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b) < 0;
+}
+
+static inline bool dl_heap_less(struct dl_rq* rq, uint32_t i, uint32_t j) {
+    return dl_before(rq->heap[i]->dl.deadline, rq->heap[j]->dl.deadline);
+}
+
+static void dl_heap_swap(struct dl_rq* rq, uint32_t i, uint32_t j) {
+    struct thread* tmp = rq->heap[i];
+
+    rq->heap[i] = rq->heap[j];
+    rq->heap[j] = tmp;
+    rq->heap[i]->dl.heap_index = i;
+    rq->heap[j]->dl.heap_index = j;
+}
+
+static void dl_heap_up(struct dl_rq* rq, uint32_t i) {
+    while (i > 0 && dl_heap_less(rq, i, (i - 1) / 2)) {
+        dl_heap_swap(rq, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void dl_heap_down(struct dl_rq* rq, uint32_t i) {
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+
+        if (child >= rq->nr_running)
+            break;
+        if (child + 1 < rq->nr_running && dl_heap_less(rq, child + 1, child))
+            child++;
+        if (!dl_heap_less(rq, child, i))
+            break;
+        dl_heap_swap(rq, i, child);
+        i = child;
+    }
+}
+
+static void dl_heap_insert(struct dl_rq* rq, struct thread* thread) {
+    uint32_t i = rq->nr_running++;
+
+    rq->heap[i] = thread;
+    thread->dl.heap_index = i;
+    dl_heap_up(rq, i);
+}
+
+static void dl_heap_remove(struct dl_rq* rq, struct thread* thread) {
+    uint32_t i = thread->dl.heap_index;
+    uint32_t last = --rq->nr_running;
+
+    thread->dl.heap_index = DL_NOT_QUEUED;
+    if (i == last)
+        return;
+
+    rq->heap[i] = rq->heap[last];
+    rq->heap[i]->dl.heap_index = i;
+    dl_heap_up(rq, i);
+    dl_heap_down(rq, rq->heap[i]->dl.heap_index);
+}
+
+/* Would the remaining budget exceed the declared bandwidth before the deadline? */
+static bool dl_overflow(const struct sched_dl_entity* dl, uint64_t now) {
+    uint64_t left = (uint64_t)dl->runtime * dl->dl_period;
+    uint64_t right = (dl->deadline - now) * dl->dl_runtime;
+
+    return left > right;
+}
+
+static void dl_new_job(struct sched_dl_entity* dl, uint64_t now) {
+    dl->deadline = now + dl->dl_deadline;
+    dl->runtime = dl->dl_runtime;
+}
+
+/* Refill a throttled thread's budget, moving its deadline a period on per refill */
+static void dl_replenish(struct sched_dl_entity* dl, uint64_t now) {
+    while (dl->runtime <= 0) {
+        dl->deadline += dl->dl_period;
+        dl->runtime += dl->dl_runtime;
+    }
+
+    /* Too far behind to catch up: start over from now */
+    if (dl_before(dl->deadline, now))
+        dl_new_job(dl, now);
+}
+
+static void dl_timer_fn(struct timer_list* timer) {
+    struct thread* thread = CONTAINER_OF(timer, struct thread, dl.timer);
+    struct cpu* cpu = this_cpu();
+    uint32_t flags = local_irq_save();
+
+    if (thread->dl.throttled) {
+        thread->dl.throttled = false;
+        dl_replenish(&thread->dl, sched_clock());
+        /* Sleepers are put back by their wakeup */
+        if (thread->state == THREAD_RUNNABLE && thread != cpu->current)
+            enqueue_thread(cpu, thread, 0);
+    }
+    local_irq_restore(flags);
+}
+
+/* Out of budget: off the CPU until the period that follows the deadline starts */
+static void dl_throttle(struct cpu* cpu, struct thread* thread) {
+    struct sched_dl_entity* dl = &thread->dl;
+    uint64_t next_period = dl->deadline - dl->dl_deadline + dl->dl_period;
+    int64_t wait = (int64_t)(next_period - sched_clock());
+    uint32_t ticks = 1;
+
+    if (wait > 0)
+        ticks = MAX((uint32_t)div_u64((uint64_t)wait + NSEC_PER_JIFFY - 1, NSEC_PER_JIFFY), 1);
+
+    dl->throttled = true;
+    mod_timer(&dl->timer, jiffies + ticks);
+    cpu->need_resched = true;
+}
+
+/* Charge the running thread for the time since it was last accounted */
+static void update_curr_dl(struct cpu* cpu) {
+    struct dl_rq* rq = dl_rq_of(cpu);
+    struct thread* curr = rq->curr;
+
+    if (!curr)
+        return;
+
+    struct sched_dl_entity* dl = &curr->dl;
+    uint64_t now = rdtsc();
+    int64_t cycles = (int64_t)(now - dl->exec_start);
+
+    if (cycles <= 0)
+        return;
+    dl->exec_start = now;
+    dl->runtime -= (int64_t)sched_cycles_to_ns((uint64_t)cycles);
+
+    if (dl->runtime <= 0 && !dl->throttled) {
+        dl->overruns++;
+        dl_throttle(cpu, curr);
+    }
+}
+
+static void dl_init(struct cpu* cpu) {
+    struct dl_rq* rq = dl_rq_of(cpu);
+
+    rq->nr_running = 0;
+    rq->curr = NULL;
+    rq->total_bw = 0;
+}
+
+static void dl_enqueue(struct cpu* cpu, struct thread* thread, uint32_t flags) {
+    struct sched_dl_entity* dl = &thread->dl;
+
+    if (flags & (ENQUEUE_WAKEUP | ENQUEUE_NEW)) {
+        uint64_t now = sched_clock();
+        if (!dl->throttled && (!dl_before(now, dl->deadline) || dl_overflow(dl, now)))
+            dl_new_job(dl, now);
+    }
+
+    /* The replenishment timer enqueues throttled threads */
+    if (!dl->throttled)
+        dl_heap_insert(dl_rq_of(cpu), thread);
+}
+
+static void dl_dequeue(struct cpu* cpu, struct thread* thread) {
+    if (thread->dl.heap_index != DL_NOT_QUEUED)
+        dl_heap_remove(dl_rq_of(cpu), thread);
+}
+
+static void dl_set_curr(struct cpu* cpu, struct thread* thread) {
+    dl_rq_of(cpu)->curr = thread;
+    thread->dl.exec_start = rdtsc();
+}
+
+static struct thread* dl_pick_next(struct cpu* cpu) {
+    struct dl_rq* rq = dl_rq_of(cpu);
+
+    if (!rq->nr_running)
+        return NULL;
+
+    struct thread* next = rq->heap[0];
+    dl_heap_remove(rq, next);
+    dl_set_curr(cpu, next);
+    return next;
+}
+
+static void dl_put_prev(struct cpu* cpu, struct thread* thread) {
+    (void)thread;
+    update_curr_dl(cpu);
+    dl_rq_of(cpu)->curr = NULL;
+}
+
+static void dl_tick(struct cpu* cpu, struct thread* curr) {
+    struct dl_rq* rq = dl_rq_of(cpu);
+
+    update_curr_dl(cpu);
+    if (rq->nr_running && dl_before(rq->heap[0]->dl.deadline, curr->dl.deadline))
+        cpu->need_resched = true;
+}
+
+static bool dl_check_preempt(struct cpu* cpu, struct thread* curr, struct thread* thread) {
+    (void)cpu;
+    return dl_before(thread->dl.deadline, curr->dl.deadline);
+}
+
+static bool dl_has_runnable(struct cpu* cpu) {
+    return dl_rq_of(cpu)->nr_running != 0;
+}
+
+/* End of the job: drop the rest of the budget until the next period */
+static void dl_yield(struct cpu* cpu, struct thread* curr) {
+    update_curr_dl(cpu);
+    if (!curr->dl.throttled) {
+        curr->dl.runtime = 0;
+        dl_throttle(cpu, curr);
+    }
+}
+
+static void dl_switched_to(struct cpu* cpu, struct thread* thread) {
+    (void)cpu;
+    timer_setup(&thread->dl.timer, dl_timer_fn);
+    thread->dl.heap_index = DL_NOT_QUEUED;
+    thread->dl.throttled = false;
+    thread->dl.overruns = 0;
+    dl_new_job(&thread->dl, sched_clock());
+}
+
+static void dl_switched_from(struct cpu* cpu, struct thread* thread) {
+    del_timer(&thread->dl.timer);
+    thread->dl.throttled = false;
+    dl_rq_of(cpu)->total_bw -= thread->dl.dl_bw;
+    thread->dl.dl_bw = 0;
+}
+
+/*
+ * Reserve bandwidth for a thread entering the class or changing its
+ * parameters; -EBUSY if the CPU has not that much left. New parameters
+ * of a thread already in the class apply from its next period.
+ */
+int dl_admit(struct cpu* cpu, struct thread* thread, uint32_t runtime, uint32_t deadline, uint32_t period) {
+    struct dl_rq* rq = dl_rq_of(cpu);
+    uint32_t limit = (uint32_t)div_u64((uint64_t)MIN(sched_dl_bw_percent, 100) << DL_BW_SHIFT, 100);
+    uint32_t bw = (uint32_t)div_u64((uint64_t)runtime << DL_BW_SHIFT, period);
+    uint32_t old_bw = thread->sched_class == &dl_sched_class ? thread->dl.dl_bw : 0;
+
+    if (rq->total_bw - old_bw + bw > limit)
+        return -EBUSY;
+
+    rq->total_bw = rq->total_bw - old_bw + bw;
+    thread->dl.dl_runtime = runtime;
+    thread->dl.dl_deadline = deadline;
+    thread->dl.dl_period = period;
+    thread->dl.dl_bw = bw;
+    return 0;
+}
+
+const struct sched_class dl_sched_class = {
+    .name = "deadline",
+    .init = dl_init,
+    .enqueue = dl_enqueue,
+    .dequeue = dl_dequeue,
+    .pick_next = dl_pick_next,
+    .set_curr = dl_set_curr,
+    .put_prev = dl_put_prev,
+    .tick = dl_tick,
+    .check_preempt = dl_check_preempt,
+    .has_runnable = dl_has_runnable,
+    .yield = dl_yield,
+    .switched_to = dl_switched_to,
+    .switched_from = dl_switched_from,
+};
@@ -0,0 +1,512 @@
+/*
+ * Fair scheduling class for nekkoOS
+ * SCHED_FAIR threads share the CPU in proportion to their weight, which
+ * follows from the nice level (NICE_0_WEIGHT at nice 0, about 1.25x per
+ * step). Each thread accumulates virtual runtime, its runtime scaled by
+ * NICE_0_WEIGHT / weight, and the thread with the least vruntime runs
+ * next: runnable threads sit in a red-black tree ordered by vruntime with
+ * the leftmost node cached.
+ *
+ * Every runnable thread gets a turn within sched.latency_ns, or within
+ * sched.min_granularity_ns per thread once there are too many for that.
+ * The running thread is checked against its share on every tick, so
+ * slices shorter than a tick end at the next one. A waking thread
+ * preempts when it is more than sched.wakeup_granularity_ns of vruntime
+ * behind the running one. Sleepers come back with up to half a latency
+ * period of credit (all of it without sched.gentle_sleepers), so a
+ * thread that mostly waits runs promptly without banking its sleep.
+ *
+ * Control groups (cgroup.c) get a run queue of their own on every CPU,
+ * and an entity weighted by their CPU shares in their parent's queue, so
+ * groups compete as one thread would and their threads compete within
+ * them. Picking walks down from the root queue taking the leftmost
+ * entity at each level. A group with a CPU quota is charged for all the
+ * time its threads run; once the quota is used up its entity leaves its
+ * parent's queue at the next reschedule, until the period timer refills
+ * the quota.
+ */
+
+#include "types.h"
+#include "string.h"
+#include "rbtree.h"
+#include "irqflags.h"
+#include "smp.h"
+#include "sched.h"
+#include "sched_class.h"
+#include "cgroup.h"
+#include "timer.h"
+#include "param.h"
+
+/* Per-CPU fair run queue of a group; times are in nanoseconds of vruntime */
+struct cfs_rq {
+    struct rb_root_cached tasks;    /* Queued entities, the running one excluded */
+    struct sched_entity* curr;      /* Running entity, or NULL */
+    uint64_t min_vruntime;          /* Monotonic floor of all vruntimes */
+    uint32_t nr_running;            /* Queued entities plus curr */
+    uint32_t load;                  /* Sum of their weights */
+    struct cpu* cpu;
+    struct cgroup* cgroup;          /* Group whose threads and subgroups it holds */
+    struct sched_entity* se;        /* The group's entity in its parent, NULL for the root */
+    bool throttled;                 /* Out of quota and off its parent's queue */
+};
+
+/* Run queues by group and CPU, the root group's are the CPUs' own */
+static struct cfs_rq cfs_rqs[CGROUP_MAX][NR_CPUS];
+static struct sched_entity group_entities[CGROUP_MAX][NR_CPUS];
+
+static uint32_t sched_latency_ns = 6000000;
+static uint32_t sched_min_granularity_ns = 750000;
+static uint32_t sched_wakeup_granularity_ns = 1000000;
+static bool sched_gentle_sleepers = true;
+param_uint("sched.latency_ns", sched_latency_ns);
+param_uint("sched.min_granularity_ns", sched_min_granularity_ns);
+param_uint("sched.wakeup_granularity_ns", sched_wakeup_granularity_ns);
+param_bool("sched.gentle_sleepers", sched_gentle_sleepers);
+
+/* Weight of nice NICE_MIN..NICE_MAX, each step is about 10% of CPU time */
+static const uint32_t nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,
+     3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,
+      335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,
+       36,    29,    23,    18,    15,
+};
+
+static inline struct cfs_rq* cfs_rq_of(struct cpu* cpu) {
+    return &cfs_rqs[CGROUP_ROOT_ID][cpu_index(cpu)];
+}
+
+static inline struct cfs_rq* group_cfs_rq(struct cgroup* cg, struct cpu* cpu) {
+    return &cfs_rqs[cg->id][cpu_index(cpu)];
+}
+
+static inline struct thread* task_of(struct sched_entity* se) {
+    return CONTAINER_OF(se, struct thread, se);
+}
+
+static inline int64_t vruntime_delta(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b);
+}
+
+static inline struct sched_entity* cfs_first(struct cfs_rq* rq) {
+    struct rb_node* left = rb_first_cached(&rq->tasks);
+
+    return left ? rb_entry(left, struct sched_entity, run_node) : NULL;
+}
+
+/* Point a thread's entity at its group's run queue on this CPU */
+static void link_task(struct cpu* cpu, struct thread* thread) {
+    struct sched_entity* se = &thread->se;
+
+    se->cfs_rq = group_cfs_rq(thread->cgroup, cpu);
+    se->parent = se->cfs_rq->se;
+    se->my_q = NULL;
+    se->depth = thread->cgroup->depth;
+}
+
+/* Runtime delta in vruntime: scaled up for light threads, down for heavy ones */
+static uint64_t calc_delta_fair(uint64_t delta, const struct sched_entity* se) {
+    if (se->weight == NICE_0_WEIGHT)
+        return delta;
+    return div_u64(delta * NICE_0_WEIGHT, se->weight);
+}
+
+/* Time in which every runnable entity runs once */
+static uint64_t sched_period(uint32_t nr_running) {
+    uint32_t nr_latency = sched_latency_ns / MAX(sched_min_granularity_ns, 1);
+
+    if (nr_running > nr_latency)
+        return (uint64_t)nr_running * sched_min_granularity_ns;
+    return sched_latency_ns;
+}
+
+/* The entity's wall-clock share of the period, counting it as runnable */
+static uint64_t sched_slice(struct cfs_rq* rq, const struct sched_entity* se) {
+    uint32_t nr_running = rq->nr_running + (se->on_rq ? 0 : 1);
+    uint32_t load = rq->load + (se->on_rq ? 0 : se->weight);
+
+    return div_u64(sched_period(nr_running) * se->weight, load);
+}
+
+static void update_min_vruntime(struct cfs_rq* rq) {
+    struct sched_entity* left = cfs_first(rq);
+    uint64_t vruntime = rq->min_vruntime;
+
+    if (rq->curr)
+        vruntime = rq->curr->vruntime;
+    if (left && (!rq->curr || vruntime_delta(left->vruntime, vruntime) < 0))
+        vruntime = left->vruntime;
+    if (vruntime_delta(vruntime, rq->min_vruntime) > 0)
+        rq->min_vruntime = vruntime;
+}
+
+/* Charge a group's quota; the group is throttled at the next reschedule */
+static void account_cfs_rq_runtime(struct cfs_rq* rq, uint64_t delta) {
+    struct cgroup* cg = rq->cgroup;
+
+    if (!cg->cpu_quota_us || rq->throttled)
+        return;
+    cg->cpu_runtime -= (int64_t)delta;
+    if (cg->cpu_runtime <= 0)
+        rq->cpu->need_resched = true;
+}
+
+static inline bool cfs_rq_out_of_quota(struct cfs_rq* rq) {
+    return rq->cgroup->cpu_quota_us && rq->cgroup->cpu_runtime <= 0;
+}
+
+/* Charge the running entity for the time since it was last accounted */
+static void update_curr(struct cfs_rq* rq) {
+    if (!rq->curr)
+        return;
+
+    struct sched_entity* se = rq->curr;
+    uint64_t now = rdtsc();
+    int64_t cycles = (int64_t)(now - se->exec_start);
+
+    if (cycles <= 0)
+        return;
+    se->exec_start = now;
+
+    uint64_t delta = sched_cycles_to_ns((uint64_t)cycles);
+    se->sum_exec_runtime += delta;
+    se->vruntime += calc_delta_fair(delta, se);
+    update_min_vruntime(rq);
+    account_cfs_rq_runtime(rq, delta);
+}
+
+/*
+ * Starting vruntime of a new or woken entity. A new thread starts one
+ * slice behind the queue so creating threads cannot starve the others;
+ * a sleeper gets its credit but never moves backwards.
+ */
+static void place_entity(struct cfs_rq* rq, struct sched_entity* se, bool initial) {
+    uint64_t vruntime = rq->min_vruntime;
+
+    if (initial) {
+        vruntime += calc_delta_fair(sched_slice(rq, se), se);
+    } else {
+        uint32_t thresh = sched_latency_ns;
+        if (sched_gentle_sleepers)
+            thresh /= 2;
+        vruntime -= thresh;
+    }
+
+    if (initial || vruntime_delta(vruntime, se->vruntime) > 0)
+        se->vruntime = vruntime;
+}
+
+static void account_enqueue(struct cfs_rq* rq, struct sched_entity* se) {
+    se->on_rq = true;
+    rq->nr_running++;
+    rq->load += se->weight;
+}
+
+static void account_dequeue(struct cfs_rq* rq, struct sched_entity* se) {
+    se->on_rq = false;
+    rq->nr_running--;
+    rq->load -= se->weight;
+}
+
+static void tree_insert(struct cfs_rq* rq, struct sched_entity* se) {
+    struct rb_node** link = &rq->tasks.root.node;
+    struct rb_node* parent = NULL;
+    bool leftmost = true;
+
+    /* Equal keys go right, so equal vruntimes run in queue order */
+    while (*link) {
+        parent = *link;
+        if (vruntime_delta(se->vruntime, rb_entry(parent, struct sched_entity, run_node)->vruntime) < 0) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+    rb_link_node(&se->run_node, parent, link);
+    rb_insert_color_cached(&se->run_node, &rq->tasks, leftmost);
+}
+
+static void enqueue_entity(struct cfs_rq* rq, struct sched_entity* se, uint32_t flags) {
+    update_curr(rq);
+    if (flags & ENQUEUE_NEW)
+        place_entity(rq, se, true);
+    else if (flags & ENQUEUE_WAKEUP)
+        place_entity(rq, se, false);
+
+    if (se != rq->curr)
+        tree_insert(rq, se);
+    account_enqueue(rq, se);
+}
+
+static void dequeue_entity(struct cfs_rq* rq, struct sched_entity* se) {
+    update_curr(rq);
+    if (se != rq->curr)
+        rb_erase_cached(&se->run_node, &rq->tasks);
+    account_dequeue(rq, se);
+    update_min_vruntime(rq);
+}
+
+static void set_next_entity(struct cfs_rq* rq, struct sched_entity* se) {
+    if (!se->on_rq)
+        account_enqueue(rq, se);
+    else if (se != rq->curr)
+        rb_erase_cached(&se->run_node, &rq->tasks);
+    rq->curr = se;
+    se->exec_start = rdtsc();
+    se->slice_start = se->sum_exec_runtime;
+}
+
+static void init_cfs_rq(struct cfs_rq* rq, struct cpu* cpu, struct cgroup* cg) {
+    rq->tasks = RB_ROOT_CACHED;
+    rq->curr = NULL;
+    rq->min_vruntime = 0;
+    rq->nr_running = 0;
+    rq->load = 0;
+    rq->cpu = cpu;
+    rq->cgroup = cg;
+    rq->se = NULL;
+    rq->throttled = false;
+}
+
+/* Back onto the parents' queues after a refill, as far as there is work */
+static void unthrottle_cfs_rq(struct cfs_rq* rq) {
+    struct sched_entity* se;
+
+    rq->throttled = false;
+    for (se = rq->se; se && !se->on_rq && se->my_q->nr_running && !se->my_q->throttled; se = se->parent)
+        enqueue_entity(se->cfs_rq, se, ENQUEUE_WAKEUP);
+    rq->cpu->need_resched = true;
+}
+
+static void cfs_period_timer(struct timer_list* timer) {
+    struct cgroup* cg = CONTAINER_OF(timer, struct cgroup, cpu_period_timer);
+    uint32_t flags = local_irq_save();
+
+    if (cg->cpu_quota_us) {
+        cg->cpu_runtime = (int64_t)cg->cpu_quota_us * 1000;
+        cg->cpu_nr_periods++;
+        for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+            if (cfs_rqs[cg->id][cpu].throttled)
+                unthrottle_cfs_rq(&cfs_rqs[cg->id][cpu]);
+        }
+        mod_timer(timer, jiffies + MAX(msecs_to_jiffies(cg->cpu_period_us / 1000), 1));
+    }
+    local_irq_restore(flags);
+}
+
+static void fair_init(struct cpu* cpu) {
+    init_cfs_rq(cfs_rq_of(cpu), cpu, &root_cgroup);
+}
+
+/* Run queues and entities of a new group, idle until threads join it */
+void fair_group_init(struct cgroup* cg) {
+    for (uint32_t i = 0; i < NR_CPUS; i++) {
+        struct cfs_rq* rq = &cfs_rqs[cg->id][i];
+        struct sched_entity* se = &group_entities[cg->id][i];
+
+        init_cfs_rq(rq, &cpus[i], cg);
+        memset(se, 0, sizeof(*se));
+        se->cfs_rq = &cfs_rqs[cg->parent->id][i];
+        se->parent = se->cfs_rq->se;
+        se->my_q = rq;
+        se->depth = cg->depth - 1;
+        se->weight = cg->cpu_shares;
+        rq->se = se;
+    }
+    timer_setup(&cg->cpu_period_timer, cfs_period_timer);
+}
+
+/* Called with interrupts disabled */
+void fair_group_set_shares(struct cgroup* cg) {
+    for (uint32_t i = 0; i < NR_CPUS; i++) {
+        struct sched_entity* se = &group_entities[cg->id][i];
+
+        if (se->on_rq)
+            se->cfs_rq->load = se->cfs_rq->load - se->weight + cg->cpu_shares;
+        se->weight = cg->cpu_shares;
+    }
+}
+
+/* Start a full quota now, or lift the limit; called with interrupts disabled */
+void fair_group_set_bandwidth(struct cgroup* cg) {
+    cg->cpu_runtime = (int64_t)cg->cpu_quota_us * 1000;
+    if (cg->cpu_quota_us) {
+        mod_timer(&cg->cpu_period_timer, jiffies + MAX(msecs_to_jiffies(cg->cpu_period_us / 1000), 1));
+    } else {
+        del_timer(&cg->cpu_period_timer);
+        for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+            if (cfs_rqs[cg->id][cpu].throttled)
+                unthrottle_cfs_rq(&cfs_rqs[cg->id][cpu]);
+        }
+    }
+}
+
+static void fair_enqueue(struct cpu* cpu, struct thread* thread, uint32_t flags) {
+    struct sched_entity* se = &thread->se;
+
+    link_task(cpu, thread);
+    se->weight = nice_to_weight[thread->nice - NICE_MIN];
+    enqueue_entity(se->cfs_rq, se, flags);
+
+    /* Groups that had nothing queued join their parents' queues, unless throttled */
+    for (se = se->parent; se && !se->on_rq && !se->my_q->throttled; se = se->parent)
+        enqueue_entity(se->cfs_rq, se, flags ? ENQUEUE_WAKEUP : 0);
+}
+
+static void fair_dequeue(struct cpu* cpu, struct thread* thread) {
+    struct sched_entity* se = &thread->se;
+
+    (void)cpu;
+    dequeue_entity(se->cfs_rq, se);
+
+    /* Groups left with nothing queued leave their parents' queues */
+    for (se = se->parent; se && se->on_rq && !se->my_q->nr_running; se = se->parent)
+        dequeue_entity(se->cfs_rq, se);
+}
+
+static void fair_set_curr(struct cpu* cpu, struct thread* thread) {
+    struct sched_entity* se = &thread->se;
+
+    if (!se->on_rq) {
+        link_task(cpu, thread);
+        se->weight = nice_to_weight[thread->nice - NICE_MIN];
+    }
+    set_next_entity(se->cfs_rq, se);
+
+    /* A throttled group keeps its place off the queue above */
+    for (se = se->parent; se && !se->my_q->throttled; se = se->parent)
+        set_next_entity(se->cfs_rq, se);
+}
+
+/* Leftmost entity at each level, down to a thread */
+static struct thread* fair_pick_next(struct cpu* cpu) {
+    struct cfs_rq* rq = cfs_rq_of(cpu);
+    struct sched_entity* se;
+
+    do {
+        se = cfs_first(rq);
+        if (!se)
+            return NULL;
+        set_next_entity(rq, se);
+        rq = se->my_q;
+    } while (rq);
+    return task_of(se);
+}
+
+static void fair_put_prev(struct cpu* cpu, struct thread* thread) {
+    struct sched_entity* se = &thread->se;
+    struct cfs_rq* rq = se->cfs_rq;
+
+    (void)cpu;
+    update_curr(rq);
+    rq->curr = NULL;
+    account_dequeue(rq, se);
+
+    /* Groups above go back into their parents' trees, or leave when empty or out of quota */
+    for (se = se->parent; se && se->cfs_rq->curr == se; se = se->parent) {
+        struct cfs_rq* group = se->my_q;
+
+        rq = se->cfs_rq;
+        update_curr(rq);
+        rq->curr = NULL;
+        if (cfs_rq_out_of_quota(group)) {
+            group->throttled = true;
+            group->cgroup->cpu_nr_throttled++;
+            account_dequeue(rq, se);
+        } else if (!group->nr_running) {
+            account_dequeue(rq, se);
+        } else {
+            tree_insert(rq, se);
+        }
+        update_min_vruntime(rq);
+    }
+}
+
+/* Preempt once the entity used its slice, or ran a slice ahead of the leftmost */
+static void entity_tick(struct cpu* cpu, struct cfs_rq* rq, struct sched_entity* se) {
+    update_curr(rq);
+    if (rq->nr_running < 2)
+        return;
+
+    uint64_t ideal = sched_slice(rq, se);
+    uint64_t ran = se->sum_exec_runtime - se->slice_start;
+    if (ran > ideal) {
+        cpu->need_resched = true;
+        return;
+    }
+    if (ran < sched_min_granularity_ns)
+        return;
+
+    struct sched_entity* left = cfs_first(rq);
+    if (left && vruntime_delta(se->vruntime, left->vruntime) > (int64_t)ideal)
+        cpu->need_resched = true;
+}
+
+static void fair_tick(struct cpu* cpu, struct thread* curr) {
+    for (struct sched_entity* se = &curr->se; se && se->cfs_rq->curr == se; se = se->parent)
+        entity_tick(cpu, se->cfs_rq, se);
+}
+
+/* Compare the two where their groups meet: the entities sharing a run queue */
+static bool fair_check_preempt(struct cpu* cpu, struct thread* curr, struct thread* thread) {
+    struct sched_entity* se = &curr->se;
+    struct sched_entity* pse = &thread->se;
+
+    (void)cpu;
+    while (se->depth > pse->depth)
+        se = se->parent;
+    while (pse->depth > se->depth)
+        pse = pse->parent;
+    while (se->cfs_rq != pse->cfs_rq) {
+        se = se->parent;
+        pse = pse->parent;
+    }
+
+    /* Queued in a throttled group */
+    if (!pse->on_rq)
+        return false;
+
+    uint64_t gran = calc_delta_fair(sched_wakeup_granularity_ns, pse);
+    update_curr(se->cfs_rq);
+    return vruntime_delta(se->vruntime, pse->vruntime) > (int64_t)gran;
+}
+
+static bool fair_has_runnable(struct cpu* cpu) {
+    return rb_first_cached(&cfs_rq_of(cpu)->tasks) != NULL;
+}
+
+/* A thread joining from another class or group starts level with the queue */
+static void fair_switched_to(struct cpu* cpu, struct thread* thread) {
+    link_task(cpu, thread);
+    thread->se.vruntime = thread->se.cfs_rq->min_vruntime;
+}
+
+static void fair_yield(struct cpu* cpu, struct thread* curr) {
+    (void)cpu;
+    (void)curr;
+}
+
+static void fair_switched_from(struct cpu* cpu, struct thread* thread) {
+    (void)cpu;
+    (void)thread;
+}
+
+const struct sched_class fair_sched_class = {
+    .name = "fair",
+    .init = fair_init,
+    .enqueue = fair_enqueue,
+    .dequeue = fair_dequeue,
+    .pick_next = fair_pick_next,
+    .set_curr = fair_set_curr,
+    .put_prev = fair_put_prev,
+    .tick = fair_tick,
+    .check_preempt = fair_check_preempt,
+    .has_runnable = fair_has_runnable,
+    .yield = fair_yield,
+    .switched_to = fair_switched_to,
+    .switched_from = fair_switched_from,
+};
@@ -0,0 +1,104 @@
+/*
+ * Fixed priority scheduling class for nekkoOS
+ * SCHED_PRIO threads: the highest priority runnable thread runs and
+ * threads of equal priority share the CPU round-robin in SCHED_TIMESLICE
+ * tick slices. The class runs before the fair class, so a runnable
+ * SCHED_PRIO thread of any level keeps fair threads off the CPU.
+ */
+
+#include "types.h"
+#include "list.h"
+#include "smp.h"
+#include "sched.h"
+#include "sched_class.h"
+
+static struct list_head prio_queue[NR_CPUS][THREAD_PRIO_LEVELS];
+
+static void prio_init(struct cpu* cpu) {
+    for (uint32_t prio = 0; prio < THREAD_PRIO_LEVELS; prio++)
+        list_init(&prio_queue[cpu_index(cpu)][prio]);
+}
+
+static void prio_enqueue(struct cpu* cpu, struct thread* thread, uint32_t flags) {
+    (void)flags;
+    list_add_tail(&thread->run_entry, &prio_queue[cpu_index(cpu)][thread->priority]);
+}
+
+static void prio_dequeue(struct cpu* cpu, struct thread* thread) {
+    (void)cpu;
+    list_del(&thread->run_entry);
+    list_init(&thread->run_entry);
+}
+
+static void prio_set_curr(struct cpu* cpu, struct thread* thread) {
+    (void)cpu;
+    thread->timeslice = SCHED_TIMESLICE;
+}
+
+static struct thread* prio_pick_next(struct cpu* cpu) {
+    for (uint32_t prio = 0; prio < THREAD_PRIO_LEVELS; prio++) {
+        struct list_head* queue = &prio_queue[cpu_index(cpu)][prio];
+
+        if (!list_empty(queue)) {
+            struct thread* next = list_first_entry(queue, struct thread, run_entry);
+            prio_dequeue(cpu, next);
+            prio_set_curr(cpu, next);
+            return next;
+        }
+    }
+    return NULL;
+}
+
+static void prio_put_prev(struct cpu* cpu, struct thread* thread) {
+    (void)cpu;
+    (void)thread;
+}
+
+static void prio_tick(struct cpu* cpu, struct thread* curr) {
+    if (curr->timeslice && --curr->timeslice == 0)
+        cpu->need_resched = true;
+}
+
+static bool prio_check_preempt(struct cpu* cpu, struct thread* curr, struct thread* thread) {
+    (void)cpu;
+    return thread->priority < curr->priority;
+}
+
+static bool prio_has_runnable(struct cpu* cpu) {
+    for (uint32_t prio = 0; prio < THREAD_PRIO_LEVELS; prio++) {
+        if (!list_empty(&prio_queue[cpu_index(cpu)][prio]))
+            return true;
+    }
+    return false;
+}
+
+static void prio_switched_to(struct cpu* cpu, struct thread* thread) {
+    (void)cpu;
+    (void)thread;
+}
+
+static void prio_yield(struct cpu* cpu, struct thread* curr) {
+    (void)cpu;
+    (void)curr;
+}
+
+static void prio_switched_from(struct cpu* cpu, struct thread* thread) {
+    (void)cpu;
+    (void)thread;
+}
+
+const struct sched_class prio_sched_class = {
+    .name = "prio",
+    .init = prio_init,
+    .enqueue = prio_enqueue,
+    .dequeue = prio_dequeue,
+    .pick_next = prio_pick_next,
+    .set_curr = prio_set_curr,
+    .put_prev = prio_put_prev,
+    .tick = prio_tick,
+    .check_preempt = prio_check_preempt,
+    .has_runnable = prio_has_runnable,
+    .yield = prio_yield,
+    .switched_to = prio_switched_to,
+    .switched_from = prio_switched_from,
+};
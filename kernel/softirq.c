@@ -0,0 +1,194 @@
+/*
+ * Softirqs and tasklets for nekkoOS
+ * Bottom halves raised by interrupt handlers run on interrupt exit with
+ * interrupts enabled. A run is bounded by SOFTIRQ_MAX_RESTART passes and
+ * softirq.budget_us; anything raised beyond that is handed to ksoftirqd
+ * so a flood of interrupts cannot starve threads.
+ */
+
+#include "types.h"
+#include "irqflags.h"
+#include "smp.h"
+#include "sched.h"
+#include "softirq.h"
+#include "timer.h"
+#include "param.h"
+#include "init.h"
+#include "errno.h"
+#include "kernel.h"
+#include "export.h"
+
+static softirq_action_t softirq_vec[NR_SOFTIRQS];
+
+static uint32_t softirq_budget_us = SOFTIRQ_BUDGET_US;
+param_uint("softirq.budget_us", softirq_budget_us);
+
+/* Per-CPU tasklet queues and ksoftirqd */
+struct tasklet_queue {
+    struct tasklet* head;
+    struct tasklet** tail;
+};
+
+static struct tasklet_queue tasklet_queues[NR_CPUS];
+static struct tasklet_queue tasklet_hi_queues[NR_CPUS];
+static struct wait_queue_head softirqd_wait[NR_CPUS];
+static struct thread* softirqd_threads[NR_CPUS];
+
+void open_softirq(int nr, softirq_action_t action) {
+    softirq_vec[nr] = action;
+}
+
+static void wakeup_softirqd(void) {
+    if (softirqd_threads[smp_processor_id()])
+        wake_up(&softirqd_wait[smp_processor_id()]);
+}
+
+void raise_softirq_irqoff(int nr) {
+    this_cpu()->softirq_pending |= BIT(nr);
+
+    /* Outside interrupt context no interrupt exit is coming to run it */
+    if (!in_interrupt())
+        wakeup_softirqd();
+}
+
+void raise_softirq(int nr) {
+    uint32_t flags = local_irq_save();
+    raise_softirq_irqoff(nr);
+    local_irq_restore(flags);
+}
+
+/* Run pending softirqs; called with interrupts disabled */
+static void __do_softirq(void) {
+    struct cpu* cpu = this_cpu();
+    uint32_t khz = timer_tsc_khz();
+    uint64_t deadline = rdtsc() + div_u64((uint64_t)softirq_budget_us * khz, 1000);
+    int restart = SOFTIRQ_MAX_RESTART;
+    uint32_t pending;
+
+    cpu->preempt_count += SOFTIRQ_OFFSET;
+    while ((pending = cpu->softirq_pending)) {
+        cpu->softirq_pending = 0;
+        local_irq_enable();
+
+        for (int nr = 0; pending; nr++, pending >>= 1) {
+            if ((pending & 1) && softirq_vec[nr])
+                softirq_vec[nr]();
+        }
+
+        local_irq_disable();
+        if (cpu->softirq_pending && (--restart == 0 || rdtsc() >= deadline)) {
+            wakeup_softirqd();
+            break;
+        }
+    }
+    cpu->preempt_count -= SOFTIRQ_OFFSET;
+}
+
+/* Interrupt exit path (irq.c), interrupts disabled */
+void invoke_softirq(void) {
+    __do_softirq();
+}
+
+void do_softirq(void) {
+    if (in_interrupt())
+        return;
+
+    uint32_t flags = local_irq_save();
+    if (this_cpu()->softirq_pending)
+        __do_softirq();
+    local_irq_restore(flags);
+}
+
+static void ksoftirqd(void* arg) {
+    uint32_t cpu = (uint32_t)arg;
+
+    for (;;) {
+        wait_event(softirqd_wait[cpu], cpus[cpu].softirq_pending);
+        do_softirq();
+        if (cpus[cpu].need_resched)
+            schedule();
+    }
+}
+
+void tasklet_init(struct tasklet* tasklet, void (*func)(uint32_t data), uint32_t data) {
+    tasklet->next = NULL;
+    tasklet->state = 0;
+    tasklet->func = func;
+    tasklet->data = data;
+}
+EXPORT_SYMBOL(tasklet_init);
+
+static void tasklet_enqueue(struct tasklet* tasklet, struct tasklet_queue* queue, int nr) {
+    uint32_t flags = local_irq_save();
+
+    if (!(tasklet->state & TASKLET_SCHEDULED)) {
+        tasklet->state |= TASKLET_SCHEDULED;
+        tasklet->next = NULL;
+        *queue->tail = tasklet;
+        queue->tail = &tasklet->next;
+        raise_softirq_irqoff(nr);
+    }
+    local_irq_restore(flags);
+}
+
+void tasklet_schedule(struct tasklet* tasklet) {
+    tasklet_enqueue(tasklet, &tasklet_queues[smp_processor_id()], TASKLET_SOFTIRQ);
+}
+EXPORT_SYMBOL(tasklet_schedule);
+
+void tasklet_hi_schedule(struct tasklet* tasklet) {
+    tasklet_enqueue(tasklet, &tasklet_hi_queues[smp_processor_id()], HI_SOFTIRQ);
+}
+
+static void tasklet_run(struct tasklet_queue* queue) {
+    uint32_t flags = local_irq_save();
+    struct tasklet* list = queue->head;
+
+    queue->head = NULL;
+    queue->tail = &queue->head;
+    local_irq_restore(flags);
+
+    while (list) {
+        struct tasklet* tasklet = list;
+        list = list->next;
+
+        /* Cleared first so the tasklet may reschedule itself */
+        tasklet->state &= ~TASKLET_SCHEDULED;
+        tasklet->func(tasklet->data);
+    }
+}
+
+static void tasklet_action(void) {
+    tasklet_run(&tasklet_queues[smp_processor_id()]);
+}
+
+static void tasklet_hi_action(void) {
+    tasklet_run(&tasklet_hi_queues[smp_processor_id()]);
+}
+
+/* Softirq initialization */
+int __init init_softirq(void) {
+    kprintf("Initializing softirqs...\n");
+
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        tasklet_queues[cpu].head = NULL;
+        tasklet_queues[cpu].tail = &tasklet_queues[cpu].head;
+        tasklet_hi_queues[cpu].head = NULL;
+        tasklet_hi_queues[cpu].tail = &tasklet_hi_queues[cpu].head;
+        wait_queue_init(&softirqd_wait[cpu]);
+    }
+    open_softirq(HI_SOFTIRQ, tasklet_hi_action);
+    open_softirq(TASKLET_SOFTIRQ, tasklet_action);
+
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct spawn_attr attr = { .flags = SPAWN_BIND, .priority = THREAD_PRIO_NORMAL, .cpu = cpu };
+
+        softirqd_threads[cpu] = thread_spawn("ksoftirqd", ksoftirqd, (void*)cpu, &attr);
+        if (!softirqd_threads[cpu])
+            return -ENOMEM;
+    }
+
+    kprintf("Softirqs initialized.\n");
+    return 0;
+}
+initcall_depends(init_softirq, 2, "init_sched");
@@ -5,14 +5,40 @@
 
 #include "include/string.h"
 #include "include/types.h"
+#include "cpufeature.h"
+#include "timer.h"
+#include "bench.h"
+#include "export.h"
 
-/* String length function */
+/*
+ * Copies of at least this size use rep movsb/stosb on ERMS CPUs; below
+ * it the microcode startup costs more than the word moves save, unless
+ * the CPU also has FSRM (copies only).
+ */
+#define REP_STRING_THRESHOLD 256
+
+/* Aligned word loads that may alias any object */
+typedef uint32_t __attribute__((may_alias)) word_t;
+
+/*
+ * String length a word at a time. Loads are aligned, so a word never
+ * reaches into the page after the terminator.
+ */
 size_t strlen(const char* str) {
-    size_t len = 0;
-    while (str[len])
-        len++;
-    return len;
+    const char* p = str;
+    const word_t* w;
+
+    for (; !IS_ALIGNED((uint32_t)p, 4); p++) {
+        if (!*p)
+            return p - str;
+    }
+    for (w = (const word_t*)p; !has_zero_byte(*w); w++)
+        ;
+    for (p = (const char*)w; *p; p++)
+        ;
+    return p - str;
 }
+EXPORT_SYMBOL(strlen);
 
 /* String copy */
 char* strcpy(char* dest, const char* src) {
@@ -20,6 +46,7 @@ char* strcpy(char* dest, const char* src) {
     while ((*dest++ = *src++));
     return orig_dest;
 }
+EXPORT_SYMBOL(strcpy);
 
 /* String copy with length limit */
 char* strncpy(char* dest, const char* src, size_t n) {
@@ -29,6 +56,7 @@ char* strncpy(char* dest, const char* src, size_t n) {
         *dest++ = '\0';
     return orig_dest;
 }
+EXPORT_SYMBOL(strncpy);
 
 /* String concatenation */
 char* strcat(char* dest, const char* src) {
@@ -46,6 +74,7 @@ int strcmp(const char* str1, const char* str2) {
     }
     return *(const unsigned char*)str1 - *(const unsigned char*)str2;
 }
+EXPORT_SYMBOL(strcmp);
 
 /* String comparison with length limit */
 int strncmp(const char* str1, const char* str2, size_t n) {
@@ -57,6 +86,7 @@ int strncmp(const char* str1, const char* str2, size_t n) {
         return 0;
     return *(const unsigned char*)str1 - *(const unsigned char*)str2;
 }
+EXPORT_SYMBOL(strncmp);
 
 /* Find character in string */
 char* strchr(const char* str, int c) {
@@ -67,40 +97,106 @@ char* strchr(const char* str, int c) {
     }
     return (*str == c) ? (char*)str : NULL;
 }
+EXPORT_SYMBOL(strchr);
+
+/* Find last occurrence of character in string */
+char* strrchr(const char* str, int c) {
+    const char* last = NULL;
+
+    do {
+        if (*str == c)
+            last = str;
+    } while (*str++);
+    return (char*)last;
+}
+EXPORT_SYMBOL(strrchr);
 
-/* Memory set function */
+/*
+ * Fill with string stores: align the destination with stosb, store whole
+ * words with stosl, finish with stosb. ERMS CPUs do long fills in one
+ * rep stosb.
+ */
 void* memset(void* ptr, int value, size_t num) {
-    unsigned char* p = (unsigned char*)ptr;
-    while (num--)
-        *p++ = (unsigned char)value;
+    uint32_t pattern = (uint8_t)value * 0x01010101U;
+    uint32_t d0, d1, d2;
+
+    if (num >= REP_STRING_THRESHOLD && boot_cpu_has(X86_FEATURE_ERMS)) {
+        __asm__ volatile ("rep stosb" : "=c"(d0), "=D"(d1) : "0"(num), "1"(ptr), "a"(pattern) : "memory");
+        return ptr;
+    }
+
+    __asm__ volatile (
+        "   cmpl $7, %0\n"
+        "   jbe 1f\n"
+        "   movl %1, %0\n"
+        "   negl %0\n"
+        "   andl $3, %0\n"
+        "   subl %0, %2\n"
+        "   rep stosb\n"
+        "   movl %2, %0\n"
+        "   shrl $2, %0\n"
+        "   andl $3, %2\n"
+        "   rep stosl\n"
+        "   movl %2, %0\n"
+        "1: rep stosb\n"
+        : "=&c"(d0), "=&D"(d1), "=r"(d2)
+        : "2"(num), "0"(num), "1"(ptr), "a"(pattern)
+        : "memory");
     return ptr;
 }
+EXPORT_SYMBOL(memset);
 
-/* Memory copy function */
+/*
+ * Copy with string moves, as __copy_user does: align the destination
+ * with movsb, move whole words with movsl, finish with movsb. ERMS CPUs
+ * do long copies in one rep movsb, FSRM CPUs every copy.
+ */
 void* memcpy(void* dest, const void* src, size_t num) {
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
-    while (num--)
-        *d++ = *s++;
+    uint32_t d0, d1, d2, d3;
+
+    if (boot_cpu_has(X86_FEATURE_FSRM) ||
+        (num >= REP_STRING_THRESHOLD && boot_cpu_has(X86_FEATURE_ERMS))) {
+        __asm__ volatile ("rep movsb" : "=c"(d0), "=D"(d1), "=S"(d2) : "0"(num), "1"(dest), "2"(src) : "memory");
+        return dest;
+    }
+
+    __asm__ volatile (
+        "   cmpl $7, %0\n"
+        "   jbe 1f\n"
+        "   movl %1, %0\n"
+        "   negl %0\n"
+        "   andl $3, %0\n"
+        "   subl %0, %3\n"
+        "   rep movsb\n"
+        "   movl %3, %0\n"
+        "   shrl $2, %0\n"
+        "   andl $3, %3\n"
+        "   rep movsl\n"
+        "   movl %3, %0\n"
+        "1: rep movsb\n"
+        : "=&c"(d0), "=&D"(d1), "=&S"(d2), "=r"(d3)
+        : "3"(num), "0"(num), "1"(dest), "2"(src)
+        : "memory");
     return dest;
 }
+EXPORT_SYMBOL(memcpy);
 
 /* Memory move function (handles overlapping regions) */
 void* memmove(void* dest, const void* src, size_t num) {
     unsigned char* d = (unsigned char*)dest;
     const unsigned char* s = (const unsigned char*)src;
-    
-    if (d < s) {
-        while (num--)
-            *d++ = *s++;
-    } else {
-        d += num;
-        s += num;
-        while (num--)
-            *--d = *--s;
-    }
+
+    /* A forward copy only overwrites source bytes it has already read */
+    if (d <= s || d >= s + num)
+        return memcpy(dest, src, num);
+
+    d += num;
+    s += num;
+    while (num--)
+        *--d = *--s;
     return dest;
 }
+EXPORT_SYMBOL(memmove);
 
 /* Memory comparison */
 int memcmp(const void* ptr1, const void* ptr2, size_t num) {
@@ -115,14 +211,25 @@ int memcmp(const void* ptr1, const void* ptr2, size_t num) {
     }
     return 0;
 }
+EXPORT_SYMBOL(memcmp);
 
-/* Memory search function */
+/* Memory search a word at a time: a match is a zero byte after XOR with the pattern */
 void* memchr(const void* ptr, int value, size_t num) {
     const unsigned char* p = (const unsigned char*)ptr;
-    while (num--) {
-        if (*p == (unsigned char)value)
+    unsigned char c = (unsigned char)value;
+    uint32_t pattern = c * 0x01010101U;
+
+    for (; num && !IS_ALIGNED((uint32_t)p, 4); num--, p++) {
+        if (*p == c)
+            return (void*)p;
+    }
+    for (; num >= 4; num -= 4, p += 4) {
+        if (has_zero_byte(*(const word_t*)p ^ pattern))
+            break;
+    }
+    for (; num; num--, p++) {
+        if (*p == c)
             return (void*)p;
-        p++;
     }
     return NULL;
 }
@@ -158,6 +265,55 @@ int atoi(const char* str) {
     return sign * result;
 }
 
+/* "00" to "99": decimal conversion writes two digits per division */
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* Decimal digits in value */
+static inline uint32_t dec_digits(uint32_t value) {
+    static const uint32_t powers[] = {
+        10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+    };
+    uint32_t digits = 1;
+
+    while (digits < 10 && value >= powers[digits - 1])
+        digits++;
+    return digits;
+}
+
+/*
+ * Base 10 from the end, two digits per division by 100 (a multiply) and
+ * no reversal pass, instead of a division per digit.
+ */
+static char* format_dec(uint32_t value, char* str) {
+    char* end = str + dec_digits(value);
+
+    *end = '\0';
+    while (value >= 100) {
+        uint32_t pair = (value % 100) * 2;
+
+        value /= 100;
+        *--end = digit_pairs[pair + 1];
+        *--end = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        *--end = digit_pairs[value * 2 + 1];
+        *--end = digit_pairs[value * 2];
+    } else {
+        *--end = '0' + value;
+    }
+    return str;
+}
+
 /* Integer to string conversion */
 char* itoa(int value, char* str, int base) {
     char* ptr = str;
@@ -171,11 +327,13 @@ char* itoa(int value, char* str, int base) {
         return str;
     }
     
-    /* Handle negative numbers for base 10 */
-    if (value < 0 && base == 10) {
-        *ptr++ = '-';
-        value = -value;
-        ptr1++;
+    /* Base 10 is signed; the magnitude of INT_MIN only fits unsigned */
+    if (base == 10) {
+        if (value >= 0)
+            return format_dec(value, str);
+        *str = '-';
+        format_dec(0U - (unsigned int)value, str + 1);
+        return str;
     }
     
     /* Convert to string (in reverse) */
@@ -210,6 +368,8 @@ char* utoa(unsigned int value, char* str, int base) {
         *str = '\0';
         return str;
     }
+    if (base == 10)
+        return format_dec(value, str);
     
     /* Convert to string (in reverse) */
     do {
@@ -295,4 +455,197 @@ void hex_to_string(unsigned int value, char* buffer, bool uppercase) {
         buffer[2 + (7 - i)] = hex_chars[(value >> (i * 4)) & 0xF];
     }
     buffer[10] = '\0';
-}
\ No newline at end of file
+}
+/*
+ * The word and string-move routines against the byte loops they
+ * replaced, for a typical syscall argument and a page. The empty asm
+ * keeps GCC from turning the byte loops back into calls to the
+ * routines under test.
+ */
+#define STRING_BENCH_ROUNDS 1000
+#define STRING_BENCH_MAX    4096
+
+enum {
+    STRING_BENCH_MEMCPY,
+    STRING_BENCH_MEMSET,
+    STRING_BENCH_STRLEN,
+    STRING_BENCH_MEMCHR,
+};
+
+static const struct {
+    const char* metric;
+    const char* bytewise_metric;
+    int op;
+    size_t length;
+} string_bench_cases[] = {
+    { "memcpy_64", "memcpy_64_bytewise", STRING_BENCH_MEMCPY, 64 },
+    { "memcpy_4096", "memcpy_4096_bytewise", STRING_BENCH_MEMCPY, 4096 },
+    { "memset_64", "memset_64_bytewise", STRING_BENCH_MEMSET, 64 },
+    { "memset_4096", "memset_4096_bytewise", STRING_BENCH_MEMSET, 4096 },
+    { "strlen_64", "strlen_64_bytewise", STRING_BENCH_STRLEN, 64 },
+    { "strlen_4096", "strlen_4096_bytewise", STRING_BENCH_STRLEN, 4096 },
+    { "memchr_64", "memchr_64_bytewise", STRING_BENCH_MEMCHR, 64 },
+    { "memchr_4096", "memchr_4096_bytewise", STRING_BENCH_MEMCHR, 4096 },
+};
+
+static char string_bench_src[STRING_BENCH_MAX] ALIGN(4);
+static char string_bench_dst[STRING_BENCH_MAX] ALIGN(4);
+
+static void memcpy_bytewise(void* dest, const void* src, size_t num) {
+    unsigned char* d = dest;
+    const unsigned char* s = src;
+
+    while (num--) {
+        *d++ = *s++;
+        __asm__ volatile ("" : : : "memory");
+    }
+}
+
+static void memset_bytewise(void* ptr, int value, size_t num) {
+    unsigned char* p = ptr;
+
+    while (num--) {
+        *p++ = (unsigned char)value;
+        __asm__ volatile ("" : : : "memory");
+    }
+}
+
+static size_t strlen_bytewise(const char* str) {
+    size_t len = 0;
+
+    while (str[len]) {
+        len++;
+        __asm__ volatile ("" : : : "memory");
+    }
+    return len;
+}
+
+static const void* memchr_bytewise(const void* ptr, int value, size_t num) {
+    const unsigned char* p = ptr;
+
+    for (; num--; p++) {
+        if (*p == (unsigned char)value)
+            return p;
+        __asm__ volatile ("" : : : "memory");
+    }
+    return NULL;
+}
+
+static uint64_t string_bench_run(int op, size_t length, bool bytewise) {
+    volatile uint32_t sink = 0;
+    uint64_t start = rdtsc();
+
+    for (int i = 0; i < STRING_BENCH_ROUNDS; i++) {
+        switch (op) {
+        case STRING_BENCH_MEMCPY:
+            if (bytewise)
+                memcpy_bytewise(string_bench_dst, string_bench_src, length);
+            else
+                memcpy(string_bench_dst, string_bench_src, length);
+            break;
+        case STRING_BENCH_MEMSET:
+            if (bytewise)
+                memset_bytewise(string_bench_dst, i, length);
+            else
+                memset(string_bench_dst, i, length);
+            break;
+        case STRING_BENCH_STRLEN:
+            sink = bytewise ? strlen_bytewise(string_bench_src) : strlen(string_bench_src);
+            break;
+        case STRING_BENCH_MEMCHR:
+            sink = (uint32_t)(bytewise ? memchr_bytewise(string_bench_src, 'b', length)
+                                       : memchr(string_bench_src, 'b', length));
+            break;
+        }
+    }
+    (void)sink;
+    return rdtsc() - start;
+}
+
+static uint32_t string_bench_ns(uint64_t cycles, uint32_t khz) {
+    return (uint32_t)div_u64(div_u64(cycles, STRING_BENCH_ROUNDS) * 1000000, khz);
+}
+
+static void string_benchmark(void) {
+    uint32_t khz = timer_tsc_khz();
+
+    if (!khz)
+        return;
+
+    for (size_t i = 0; i < ARRAY_SIZE(string_bench_cases); i++) {
+        size_t length = string_bench_cases[i].length;
+        int op = string_bench_cases[i].op;
+
+        /* strlen stops at the terminator, memchr finds the 'b' */
+        memset(string_bench_src, 'a', length);
+        string_bench_src[length - 1] = op == STRING_BENCH_MEMCHR ? 'b' : '\0';
+
+        bench_report("string", string_bench_cases[i].metric,
+                     string_bench_ns(string_bench_run(op, length, false), khz), "ns");
+        bench_report("string", string_bench_cases[i].bytewise_metric,
+                     string_bench_ns(string_bench_run(op, length, true), khz), "ns");
+    }
+}
+KERNEL_BENCH("string", string_benchmark);
+
+/*
+ * Decimal conversion against the division-per-digit loop it replaced,
+ * over values of every length. The empty asm keeps GCC from merging the
+ * divisions of the old loop.
+ */
+#define FORMAT_BENCH_VALUES 1000
+
+static char* utoa_divide(unsigned int value, char* str) {
+    char* ptr = str;
+    char* ptr1 = str;
+
+    do {
+        *ptr++ = '0' + value % 10;
+        value /= 10;
+        __asm__ volatile ("" : "+r"(value));
+    } while (value);
+    *ptr-- = '\0';
+
+    while (ptr1 < ptr) {
+        char tmp_char = *ptr;
+        *ptr-- = *ptr1;
+        *ptr1++ = tmp_char;
+    }
+    return str;
+}
+
+static uint32_t format_bench_values[FORMAT_BENCH_VALUES];
+
+static uint64_t format_bench_run(bool divide) {
+    char buffer[12];
+    uint64_t start = rdtsc();
+
+    for (int i = 0; i < FORMAT_BENCH_VALUES; i++) {
+        if (divide)
+            utoa_divide(format_bench_values[i], buffer);
+        else
+            utoa(format_bench_values[i], buffer, 10);
+        __asm__ volatile ("" : : "r"(buffer) : "memory");
+    }
+    return rdtsc() - start;
+}
+
+static void format_benchmark(void) {
+    uint32_t khz = timer_tsc_khz();
+    uint32_t seed = 1;
+
+    if (!khz)
+        return;
+
+    /* Shift by 0 to 31 bits: as many short numbers as long ones */
+    for (int i = 0; i < FORMAT_BENCH_VALUES; i++) {
+        seed = seed * 1664525 + 1013904223;
+        format_bench_values[i] = seed >> (i % 32);
+    }
+
+    uint64_t cycles = format_bench_run(false);
+    bench_report("format", "utoa_10", (uint32_t)div_u64(div_u64(cycles, FORMAT_BENCH_VALUES) * 1000000, khz), "ns");
+    cycles = format_bench_run(true);
+    bench_report("format", "utoa_10_divide", (uint32_t)div_u64(div_u64(cycles, FORMAT_BENCH_VALUES) * 1000000, khz), "ns");
+}
+KERNEL_BENCH("format", format_benchmark);
@@ -0,0 +1,48 @@
+/*
+ * System call entry for nekkoOS
+ * Vector 0x80 is an interrupt gate callable from ring 3. The handler
+ * runs with interrupts enabled again and looks the call up in a table
+ * indexed by the number in EAX; handlers take their arguments as
+ * ordinary C parameters.
+ */
+
+#include "types.h"
+#include "idt.h"
+#include "irqflags.h"
+#include "syscall.h"
+#include "init.h"
+#include "errno.h"
+#include "kernel.h"
+
+/* Entry stub (interrupt.s) */
+extern void isr128(void);
+
+/* Handlers have their own prototypes; the cast goes through the generic function type */
+#define SYSCALL(nr, fn)     [nr] = (syscall_t)(void (*)(void))(fn)
+
+static const syscall_t syscall_table[SYSCALL_COUNT] = {
+    SYSCALL(SYS_REBOOT, sys_reboot),
+    SYSCALL(SYS_KEXEC_LOAD, sys_kexec_load),
+    SYSCALL(SYS_INIT_MODULE, sys_init_module),
+    SYSCALL(SYS_DELETE_MODULE, sys_delete_module),
+};
+
+void syscall_dispatch(struct interrupt_frame* frame) {
+    uint32_t nr = frame->eax;
+
+    if (nr >= SYSCALL_COUNT || !syscall_table[nr]) {
+        frame->eax = (uint32_t)-ENOSYS;
+        return;
+    }
+
+    if (frame->eflags & EFLAGS_IF)
+        local_irq_enable();
+    frame->eax = syscall_table[nr](frame->ebx, frame->ecx, frame->edx, frame->esi, frame->edi);
+    local_irq_disable();
+}
+
+int __init init_syscalls(void) {
+    idt_set_gate(SYSCALL_VECTOR, isr128, IDT_PRESENT | IDT_RING3 | IDT_INTERRUPT_GATE);
+    return 0;
+}
+initcall_depends(init_syscalls, 0, "init_idt");
@@ -0,0 +1,347 @@
+/*
+ * Workqueues for nekkoOS
+ * Work items run in process context on per-CPU worker pools shared by
+ * all workqueues. A pool keeps exactly one worker running while it has
+ * work: the scheduler tells the pool when a worker blocks, and an idle
+ * worker (or a new one) picks up the remaining items. When the blocked
+ * worker returns the extra worker goes idle again, so pools neither
+ * serialize behind a sleeping work item nor oversubscribe the CPU.
+ *
+ * Workers are bound to their pool's CPU. Work queued on a CPU isolated
+ * by isolcpus= goes to the first housekeeping CPU's pool instead.
+ */
+
+#include "types.h"
+#include "list.h"
+#include "irqflags.h"
+#include "smp.h"
+#include "cpumask.h"
+#include "sched.h"
+#include "cgroup.h"
+#include "workqueue.h"
+#include "timer.h"
+#include "bench.h"
+#include "init.h"
+#include "errno.h"
+#include "kernel.h"
+#include "export.h"
+
+enum {
+    POOL_NORMAL,
+    POOL_HIGHPRI,
+    NR_POOLS
+};
+
+struct worker {
+    struct thread* thread;
+    struct worker_pool* pool;
+    struct work_struct* current_work;
+    struct list_head idle_entry;
+    bool idle;
+    bool sleeping;              /* Blocked and not counted in nr_running */
+};
+
+struct worker_pool {
+    const char* name;
+    uint32_t cpu;
+    uint32_t priority;
+    struct list_head worklist;
+    struct list_head idle_list;
+    uint32_t nr_workers;
+    uint32_t nr_running;        /* Workers that are runnable */
+    struct wait_queue_head done_wait;
+    struct worker workers[WORKER_POOL_MAX];
+};
+
+struct workqueue_struct {
+    const char* name;
+    uint32_t flags;
+};
+
+static struct worker_pool worker_pools[NR_CPUS][NR_POOLS];
+static struct workqueue_struct workqueues[WORKQUEUE_MAX];
+static uint32_t nr_workqueues;
+
+struct workqueue_struct* system_wq;
+EXPORT_SYMBOL(system_wq);
+struct workqueue_struct* system_highpri_wq;
+
+static void worker_thread(void* arg);
+
+static struct worker_pool* wq_pool(struct workqueue_struct* wq) {
+    uint32_t cpu = smp_processor_id();
+
+    if (cpu_is_isolated(cpu))
+        cpu = cpumask_first(housekeeping_cpumask());
+    return &worker_pools[cpu][(wq->flags & WQ_HIGHPRI) ? POOL_HIGHPRI : POOL_NORMAL];
+}
+
+static bool need_more_worker(struct worker_pool* pool) {
+    return !list_empty(&pool->worklist) && pool->nr_running == 0;
+}
+
+static bool keep_working(struct worker_pool* pool) {
+    return !list_empty(&pool->worklist) && pool->nr_running <= 1;
+}
+
+/* Start a new worker; called with interrupts disabled */
+static struct worker* create_worker(struct worker_pool* pool) {
+    for (int i = 0; i < WORKER_POOL_MAX; i++) {
+        struct worker* worker = &pool->workers[i];
+        if (worker->thread && worker->thread->state != THREAD_DEAD)
+            continue;
+
+        worker->pool = pool;
+        worker->current_work = NULL;
+        worker->idle = false;
+        worker->sleeping = false;
+        list_init(&worker->idle_entry);
+
+        /* Work items come from every group; the creator's limits are not theirs */
+        struct spawn_attr attr = {
+            .flags = SPAWN_BIND | SPAWN_SETCGROUP,
+            .priority = pool->priority,
+            .cpu = pool->cpu,
+            .cgroup = &root_cgroup,
+        };
+
+        worker->thread = thread_spawn(pool->name, worker_thread, worker, &attr);
+        if (!worker->thread)
+            return NULL;
+        worker->thread->flags |= THREAD_WORKER;
+        worker->thread->worker = worker;
+        pool->nr_workers++;
+        pool->nr_running++;
+        return worker;
+    }
+    return NULL;
+}
+
+static void wake_up_worker(struct worker_pool* pool) {
+    if (!list_empty(&pool->idle_list)) {
+        struct worker* worker = list_first_entry(&pool->idle_list, struct worker, idle_entry);
+        thread_wake(worker->thread);
+    } else {
+        create_worker(pool);
+    }
+}
+
+void wq_worker_sleeping(struct thread* thread) {
+    struct worker* worker = thread->worker;
+    struct worker_pool* pool = worker->pool;
+
+    if (worker->sleeping)
+        return;
+    worker->sleeping = true;
+    pool->nr_running--;
+
+    /* Keep the pool busy while this worker is blocked */
+    if (need_more_worker(pool))
+        wake_up_worker(pool);
+}
+
+void wq_worker_waking_up(struct thread* thread) {
+    struct worker* worker = thread->worker;
+
+    if (!worker->sleeping)
+        return;
+    worker->sleeping = false;
+    worker->pool->nr_running++;
+}
+
+static void worker_thread(void* arg) {
+    struct worker* worker = arg;
+    struct worker_pool* pool = worker->pool;
+
+    for (;;) {
+        local_irq_disable();
+        if (worker->idle) {
+            list_del(&worker->idle_entry);
+            worker->idle = false;
+        }
+
+        while (keep_working(pool)) {
+            struct work_struct* work = list_first_entry(&pool->worklist, struct work_struct, entry);
+            list_del(&work->entry);
+            work->flags &= ~WORK_PENDING;
+            worker->current_work = work;
+
+            local_irq_enable();
+            work->func(work);
+            local_irq_disable();
+
+            worker->current_work = NULL;
+            wake_up(&pool->done_wait);
+        }
+
+        /* Nothing left for this worker: park on the idle list */
+        worker->idle = true;
+        list_add(&worker->idle_entry, &pool->idle_list);
+        worker->thread->state = THREAD_SLEEPING;
+        schedule();
+    }
+}
+
+/* Queue on the current CPU's pool, or a housekeeping one; called with interrupts disabled */
+static void __queue_work(struct workqueue_struct* wq, struct work_struct* work) {
+    struct worker_pool* pool = wq_pool(wq);
+
+    work->pool = pool;
+    list_add_tail(&work->entry, &pool->worklist);
+    if (need_more_worker(pool))
+        wake_up_worker(pool);
+}
+
+/* Returns false if the work was already pending */
+bool queue_work(struct workqueue_struct* wq, struct work_struct* work) {
+    uint32_t flags = local_irq_save();
+    bool queued = !(work->flags & WORK_PENDING);
+
+    if (queued) {
+        work->flags |= WORK_PENDING;
+        __queue_work(wq, work);
+    }
+    local_irq_restore(flags);
+    return queued;
+}
+EXPORT_SYMBOL(queue_work);
+
+static void delayed_work_timer(struct timer_list* timer) {
+    struct delayed_work* dwork = CONTAINER_OF(timer, struct delayed_work, timer);
+    uint32_t flags = local_irq_save();
+
+    __queue_work(dwork->wq, &dwork->work);
+    local_irq_restore(flags);
+}
+
+bool queue_delayed_work(struct workqueue_struct* wq, struct delayed_work* dwork, uint32_t delay_ms) {
+    uint32_t flags = local_irq_save();
+    bool queued = !(dwork->work.flags & WORK_PENDING);
+
+    if (queued) {
+        dwork->work.flags |= WORK_PENDING;
+        dwork->wq = wq;
+        if (delay_ms == 0)
+            __queue_work(wq, &dwork->work);
+        else
+            mod_timer(&dwork->timer, jiffies + msecs_to_jiffies(delay_ms));
+    }
+    local_irq_restore(flags);
+    return queued;
+}
+EXPORT_SYMBOL(queue_delayed_work);
+
+/* Cancel a delayed work whose timer has not fired yet */
+bool cancel_delayed_work(struct delayed_work* dwork) {
+    uint32_t flags = local_irq_save();
+    bool cancelled = del_timer(&dwork->timer);
+
+    if (cancelled)
+        dwork->work.flags &= ~WORK_PENDING;
+    local_irq_restore(flags);
+    return cancelled;
+}
+EXPORT_SYMBOL(cancel_delayed_work);
+
+void work_init(struct work_struct* work, work_func_t func) {
+    list_init(&work->entry);
+    work->func = func;
+    work->flags = 0;
+    work->pool = NULL;
+}
+EXPORT_SYMBOL(work_init);
+
+void delayed_work_init(struct delayed_work* dwork, work_func_t func) {
+    work_init(&dwork->work, func);
+    timer_setup(&dwork->timer, delayed_work_timer);
+    dwork->wq = NULL;
+}
+EXPORT_SYMBOL(delayed_work_init);
+
+static bool work_busy(struct work_struct* work) {
+    struct worker_pool* pool = work->pool;
+    uint32_t flags = local_irq_save();
+    bool busy = work->flags & WORK_PENDING;
+
+    for (int i = 0; pool && !busy && i < WORKER_POOL_MAX; i++) {
+        if (pool->workers[i].current_work == work)
+            busy = true;
+    }
+    local_irq_restore(flags);
+    return busy;
+}
+
+/* Wait until the work is neither queued nor running */
+void flush_work(struct work_struct* work) {
+    if (!work->pool)
+        return;
+    wait_event(work->pool->done_wait, !work_busy(work));
+}
+EXPORT_SYMBOL(flush_work);
+
+struct workqueue_struct* alloc_workqueue(const char* name, uint32_t flags) {
+    if (nr_workqueues == WORKQUEUE_MAX)
+        return NULL;
+
+    struct workqueue_struct* wq = &workqueues[nr_workqueues++];
+    wq->name = name;
+    wq->flags = flags;
+    return wq;
+}
+EXPORT_SYMBOL(alloc_workqueue);
+
+/* Workqueue initialization: one worker per pool to start with */
+int __init init_workqueues(void) {
+    kprintf("Initializing workqueues...\n");
+
+    uint32_t flags = local_irq_save();
+    for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+        for (int i = 0; i < NR_POOLS; i++) {
+            struct worker_pool* pool = &worker_pools[cpu][i];
+
+            pool->name = i == POOL_HIGHPRI ? "kworker/H" : "kworker";
+            pool->cpu = cpu;
+            pool->priority = i == POOL_HIGHPRI ? THREAD_PRIO_HIGH : THREAD_PRIO_NORMAL;
+            list_init(&pool->worklist);
+            list_init(&pool->idle_list);
+            wait_queue_init(&pool->done_wait);
+            if (!create_worker(pool)) {
+                local_irq_restore(flags);
+                return -ENOMEM;
+            }
+        }
+    }
+    local_irq_restore(flags);
+
+    system_wq = alloc_workqueue("events", 0);
+    system_highpri_wq = alloc_workqueue("events_highpri", WQ_HIGHPRI);
+
+    kprintf("Workqueues initialized.\n");
+    return 0;
+}
+initcall_depends(init_workqueues, 2, "init_sched");
+
+/* Queue-to-completion latency of an empty work item */
+#define WQ_BENCH_ROUNDS     100
+
+static void wq_bench_func(struct work_struct* work) {
+    (void)work;
+}
+
+static void workqueue_benchmark(void) {
+    struct work_struct work;
+    uint32_t khz = timer_tsc_khz();
+
+    if (!khz)
+        return;
+
+    work_init(&work, wq_bench_func);
+    uint64_t start = rdtsc();
+    for (int i = 0; i < WQ_BENCH_ROUNDS; i++) {
+        schedule_work(&work);
+        flush_work(&work);
+    }
+    uint64_t cycles = div_u64(rdtsc() - start, WQ_BENCH_ROUNDS);
+    bench_report("workqueue", "queue_flush", (uint32_t)div_u64(cycles * 1000000, khz), "ns");
+}
+KERNEL_BENCH("workqueue", workqueue_benchmark);
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""
+nekkoOS Kernel Profile Extractor
+Writes the .gcda files of a PGO=gen kernel from the "gcov:" lines its
+gcov_dump() (kernel/gcov.c) printed on the serial console. Each object's
+counters go to the path the compiler recorded for it, next to the object
+file, where the PGO=use build of the same tree looks for them.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+
+def read_dump(path):
+    """[(gcda path, bytes)] from a console log"""
+    files = []
+    current = None
+    with open(path, 'r', errors='replace') as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith('gcov: '):
+                continue
+            payload = line[len('gcov: '):]
+            if payload.startswith('file '):
+                current = (payload[len('file '):], bytearray())
+                files.append(current)
+            elif payload in ('begin', 'end'):
+                current = None
+            elif current is not None:
+                for i in range(0, len(payload), 8):
+                    current[1].extend(struct.pack('<I', int(payload[i:i + 8], 16)))
+    return files
+
+
+def remap(path, strip, prefix):
+    path = path.replace('\\', '/')
+    if strip and path.startswith(strip):
+        path = path[len(strip):].lstrip('/')
+    return os.path.join(prefix, path) if prefix else path
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Write .gcda files from a PGO=gen kernel's console log")
+    parser.add_argument('log', help="serial log of the PGO=gen boot")
+    parser.add_argument('--strip', default='', help="leading path to remove from the recorded names")
+    parser.add_argument('--prefix', default='', help="directory to put the stripped names under")
+    args = parser.parse_args()
+
+    files = read_dump(args.log)
+    if not files:
+        print(f"Error: no gcov: lines in {args.log} (is the kernel built with PGO=gen and serial=1 set?)")
+        return 1
+
+    for name, data in files:
+        path = remap(name, args.strip, args.prefix)
+        directory = os.path.dirname(path)
+        if directory:
+            os.makedirs(directory, exist_ok=True)
+        with open(path, 'wb') as f:
+            f.write(data)
+
+    print(f"Wrote {len(files)} .gcda files")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
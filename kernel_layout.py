@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""
+nekkoOS Kernel Text Layout Generator
+Turns the samples of a profile=1 boot ("profile: <address> <hits>" lines
+on the serial console, see kernel/profile.c) into the ordered section
+list kernel/kernel.ld includes as text_order.ld. Sampled functions come
+first, busiest first, so the hot code shares as few cache lines and pages
+as possible; every other function follows in its previous order. The
+list names one input section per function, so the kernel must be rebuilt
+with LAYOUT=1 (-ffunction-sections) for it to take effect.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+PAGE_SIZE = 4096
+CACHE_LINE = 64
+
+SHT_SYMTAB = 2
+STT_FUNC = 2
+
+PROFILE_LINE = re.compile(r'profile: 0x([0-9A-Fa-f]+) (\d+)')
+
+
+def read_functions(path):
+    """(address, size, name) of every function in the .text output section"""
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    if data[:4] != b'\x7fELF' or data[4] != 1:
+        raise ValueError(f"{path} is not an ELF32 file")
+
+    e_shoff, = struct.unpack_from('<I', data, 0x20)
+    e_shentsize, e_shnum, e_shstrndx = struct.unpack_from('<HHH', data, 0x2E)
+    sections = [struct.unpack_from('<10I', data, e_shoff + i * e_shentsize) for i in range(e_shnum)]
+    shstr_offset = sections[e_shstrndx][4]
+
+    def cstring(offset):
+        return data[offset:data.index(b'\0', offset)].decode()
+
+    names = [cstring(shstr_offset + s[0]) for s in sections]
+    if '.text' not in names:
+        raise ValueError(f"{path} has no .text section")
+    text_index = names.index('.text')
+
+    functions = []
+    for section in sections:
+        if section[1] != SHT_SYMTAB:
+            continue
+        strtab_offset = sections[section[6]][4]
+        for offset in range(section[4], section[4] + section[5], 16):
+            st_name, st_value, st_size, st_info, _, st_shndx = struct.unpack_from('<IIIBBH', data, offset)
+            if st_info & 0xF == STT_FUNC and st_shndx == text_index and st_size:
+                functions.append((st_value, st_size, cstring(strtab_offset + st_name)))
+    functions.sort()
+    return functions
+
+
+def read_profile(path):
+    """{address: hits} from a console log"""
+    samples = {}
+    with open(path, 'r', errors='replace') as f:
+        for line in f:
+            match = PROFILE_LINE.search(line)
+            if match:
+                address = int(match.group(1), 16)
+                samples[address] = samples.get(address, 0) + int(match.group(2))
+    return samples
+
+
+def function_hits(functions, samples):
+    """Samples per function name; buckets outside any function are dropped"""
+    starts = [f[0] for f in functions]
+    hits = {}
+    for address, count in samples.items():
+        lo, hi = 0, len(functions)
+        while lo < hi:
+            mid = (lo + hi) // 2
+            if starts[mid] <= address:
+                lo = mid + 1
+            else:
+                hi = mid
+        if lo == 0:
+            continue
+        start, size, name = functions[lo - 1]
+        if address < start + size:
+            hits[name] = hits.get(name, 0) + count
+    return hits
+
+
+def footprint(ranges, unit):
+    """Distinct units of the given size that the (address, size) ranges touch"""
+    touched = set()
+    for address, size in ranges:
+        touched.update(range(address // unit, (address + size - 1) // unit + 1))
+    return len(touched)
+
+
+def section_name(name):
+    # GCC puts the .cold part of a function into .text.unlikely.<name>
+    return None if name.endswith('.cold') or '.cold.' in name else f".text.{name}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate the kernel text order from a profile")
+    parser.add_argument('kernel', help="profiled kernel.elf")
+    parser.add_argument('profile', help="console log of the profile=1 boot")
+    parser.add_argument('output', help="text_order.ld to write")
+    parser.add_argument('--min-hits', type=int, default=1, help="samples a function needs to count as hot")
+    args = parser.parse_args()
+
+    try:
+        functions = read_functions(args.kernel)
+    except (OSError, ValueError) as e:
+        print(f"Error: {e}")
+        return 1
+
+    samples = read_profile(args.profile)
+    if not samples:
+        print(f"Error: no profile: lines in {args.profile} (boot with profile=1 serial=1)")
+        return 1
+
+    hits = function_hits(functions, samples)
+    order = {name: i for i, (_, _, name) in enumerate(functions)}
+    hot = sorted((n for n, h in hits.items() if h >= args.min_hits), key=lambda n: (-hits[n], order[n]))
+    hot_set = set(hot)
+
+    lines = [
+        "/* Generated by kernel_layout.py from " + args.profile.replace('\\', '/') + ", do not edit */",
+        "",
+        "/* Sampled functions, busiest first */",
+    ]
+    emitted = set()
+    for name in hot:
+        section = section_name(name)
+        if section and section not in emitted:
+            emitted.add(section)
+            lines.append(f"*({section})")
+    lines += ["", "/* Everything else in link order */"]
+    for _, _, name in functions:
+        section = section_name(name)
+        if name not in hot_set and section and section not in emitted:
+            emitted.add(section)
+            lines.append(f"*({section})")
+
+    with open(args.output, 'w') as f:
+        f.write("\n".join(lines) + "\n")
+
+    # I-cache and iTLB proxies: what the hot code spans now and once packed
+    hot_ranges = [(a, s) for a, s, n in functions if n in hot_set]
+    packed = []
+    address = 0
+    for name in hot:
+        size = next(s for _, s, n in functions if n == name)
+        packed.append((address, size))
+        address += size
+
+    total = sum(samples.values())
+    print(f"Samples: {total}, {sum(hits.values())} in {len(hits)} functions")
+    print(f"Hot functions: {len(hot)}, {address} bytes")
+    print(f"Hot cache lines: {footprint(hot_ranges, CACHE_LINE)} now, {footprint(packed, CACHE_LINE)} packed")
+    print(f"Hot pages: {footprint(hot_ranges, PAGE_SIZE)} now, {footprint(packed, PAGE_SIZE)} packed")
+    print(f"Section order written to {args.output}")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
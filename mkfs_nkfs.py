@@ -0,0 +1,354 @@
+#!/usr/bin/env python3
+"""
+nekkoOS nkfs Image Creator
+Creates an nkfs filesystem image, optionally filled from a host directory.
+The layout matches nkfs_format() in kernel/fs/nkfs_super.c and the
+structures in kernel/include/nkfs_format.h.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+NKFS_MAGIC = 0x53464B4E
+NKFS_VERSION = 3
+BLOCK_SIZE = 4096
+SUPER_OFFSET = 1024
+BITS_PER_BLOCK = BLOCK_SIZE * 8
+ROOT_INO = 1
+INODE_SIZE = 256
+INODES_PER_BLOCK = BLOCK_SIZE // INODE_SIZE
+STATE_CLEAN = 0x0001
+
+S_IFDIR = 0x4000
+S_IFREG = 0x8000
+INODE_INLINE_DATA = 0x0001
+INODE_EXTENT_TREE = 0x0002
+INODE_COMPRESS = 0x0004
+INLINE_DATA_SIZE = 192
+INLINE_EXTENTS = 16
+
+CLUSTER_BLOCKS = 4
+CLUSTER_SIZE = CLUSTER_BLOCKS * BLOCK_SIZE
+EXTENT_COMPRESSED = 0x80000000
+EXTENT_SIZE = 12
+
+BTREE_MAGIC = 0x45455254
+BTREE_HEADER_SIZE = 16
+BTREE_SPACE = BLOCK_SIZE - BTREE_HEADER_SIZE
+DIRENT_SIZE = 64
+INDEX_SIZE = 8
+INDEX_ENTRIES = BTREE_SPACE // INDEX_SIZE
+
+NAME_MAX = 54
+FT_REG = 1
+FT_DIR = 2
+
+JOURNAL_MAGIC = 0x4C4E524A
+JOURNAL_MIN = 256
+JOURNAL_MAX = 8192
+JOURNAL_SUPER = 1
+
+
+def fnv1a(data):
+    """FNV-1a hash, same as hash_bytes() in the kernel"""
+    value = 2166136261
+    for byte in data:
+        value ^= byte
+        value = (value * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def lz4_compress(data, capacity):
+    """LZ4 block format, greedy like lz4_compress() in kernel/lz4.c.
+    Returns None when the output would not fit in capacity."""
+    out = bytearray()
+    table = {}
+    anchor = 0
+    length = len(data)
+
+    def put_sequence(literals, offset, match_length):
+        lit = len(literals)
+        token = min(lit, 15) << 4
+        if match_length:
+            token |= min(match_length - 4, 15)
+        out.append(token)
+        if lit >= 15:
+            rest = lit - 15
+            while rest >= 255:
+                out.append(255)
+                rest -= 255
+            out.append(rest)
+        out.extend(literals)
+        if match_length:
+            out.extend(struct.pack('<H', offset))
+            if match_length - 4 >= 15:
+                rest = match_length - 4 - 15
+                while rest >= 255:
+                    out.append(255)
+                    rest -= 255
+                out.append(rest)
+
+    if length > 12:
+        match_limit = length - 5
+        pos = 1
+        while pos <= length - 12:
+            key = data[pos:pos + 4]
+            ref = table.get(key)
+            table[key] = pos
+            if ref is None or pos - ref > 65535:
+                pos += 1
+                continue
+            while pos > anchor and ref > 0 and data[pos - 1] == data[ref - 1]:
+                pos -= 1
+                ref -= 1
+            end = pos + 4
+            while end < match_limit and data[end] == data[ref + end - pos]:
+                end += 1
+            put_sequence(data[anchor:pos], pos - ref, end - pos)
+            if len(out) > capacity:
+                return None
+            pos = anchor = end
+    put_sequence(data[anchor:], 0, 0)
+    return bytes(out) if len(out) <= capacity else None
+
+
+def bitmap_blocks(bits):
+    return (bits + BITS_PER_BLOCK - 1) // BITS_PER_BLOCK
+
+
+def parse_size(text):
+    units = {'K': 1024, 'M': 1024 * 1024, 'G': 1024 * 1024 * 1024}
+    text = text.strip().upper()
+    if text and text[-1] in units:
+        return int(text[:-1]) * units[text[-1]]
+    return int(text)
+
+
+class NKFSBuilder:
+    def __init__(self, image_size, inodes, compress=False):
+        self.blocks_count = image_size // BLOCK_SIZE
+        self.inodes_count = max(inodes, INODES_PER_BLOCK)
+        self.inodes_count = (self.inodes_count + INODES_PER_BLOCK - 1) // INODES_PER_BLOCK * INODES_PER_BLOCK
+
+        # Filesystem layout, as in nkfs_format()
+        self.block_bitmap = 1
+        self.inode_bitmap = self.block_bitmap + bitmap_blocks(self.blocks_count)
+        self.inode_table = self.inode_bitmap + bitmap_blocks(self.inodes_count)
+        self.journal_start = self.inode_table + self.inodes_count // INODES_PER_BLOCK
+        self.journal_blocks = min(max(self.blocks_count // 32, JOURNAL_MIN), JOURNAL_MAX)
+        self.data_start = self.journal_start + self.journal_blocks
+        if self.data_start + 1 >= self.blocks_count:
+            raise ValueError("Image too small for the inode table")
+
+        self.image = bytearray(self.blocks_count * BLOCK_SIZE)
+        self.next_block = self.data_start
+        self.next_ino = ROOT_INO + 1
+        self.inodes = {}
+        self.compress = compress
+        self.raw_blocks = 0
+        self.data_blocks = 0
+
+    def alloc_blocks(self, count):
+        if self.next_block + count > self.blocks_count:
+            raise ValueError("Image full")
+        start = self.next_block
+        self.next_block += count
+        return start
+
+    def alloc_inode(self):
+        if self.next_ino >= self.inodes_count:
+            raise ValueError("Out of inodes")
+        ino = self.next_ino
+        self.next_ino += 1
+        return ino
+
+    def write_block(self, block, data):
+        offset = block * BLOCK_SIZE
+        self.image[offset:offset + len(data)] = data
+
+    def pack_inode(self, mode, flags, links, size, blocks, parent, tree_root, nr_extents, body):
+        inode = struct.pack('<HHIQIIII8I', mode, flags, links, size, blocks,
+                            parent, tree_root, nr_extents, *([0] * 8))
+        return inode + body.ljust(INLINE_DATA_SIZE, b'\0')
+
+    def add_file(self, path):
+        """Store a file inline when it fits, else as one contiguous extent
+        or, with compression, one extent per cluster"""
+        with open(path, 'rb') as f:
+            data = f.read()
+
+        ino = self.alloc_inode()
+        flags = INODE_COMPRESS if self.compress else 0
+        if len(data) <= INLINE_DATA_SIZE:
+            self.inodes[ino] = self.pack_inode(S_IFREG | 0o644, flags | INODE_INLINE_DATA, 1, len(data),
+                                               0, 0, 0, 0, data)
+            return ino
+
+        count = (len(data) + BLOCK_SIZE - 1) // BLOCK_SIZE
+        self.raw_blocks += count
+        if self.compress:
+            extents = [self.add_cluster(data, offset) for offset in range(0, len(data), CLUSTER_SIZE)]
+            blocks = sum(extent[2] & ~EXTENT_COMPRESSED for extent in extents)
+        else:
+            start = self.alloc_blocks(count)
+            self.write_block(start, data)
+            extents = [(0, start, count)]
+            blocks = count
+        self.data_blocks += blocks
+
+        records = [struct.pack('<III', *extent) for extent in extents]
+        if len(records) <= INLINE_EXTENTS:
+            self.inodes[ino] = self.pack_inode(S_IFREG | 0o644, flags, 1, len(data),
+                                               blocks, 0, 0, len(records), b''.join(records))
+        else:
+            root, nodes = self.build_tree(records, EXTENT_SIZE)
+            self.inodes[ino] = self.pack_inode(S_IFREG | 0o644, flags | INODE_EXTENT_TREE, 1, len(data),
+                                               blocks + nodes, 0, root, 0, b'')
+        return ino
+
+    def add_cluster(self, data, offset):
+        """Store one cluster compressed when that saves a block, else raw"""
+        chunk = data[offset:offset + CLUSTER_SIZE]
+        count = (len(chunk) + BLOCK_SIZE - 1) // BLOCK_SIZE
+        packed = lz4_compress(chunk, (count - 1) * BLOCK_SIZE - 4) if count > 1 else None
+        if packed is None:
+            start = self.alloc_blocks(count)
+            self.write_block(start, chunk)
+            return (offset // BLOCK_SIZE, start, count)
+
+        blocks = (4 + len(packed) + BLOCK_SIZE - 1) // BLOCK_SIZE
+        start = self.alloc_blocks(blocks)
+        self.write_block(start, struct.pack('<I', len(packed)) + packed)
+        return (offset // BLOCK_SIZE, start, blocks | EXTENT_COMPRESSED)
+
+    def write_node(self, level, entries, next_leaf=0):
+        block = self.alloc_blocks(1)
+        header = struct.pack('<IHHII', BTREE_MAGIC, level, len(entries), next_leaf, 0)
+        self.write_block(block, header + b''.join(entries))
+        return block
+
+    def build_tree(self, records, record_size=DIRENT_SIZE):
+        """Pack sorted records into full leaves, then index levels bottom up.
+        Returns the root block and the number of nodes."""
+        per_leaf = BTREE_SPACE // record_size
+        chunks = [records[i:i + per_leaf] for i in range(0, len(records), per_leaf)] or [[]]
+
+        # Leaves are allocated in order so each one links to the next block
+        first = self.next_block
+        level_nodes = []
+        for i, chunk in enumerate(chunks):
+            next_leaf = first + i + 1 if i + 1 < len(chunks) else 0
+            key = struct.unpack_from('<I', chunk[0])[0] if chunk else 0
+            level_nodes.append((key, self.write_node(0, chunk, next_leaf)))
+        nodes = len(level_nodes)
+
+        level = 0
+        while len(level_nodes) > 1:
+            level += 1
+            parents = []
+            for i in range(0, len(level_nodes), INDEX_ENTRIES):
+                group = level_nodes[i:i + INDEX_ENTRIES]
+                entries = [struct.pack('<II', key, child) for key, child in group]
+                parents.append((group[0][0], self.write_node(level, entries)))
+            nodes += len(parents)
+            level_nodes = parents
+        return level_nodes[0][1], nodes
+
+    def add_directory(self, path, ino, parent):
+        """Store a directory and everything below it"""
+        records = []
+        for name in sorted(os.listdir(path)) if path else []:
+            encoded = name.encode('utf-8')
+            if len(encoded) > NAME_MAX or b'/' in encoded:
+                raise ValueError(f"Name too long for nkfs: {name}")
+            child_path = os.path.join(path, name)
+            if os.path.isdir(child_path):
+                child = self.alloc_inode()
+                self.add_directory(child_path, child, ino)
+                kind = FT_DIR
+            elif os.path.isfile(child_path):
+                child = self.add_file(child_path)
+                kind = FT_REG
+            else:
+                continue
+            records.append(struct.pack('<IIBB', fnv1a(encoded), child, len(encoded), kind) +
+                           encoded.ljust(NAME_MAX, b'\0'))
+
+        records.sort(key=lambda record: struct.unpack_from('<I', record)[0])
+        root, nodes = self.build_tree(records)
+        flags = INODE_COMPRESS if self.compress else 0
+        self.inodes[ino] = self.pack_inode(S_IFDIR | 0o755, flags, 1, len(records),
+                                           nodes, parent, root, 0, b'')
+
+    def write_metadata(self):
+        used_blocks = self.next_block
+        for block in range(used_blocks):
+            self.image[self.block_bitmap * BLOCK_SIZE + block // 8] |= 1 << (block % 8)
+        for ino in range(self.next_ino):
+            self.image[self.inode_bitmap * BLOCK_SIZE + ino // 8] |= 1 << (ino % 8)
+        for ino, inode in self.inodes.items():
+            offset = self.inode_table * BLOCK_SIZE + ino * INODE_SIZE
+            self.image[offset:offset + INODE_SIZE] = inode
+
+        # Empty journal: the log starts at its first block with sequence 1
+        self.write_block(self.journal_start, struct.pack('<5I', JOURNAL_MAGIC, JOURNAL_SUPER, 0, 0, 1))
+
+        super_block = struct.pack('<15I', NKFS_MAGIC, NKFS_VERSION, BLOCK_SIZE,
+                                  self.blocks_count, self.inodes_count,
+                                  self.blocks_count - used_blocks, self.inodes_count - self.next_ino,
+                                  self.block_bitmap, self.inode_bitmap, self.inode_table,
+                                  self.data_start, ROOT_INO, STATE_CLEAN,
+                                  self.journal_start, self.journal_blocks)
+        self.image[SUPER_OFFSET:SUPER_OFFSET + 512] = super_block.ljust(512, b'\0')
+
+    def build(self, source_dir, output_path):
+        try:
+            self.add_directory(source_dir, ROOT_INO, ROOT_INO)
+            self.write_metadata()
+            with open(output_path, 'wb') as f:
+                f.write(self.image)
+
+            print(f"nkfs image created: {output_path}")
+            print(f"  Blocks: {self.blocks_count} ({BLOCK_SIZE} bytes)")
+            print(f"  Inodes: {self.inodes_count} ({self.next_ino - 1} used)")
+            print(f"  Inode table start block: {self.inode_table}")
+            print(f"  Journal: {self.journal_blocks} blocks at {self.journal_start}")
+            print(f"  Data start block: {self.data_start}")
+            print(f"  Blocks used: {self.next_block}")
+            if self.compress and self.raw_blocks:
+                saved = self.raw_blocks - self.data_blocks
+                print(f"  Compression: {self.data_blocks} data blocks instead of {self.raw_blocks}, "
+                      f"{saved * BLOCK_SIZE // 1024} KB ({saved * 100 // self.raw_blocks}%) saved")
+            return True
+
+        except (OSError, ValueError) as e:
+            print(f"Error creating nkfs image: {e}")
+            return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Create an nkfs filesystem image")
+    parser.add_argument('image', help="output image file")
+    parser.add_argument('source', nargs='?', help="host directory to copy into the image")
+    parser.add_argument('--size', default='32M', help="image size, e.g. 32M (default 32M)")
+    parser.add_argument('--inodes', type=int, default=0, help="inode count (default: one per 16KB)")
+    parser.add_argument('--compress', action='store_true', help="store files LZ4 compressed")
+    args = parser.parse_args()
+
+    size = parse_size(args.size)
+    inodes = args.inodes or size // (16 * 1024)
+
+    try:
+        builder = NKFSBuilder(size, inodes, args.compress)
+    except ValueError as e:
+        print(f"Error: {e}")
+        return 1
+
+    success = builder.build(args.source, args.image)
+    return 0 if success else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
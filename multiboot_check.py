@@ -0,0 +1,45 @@
+#!/usr/bin/env python3
+"""
+nekkoOS Multiboot Header Check
+Fails the kernel build unless kernel.elf carries a multiboot header the
+way a loader looks for it: the magic, flags and checksum words on a
+4-byte boundary within the first 8KB of the file (grub-file
+--is-x86-multiboot does the same search).
+"""
+
+import struct
+import sys
+
+MULTIBOOT_MAGIC = 0x1BADB002
+MULTIBOOT_SEARCH = 8192
+
+
+def find_header(data):
+    """File offset of the first valid multiboot header, or None"""
+    for offset in range(0, min(len(data), MULTIBOOT_SEARCH) - 11, 4):
+        magic, flags, checksum = struct.unpack_from('<III', data, offset)
+        if magic == MULTIBOOT_MAGIC and (magic + flags + checksum) & 0xFFFFFFFF == 0:
+            return offset
+    return None
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(f"usage: {sys.argv[0]} kernel.elf", file=sys.stderr)
+        return 2
+
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read(MULTIBOOT_SEARCH)
+
+    offset = find_header(data)
+    if offset is None:
+        print(f"Error: no multiboot header in the first {MULTIBOOT_SEARCH} bytes of {sys.argv[1]}",
+              file=sys.stderr)
+        return 1
+
+    print(f"Multiboot header at file offset {offset:#x}")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,310 @@
+#!/usr/bin/env python3
+"""
+nekkoOS NEF Module Linker
+Turns a relocatable i386 ELF object (one driver compiled with -DMODULE)
+into a NEF_DRIVER or NEF_SYS kernel module. The object's allocated
+sections are laid out from address 0; the module keeps the symbols its
+relocations refer to, undefined ones being resolved by the kernel
+against its exported symbols at load time (kernel/module.c). The format
+is described in executable-format/NEF_specification.md and
+kernel/include/nef.h.
+"""
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+from mkfs_nkfs import lz4_compress
+
+NEF_MAGIC = 0x4E454646
+NEF_VERSION = 1
+NEF_TYPES = {'sys': 0x03, 'driver': 0x04}
+
+NEF_F_COMPRESSED = 0x0001
+NEF_F_RELOCATABLE = 0x0002
+
+NEF_SECT_TEXT = 0x01
+NEF_SECT_DATA = 0x02
+NEF_SECT_BSS = 0x03
+NEF_SECT_RODATA = 0x04
+
+NEF_SF_READ = 0x01
+NEF_SF_WRITE = 0x02
+NEF_SF_EXEC = 0x04
+NEF_SF_COMPRESSED = 0x08
+
+NEF_SYM_NOTYPE = 0x00
+NEF_SYM_OBJECT = 0x01
+NEF_SYM_FUNC = 0x02
+NEF_SYM_SECTION = 0x03
+
+NEF_SECTION_UNDEF = 0xFFFF
+NEF_SECTION_ABS = 0xFFFE
+
+HEADER_SIZE = 64
+SECTION_SIZE = 32
+SYMBOL_SIZE = 16
+RELOC_SIZE = 12
+
+ET_REL = 1
+EM_386 = 3
+
+SHT_SYMTAB = 2
+SHT_RELA = 4
+SHT_NOBITS = 8
+SHT_REL = 9
+
+SHF_WRITE = 0x1
+SHF_ALLOC = 0x2
+SHF_EXECINSTR = 0x4
+
+SHN_UNDEF = 0
+SHN_ABS = 0xFFF1
+SHN_COMMON = 0xFFF2
+
+STB_WEAK = 2
+
+# ELF relocation type -> NEF relocation type (same numbers on i386)
+RELOCS = {1: 1, 2: 2, 4: 4}
+R_386_NONE = 0
+R_386_GOT32 = 3
+
+# Kernel tables a module cannot take part in
+UNSUPPORTED = ('.initcall', '.kparam', '.kbench', '.ksymtab', '__ex_table', '.ctors', '.init_array')
+
+ENTRY_SYMBOL = '__module_init'
+EXIT_SYMBOL = '__module_exit'
+
+
+def align_up(value, alignment):
+    return (value + alignment - 1) & ~(alignment - 1) if alignment > 1 else value
+
+
+class ElfObject:
+    """Sections, symbols and relocations of an ELF32 i386 relocatable object"""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = data = f.read()
+
+        if data[:4] != b'\x7fELF' or data[4] != 1 or data[5] != 1:
+            raise ValueError(f"{path} is not a little endian ELF32 file")
+        e_type, e_machine = struct.unpack_from('<HH', data, 0x10)
+        if e_type != ET_REL or e_machine != EM_386:
+            raise ValueError(f"{path} is not an i386 relocatable object")
+
+        e_shoff, = struct.unpack_from('<I', data, 0x20)
+        e_shentsize, e_shnum, e_shstrndx = struct.unpack_from('<HHH', data, 0x2E)
+        self.sections = [struct.unpack_from('<10I', data, e_shoff + i * e_shentsize) for i in range(e_shnum)]
+        shstr_offset = self.sections[e_shstrndx][4]
+        self.names = [self.cstring(shstr_offset + s[0]) for s in self.sections]
+
+        self.symbols = []
+        for section in self.sections:
+            if section[1] == SHT_SYMTAB:
+                strtab_offset = self.sections[section[6]][4]
+                for offset in range(section[4], section[4] + section[5], 16):
+                    st_name, st_value, st_size, st_info, _, st_shndx = struct.unpack_from('<IIIBBH', data, offset)
+                    self.symbols.append((self.cstring(strtab_offset + st_name), st_value, st_size,
+                                         st_info & 0xF, st_info >> 4, st_shndx))
+
+    def cstring(self, offset):
+        return self.data[offset:self.data.index(b'\0', offset)].decode()
+
+    def contents(self, index):
+        section = self.sections[index]
+        return self.data[section[4]:section[4] + section[5]]
+
+    def relocations(self, index):
+        """(offset, symbol index, type) of a SHT_REL section"""
+        section = self.sections[index]
+        return [struct.unpack_from('<II', self.data, offset)
+                for offset in range(section[4], section[4] + section[5], 8)]
+
+
+class NEFModule:
+    def __init__(self, obj, module_type, compress):
+        self.obj = obj
+        self.type = NEF_TYPES[module_type]
+        self.compress = compress
+        self.strings = bytearray(b'\0')
+        self.string_offsets = {}
+        self.layout = {}            # ELF section index -> address
+        self.memory_size = 0
+        self.symbols = []
+        self.symbol_map = {}        # ELF symbol index -> NEF symbol index
+        self.relocs = []
+
+    def string(self, name):
+        if name not in self.string_offsets:
+            self.string_offsets[name] = len(self.strings)
+            self.strings += name.encode() + b'\0'
+        return self.string_offsets[name]
+
+    def place_sections(self):
+        """Allocated sections in object order, each at its alignment"""
+        address = 0
+        for index, section in enumerate(self.obj.sections):
+            name = self.obj.names[index]
+            if not section[2] & SHF_ALLOC:
+                continue
+            if name.startswith(UNSUPPORTED):
+                raise ValueError(f"section {name} is not supported in modules")
+            if name.startswith('.note') or name == '.eh_frame':
+                continue
+            address = align_up(address, section[8])
+            self.layout[index] = address
+            address += section[5]
+        self.memory_size = address
+        if not self.memory_size:
+            raise ValueError("object has no code or data")
+
+    def symbol(self, elf_index):
+        """NEF symbol for an ELF symbol, added on first use"""
+        if elf_index in self.symbol_map:
+            return self.symbol_map[elf_index]
+
+        name, value, size, sym_type, binding, shndx = self.obj.symbols[elf_index]
+        nef_type = {1: NEF_SYM_OBJECT, 2: NEF_SYM_FUNC, 3: NEF_SYM_SECTION}.get(sym_type, NEF_SYM_NOTYPE)
+        if shndx == SHN_UNDEF:
+            section, value = NEF_SECTION_UNDEF, 0
+        elif shndx == SHN_ABS:
+            section = NEF_SECTION_ABS
+        elif shndx == SHN_COMMON:
+            raise ValueError(f"common symbol {name}, compile with -fno-common")
+        elif shndx in self.layout:
+            section = list(self.layout).index(shndx)
+            value += self.layout[shndx]
+        else:
+            raise ValueError(f"symbol {name or self.obj.names[shndx]} is in a section modules leave out")
+
+        if sym_type == 3:
+            name = self.obj.names[shndx]
+        self.symbol_map[elf_index] = len(self.symbols)
+        self.symbols.append(struct.pack('<IIIHBB', self.string(name), value, size, section, nef_type,
+                                        min(binding, STB_WEAK)))
+        return self.symbol_map[elf_index]
+
+    def collect(self):
+        """Relocations of the placed sections, and the symbols they use"""
+        for index, section in enumerate(self.obj.sections):
+            if section[1] == SHT_RELA and section[7] in self.layout:
+                raise ValueError(f"{self.obj.names[index]}: RELA relocations are not used on i386")
+            if section[1] != SHT_REL or section[7] not in self.layout:
+                continue
+            base = self.layout[section[7]]
+            for r_offset, r_info in self.obj.relocations(index):
+                r_type = r_info & 0xFF
+                if r_type == R_386_NONE:
+                    continue
+                if r_type not in RELOCS:
+                    reason = "needs a GOT, compile without -fpic" if r_type == R_386_GOT32 else "is not supported"
+                    raise ValueError(f"relocation type {r_type} in {self.obj.names[index]} {reason}")
+                self.relocs.append(struct.pack('<III', base + r_offset, self.symbol(r_info >> 8), RELOCS[r_type]))
+
+        for name in (ENTRY_SYMBOL, EXIT_SYMBOL):
+            for elf_index, sym in enumerate(self.obj.symbols):
+                if sym[0] == name and sym[5] != SHN_UNDEF:
+                    self.symbol(elf_index)
+
+    def entry_point(self):
+        for elf_index, nef_index in self.symbol_map.items():
+            if self.obj.symbols[elf_index][0] == ENTRY_SYMBOL:
+                return struct.unpack_from('<I', self.symbols[nef_index], 4)[0]
+        raise ValueError(f"no {ENTRY_SYMBOL}: the driver needs one initcall (init.h)")
+
+    def section_data(self, index):
+        """Stored bytes and flags of a section, LZ4 compressed when that saves space"""
+        data = self.obj.contents(index)
+        if self.compress and len(data) > 16:
+            packed = lz4_compress(data, len(data) - 5)
+            if packed is not None:
+                return struct.pack('<I', len(data)) + packed, NEF_SF_COMPRESSED
+        return data, 0
+
+    def build(self):
+        self.place_sections()
+        self.collect()
+        entry = self.entry_point()
+
+        flags = NEF_F_RELOCATABLE
+        headers = bytearray()
+        body = bytearray()
+        data_offset = HEADER_SIZE + SECTION_SIZE * len(self.layout)
+        raw_size = stored_size = 0
+
+        for index, address in self.layout.items():
+            section = self.obj.sections[index]
+            sect_flags = NEF_SF_READ
+            if section[2] & SHF_WRITE:
+                sect_flags |= NEF_SF_WRITE
+            if section[2] & SHF_EXECINSTR:
+                sect_flags |= NEF_SF_EXEC
+
+            if section[1] == SHT_NOBITS:
+                sect_type, data, size = NEF_SECT_BSS, b'', section[5]
+            else:
+                if section[2] & SHF_EXECINSTR:
+                    sect_type = NEF_SECT_TEXT
+                elif section[2] & SHF_WRITE:
+                    sect_type = NEF_SECT_DATA
+                else:
+                    sect_type = NEF_SECT_RODATA
+                data, compressed = self.section_data(index)
+                sect_flags |= compressed
+                if compressed:
+                    flags |= NEF_F_COMPRESSED
+                size = len(data)
+                raw_size += section[5]
+                stored_size += size
+
+            headers += struct.pack('<8I', self.string(self.obj.names[index]), sect_type, sect_flags, address,
+                                   data_offset + len(body), size, max(section[8], 1), 0)
+            body += data
+
+        symbol_offset = data_offset + len(body)
+        string_offset = symbol_offset + SYMBOL_SIZE * len(self.symbols)
+        reloc_offset = string_offset + len(self.strings)
+        file_size = reloc_offset + RELOC_SIZE * len(self.relocs) + 4
+
+        tables = headers + body + b''.join(self.symbols) + self.strings + b''.join(self.relocs)
+        checksum = zlib.crc32(tables) & 0xFFFFFFFF
+        header = struct.pack('<IBBHIIIIHHIIII16sI', NEF_MAGIC, NEF_VERSION, self.type, flags, entry, 0,
+                             file_size, self.memory_size, len(self.layout), len(self.symbols),
+                             symbol_offset, string_offset, reloc_offset, checksum, bytes(16), int(time.time()))
+        self.stats = (raw_size, stored_size, len(self.symbols), len(self.relocs))
+        return header + tables + struct.pack('<I', checksum)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Link a driver object into a NEF kernel module")
+    parser.add_argument('object', help="relocatable object compiled with -DMODULE")
+    parser.add_argument('-o', '--output', required=True, help="output .nef file")
+    parser.add_argument('--type', choices=sorted(NEF_TYPES), default='driver',
+                        help="driver (default) probes for hardware and is dropped without it; sys always stays")
+    parser.add_argument('--compress', action='store_true', help="store sections LZ4 compressed")
+    args = parser.parse_args()
+
+    try:
+        module = NEFModule(ElfObject(args.object), args.type, args.compress)
+        image = module.build()
+    except (OSError, ValueError) as e:
+        print(f"Error: {e}")
+        return 1
+
+    with open(args.output, 'wb') as f:
+        f.write(image)
+
+    raw_size, stored_size, symbols, relocs = module.stats
+    print(f"NEF module created: {args.output}")
+    print(f"  Memory: {module.memory_size} bytes, file: {len(image)} bytes")
+    print(f"  Symbols: {symbols}, relocations: {relocs}")
+    if args.compress:
+        print(f"  Compression: {stored_size} bytes of section data instead of {raw_size}")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
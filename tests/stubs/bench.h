@@ -0,0 +1,29 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "types.h"
+
+/*
+ * Host stand-in for kernel/include/bench.h. KERNEL_BENCH registers the
+ * benchmark from a constructor instead of the .kbench section, and
+ * run_benchmarks() runs every one linked into the program.
+ */
+struct kernel_bench {
+    const char* name;
+    void (*run)(void);
+    struct kernel_bench* next;
+};
+
+void bench_register(struct kernel_bench* bench);
+
+#define KERNEL_BENCH(name_str, fn)                                     \
+    static struct kernel_bench __bench_##fn = { .name = name_str, .run = fn }; \
+    __attribute__((constructor)) static void __bench_register_##fn(void) { \
+        bench_register(&__bench_##fn);                                 \
+    }
+
+void run_benchmarks(void);
+void bench_report(const char* name, const char* metric, uint32_t value, const char* unit);
+uint32_t bench_rate(uint32_t count, uint64_t cycles);
+
+#endif /* BENCH_H */
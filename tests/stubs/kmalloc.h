@@ -0,0 +1,26 @@
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+#include "types.h"
+
+/*
+ * Host stand-in for kernel/include/kmalloc.h, backed by malloc (stubs.c).
+ * Setting kmalloc_fail_after to n makes the allocation after the next n
+ * fail, to drive the -ENOMEM paths; -1 never fails.
+ */
+extern int kmalloc_fail_after;
+
+struct kmem_cache {
+    const char* name;
+    uint32_t size;
+};
+
+void kmem_cache_init(struct kmem_cache* cache, const char* name, size_t size);
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* object);
+
+void* kmalloc(size_t size);
+void* kzalloc(size_t size);
+void kfree(void* ptr);
+
+#endif /* KMALLOC_H */
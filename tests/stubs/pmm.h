@@ -0,0 +1,13 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include "types.h"
+
+/* Host stand-in for kernel/include/pmm.h, backed by malloc (stubs.c) */
+#define PAGE_SIZE           4096
+#define PAGE_SHIFT          12
+
+void* page_alloc(uint32_t count);
+void page_free(void* addr, uint32_t count);
+
+#endif /* PMM_H */
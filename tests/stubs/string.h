@@ -0,0 +1,11 @@
+#ifndef STRING_H
+#define STRING_H
+
+/* Host stand-in for kernel/include/string.h */
+#include <string.h>
+
+/* Kernel additions (kernel/string.c) */
+char* itoa(int value, char* str, int base);
+char* utoa(unsigned int value, char* str, int base);
+
+#endif /* STRING_H */
@@ -0,0 +1,125 @@
+/*
+ * Host implementations of the kernel services the containers use:
+ * allocation from malloc, console output on stdout, a nanosecond "TSC"
+ * and the benchmark registry.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "types.h"
+#include "kmalloc.h"
+#include "pmm.h"
+#include "timer.h"
+#include "bench.h"
+#include "kernel.h"
+#include "cpufeature.h"
+
+int kmalloc_fail_after = -1;
+bool kprintf_quiet;
+
+/* Read by string.c; tests set the features to pick its code paths */
+uint32_t boot_cpu_features;
+
+static bool alloc_fails(void) {
+    if (kmalloc_fail_after < 0)
+        return false;
+    return kmalloc_fail_after-- == 0;
+}
+
+void kmem_cache_init(struct kmem_cache* cache, const char* name, size_t size) {
+    cache->name = name;
+    cache->size = size;
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    return alloc_fails() ? NULL : malloc(cache->size);
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* object) {
+    (void)cache;
+    free(object);
+}
+
+void* kmalloc(size_t size) {
+    return alloc_fails() ? NULL : malloc(size);
+}
+
+void* kzalloc(size_t size) {
+    return alloc_fails() ? NULL : calloc(1, size);
+}
+
+void kfree(void* ptr) {
+    free(ptr);
+}
+
+void* page_alloc(uint32_t count) {
+    void* pages;
+
+    return posix_memalign(&pages, PAGE_SIZE, (size_t)count * PAGE_SIZE) ? NULL : pages;
+}
+
+void page_free(void* addr, uint32_t count) {
+    (void)count;
+    free(addr);
+}
+
+uint64_t rdtsc(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+uint32_t timer_tsc_khz(void) {
+    return 1000000;
+}
+
+/* Kernel format strings carry no conversions; print them as they are */
+void kprintf(const char* format, ...) {
+    if (!kprintf_quiet)
+        fputs(format, stdout);
+}
+
+void kprintf_hex(uint32_t value) {
+    if (!kprintf_quiet)
+        printf("0x%08X", value);
+}
+
+void kprintf_dec(uint32_t value) {
+    if (!kprintf_quiet)
+        printf("%u", value);
+}
+
+void panic(const char* message) {
+    fprintf(stderr, "panic: %s\n", message);
+    abort();
+}
+
+static struct kernel_bench* benches;
+static struct kernel_bench** benches_tail = &benches;
+
+void bench_register(struct kernel_bench* bench) {
+    *benches_tail = bench;
+    benches_tail = &bench->next;
+}
+
+void run_benchmarks(void) {
+    for (struct kernel_bench* bench = benches; bench; bench = bench->next)
+        bench->run();
+}
+
+/* Same "bench: <name> <metric> <value> <unit>" lines as kernel/bench.c */
+void bench_report(const char* name, const char* metric, uint32_t value, const char* unit) {
+    printf("bench: %s %s %u %s\n", name, metric, value, unit);
+}
+
+uint32_t bench_rate(uint32_t count, uint64_t cycles) {
+    uint64_t us = div_u64(cycles * 1000, timer_tsc_khz());
+
+    if (us == 0)
+        us = 1;
+    return (uint32_t)div_u64((uint64_t)count * 1000000, (uint32_t)us);
+}
@@ -0,0 +1,18 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "types.h"
+
+/*
+ * Host stand-in for kernel/include/timer.h. The "TSC" counts nanoseconds
+ * of CLOCK_MONOTONIC, so timer_tsc_khz() is a fixed 1GHz and the kernel's
+ * benchmarks report host rates unchanged.
+ */
+uint64_t rdtsc(void);
+uint32_t timer_tsc_khz(void);
+
+static inline uint64_t div_u64(uint64_t dividend, uint32_t divisor) {
+    return dividend / divisor;
+}
+
+#endif /* TIMER_H */
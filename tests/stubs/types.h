@@ -0,0 +1,46 @@
+#ifndef TYPES_H
+#define TYPES_H
+
+/*
+ * Host stand-in for kernel/include/types.h: the same names and macros,
+ * with the integer types taken from the host C library so container
+ * code builds and runs as a normal 64-bit process.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Common macros */
+#define PACKED             __attribute__((packed))
+#define ALIGN(x)           __attribute__((aligned(x)))
+#define NORETURN           __attribute__((noreturn))
+#define UNUSED             __attribute__((unused))
+
+/* Bit manipulation macros */
+#define BIT(n)             (1U << (n))
+#define SET_BIT(x, n)      ((x) |= BIT(n))
+#define CLEAR_BIT(x, n)    ((x) &= ~BIT(n))
+#define TOGGLE_BIT(x, n)   ((x) ^= BIT(n))
+#define CHECK_BIT(x, n)    (((x) & BIT(n)) != 0)
+
+/* Memory alignment macros */
+#define ALIGN_UP(x, a)     (((x) + (a) - 1) & ~((a) - 1))
+#define ALIGN_DOWN(x, a)   ((x) & ~((a) - 1))
+#define IS_ALIGNED(x, a)   (((x) & ((a) - 1)) == 0)
+
+/* Min/Max macros */
+#define MIN(a, b)          ((a) < (b) ? (a) : (b))
+#define MAX(a, b)          ((a) > (b) ? (a) : (b))
+
+/* Array size macro */
+#define ARRAY_SIZE(arr)    (sizeof(arr) / sizeof((arr)[0]))
+
+/* Offset of field in structure */
+#define OFFSETOF(type, member) ((size_t) &((type*)0)->member)
+
+/* Container of macro */
+#define CONTAINER_OF(ptr, type, member) \
+    ((type*)((char*)(ptr) - OFFSETOF(type, member)))
+
+#endif /* TYPES_H */
@@ -0,0 +1,32 @@
+#ifndef TEST_H
+#define TEST_H
+
+/*
+ * Host test helpers. Each test program links one kernel container with
+ * the stubs, checks it against a plain reference model on random
+ * operations, then prints "bench:" lines like the in-kernel benchmarks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "types.h"
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                           \
+        }                                                                      \
+    } while (0)
+
+/* xorshift32; fixed seeds keep failures reproducible */
+static inline uint32_t test_random(uint32_t* state) {
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+#endif /* TEST_H */
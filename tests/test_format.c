@@ -0,0 +1,121 @@
+/*
+ * Decimal conversion host test: utoa(v, buf, 10) for every uint32 and
+ * itoa for every int32, INT_MIN included, against a decimal counter that
+ * is stepped once per value and checked against snprintf every 4096
+ * values and at every power of ten. The other bases are checked against
+ * snprintf on random values. The sweep takes a few minutes.
+ */
+
+#include <limits.h>
+
+#include "test.h"
+#include "string.h"
+
+#define FORMAT_SNPRINTF_MASK 0xFFF
+#define RANDOM_VALUES        1000000
+
+/* Decimal string of a counter, most significant digit first */
+struct counter {
+    char digits[12];
+    uint32_t length;
+};
+
+/* Returns true when the counter got one digit longer */
+static bool counter_increment(struct counter* counter) {
+    int i = counter->length - 1;
+
+    while (i >= 0 && counter->digits[i] == '9')
+        counter->digits[i--] = '0';
+    if (i >= 0) {
+        counter->digits[i]++;
+        return false;
+    }
+    counter->digits[0] = '1';
+    counter->digits[counter->length] = '0';
+    counter->digits[++counter->length] = '\0';
+    return true;
+}
+
+static void check_counter(const struct counter* counter, uint32_t value) {
+    char expected[12];
+
+    snprintf(expected, sizeof(expected), "%u", value);
+    CHECK(strcmp(counter->digits, expected) == 0);
+}
+
+static void test_decimal_sweep(void) {
+    struct counter counter = { .digits = "0", .length = 1 };
+    char buffer[16];
+    uint32_t value = 0;
+
+    for (;;) {
+        if ((value & FORMAT_SNPRINTF_MASK) == 0)
+            check_counter(&counter, value);
+
+        CHECK(utoa(value, buffer, 10) == buffer);
+        CHECK(memcmp(buffer, counter.digits, counter.length + 1) == 0);
+
+        if (value <= INT_MAX) {
+            CHECK(itoa((int)value, buffer, 10) == buffer);
+            CHECK(memcmp(buffer, counter.digits, counter.length + 1) == 0);
+        }
+        /* -value, down to INT_MIN at value 2^31 */
+        if (value != 0 && value <= 0x80000000U) {
+            CHECK(itoa((int)(0U - value), buffer, 10) == buffer);
+            CHECK(buffer[0] == '-');
+            CHECK(memcmp(buffer + 1, counter.digits, counter.length + 1) == 0);
+        }
+
+        if (value == UINT_MAX)
+            break;
+        value++;
+        if (counter_increment(&counter))
+            check_counter(&counter, value);
+    }
+    check_counter(&counter, UINT_MAX);
+    printf("format: utoa and itoa base 10 match for every 32-bit value\n");
+}
+
+/* Base 2 by hand, snprintf has no conversion for it */
+static const char* format_binary(uint32_t value, char* buffer, size_t size) {
+    char* end = buffer + size - 1;
+
+    *end = '\0';
+    do {
+        *--end = '0' + (value & 1);
+        value >>= 1;
+    } while (value);
+    return end;
+}
+
+/* Bases other than 10 keep the division loop */
+static void test_other_bases(void) {
+    char buffer[40];
+    char expected[40];
+    uint32_t seed = 1;
+
+    for (uint32_t i = 0; i < RANDOM_VALUES; i++) {
+        uint32_t value = test_random(&seed) >> (i % 32);
+
+        CHECK(strcmp(utoa(value, buffer, 2), format_binary(value, expected, sizeof(expected))) == 0);
+        snprintf(expected, sizeof(expected), "%o", value);
+        CHECK(strcmp(utoa(value, buffer, 8), expected) == 0);
+        snprintf(expected, sizeof(expected), "%x", value);
+        CHECK(strcmp(utoa(value, buffer, 16), expected) == 0);
+        if ((int)value >= 0)
+            CHECK(strcmp(itoa((int)value, buffer, 16), expected) == 0);
+    }
+
+    CHECK(strcmp(utoa(35, buffer, 36), "z") == 0);
+    CHECK(utoa(1, buffer, 1)[0] == '\0');
+    CHECK(utoa(1, buffer, 37)[0] == '\0');
+    CHECK(itoa(1, buffer, 0)[0] == '\0');
+    printf("format: %u random values in bases 2, 8 and 16 OK\n", RANDOM_VALUES);
+}
+
+int main(void) {
+    test_other_bases();
+    test_decimal_sweep();
+    /* The format benchmark runs with the string ones in test_string */
+    return 0;
+}
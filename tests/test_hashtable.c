@@ -0,0 +1,155 @@
+/*
+ * Hash table host test: random inserts, removes and lookups that grow
+ * and shrink the table through many incremental resizes, checked against
+ * a presence table, with resize allocations failing now and then. Then
+ * insert and lookup rates and the worst single insert for a large table.
+ */
+
+#include "test.h"
+#include "hashtable.h"
+#include "kmalloc.h"
+#include "timer.h"
+#include "bench.h"
+
+#define KEY_SPACE           16384
+#define RANDOM_OPS          400000
+#define BENCH_ENTRIES       (1 << 20)
+
+struct entry {
+    struct hash_node node;
+    uint32_t key;
+    uint32_t visits;
+};
+
+static struct entry entries[KEY_SPACE];
+static bool present[KEY_SPACE];
+static uint32_t nr_present;
+
+/* A third of the keys share 256 hash values, so chains get long */
+static uint32_t key_hash(uint32_t key) {
+    return key % 3 == 0 ? hash_u32(key) & 0xFF : hash_u32(key);
+}
+
+static bool entry_match(const struct hash_node* node, const void* key) {
+    return hash_entry(node, struct entry, node)->key == *(const uint32_t*)key;
+}
+
+static struct entry* find(struct hash_table* table, uint32_t key) {
+    struct hash_node* node = hash_lookup(table, key_hash(key), entry_match, &key);
+    return node ? hash_entry(node, struct entry, node) : NULL;
+}
+
+static void count_visit(struct hash_node* node, void* arg) {
+    hash_entry(node, struct entry, node)->visits++;
+    (*(uint32_t*)arg)++;
+}
+
+/* Every present entry is visited exactly once, in or between resizes */
+static void check_foreach(struct hash_table* table) {
+    uint32_t visited = 0;
+
+    for (uint32_t i = 0; i < KEY_SPACE; i++)
+        entries[i].visits = 0;
+    hash_table_foreach(table, count_visit, &visited);
+    CHECK(visited == nr_present);
+    for (uint32_t i = 0; i < KEY_SPACE; i++)
+        CHECK(entries[i].visits == (present[i] ? 1 : 0));
+}
+
+static void test_random_ops(void) {
+    struct hash_table table;
+    uint32_t seed = 1;
+    uint32_t resizes = 0;
+    uint32_t size = 0;
+
+    CHECK(hash_table_init(&table, 0) == 0);
+    for (uint32_t i = 0; i < KEY_SPACE; i++)
+        entries[i].key = i;
+
+    for (uint32_t op = 0; op < RANDOM_OPS; op++) {
+        /* Alternate long insert-heavy and remove-heavy phases */
+        bool growing = (op / 50000) % 2 == 0;
+        uint32_t key = test_random(&seed) % KEY_SPACE;
+        bool insert = test_random(&seed) % 4 != 0;
+
+        if (!growing)
+            insert = !insert;
+        CHECK(find(&table, key) == (present[key] ? &entries[key] : NULL));
+
+        if (insert && !present[key]) {
+            if (test_random(&seed) % 16 == 0)
+                kmalloc_fail_after = 0;
+            hash_insert(&table, &entries[key].node, key_hash(key));
+            kmalloc_fail_after = -1;
+            present[key] = true;
+            nr_present++;
+        } else if (!insert && present[key]) {
+            CHECK(hash_remove(&table, &entries[key].node));
+            CHECK(!hash_remove(&table, &entries[key].node));
+            present[key] = false;
+            nr_present--;
+        }
+        CHECK(table.count == nr_present);
+
+        if (table.size[0] != size) {
+            size = table.size[0];
+            resizes++;
+        }
+        if (op % 1024 == 0 || table.rehash_index == 1)
+            check_foreach(&table);
+    }
+
+    for (uint32_t key = 0; key < KEY_SPACE; key++)
+        CHECK(find(&table, key) == (present[key] ? &entries[key] : NULL));
+    check_foreach(&table);
+    hash_table_destroy(&table);
+    CHECK(resizes > 10);
+    printf("hashtable: %u random operations through %u resizes OK\n", RANDOM_OPS, resizes);
+}
+
+static void benchmark(void) {
+    struct entry* bench = malloc(BENCH_ENTRIES * sizeof(*bench));
+    struct hash_table table;
+    uint64_t worst = 0;
+
+    CHECK(bench);
+    CHECK(hash_table_init(&table, 0) == 0);
+
+    for (uint32_t i = 0; i < BENCH_ENTRIES; i++)
+        bench[i].key = i;
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < BENCH_ENTRIES; i++) {
+        uint64_t before = rdtsc();
+        hash_insert(&table, &bench[i].node, hash_u32(i));
+        uint64_t cycles = rdtsc() - before;
+        if (cycles > worst)
+            worst = cycles;
+    }
+    uint64_t insert_cycles = rdtsc() - start;
+
+    uint32_t hits = 0;
+    uint32_t seed = 12345;
+    start = rdtsc();
+    for (uint32_t i = 0; i < BENCH_ENTRIES; i++) {
+        uint32_t key = test_random(&seed) % BENCH_ENTRIES;
+        struct hash_node* node = hash_lookup(&table, hash_u32(key), entry_match, &key);
+        hits += node != NULL;
+    }
+    uint64_t lookup_cycles = rdtsc() - start;
+    CHECK(hits == BENCH_ENTRIES);
+
+    hash_table_destroy(&table);
+    free(bench);
+
+    bench_report("hashtable", "host_1M_inserts", bench_rate(BENCH_ENTRIES, insert_cycles), "ops/s");
+    bench_report("hashtable", "host_1M_lookups", bench_rate(BENCH_ENTRIES, lookup_cycles), "ops/s");
+    bench_report("hashtable", "host_1M_worst_insert", (uint32_t)worst, "ns");
+}
+
+int main(void) {
+    test_random_ops();
+    benchmark();
+    run_benchmarks();
+    return 0;
+}
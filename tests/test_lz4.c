@@ -0,0 +1,228 @@
+/*
+ * LZ4 host test: random, compressible and mixed buffers round trip
+ * through lz4_compress and lz4_decompress at every length up to 600 and
+ * at random lengths up to 64KB. Hand-made malformed blocks must fail
+ * with -EINVAL; truncated blocks must fail or decode to a prefix of the
+ * data, and randomly corrupted ones must fail or decode within capacity.
+ * No output may land past the capacity. Then compress and decompress
+ * rates.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "lz4.h"
+#include "errno.h"
+#include "timer.h"
+#include "bench.h"
+
+#define MAX_INPUT           65536
+#define SHORT_LENGTHS       600
+#define RANDOM_BUFFERS      300
+#define CORRUPTIONS         200
+#define GUARD               64
+#define GUARD_BYTE          0xEE
+#define BENCH_ROUNDS        200
+
+enum { RANDOM, RUNS, TEXT, MIXED, NR_KINDS };
+
+static const char* const kind_names[NR_KINDS] = { "random", "runs", "text", "mixed" };
+
+static uint8_t input[MAX_INPUT];
+static uint8_t packed[LZ4_COMPRESS_BOUND(MAX_INPUT) + GUARD];
+static uint8_t output[MAX_INPUT + GUARD];
+static uint32_t workmem[LZ4_WORKMEM_SIZE / sizeof(uint32_t)];
+static uint32_t seed = 1;
+
+static void fill_input(int kind, size_t length) {
+    static const char* const words[] = { "the ", "nekkoOS ", "kernel ", "page ", "cache ", "of ", "\n" };
+
+    for (size_t i = 0; i < length; ) {
+        uint32_t r = test_random(&seed);
+        size_t n;
+
+        switch (kind == MIXED ? (int)(r % 3) : kind) {
+        case RANDOM:
+            input[i++] = r >> 8;
+            continue;
+        case RUNS:
+            /* Runs of one byte, and repeats of earlier data near and far */
+            n = MIN(length - i, 1 + (r >> 8) % 300);
+            if (i >= 8 && r & 0x10000) {
+                size_t offset = 1 + (r >> 17) % MIN(i, 70000);
+                for (size_t j = 0; j < n; j++, i++)
+                    input[i] = input[i - offset];
+            } else {
+                memset(input + i, r >> 24, n);
+                i += n;
+            }
+            continue;
+        default:
+            {
+                const char* word = words[(r >> 8) % ARRAY_SIZE(words)];
+                n = MIN(length - i, strlen(word));
+                memcpy(input + i, word, n);
+                i += n;
+            }
+            continue;
+        }
+    }
+}
+
+/* Decode into a capacity of exactly capacity bytes followed by guard bytes */
+static ssize_t decompress(const uint8_t* src, size_t length, size_t capacity) {
+    ssize_t ret;
+
+    memset(output, GUARD_BYTE, capacity + GUARD);
+    ret = lz4_decompress(src, length, output, capacity);
+    for (size_t i = capacity; i < capacity + GUARD; i++)
+        CHECK(output[i] == GUARD_BYTE);
+    CHECK(ret == -EINVAL || (ret >= 0 && (size_t)ret <= capacity));
+    return ret;
+}
+
+static size_t compress(size_t length, size_t capacity) {
+    size_t packed_length;
+
+    memset(packed, GUARD_BYTE, capacity + GUARD);
+    packed_length = lz4_compress(input, length, packed, capacity, workmem);
+    for (size_t i = capacity; i < capacity + GUARD; i++)
+        CHECK(packed[i] == GUARD_BYTE);
+    CHECK(packed_length <= capacity);
+    return packed_length;
+}
+
+/* What a truncated block decodes to must be a prefix of the original */
+static ssize_t check_truncated(const uint8_t* src, size_t length, size_t original) {
+    ssize_t ret = decompress(src, length, original);
+
+    if (ret >= 0)
+        CHECK(memcmp(output, input, ret) == 0);
+    return ret;
+}
+
+/*
+ * Every truncation, then random single byte corruptions. A block cut
+ * right after the literals of a sequence is still a valid block.
+ */
+static void damage_block(size_t packed_length, size_t length) {
+    uint32_t failed = 0;
+
+    for (size_t cut = 0; cut < packed_length; cut++)
+        failed += check_truncated(packed, cut, length) == -EINVAL;
+    CHECK(packed_length < 2 || failed > 0);
+
+    for (uint32_t i = 0; i < CORRUPTIONS; i++) {
+        size_t pos = test_random(&seed) % packed_length;
+        uint8_t saved = packed[pos];
+
+        packed[pos] ^= 1 + test_random(&seed) % 255;
+        decompress(packed, packed_length, length);
+        packed[pos] = saved;
+    }
+}
+
+static void test_block(size_t length, bool damage) {
+    size_t bound = LZ4_COMPRESS_BOUND(length);
+    size_t packed_length = compress(length, bound);
+
+    CHECK(packed_length > 0);
+    CHECK(decompress(packed, packed_length, length) == (ssize_t)length);
+    CHECK(memcmp(output, input, length) == 0);
+
+    /* One byte short of room, to decompress and then to compress */
+    if (length > 0)
+        CHECK(decompress(packed, packed_length, length - 1) == -EINVAL);
+
+    if (damage)
+        damage_block(packed_length, length);
+
+    CHECK(compress(length, packed_length - 1) == 0);
+}
+
+/* Blocks the compressor never makes, each broken in one way */
+static void test_malformed(void) {
+    static const struct {
+        const char* name;
+        uint8_t block[12];
+        size_t length;
+    } blocks[] = {
+        { "offset 0",                    { 0x10, 'a', 0x00, 0x00, 0x50, 'b', 'c', 'd', 'e', 'f' }, 10 },
+        { "offset before the output",    { 0x10, 'a', 0x02, 0x00, 0x50, 'b', 'c', 'd', 'e', 'f' }, 10 },
+        { "literals past the input",     { 0x50, 'a', 'b' }, 3 },
+        { "literal length bytes cut",    { 0xF0, 0xFF }, 2 },
+        { "offset cut",                  { 0x10, 'a', 0x01 }, 3 },
+        { "match length bytes cut",      { 0x1F, 'a', 0x01, 0x00, 0xFF }, 5 },
+        { "match past the capacity",     { 0x1F, 'a', 0x01, 0x00, 0x2D, 0x50, 'b', 'c', 'd', 'e', 'f' }, 11 },
+        { "short last literals",         { 0x10, 'a', 0x01, 0x00, 0x40, 'b', 'c', 'd', 'e' }, 9 },
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(blocks); i++) {
+        if (decompress(blocks[i].block, blocks[i].length, 64) != -EINVAL) {
+            fprintf(stderr, "lz4: accepted a block with %s\n", blocks[i].name);
+            exit(1);
+        }
+    }
+
+    /* The match of 64 bytes again, with room for it this time */
+    static const uint8_t valid[] = { 0x1F, 'a', 0x01, 0x00, 0x2D, 0x50, 'b', 'c', 'd', 'e', 'f' };
+    CHECK(decompress(valid, sizeof(valid), 70) == 70);
+    for (size_t i = 0; i < 65; i++)
+        CHECK(output[i] == 'a');
+    CHECK(memcmp(output + 65, "bcdef", 5) == 0);
+    CHECK(decompress((const uint8_t*)"\x30xyz", 4, 3) == 3);
+    CHECK(decompress(NULL, 0, 0) == 0);
+    printf("lz4: %zu malformed blocks rejected\n", ARRAY_SIZE(blocks));
+}
+
+static void test_round_trips(void) {
+    for (int kind = 0; kind < NR_KINDS; kind++) {
+        uint64_t in = 0;
+        uint64_t out = 0;
+
+        for (size_t length = 0; length <= SHORT_LENGTHS; length++) {
+            fill_input(kind, length);
+            test_block(length, length % 8 == 0);
+        }
+        for (uint32_t i = 0; i < RANDOM_BUFFERS; i++) {
+            size_t length = i == 0 ? MAX_INPUT : test_random(&seed) % MAX_INPUT;
+
+            fill_input(kind, length);
+            test_block(length, i < 2);
+            in += length;
+            out += lz4_compress(input, length, packed, LZ4_COMPRESS_BOUND(length), workmem);
+        }
+        printf("lz4: %s buffers round trip, %u%% of their size packed\n",
+               kind_names[kind], (uint32_t)(out * 100 / in));
+    }
+}
+
+static void benchmark(void) {
+    size_t packed_length;
+    uint64_t start;
+    uint64_t compress_cycles;
+    uint64_t decompress_cycles;
+
+    fill_input(MIXED, MAX_INPUT);
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++)
+        packed_length = lz4_compress(input, MAX_INPUT, packed, sizeof(packed), workmem);
+    compress_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++)
+        CHECK(lz4_decompress(packed, packed_length, output, MAX_INPUT) == MAX_INPUT);
+    decompress_cycles = rdtsc() - start;
+
+    bench_report("lz4", "host_64K_compress", bench_rate(BENCH_ROUNDS, compress_cycles), "ops/s");
+    bench_report("lz4", "host_64K_decompress", bench_rate(BENCH_ROUNDS, decompress_cycles), "ops/s");
+}
+
+int main(void) {
+    test_malformed();
+    test_round_trips();
+    benchmark();
+    run_benchmarks();
+    return 0;
+}
@@ -0,0 +1,844 @@
+/*
+ * nkfs B+tree and journal host test, on a RAM disk through a stand-in for
+ * the metadata block cache. Random inserts, deletes and lookups, with one
+ * key repeated over several leaves as colliding name hashes are, run
+ * against a sorted reference array, and the whole tree is checked after
+ * every operation: node levels and counts, key order within each node and
+ * against the index entries above it, the leaf chain, the inode's block
+ * count, the allocated blocks and the buffer references the journal holds.
+ * Inserts that run out of blocks must leave the tree as it was. Blocks of
+ * a freed tree reused for file data must survive recovery, which must not
+ * replay their older log copies. Right-edge appends must keep leaves full
+ * up to a three-level tree, splits of every height running short once.
+ *
+ * Then a commit is cut off after each of its block writes, again with the
+ * last block written only in half, and with each single write lost while
+ * the others land (the disk reordered them): recovery must bring back the
+ * tree as it was before the commit, or as after it once every block made
+ * it to disk. A damaged descriptor, and a stale transaction of the last
+ * lap around the log right after the head, must not be replayed.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "nkfs.h"
+#include "kmalloc.h"
+#include "pmm.h"
+#include "errno.h"
+#include "kernel.h"
+
+#define DISK_BLOCKS         4096
+#define BLOCK_BITMAP        1
+#define INODE_BITMAP        2
+#define INODE_TABLE         3
+#define JOURNAL_START       4
+#define DATA_START          (JOURNAL_START + NKFS_JOURNAL_MIN)
+#define TEST_INO            2
+
+#define RECORD_SIZE         32
+#define KEY_SPACE           1024
+#define HOT_KEY             500     /* Gets an eighth of the inserts */
+#define RANDOM_OPS          20000
+#define COMMIT_EVERY        64
+#define APPEND_RECORDS      40000
+#define APPEND_RECORD_SIZE  NKFS_BTREE_MAX_RECORD
+#define BATCH_OPS           24
+
+struct record {
+    uint32_t key;
+    uint32_t id;
+    uint8_t fill[NKFS_BTREE_MAX_RECORD - 8];
+};
+
+/* What the tree should hold, sorted by key, then id (insertion order) */
+struct ref {
+    uint32_t key;
+    uint32_t id;
+};
+
+struct state {
+    struct ref* refs;
+    uint32_t count;
+    uint32_t size;
+};
+
+static uint8_t* disk;
+/* How the writes of the commit under test reach the disk */
+enum {
+    WRITES_ALL,
+    WRITES_CUT,                     /* The first write_cut land, then power fails */
+    WRITES_TORN,                    /* As WRITES_CUT, with the last one half written */
+    WRITES_LOSE_ONE,                /* All but write number write_cut land */
+};
+
+static int write_mode = WRITES_ALL;
+static uint32_t write_cut;
+static uint32_t disk_writes;
+
+static struct nkfs_buf* cache[DISK_BLOCKS];
+static struct nkfs_fs fs;
+static struct nkfs_inode inode;
+static uint32_t record_size = RECORD_SIZE;
+
+static struct state expected;
+static struct state found;
+static uint32_t next_id = 1;
+static uint32_t seed = 1;
+
+/*
+ * Stand-ins for nkfs_super.c: block I/O on the RAM disk and an unbounded
+ * block cache. Writes that do not land are dropped without an error, as
+ * a disk that lost power reports none.
+ */
+int nkfs_block_read(struct nkfs_fs* fs, uint32_t block, void* data) {
+    if (block >= fs->super.blocks_count)
+        return -EIO;
+    memcpy(data, disk + (size_t)block * NKFS_BLOCK_SIZE, NKFS_BLOCK_SIZE);
+    return 0;
+}
+
+int nkfs_block_write(struct nkfs_fs* fs, uint32_t block, const void* data) {
+    size_t size = NKFS_BLOCK_SIZE;
+
+    if (block >= fs->super.blocks_count)
+        return -EIO;
+    disk_writes++;
+    if (write_mode == WRITES_LOSE_ONE && disk_writes == write_cut)
+        return 0;
+    if ((write_mode == WRITES_CUT || write_mode == WRITES_TORN) && disk_writes > write_cut)
+        return 0;
+    if (write_mode == WRITES_TORN && disk_writes == write_cut)
+        size /= 2;
+    memcpy(disk + (size_t)block * NKFS_BLOCK_SIZE, data, size);
+    return 0;
+}
+
+static struct nkfs_buf* buf_get(struct nkfs_fs* fs, uint32_t block, bool read) {
+    struct nkfs_buf* buf;
+
+    if (block >= DISK_BLOCKS)
+        return NULL;
+    if ((buf = cache[block])) {
+        buf->count++;
+        return buf;
+    }
+
+    buf = kzalloc(sizeof(*buf));
+    CHECK(buf && (buf->data = page_alloc(1)));
+    buf->fs = fs;
+    buf->block = block;
+    buf->count = 1;
+    list_init(&buf->lru);
+    list_init(&buf->trans_entry);
+    list_init(&buf->checkpoint_entry);
+    if (read)
+        CHECK(nkfs_block_read(fs, block, buf->data) == 0);
+    cache[block] = buf;
+    return buf;
+}
+
+static void buf_free(struct nkfs_buf* buf) {
+    cache[buf->block] = NULL;
+    page_free(buf->data, 1);
+    kfree(buf);
+}
+
+struct nkfs_buf* nkfs_bread(struct nkfs_fs* fs, uint32_t block) {
+    return buf_get(fs, block, true);
+}
+
+struct nkfs_buf* nkfs_bnew(struct nkfs_fs* fs, uint32_t block) {
+    struct nkfs_buf* buf = buf_get(fs, block, false);
+
+    if (buf) {
+        memset(buf->data, 0, NKFS_BLOCK_SIZE);
+        nkfs_bdirty(buf);
+    }
+    return buf;
+}
+
+void nkfs_brelse(struct nkfs_buf* buf) {
+    if (buf) {
+        CHECK(buf->count > 0);
+        buf->count--;
+    }
+}
+
+void nkfs_bdirty(struct nkfs_buf* buf) {
+    nkfs_journal_dirty(buf);
+}
+
+void nkfs_bforget(struct nkfs_fs* fs, uint32_t block) {
+    struct nkfs_buf* buf = block < DISK_BLOCKS ? cache[block] : NULL;
+
+    (void)fs;
+    if (!buf)
+        return;
+    nkfs_journal_forget(buf);
+    if (buf->count == 0)
+        buf_free(buf);
+}
+
+/* The test inode is the only metadata staged besides the tree nodes */
+int nkfs_stage_metadata(struct nkfs_fs* fs) {
+    memset(fs->bitmap_dirty, 0, (INODE_TABLE - BLOCK_BITMAP) * sizeof(bool));
+    if (!inode.dirty)
+        return 0;
+
+    struct nkfs_buf* buf = nkfs_bread(fs, INODE_TABLE);
+    if (!buf)
+        return -EIO;
+    memcpy(buf->data + TEST_INO * NKFS_INODE_SIZE, &inode.disk, sizeof(inode.disk));
+    nkfs_bdirty(buf);
+    nkfs_brelse(buf);
+    inode.dirty = false;
+    return 0;
+}
+
+void nkfs_mark_inode_dirty(struct nkfs_inode* inode) {
+    inode->dirty = true;
+}
+
+void nkfs_lock(struct nkfs_fs* fs) {
+    CHECK(!fs->locked);
+    fs->locked = true;
+}
+
+void nkfs_unlock(struct nkfs_fs* fs) {
+    fs->locked = false;
+}
+
+/* Work items are queued but never run: the test commits and checkpoints itself */
+struct workqueue_struct* system_wq;
+
+void work_init(struct work_struct* work, work_func_t func) {
+    work->func = func;
+    work->flags = 0;
+}
+
+void delayed_work_init(struct delayed_work* dwork, work_func_t func) {
+    work_init(&dwork->work, func);
+}
+
+bool queue_work(struct workqueue_struct* wq, struct work_struct* work) {
+    (void)wq;
+    if (work->flags & WORK_PENDING)
+        return false;
+    work->flags |= WORK_PENDING;
+    return true;
+}
+
+bool queue_delayed_work(struct workqueue_struct* wq, struct delayed_work* dwork, uint32_t delay_ms) {
+    (void)delay_ms;
+    return queue_work(wq, &dwork->work);
+}
+
+bool cancel_delayed_work(struct delayed_work* dwork) {
+    bool pending = dwork->work.flags & WORK_PENDING;
+
+    dwork->work.flags &= ~WORK_PENDING;
+    return pending;
+}
+
+void flush_work(struct work_struct* work) {
+    work->flags &= ~WORK_PENDING;
+}
+
+void wait_queue_init(struct wait_queue_head* wq) {
+    list_init(&wq->waiters);
+}
+
+void wake_up(struct wait_queue_head* wq) {
+    (void)wq;
+}
+
+/* Nothing else runs, so a wait would never end */
+void prepare_to_wait(struct wait_queue_head* wq) {
+    (void)wq;
+    panic("nkfs test: wait_event");
+}
+
+void finish_wait(struct wait_queue_head* wq) {
+    (void)wq;
+}
+
+void schedule(void) {
+}
+
+/* Mount: journal recovery, the inode, and a block bitmap from the tree */
+static void tree_walk(struct state* state);
+
+static void mount(void) {
+    memset(&fs, 0, sizeof(fs));
+    fs.super.blocks_count = DISK_BLOCKS;
+    fs.super.block_bitmap = BLOCK_BITMAP;
+    fs.super.inode_bitmap = INODE_BITMAP;
+    fs.super.inode_table = INODE_TABLE;
+    fs.super.journal_start = JOURNAL_START;
+    fs.super.journal_blocks = NKFS_JOURNAL_MIN;
+    fs.super.data_start = DATA_START;
+    fs.super.free_blocks = DISK_BLOCKS - DATA_START;
+    CHECK(fs.block_bitmap = calloc(DISK_BLOCKS / 8, 1));
+    CHECK(fs.bitmap_dirty = calloc(INODE_TABLE - BLOCK_BITMAP, sizeof(bool)));
+    CHECK(nkfs_journal_load(&fs) == 0);
+
+    memset(&inode, 0, sizeof(inode));
+    inode.fs = &fs;
+    inode.ino = TEST_INO;
+    memcpy(&inode.disk, disk + INODE_TABLE * NKFS_BLOCK_SIZE + TEST_INO * NKFS_INODE_SIZE, sizeof(inode.disk));
+    tree_walk(&found);
+}
+
+/* Drop everything in memory, as a crash or the end of a test does */
+static void crash(void) {
+    struct list_head* pos;
+    struct list_head* tmp;
+
+    list_for_each_safe(pos, tmp, &fs.journal.running.frees)
+        kfree(list_entry(pos, struct nkfs_free_run, entry));
+    nkfs_journal_destroy(&fs);
+    for (uint32_t block = 0; block < DISK_BLOCKS; block++) {
+        if (cache[block])
+            buf_free(cache[block]);
+    }
+    free(fs.block_bitmap);
+    free(fs.bitmap_dirty);
+}
+
+static void format(void) {
+    void* block = page_alloc(1);
+
+    CHECK(block);
+    memset(disk, 0, (size_t)DISK_BLOCKS * NKFS_BLOCK_SIZE);
+    memset(&fs, 0, sizeof(fs));
+    fs.super.blocks_count = DISK_BLOCKS;
+    fs.super.journal_start = JOURNAL_START;
+    CHECK(nkfs_journal_format(&fs, block) == 0);
+    page_free(block, 1);
+}
+
+/* Tree walk */
+struct walk {
+    uint32_t nodes;
+    uint32_t leaves;
+    uint32_t full_leaves;
+    uint32_t next_leaf;             /* What the previous leaf's next pointer named */
+    bool first_leaf;
+};
+
+static void record_fill(struct record* record, uint32_t key, uint32_t id) {
+    record->key = key;
+    record->id = id;
+    for (uint32_t i = 0; i < sizeof(record->fill); i++)
+        record->fill[i] = id * 7 + i;
+}
+
+static void state_reserve(struct state* state, uint32_t count) {
+    if (count > state->size) {
+        state->size = ALIGN_UP(count, 1024);
+        CHECK(state->refs = realloc(state->refs, state->size * sizeof(struct ref)));
+    }
+}
+
+static void state_copy(struct state* dest, const struct state* src) {
+    state_reserve(dest, src->count);
+    memcpy(dest->refs, src->refs, src->count * sizeof(struct ref));
+    dest->count = src->count;
+}
+
+static void state_add(struct state* state, uint32_t index, uint32_t key, uint32_t id) {
+    state_reserve(state, state->count + 1);
+    memmove(state->refs + index + 1, state->refs + index, (state->count - index) * sizeof(struct ref));
+    state->refs[index] = (struct ref){ key, id };
+    state->count++;
+}
+
+/*
+ * Node checks. Records are appended to state in tree order, which must be
+ * key order, and insertion (id) order among equal keys.
+ */
+static void walk_node(struct walk* walk, struct state* state, uint32_t block, int level,
+                      uint32_t low, uint32_t high) {
+    struct nkfs_buf* buf = nkfs_bread(&fs, block);
+    CHECK(buf);
+
+    struct nkfs_btree_header* header = (struct nkfs_btree_header*)buf->data;
+    uint8_t* entries = buf->data + sizeof(*header);
+
+    CHECK(header->magic == NKFS_BTREE_MAGIC);
+    CHECK(level < 0 || header->level == level);
+    CHECK(block >= DATA_START && block < DISK_BLOCKS);
+    CHECK(!(fs.block_bitmap[block / 8] & (1 << (block % 8))));
+    fs.block_bitmap[block / 8] |= 1 << (block % 8);
+    fs.super.free_blocks--;
+    walk->nodes++;
+
+    if (header->level > 0) {
+        struct nkfs_btree_index* index = (struct nkfs_btree_index*)entries;
+
+        CHECK(header->count >= 1 && header->count <= NKFS_BTREE_SPACE / sizeof(*index));
+        for (uint32_t i = 1; i < header->count; i++)
+            CHECK(index[i].key >= low && index[i].key <= high && index[i].key >= index[i - 1].key);
+        for (uint32_t i = 0; i < header->count; i++)
+            walk_node(walk, state, index[i].child, header->level - 1, i == 0 ? low : index[i].key,
+                      i + 1 < header->count ? index[i + 1].key : high);
+    } else {
+        CHECK(header->count <= NKFS_BTREE_SPACE / record_size);
+        for (uint32_t i = 0; i < header->count; i++) {
+            struct record* record = (struct record*)(entries + i * record_size);
+            struct record reference;
+
+            CHECK(record->key >= low && record->key <= high);
+            record_fill(&reference, record->key, record->id);
+            CHECK(memcmp(record, &reference, record_size) == 0);
+            if (state->count) {
+                struct ref* last = &state->refs[state->count - 1];
+                CHECK(record->key > last->key || (record->key == last->key && record->id > last->id));
+            }
+            state_add(state, state->count, record->key, record->id);
+        }
+        CHECK(walk->first_leaf || walk->next_leaf == block);
+        walk->first_leaf = false;
+        walk->next_leaf = header->next;
+        walk->leaves++;
+        walk->full_leaves += header->count == NKFS_BTREE_SPACE / record_size;
+    }
+    nkfs_brelse(buf);
+}
+
+static struct walk last_walk;
+
+/* Walk the whole tree into state, marking its nodes in the block bitmap */
+static void tree_walk(struct state* state) {
+    struct walk walk = { .first_leaf = true };
+
+    memset(fs.block_bitmap, 0, DISK_BLOCKS / 8);
+    fs.super.free_blocks = DISK_BLOCKS - DATA_START;
+    state->count = 0;
+    if (inode.disk.tree_root) {
+        walk_node(&walk, state, inode.disk.tree_root, -1, 0, UINT32_MAX);
+        CHECK(walk.next_leaf == 0);
+    }
+    CHECK(inode.disk.blocks == walk.nodes);
+    last_walk = walk;
+}
+
+static bool state_equal(const struct state* a, const struct state* b) {
+    return a->count == b->count && memcmp(a->refs, b->refs, a->count * sizeof(struct ref)) == 0;
+}
+
+/* Every cached buffer is referenced only by the journal lists it is on */
+static void check_buffers(void) {
+    for (uint32_t block = 0; block < DISK_BLOCKS; block++) {
+        struct nkfs_buf* buf = cache[block];
+
+        if (buf)
+            CHECK(buf->count == (uint32_t)(buf->trans != 0) + !list_empty(&buf->checkpoint_entry));
+    }
+}
+
+static void check_tree(void) {
+    struct list_head* pos;
+    uint32_t free_blocks = fs.super.free_blocks;
+    uint8_t* bitmap = malloc(DISK_BLOCKS / 8);
+
+    CHECK(bitmap);
+    memcpy(bitmap, fs.block_bitmap, DISK_BLOCKS / 8);
+    tree_walk(&found);
+    CHECK(state_equal(&found, &expected));
+    check_buffers();
+
+    /* Allocated blocks are the tree's and those freed but not yet committed, no others */
+    list_for_each(pos, &fs.journal.running.frees) {
+        struct nkfs_free_run* run = list_entry(pos, struct nkfs_free_run, entry);
+
+        for (uint32_t block = run->start; block < run->start + run->count; block++) {
+            CHECK(!(fs.block_bitmap[block / 8] & (1 << (block % 8))));
+            fs.block_bitmap[block / 8] |= 1 << (block % 8);
+            fs.super.free_blocks--;
+        }
+    }
+    CHECK(memcmp(bitmap, fs.block_bitmap, DISK_BLOCKS / 8) == 0);
+    CHECK(fs.super.free_blocks == free_blocks);
+    memcpy(fs.block_bitmap, bitmap, DISK_BLOCKS / 8);
+    fs.super.free_blocks = free_blocks;
+    free(bitmap);
+}
+
+/* Operations */
+
+/* First slot with a key above key, or with key and an id above id */
+static uint32_t state_upper(const struct state* state, uint32_t key, uint32_t id) {
+    uint32_t low = 0;
+    uint32_t high = state->count;
+
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        const struct ref* ref = &state->refs[mid];
+        if (ref->key < key || (ref->key == key && ref->id <= id))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+static int insert(uint32_t key) {
+    struct record record;
+    int ret;
+
+    record_fill(&record, key, next_id);
+    nkfs_journal_start(&fs);
+    ret = nkfs_btree_insert(&inode, record_size, &record);
+    nkfs_journal_stop(&fs);
+    if (ret == 0)
+        state_add(&expected, state_upper(&expected, key, next_id), key, next_id);
+    next_id++;
+    return ret;
+}
+
+static void delete(uint32_t index) {
+    struct ref ref = expected.refs[index];
+    struct nkfs_btree_cursor cursor;
+
+    nkfs_journal_start(&fs);
+    CHECK(nkfs_btree_find(&inode, record_size, ref.key, NKFS_BTREE_GE, &cursor) == 0);
+    for (;;) {
+        struct record* record = nkfs_btree_record(&cursor, record_size);
+
+        CHECK(record->key == ref.key);
+        if (record->id == ref.id)
+            break;
+        CHECK(nkfs_btree_next(&inode, record_size, &cursor) == 0);
+    }
+    nkfs_btree_delete(&cursor, record_size);
+    nkfs_btree_release(&cursor);
+    nkfs_journal_stop(&fs);
+
+    memmove(expected.refs + index, expected.refs + index + 1, (expected.count - index - 1) * sizeof(struct ref));
+    expected.count--;
+}
+
+/* Every record with the key, in id order */
+static void lookup(uint32_t key) {
+    struct nkfs_btree_cursor cursor;
+    uint32_t index = state_upper(&expected, key, 0);
+    int ret = nkfs_btree_find(&inode, record_size, key, NKFS_BTREE_GE, &cursor);
+
+    while (ret == 0) {
+        struct record* record = nkfs_btree_record(&cursor, record_size);
+
+        if (record->key != key)
+            break;
+        CHECK(index < expected.count && expected.refs[index].key == key);
+        CHECK(record->id == expected.refs[index++].id);
+        ret = nkfs_btree_next(&inode, record_size, &cursor);
+    }
+    CHECK(ret == 0 || ret == -ENOENT);
+    CHECK(index == expected.count || expected.refs[index].key != key);
+    nkfs_btree_release(&cursor);
+}
+
+/* Last record <= key; only valid while nothing was deleted */
+static void lookup_le(uint32_t key) {
+    struct nkfs_btree_cursor cursor;
+    uint32_t index = state_upper(&expected, key, UINT32_MAX);
+    int ret = nkfs_btree_find(&inode, record_size, key, NKFS_BTREE_LE, &cursor);
+
+    if (index == 0) {
+        CHECK(ret == -ENOENT);
+        return;
+    }
+    CHECK(ret == 0);
+    struct record* record = nkfs_btree_record(&cursor, record_size);
+    CHECK(record->key == expected.refs[index - 1].key && record->id == expected.refs[index - 1].id);
+    nkfs_btree_release(&cursor);
+}
+
+/* An insert that finds only limit free blocks, maybe fewer than its splits need */
+static int insert_short_of_blocks(uint32_t key, uint32_t limit) {
+    uint32_t free_blocks = fs.super.free_blocks;
+    int ret;
+
+    fs.super.free_blocks = limit;
+    ret = insert(key);
+    fs.super.free_blocks = free_blocks - (limit - fs.super.free_blocks);
+    CHECK(ret == 0 || ret == -ENOSPC);
+    return ret;
+}
+
+static uint32_t random_key(void) {
+    uint32_t r = test_random(&seed);
+    return r % 8 == 0 ? HOT_KEY : (r >> 3) % KEY_SPACE;
+}
+
+static void test_random_ops(void) {
+    uint32_t deletes = 0;
+    uint32_t max_depth = 0;
+
+    format();
+    mount();
+    record_size = RECORD_SIZE;
+    expected.count = 0;
+
+    for (uint32_t i = 0; i < RANDOM_OPS; i++) {
+        uint32_t r = test_random(&seed) % 100;
+        uint32_t insert_percent = i < RANDOM_OPS / 2 ? 60 : 25;
+
+        if (r < insert_percent) {
+            if (r % 4 == 0)
+                insert_short_of_blocks(random_key(), test_random(&seed) % 3);
+            else
+                CHECK(insert(random_key()) == 0);
+        } else if (r < insert_percent + 25 && expected.count) {
+            delete(test_random(&seed) % expected.count);
+            deletes++;
+        } else {
+            lookup(random_key());
+            if (!deletes)
+                lookup_le(random_key());
+        }
+
+        if (i % COMMIT_EVERY == COMMIT_EVERY - 1)
+            CHECK(nkfs_journal_commit(&fs) == 0);
+        if (i % (COMMIT_EVERY * 8) == 0)
+            CHECK(nkfs_journal_checkpoint(&fs) == 0);
+        check_tree();
+        if (nkfs_btree_depth(&inode) > max_depth)
+            max_depth = nkfs_btree_depth(&inode);
+    }
+
+    /* What was committed comes back after a crash */
+    CHECK(nkfs_journal_commit(&fs) == 0);
+    crash();
+    mount();
+    CHECK(state_equal(&found, &expected));
+    check_buffers();
+
+    /* Change most of the tree again, so the log holds copies of its nodes */
+    for (uint32_t i = 0; i < RANDOM_OPS / 20; i++) {
+        if (i % 2)
+            CHECK(insert(random_key()) == 0);
+        else
+            delete(test_random(&seed) % expected.count);
+    }
+    CHECK(nkfs_journal_commit(&fs) == 0);
+    check_tree();
+
+    /*
+     * Free the tree and write file data over its blocks in place. Once the
+     * free has committed, every block comes back, and recovery must not
+     * replay the older copies over the data.
+     */
+    uint8_t* data = page_alloc(1);
+    uint8_t* tree_blocks = malloc(DISK_BLOCKS / 8);
+    CHECK(data && tree_blocks);
+    memcpy(tree_blocks, fs.block_bitmap, DISK_BLOCKS / 8);
+
+    nkfs_journal_start(&fs);
+    nkfs_btree_free(&inode);
+    nkfs_journal_stop(&fs);
+    CHECK(nkfs_journal_commit(&fs) == 0);
+    CHECK(inode.disk.blocks == 0);
+    CHECK(fs.super.free_blocks == DISK_BLOCKS - DATA_START);
+    check_buffers();
+
+    /* The freed nodes also left the cache, so no checkpoint writes them back */
+    for (uint32_t block = DATA_START; block < DISK_BLOCKS; block++) {
+        if (tree_blocks[block / 8] & (1 << (block % 8))) {
+            CHECK(!cache[block]);
+            memset(data, block, NKFS_BLOCK_SIZE);
+            CHECK(nkfs_block_write(&fs, block, data) == 0);
+        }
+    }
+    crash();
+    mount();
+    for (uint32_t block = DATA_START; block < DISK_BLOCKS; block++) {
+        if (tree_blocks[block / 8] & (1 << (block % 8))) {
+            memset(data, block, NKFS_BLOCK_SIZE);
+            CHECK(memcmp(disk + (size_t)block * NKFS_BLOCK_SIZE, data, NKFS_BLOCK_SIZE) == 0);
+        }
+    }
+    crash();
+    page_free(data, 1);
+    free(tree_blocks);
+
+    printf("nkfs_btree: %u random operations, up to %u records and depth %u\n",
+           RANDOM_OPS, expected.count, max_depth);
+}
+
+/* Appending keeps every leaf but the last one full */
+static void test_append(void) {
+    format();
+    mount();
+    record_size = APPEND_RECORD_SIZE;
+    expected.count = 0;
+
+    /* Each insert gets one more free block until it fits, so splits of every height run short */
+    for (uint32_t key = 0; key < APPEND_RECORDS; key++) {
+        for (uint32_t limit = 0; insert_short_of_blocks(key, limit) < 0; limit++)
+            CHECK(limit < NKFS_BTREE_MAX_DEPTH + 1);
+        if (key % 5000 == 4999 || key == APPEND_RECORDS - 1) {
+            lookup_le(key / 2);
+            check_tree();
+            CHECK(last_walk.full_leaves >= last_walk.leaves - 1);
+        }
+    }
+    CHECK(nkfs_btree_depth(&inode) == 3);
+    CHECK(nkfs_journal_commit(&fs) == 0);
+    crash();
+    printf("nkfs_btree: %u appended records in %u full leaves, depth 3\n", APPEND_RECORDS, last_walk.leaves);
+}
+
+static bool stale_descriptor_at_head(void) {
+    struct nkfs_journal_header* header = (void*)(disk + (size_t)(fs.journal.start + fs.journal.head) * NKFS_BLOCK_SIZE);
+
+    return header->magic == NKFS_JOURNAL_MAGIC && header->type == NKFS_JOURNAL_DESCRIPTOR;
+}
+
+/*
+ * Point the second tag of a descriptor of transaction seq at the block of
+ * the first, as a bit flipped in the log would. The data checksums still
+ * match, only the commit checksum over the descriptors can tell.
+ */
+static void damage_descriptor(uint32_t seq) {
+    for (uint32_t block = JOURNAL_START; block < DATA_START; block++) {
+        struct nkfs_journal_descriptor* desc = (void*)(disk + (size_t)block * NKFS_BLOCK_SIZE);
+
+        if (desc->header.magic == NKFS_JOURNAL_MAGIC && desc->header.type == NKFS_JOURNAL_DESCRIPTOR &&
+            desc->header.seq == seq) {
+            CHECK(desc->count >= 2);
+            desc->tags[1].block = desc->tags[0].block;
+            return;
+        }
+    }
+    CHECK(!"no descriptor");
+}
+
+/*
+ * Apply BATCH_OPS operations from the given seed in one transaction and
+ * commit it, its writes reaching the disk as mode and cut say. Returns
+ * the number of writes the commit made.
+ */
+static uint32_t commit_batch(uint32_t batch_seed, int mode, uint32_t cut) {
+    uint32_t commits = fs.journal.commits;
+    uint32_t writes;
+
+    seed = batch_seed;
+    for (uint32_t i = 0; i < BATCH_OPS; i++) {
+        if (test_random(&seed) % 3 && expected.count)
+            delete(test_random(&seed) % expected.count);
+        else
+            CHECK(insert(random_key()) == 0);
+    }
+    CHECK(fs.journal.commits == commits);
+
+    disk_writes = 0;
+    write_mode = mode;
+    write_cut = cut;
+    CHECK(nkfs_journal_commit(&fs) == 0);
+    writes = disk_writes;
+    write_mode = WRITES_ALL;
+    return writes;
+}
+
+static void test_torn_commits(void) {
+    uint8_t* saved_disk = malloc((size_t)DISK_BLOCKS * NKFS_BLOCK_SIZE);
+    struct state before = { 0 };
+    struct state after = { 0 };
+    uint32_t saved_next_id;
+    uint32_t writes;
+    uint32_t seq;
+    uint32_t trials = 0;
+
+    CHECK(saved_disk);
+    kprintf_quiet = true;
+    format();
+    mount();
+    record_size = RECORD_SIZE;
+    expected.count = 0;
+
+    /* Some of the tree in place, the rest only in the log */
+    for (uint32_t i = 0; i < 3000; i++)
+        CHECK(insert(random_key()) == 0);
+    CHECK(nkfs_journal_commit(&fs) == 0);
+    CHECK(nkfs_journal_checkpoint(&fs) == 0);
+    for (uint32_t head = fs.journal.head; fs.journal.head >= head; ) {
+        head = fs.journal.head;
+        CHECK(insert(random_key()) == 0);
+        CHECK(nkfs_journal_commit(&fs) == 0);
+        CHECK(nkfs_journal_checkpoint(&fs) == 0);
+    }
+    for (uint32_t i = 0; i < 200; i++)
+        delete(test_random(&seed) % expected.count);
+    CHECK(nkfs_journal_commit(&fs) == 0);
+
+    /*
+     * The log went around once, so a complete transaction of the last lap
+     * may follow the head. Leave the head on one: only its sequence number
+     * tells recovery it is stale.
+     */
+    for (uint32_t i = 0; !stale_descriptor_at_head(); i++) {
+        CHECK(i < 100);
+        CHECK(insert(random_key()) == 0);
+        CHECK(nkfs_journal_commit(&fs) == 0);
+    }
+    crash();
+
+    memcpy(saved_disk, disk, (size_t)DISK_BLOCKS * NKFS_BLOCK_SIZE);
+    saved_next_id = next_id;
+    for (uint32_t batch = 0; batch < 4; batch++) {
+        uint32_t batch_seed = 1000 + batch;
+
+        /* The whole commit, for the write count and the state after it */
+        memcpy(disk, saved_disk, (size_t)DISK_BLOCKS * NKFS_BLOCK_SIZE);
+        mount();
+        state_copy(&before, &found);
+        state_copy(&expected, &found);
+        next_id = saved_next_id;
+        writes = commit_batch(batch_seed, WRITES_ALL, 0);
+        state_copy(&after, &expected);
+        seq = fs.journal.commit_seq;
+        crash();
+
+        /* Every block on disk, but a descriptor damaged */
+        damage_descriptor(seq);
+        mount();
+        CHECK(state_equal(&found, &before));
+        crash();
+
+        for (int mode = WRITES_CUT; mode <= WRITES_LOSE_ONE; mode++) {
+            for (uint32_t cut = mode == WRITES_CUT ? 0 : 1; cut <= writes; cut++) {
+                bool committed = mode != WRITES_LOSE_ONE && cut == writes;
+
+                memcpy(disk, saved_disk, (size_t)DISK_BLOCKS * NKFS_BLOCK_SIZE);
+                mount();
+                CHECK(state_equal(&found, &before));
+                state_copy(&expected, &before);
+                next_id = saved_next_id;
+                commit_batch(batch_seed, mode, cut);
+                crash();
+
+                mount();
+                CHECK(state_equal(&found, committed ? &after : &before));
+                crash();
+                trials++;
+            }
+        }
+    }
+
+    kprintf_quiet = false;
+    free(saved_disk);
+    free(before.refs);
+    free(after.refs);
+    printf("nkfs_btree: %u commits cut off, each recovered to before or after\n", trials);
+}
+
+int main(void) {
+    CHECK(disk = malloc((size_t)DISK_BLOCKS * NKFS_BLOCK_SIZE));
+    test_random_ops();
+    test_append();
+    test_torn_commits();
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * Radix tree host test: random inserts, deletes and range lookups over
+ * dense, sparse and top-of-range indices, checked against a sorted array,
+ * with allocation failures injected into inserts. Then sequential and
+ * random insert and lookup rates.
+ */
+
+#include "test.h"
+#include "radix_tree.h"
+#include "kmalloc.h"
+#include "timer.h"
+#include "bench.h"
+#include "errno.h"
+
+#define MODEL_MAX           4096
+#define RANDOM_OPS          200000
+#define BENCH_ITEMS         (1 << 20)
+
+/* Reference model: indices in ascending order, item i is &items[slot] */
+static uint32_t model[MODEL_MAX];
+static uint32_t nr_model;
+static char items[MODEL_MAX];
+
+static void* item_for(uint32_t index) {
+    return &items[index % MODEL_MAX];
+}
+
+/* Slot of the first model index >= index */
+static uint32_t model_search(uint32_t index) {
+    uint32_t low = 0;
+    uint32_t high = nr_model;
+
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        if (model[mid] < index)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+static uint32_t random_index(uint32_t* seed) {
+    uint32_t value = test_random(seed);
+
+    switch (value % 4) {
+    case 0:
+        return value >> 20;                 /* Dense: a few leaves */
+    case 1:
+        return 0xFFFFFFFF - (value >> 24);  /* The top of the index space */
+    case 2:
+        return (value >> 8) & 0xFFFFF;      /* Middle levels */
+    default:
+        return test_random(seed);           /* Sparse over all 32 bits */
+    }
+}
+
+static void check_ranges(const struct radix_tree_root* root, uint32_t* seed) {
+    void* results[16];
+
+    CHECK(root->count == nr_model);
+    for (int i = 0; i < 8; i++) {
+        uint32_t first = random_index(seed);
+        uint32_t slot = model_search(first);
+        uint32_t found = radix_tree_gang_lookup(root, results, first, ARRAY_SIZE(results));
+
+        CHECK(found == MIN(nr_model - slot, ARRAY_SIZE(results)));
+        for (uint32_t j = 0; j < found; j++)
+            CHECK(results[j] == item_for(model[slot + j]));
+
+        uint32_t index = first;
+        void* item = radix_tree_find_next(root, &index);
+        if (slot == nr_model) {
+            CHECK(item == NULL);
+        } else {
+            CHECK(item == item_for(model[slot]));
+            CHECK(index == model[slot]);
+        }
+    }
+}
+
+static void test_random_ops(void) {
+    struct radix_tree_root root = RADIX_TREE_INIT;
+    uint32_t seed = 1;
+    uint32_t failed = 0;
+
+    CHECK(radix_tree_insert(&root, 5, NULL) == -EINVAL);
+    for (uint32_t op = 0; op < RANDOM_OPS; op++) {
+        uint32_t index = random_index(&seed);
+        uint32_t slot = model_search(index);
+        bool present = slot < nr_model && model[slot] == index;
+
+        CHECK(radix_tree_lookup(&root, index) == (present ? item_for(index) : NULL));
+        if (present && test_random(&seed) % 2) {
+            CHECK(radix_tree_delete(&root, index) == item_for(index));
+            CHECK(radix_tree_delete(&root, index) == NULL);
+            nr_model--;
+            for (uint32_t i = slot; i < nr_model; i++)
+                model[i] = model[i + 1];
+        } else if (present) {
+            CHECK(radix_tree_insert(&root, index, item_for(index)) == -EEXIST);
+        } else if (nr_model < MODEL_MAX) {
+            /* Every few inserts, fail one of the node allocations */
+            if (test_random(&seed) % 8 == 0)
+                kmalloc_fail_after = test_random(&seed) % 4;
+            int ret = radix_tree_insert(&root, index, item_for(index));
+            kmalloc_fail_after = -1;
+            if (ret == -ENOMEM) {
+                failed++;
+                CHECK(radix_tree_lookup(&root, index) == NULL);
+            } else {
+                CHECK(ret == 0);
+                for (uint32_t i = nr_model; i > slot; i--)
+                    model[i] = model[i - 1];
+                model[slot] = index;
+                nr_model++;
+            }
+        }
+        if (op % 64 == 0)
+            check_ranges(&root, &seed);
+    }
+    CHECK(failed > 0);
+
+    /* Delete everything; the tree must shrink back to nothing */
+    while (nr_model > 0) {
+        uint32_t slot = test_random(&seed) % nr_model;
+        CHECK(radix_tree_delete(&root, model[slot]) == item_for(model[slot]));
+        nr_model--;
+        for (uint32_t i = slot; i < nr_model; i++)
+            model[i] = model[i + 1];
+    }
+    CHECK(root.node == NULL && root.count == 0);
+    printf("radix_tree: %u random operations OK (%u injected allocation failures)\n", RANDOM_OPS, failed);
+}
+
+static void benchmark(void) {
+    struct radix_tree_root root = RADIX_TREE_INIT;
+    uint32_t seed = 12345;
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < BENCH_ITEMS; i++)
+        CHECK(radix_tree_insert(&root, i, item_for(i)) == 0);
+    uint64_t insert_cycles = rdtsc() - start;
+
+    uint32_t hits = 0;
+    start = rdtsc();
+    for (uint32_t i = 0; i < BENCH_ITEMS; i++)
+        hits += radix_tree_lookup(&root, test_random(&seed) % BENCH_ITEMS) != NULL;
+    uint64_t lookup_cycles = rdtsc() - start;
+    CHECK(hits == BENCH_ITEMS);
+    radix_tree_destroy(&root);
+
+    /* Sparse random indices: deeper paths, one leaf per item */
+    uint64_t sparse_cycles = 0;
+    uint32_t inserted = 0;
+    start = rdtsc();
+    for (uint32_t i = 0; i < BENCH_ITEMS; i++)
+        inserted += radix_tree_insert(&root, test_random(&seed), item_for(i)) == 0;
+    sparse_cycles = rdtsc() - start;
+    CHECK(root.count == inserted);
+    radix_tree_destroy(&root);
+
+    bench_report("radix_tree", "host_1M_sequential_inserts", bench_rate(BENCH_ITEMS, insert_cycles), "ops/s");
+    bench_report("radix_tree", "host_1M_random_lookups", bench_rate(BENCH_ITEMS, lookup_cycles), "ops/s");
+    bench_report("radix_tree", "host_1M_sparse_inserts", bench_rate(BENCH_ITEMS, sparse_cycles), "ops/s");
+}
+
+int main(void) {
+    test_random_ops();
+    benchmark();
+    run_benchmarks();
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * rbtree host test: random inserts and erases on a cached-leftmost tree,
+ * checked against a presence table after every operation, then insert,
+ * lookup and erase rates for a large tree.
+ */
+
+#include "test.h"
+#include "rbtree.h"
+#include "timer.h"
+#include "bench.h"
+
+#define KEY_SPACE           2048
+#define RANDOM_OPS          200000
+#define BENCH_NODES         (1 << 20)
+
+struct item {
+    struct rb_node node;
+    uint32_t key;
+};
+
+static struct item items[KEY_SPACE];
+static bool present[KEY_SPACE];
+static uint32_t nr_present;
+
+static void insert(struct rb_root_cached* root, struct item* item) {
+    struct rb_node** link = &root->root.node;
+    struct rb_node* parent = NULL;
+    bool leftmost = true;
+
+    while (*link) {
+        parent = *link;
+        if (item->key < rb_entry(parent, struct item, node)->key) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+    rb_link_node(&item->node, parent, link);
+    rb_insert_color_cached(&item->node, root, leftmost);
+}
+
+static struct item* find(const struct rb_root* root, uint32_t key) {
+    struct rb_node* node = root->node;
+
+    while (node) {
+        struct item* item = rb_entry(node, struct item, node);
+        if (key < item->key)
+            node = node->left;
+        else if (key > item->key)
+            node = node->right;
+        else
+            return item;
+    }
+    return NULL;
+}
+
+/* Black height of the subtree, checking colors, order and parent links */
+static uint32_t check_subtree(const struct rb_node* node, const struct rb_node* parent,
+                              uint32_t low, uint32_t high) {
+    if (!node)
+        return 1;
+
+    uint32_t key = rb_entry(node, struct item, node)->key;
+    CHECK(node->parent == parent);
+    CHECK(key >= low && key <= high);
+    if (node->color == RB_RED) {
+        CHECK(!node->left || node->left->color == RB_BLACK);
+        CHECK(!node->right || node->right->color == RB_BLACK);
+    } else {
+        CHECK(node->color == RB_BLACK);
+    }
+
+    uint32_t left = check_subtree(node->left, node, low, key ? key - 1 : 0);
+    uint32_t right = check_subtree(node->right, node, key + 1, high);
+    CHECK(left == right);
+    return left + (node->color == RB_BLACK);
+}
+
+static void check_tree(const struct rb_root_cached* root) {
+    const struct rb_node* top = root->root.node;
+
+    CHECK(!top || top->color == RB_BLACK);
+    check_subtree(top, NULL, 0, 0xFFFFFFFF);
+    CHECK(rb_first_cached(root) == rb_first(&root->root));
+
+    /* In order both ways, matching the presence table */
+    uint32_t key = 0;
+    uint32_t count = 0;
+    for (struct rb_node* node = rb_first(&root->root); node; node = rb_next(node), count++) {
+        while (!present[key])
+            key++;
+        CHECK(rb_entry(node, struct item, node)->key == key);
+        key++;
+    }
+    CHECK(count == nr_present);
+
+    key = KEY_SPACE;
+    for (struct rb_node* node = rb_last(&root->root); node; node = rb_prev(node)) {
+        while (!present[--key])
+            ;
+        CHECK(rb_entry(node, struct item, node)->key == key);
+    }
+}
+
+static void test_random_ops(void) {
+    struct rb_root_cached root = RB_ROOT_CACHED;
+    uint32_t seed = 1;
+
+    for (uint32_t i = 0; i < KEY_SPACE; i++)
+        items[i].key = i;
+
+    for (uint32_t op = 0; op < RANDOM_OPS; op++) {
+        uint32_t key = test_random(&seed) % KEY_SPACE;
+
+        if (present[key]) {
+            CHECK(find(&root.root, key) == &items[key]);
+            rb_erase_cached(&items[key].node, &root);
+            present[key] = false;
+            nr_present--;
+        } else {
+            CHECK(find(&root.root, key) == NULL);
+            insert(&root, &items[key]);
+            present[key] = true;
+            nr_present++;
+        }
+        /* Full checks are quadratic; do them often while the tree is small */
+        if (op < 4096 || op % 256 == 0)
+            check_tree(&root);
+    }
+
+    while (!rb_empty(&root.root)) {
+        struct item* item = rb_entry(rb_first_cached(&root), struct item, node);
+        rb_erase_cached(&item->node, &root);
+        present[item->key] = false;
+        nr_present--;
+    }
+    check_tree(&root);
+    printf("rbtree: %u random operations OK\n", RANDOM_OPS);
+}
+
+static void benchmark(void) {
+    struct item* nodes = malloc(BENCH_NODES * sizeof(*nodes));
+    struct rb_root_cached root = RB_ROOT_CACHED;
+    uint32_t seed = 12345;
+
+    CHECK(nodes);
+    for (uint32_t i = 0; i < BENCH_NODES; i++)
+        nodes[i].key = test_random(&seed);
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < BENCH_NODES; i++)
+        insert(&root, &nodes[i]);
+    uint64_t insert_cycles = rdtsc() - start;
+
+    uint32_t found = 0;
+    start = rdtsc();
+    for (uint32_t i = 0; i < BENCH_NODES; i++)
+        found += find(&root.root, nodes[i].key) != NULL;
+    uint64_t lookup_cycles = rdtsc() - start;
+    CHECK(found == BENCH_NODES);
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < BENCH_NODES; i++)
+        rb_erase_cached(&nodes[i].node, &root);
+    uint64_t erase_cycles = rdtsc() - start;
+    CHECK(rb_empty(&root.root));
+    free(nodes);
+
+    bench_report("rbtree", "host_1M_inserts", bench_rate(BENCH_NODES, insert_cycles), "ops/s");
+    bench_report("rbtree", "host_1M_lookups", bench_rate(BENCH_NODES, lookup_cycles), "ops/s");
+    bench_report("rbtree", "host_1M_erases", bench_rate(BENCH_NODES, erase_cycles), "ops/s");
+}
+
+int main(void) {
+    test_random_ops();
+    benchmark();
+    run_benchmarks();
+    return 0;
+}
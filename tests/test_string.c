@@ -0,0 +1,242 @@
+/*
+ * String routine host test: memcpy, memset, memmove, strlen and memchr
+ * from kernel/string.c against byte loops, for every source and
+ * destination alignment 0-3 and every length 0-300 plus lengths around
+ * 1024 and 4096, under each combination of the ERMS and FSRM features.
+ * Guard bytes around every destination must stay untouched, and strlen
+ * and memchr must not read past a string that ends at an unmapped page.
+ */
+
+#include <sys/mman.h>
+
+#include "test.h"
+#include "string.h"
+#include "cpufeature.h"
+#include "pmm.h"
+#include "bench.h"
+
+#define MAX_SHORT           300
+#define GUARD               16
+#define BUFFER_SIZE         (4200 + 2 * GUARD + 8)
+#define GUARD_BYTE          0xEE
+
+static const size_t long_lengths[] = {
+    1020, 1021, 1022, 1023, 1024, 1025, 1026, 1027, 1028,
+    4088, 4089, 4090, 4091, 4092, 4093, 4094, 4095, 4096, 4097, 4098, 4099, 4100, 4101,
+};
+
+static const struct {
+    uint32_t features;
+    const char* name;
+} feature_sets[] = {
+    { 0, "none" },
+    { X86_FEATURE_ERMS, "ERMS" },
+    { X86_FEATURE_FSRM, "FSRM" },
+    { X86_FEATURE_ERMS | X86_FEATURE_FSRM, "ERMS+FSRM" },
+};
+
+static uint8_t src_buffer[BUFFER_SIZE] ALIGN(16);
+static uint8_t dst_buffer[BUFFER_SIZE] ALIGN(16);
+static uint8_t expected[BUFFER_SIZE] ALIGN(16);
+static uint32_t seed = 1;
+
+/* 0 to MAX_SHORT, then long_lengths */
+static size_t lengths[MAX_SHORT + 1 + ARRAY_SIZE(long_lengths)];
+
+static void init_lengths(void) {
+    for (size_t i = 0; i <= MAX_SHORT; i++)
+        lengths[i] = i;
+    for (size_t i = 0; i < ARRAY_SIZE(long_lengths); i++)
+        lengths[MAX_SHORT + 1 + i] = long_lengths[i];
+}
+
+/* Random bytes, never zero: high-bit and 0x01 bytes test the word tricks */
+static void fill_random(uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        uint8_t byte = test_random(&seed);
+        buffer[i] = byte ? byte : 0x80;
+    }
+}
+
+/* Byte loops through volatile pointers, so GCC cannot call the routines under test */
+static void copy_bytes(uint8_t* dest, const uint8_t* src, size_t num) {
+    volatile uint8_t* d = dest;
+    const volatile uint8_t* s = src;
+
+    while (num--)
+        *d++ = *s++;
+}
+
+static void fill_bytes(uint8_t* buffer, uint8_t value, size_t size) {
+    volatile uint8_t* p = buffer;
+
+    while (size--)
+        *p++ = value;
+}
+
+static void check_bytes(const uint8_t* buffer, const uint8_t* reference, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        CHECK(buffer[i] == reference[i]);
+}
+
+static void test_memcpy(void) {
+    for (uint32_t s = 0; s < 4; s++) {
+        for (uint32_t d = 0; d < 4; d++) {
+            for (size_t l = 0; l < ARRAY_SIZE(lengths); l++) {
+                size_t length = lengths[l];
+                uint8_t* src = src_buffer + GUARD + s;
+                uint8_t* dst = dst_buffer + GUARD + d;
+
+                fill_random(src_buffer, BUFFER_SIZE);
+                fill_bytes(expected, GUARD_BYTE, BUFFER_SIZE);
+                copy_bytes(expected + GUARD + d, src, length);
+                copy_bytes(dst_buffer, expected, BUFFER_SIZE);
+                for (size_t i = 0; i < length; i++)
+                    dst[i] = ~src[i];
+
+                CHECK(memcpy(dst, src, length) == dst);
+                check_bytes(dst_buffer, expected, BUFFER_SIZE);
+            }
+        }
+    }
+}
+
+static void test_memset(void) {
+    static const int values[] = { 0, 0xA5, 0x1FF, -1 };
+
+    for (uint32_t d = 0; d < 4; d++) {
+        for (size_t l = 0; l < ARRAY_SIZE(lengths); l++) {
+            size_t length = lengths[l];
+
+            for (size_t v = 0; v < ARRAY_SIZE(values); v++) {
+                uint8_t* dst = dst_buffer + GUARD + d;
+
+                fill_random(dst_buffer, BUFFER_SIZE);
+                copy_bytes(expected, dst_buffer, BUFFER_SIZE);
+                for (size_t i = 0; i < length; i++)
+                    expected[GUARD + d + i] = (uint8_t)values[v];
+
+                CHECK(memset(dst, values[v], length) == dst);
+                check_bytes(dst_buffer, expected, BUFFER_SIZE);
+            }
+        }
+    }
+}
+
+/* Overlapping moves both ways, by 1 to 8 bytes and by more than a word */
+static void test_memmove(void) {
+    static const int shifts[] = { -300, -64, -8, -7, -5, -4, -3, -2, -1, 0, 1, 2, 3, 4, 5, 7, 8, 64, 300 };
+    uint8_t* base = dst_buffer + GUARD + 304;
+
+    for (uint32_t s = 0; s < 4; s++) {
+        for (size_t i = 0; i < ARRAY_SIZE(shifts); i++) {
+            for (size_t length = 0; length <= MAX_SHORT; length++) {
+                uint8_t* src = base + s;
+                uint8_t* dst = src + shifts[i];
+                uint8_t moved[MAX_SHORT + 1];
+
+                fill_random(dst_buffer, BUFFER_SIZE);
+                copy_bytes(moved, src, length);
+                copy_bytes(expected, dst_buffer, BUFFER_SIZE);
+                copy_bytes(expected + (dst - dst_buffer), moved, length);
+
+                CHECK(memmove(dst, src, length) == dst);
+                check_bytes(dst_buffer, expected, BUFFER_SIZE);
+            }
+        }
+    }
+}
+
+/* The terminator in every byte lane: every start alignment and length */
+static void test_strlen(void) {
+    for (uint32_t s = 0; s < 4; s++) {
+        for (size_t l = 0; l < ARRAY_SIZE(lengths); l++) {
+            size_t length = lengths[l];
+            char* str = (char*)src_buffer + GUARD + s;
+
+            fill_random(src_buffer, BUFFER_SIZE);
+            str[length] = '\0';
+            CHECK(strlen(str) == length);
+        }
+    }
+}
+
+static void test_memchr(void) {
+    for (uint32_t s = 0; s < 4; s++) {
+        for (size_t length = 0; length <= MAX_SHORT; length++) {
+            uint8_t* ptr = src_buffer + GUARD + s;
+            uint8_t c = test_random(&seed) | 1;
+
+            /* No c in or just past the searched bytes, then c right after them */
+            fill_random(src_buffer, BUFFER_SIZE);
+            for (size_t i = 0; i < length + 8; i++) {
+                if (ptr[i] == c)
+                    ptr[i] ^= 0x80;
+            }
+            CHECK(memchr(ptr, c, length) == NULL);
+            ptr[length] = c;
+            CHECK(memchr(ptr, c, length) == NULL);
+            CHECK(memchr(ptr, c | 0x100, length + 1) == ptr + length);
+
+            for (size_t pos = 0; pos < length; pos++) {
+                uint8_t saved = ptr[pos];
+
+                ptr[pos] = c;
+                CHECK(memchr(ptr, c, length) == ptr + pos);
+                ptr[pos] = saved;
+            }
+        }
+    }
+}
+
+/* Strings and buffers that end at the last byte before an unmapped page */
+static void test_page_end(void) {
+    uint8_t* pages = mmap(NULL, 2 * PAGE_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    CHECK(pages != MAP_FAILED);
+    CHECK(mprotect(pages + PAGE_SIZE, PAGE_SIZE, PROT_NONE) == 0);
+
+    for (size_t length = 0; length <= MAX_SHORT; length++) {
+        uint8_t* end = pages + PAGE_SIZE;
+        char* str = (char*)end - length - 1;
+
+        fill_random(pages, PAGE_SIZE);
+        end[-1] = '\0';
+        CHECK(strlen(str) == length);
+
+        end[-1] = 'x';
+        for (size_t i = 0; i < length; i++) {
+            if (str[i] == 'x')
+                str[i] = 'y';
+        }
+        CHECK(memchr(str, 'x', length + 1) == end - 1);
+        CHECK(memchr(str, 'x', length) == NULL);
+
+        /* Searches that end exactly at the page end, hit and miss */
+        CHECK(memchr(str + 1, 'x', length) == (length ? end - 1 : NULL));
+        end[-1] = 'y';
+        CHECK(memchr(str + 1, 'x', length) == NULL);
+    }
+    munmap(pages, 2 * PAGE_SIZE);
+}
+
+int main(void) {
+    init_lengths();
+
+    for (size_t f = 0; f < ARRAY_SIZE(feature_sets); f++) {
+        boot_cpu_features = feature_sets[f].features;
+        test_memcpy();
+        test_memset();
+        test_memmove();
+        test_strlen();
+        test_memchr();
+        test_page_end();
+        printf("string: features %s OK\n", feature_sets[f].name);
+    }
+
+    /* Kernel string and format benchmarks on the word and string-move paths */
+    boot_cpu_features = 0;
+    run_benchmarks();
+    return 0;
+}